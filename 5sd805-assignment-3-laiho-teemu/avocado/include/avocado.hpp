@@ -33,6 +33,7 @@ namespace avocado {
    struct debug {
       static bool message_box(const char *caption, const char *format, ...);
       static bool error_box(const char *caption, const char *format, ...);
+      static void output(const char *format, ...);
    };
 
    struct point {
@@ -83,6 +84,41 @@ namespace avocado {
       static bool write_file_content(const string &filename, const dynamic_array<uint8> &content, bool allow_overwrite);
    };
 
+   // note: read-only view of a whole file, the bytes stay valid until destroy
+   struct mapped_file {
+      mapped_file();
+
+      bool is_valid() const;
+      bool create(const string &filename);
+      void destroy();
+
+      const uint8 *data() const;
+      int64 size() const;
+
+      void *file_;
+      void *mapping_;
+      const uint8 *data_;
+      int64 size_;
+   };
+
+   // note: sequential writes to a file, blocks of any size are split into writes the
+   //       system accepts
+   struct file_writer {
+      file_writer();
+
+      bool is_valid() const;
+      bool create(const string &filename, bool allow_overwrite);
+      void destroy();
+
+      bool write(const void *data, int64 size);
+      bool pad(int64 size);
+
+      int64 offset() const;
+
+      void *file_;
+      int64 offset_;
+   };
+
    struct mouse {
       static void show_cursor(bool state);
 
@@ -271,6 +307,25 @@ namespace avocado {
       uint8 *data_;
    };
 
+   // note: 16 bits per channel, 8 bit images are widened so 0xff becomes 0xffff
+   struct bitmap16 {
+      bitmap16();
+
+      bool is_valid() const;
+      bool create(const char *filename);
+      void destroy();
+
+      int32 width() const;
+      int32 height() const;
+      int32 components() const;
+      const uint16 *data() const;
+
+      int32 width_;
+      int32 height_;
+      int32 components_;
+      uint16 *data_;
+   };
+
    struct settings {
       string title_;
       int32 width_{};
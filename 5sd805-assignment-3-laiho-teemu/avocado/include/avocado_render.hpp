@@ -20,6 +20,9 @@ namespace avocado {
    enum texture_format {
       TEXTURE_FORMAT_RGB8,
       TEXTURE_FORMAT_RGBA8,
+      TEXTURE_FORMAT_R32F,
+      TEXTURE_FORMAT_RG8,
+      TEXTURE_FORMAT_RG16,
       TEXTURE_FORMAT_COUNT,
       TEXTURE_FORMAT_UNKNOWN,
    };
@@ -171,6 +174,12 @@ namespace avocado {
                   const int32 width,
                   const int32 height,
                   const void *data);
+      void update(const texture_format format,
+                  const int32 x,
+                  const int32 y,
+                  const int32 width,
+                  const int32 height,
+                  const void *data);
       void destroy();
 
       uint32 id_; 
@@ -198,6 +207,9 @@ namespace avocado {
                   const void *data);
       void update(const int32 size,
                   const void *data);
+      void update(const int32 offset,
+                  const int32 size,
+                  const void *data);
       void destroy();
 
       uint32 id_;
@@ -255,6 +267,8 @@ namespace avocado {
       enum attribute_format {
          ATTRIBUTE_FORMAT_FLOAT,
          ATTRIBUTE_FORMAT_BYTE,
+         ATTRIBUTE_FORMAT_UNSIGNED_SHORT,
+         ATTRIBUTE_FORMAT_SHORT,
       };
 
       struct attribute
@@ -333,6 +347,13 @@ namespace avocado {
                         const index_type type,
                         const int32 start_index,
                         const int32 primitive_count);
+      // note: indices are offset by base_vertex before fetching, so one set of
+      //       indices can be shared by many ranges of the vertex buffer
+      void draw_indexed(const primitive_topology topology,
+                        const index_type type,
+                        const int32 start_index,
+                        const int32 primitive_count,
+                        const int32 base_vertex);
    };
 } // !avocado
 
@@ -0,0 +1,45 @@
+// avocado_thread.hpp
+
+#ifndef AVOCADO_THREAD_HPP_INCLUDED
+#define AVOCADO_THREAD_HPP_INCLUDED
+
+#include <avocado.hpp>
+
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+
+namespace avocado {
+   struct worker_pool {
+      static int32 hardware_thread_count();
+
+      worker_pool();
+      ~worker_pool();
+
+      bool is_valid() const;
+      bool create(const int32 thread_count = 0);
+      void destroy();
+
+      // note: fire and forget, the job runs on one of the worker threads
+      void submit(std::function<void()> job);
+
+      // note: runs job(0) .. job(count - 1) and returns when all have finished,
+      //       the calling thread takes part so nesting from a worker is safe
+      void parallel_for(const int32 count, const std::function<void(const int32 index)> &job);
+
+      int32 thread_count() const;
+
+      std::mutex mutex_;
+      std::condition_variable condition_;
+      std::deque<std::function<void()>> jobs_;
+      dynamic_array<std::thread> threads_;
+      bool running_;
+   };
+
+   // note: runs serially on the calling thread when pool is null
+   void parallel_for(worker_pool *pool, const int32 count, const std::function<void(const int32 index)> &job);
+} // !avocado
+
+#endif // !AVOCADO_THREAD_HPP_INCLUDED
@@ -36,6 +36,17 @@ namespace avocado {
       return MessageBoxA(NULL, message, caption, MB_OKCANCEL | MB_ICONERROR) == IDOK;
    }
 
+   // static
+   void debug::output(const char *format, ...)
+   {
+      char message[2048] = {};
+      va_list vargs;
+      va_start(vargs, format);
+      vsprintf_s(message, format, vargs);
+      va_end(vargs);
+      OutputDebugStringA(message);
+   }
+
    point::point()
       : x_(0)
       , y_(0)
@@ -292,13 +303,6 @@ namespace avocado {
          CloseHandle(handle);
       }));
 
-      if (allow_overwrite) {
-         DWORD error = GetLastError();
-         if (error != ERROR_ALREADY_EXISTS) {
-            return false;
-         }
-      }
-
       LARGE_INTEGER size = {};
       size.QuadPart = content.size();
       if (!WriteFile(handle, content.data(), size.LowPart, NULL, NULL)) {
@@ -314,6 +318,169 @@ namespace avocado {
       return true;
    }
 
+   mapped_file::mapped_file()
+      : file_(nullptr)
+      , mapping_(nullptr)
+      , data_(nullptr)
+      , size_(0)
+   {
+   }
+
+   bool mapped_file::is_valid() const
+   {
+      return data_ != nullptr;
+   }
+
+   bool mapped_file::create(const string &filename)
+   {
+      HANDLE handle = CreateFileA(filename.c_str(),
+                                  GENERIC_READ,
+                                  FILE_SHARE_READ,
+                                  NULL,
+                                  OPEN_EXISTING,
+                                  FILE_ATTRIBUTE_NORMAL,
+                                  NULL);
+      if (handle == INVALID_HANDLE_VALUE) {
+         return false;
+      }
+
+      // note: empty files can not be mapped
+      LARGE_INTEGER size = {};
+      if (!GetFileSizeEx(handle, &size) || size.QuadPart == 0) {
+         CloseHandle(handle);
+         return false;
+      }
+
+      HANDLE mapping = CreateFileMappingA(handle, NULL, PAGE_READONLY, 0, 0, NULL);
+      if (mapping == NULL) {
+         CloseHandle(handle);
+         return false;
+      }
+
+      void *view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+      if (view == NULL) {
+         CloseHandle(mapping);
+         CloseHandle(handle);
+         return false;
+      }
+
+      file_    = handle;
+      mapping_ = mapping;
+      data_    = static_cast<const uint8 *>(view);
+      size_    = size.QuadPart;
+
+      return is_valid();
+   }
+
+   void mapped_file::destroy()
+   {
+      if (data_) {
+         UnmapViewOfFile(data_);
+      }
+      if (mapping_) {
+         CloseHandle(mapping_);
+      }
+      if (file_) {
+         CloseHandle(file_);
+      }
+
+      file_    = nullptr;
+      mapping_ = nullptr;
+      data_    = nullptr;
+      size_    = 0;
+   }
+
+   const uint8 *mapped_file::data() const
+   {
+      return data_;
+   }
+
+   int64 mapped_file::size() const
+   {
+      return size_;
+   }
+
+   file_writer::file_writer()
+      : file_(nullptr)
+      , offset_(0)
+   {
+   }
+
+   bool file_writer::is_valid() const
+   {
+      return file_ != nullptr;
+   }
+
+   bool file_writer::create(const string &filename, bool allow_overwrite)
+   {
+      HANDLE handle = CreateFileA(filename.c_str(),
+                                  GENERIC_WRITE,
+                                  0,
+                                  NULL,
+                                  allow_overwrite ? CREATE_ALWAYS : CREATE_NEW,
+                                  FILE_ATTRIBUTE_NORMAL,
+                                  NULL);
+      if (handle == INVALID_HANDLE_VALUE) {
+         return false;
+      }
+
+      file_   = handle;
+      offset_ = 0;
+
+      return is_valid();
+   }
+
+   void file_writer::destroy()
+   {
+      if (file_) {
+         CloseHandle(file_);
+      }
+
+      file_   = nullptr;
+      offset_ = 0;
+   }
+
+   bool file_writer::write(const void *data, int64 size)
+   {
+      // note: WriteFile takes 32 bit sizes
+      const int64 limit = 1 << 30;
+
+      const uint8 *bytes = static_cast<const uint8 *>(data);
+      while (size > 0) {
+         const DWORD count = static_cast<DWORD>(size < limit ? size : limit);
+         DWORD written = 0;
+         if (!WriteFile(file_, bytes, count, &written, NULL) || written != count) {
+            return false;
+         }
+
+         bytes   += count;
+         size    -= count;
+         offset_ += count;
+      }
+
+      return true;
+   }
+
+   bool file_writer::pad(int64 size)
+   {
+      const uint8 zeros[64] = {};
+      while (size > 0) {
+         const int64 count = size < static_cast<int64>(sizeof(zeros)) ? size : static_cast<int64>(sizeof(zeros));
+         if (!write(zeros, count)) {
+            return false;
+         }
+
+         size -= count;
+      }
+
+      return true;
+   }
+
+   int64 file_writer::offset() const
+   {
+      return offset_;
+   }
+
    // static 
    void mouse::show_cursor(bool state)
    {
@@ -573,6 +740,79 @@ namespace avocado {
       return data_;
    }
 
+   bitmap16::bitmap16()
+      : width_(0)
+      , height_(0)
+      , components_(0)
+      , data_(nullptr)
+   {
+   }
+
+   bool bitmap16::is_valid() const
+   {
+      return data_ != nullptr;
+   }
+
+   bool bitmap16::create(const char *filename)
+   {
+      dynamic_array<uint8> content;
+      if (!file_system::read_file_content(filename, content)) {
+         return false;
+      }
+
+      int width = 0;
+      int height = 0;
+      int components = 0;
+      stbi_us *data = stbi_load_16_from_memory(content.data(),
+                                               (int)content.size(),
+                                               &width,
+                                               &height,
+                                               &components,
+                                               0);
+      if (!data) {
+         return false;
+      }
+
+      width_      = width;
+      height_     = height;
+      components_ = components;
+      data_       = data;
+
+      return is_valid();
+   }
+
+   void bitmap16::destroy()
+   {
+      if (data_) {
+         stbi_image_free(data_);
+      }
+
+      width_      = 0;
+      height_     = 0;
+      components_ = 0;
+      data_       = nullptr;
+   }
+
+   int32 bitmap16::width() const
+   {
+      return width_;
+   }
+
+   int32 bitmap16::height() const
+   {
+      return height_;
+   }
+
+   int32 bitmap16::components() const
+   {
+      return components_;
+   }
+
+   const uint16 *bitmap16::data() const
+   {
+      return data_;
+   }
+
    // static 
    bool application::on_error(const char *format, ...)
    {
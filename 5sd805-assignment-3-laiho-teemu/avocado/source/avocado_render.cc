@@ -47,18 +47,27 @@ namespace avocado {
    {
       GL_RGB8,
       GL_RGBA8,
+      GL_R32F,
+      GL_RG8,
+      GL_RG16,
    };
 
    static const GLenum gl_texture_format[] =
    {
       GL_RGB,
       GL_RGBA,
+      GL_RED,
+      GL_RG,
+      GL_RG,
    };
 
    static const GLenum gl_texture_format_type[] =
    {
       GL_UNSIGNED_BYTE,
       GL_UNSIGNED_BYTE,
+      GL_FLOAT,
+      GL_UNSIGNED_BYTE,
+      GL_UNSIGNED_SHORT,
    };
 
    static const GLenum gl_sampler_filter[] =
@@ -199,12 +208,16 @@ namespace avocado {
    {
       GL_FLOAT,
       GL_UNSIGNED_BYTE,
+      GL_UNSIGNED_SHORT,
+      GL_SHORT,
    };
 
    static const GLuint gl_attribute_size[] =
    {
       sizeof(float),
       sizeof(char),
+      sizeof(uint16),
+      sizeof(int16),
    };
 
    shader_program::shader_program()
@@ -361,6 +374,29 @@ namespace avocado {
       opengl_error_check();
    }
 
+   void texture::update(const texture_format format,
+                        const int32 x,
+                        const int32 y,
+                        const int32 width,
+                        const int32 height,
+                        const void *data)
+   {
+      // note: rewrites one rectangle of mip level 0, data holds its rows back to back
+      glActiveTexture(GL_TEXTURE0);
+      glBindTexture(GL_TEXTURE_2D, id_);
+      glTexSubImage2D(GL_TEXTURE_2D,
+                      0,
+                      x,
+                      y,
+                      width,
+                      height,
+                      gl_texture_format[format],
+                      gl_texture_format_type[format],
+                      data);
+      glBindTexture(GL_TEXTURE_2D, 0);
+      opengl_error_check();
+   }
+
    void texture::destroy()
    {
       glBindTexture(GL_TEXTURE_2D, 0);
@@ -449,6 +485,17 @@ namespace avocado {
       opengl_error_check();
    }
 
+   void vertex_buffer::update(const int32 offset,
+                              const int32 size,
+                              const void *data)
+   {
+      // note: rewrites bytes [offset, offset + size) and keeps the rest of the buffer
+      glBindBuffer(GL_ARRAY_BUFFER, id_);
+      glBufferSubData(GL_ARRAY_BUFFER, offset, size, data);
+      glBindBuffer(GL_ARRAY_BUFFER, 0);
+      opengl_error_check();
+   }
+
    void vertex_buffer::destroy()
    {
       glDeleteBuffers(1, &id_);
@@ -714,6 +761,11 @@ namespace avocado {
          opengl_error_check();
       }
 
+      // note: texture rows are passed tightly packed, rg8 and rgb8 rows need not
+      //       be multiples of four bytes
+      glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+      opengl_error_check();
+
       return true;
    }
 
@@ -945,11 +997,24 @@ namespace avocado {
                                const int32 start_index,
                                const int32 primitive_count)
    {
-      // todo: glDrawElementsBaseVertex
       glDrawElements(gl_primitive_topology[topology],
                      primitive_count,
                      gl_index_type[type],
                      (const void *)(uintptr_t)(gl_index_size[type] * start_index));
       opengl_error_check();
    }
+
+   void renderer::draw_indexed(const primitive_topology topology,
+                               const index_type type,
+                               const int32 start_index,
+                               const int32 primitive_count,
+                               const int32 base_vertex)
+   {
+      glDrawElementsBaseVertex(gl_primitive_topology[topology],
+                               primitive_count,
+                               gl_index_type[type],
+                               (const void *)(uintptr_t)(gl_index_size[type] * start_index),
+                               base_vertex);
+      opengl_error_check();
+   }
 } // !avocado
@@ -0,0 +1,179 @@
+// avocado_thread.cc
+
+#include "avocado_thread.hpp"
+
+#include <atomic>
+#include <memory>
+
+namespace avocado {
+   namespace {
+      struct parallel_for_state {
+         parallel_for_state(const int32 count, const std::function<void(const int32)> &job)
+            : count_(count)
+            , next_(0)
+            , done_(0)
+            , job_(job)
+         {
+         }
+
+         // note: claims indices until none are left
+         void run()
+         {
+            int32 completed = 0;
+            for (int32 index = next_++; index < count_; index = next_++) {
+               job_(index);
+               completed++;
+            }
+
+            if (completed > 0 && (done_ += completed) == count_) {
+               std::lock_guard<std::mutex> lock(mutex_);
+               condition_.notify_all();
+            }
+         }
+
+         void wait()
+         {
+            std::unique_lock<std::mutex> lock(mutex_);
+            condition_.wait(lock, [this]() { return done_.load() == count_; });
+         }
+
+         const int32 count_;
+         std::atomic<int32> next_;
+         std::atomic<int32> done_;
+         const std::function<void(const int32)> &job_;
+         std::mutex mutex_;
+         std::condition_variable condition_;
+      };
+   } // !anon
+
+   // static
+   int32 worker_pool::hardware_thread_count()
+   {
+      const int32 count = static_cast<int32>(std::thread::hardware_concurrency());
+      return count > 0 ? count : 1;
+   }
+
+   worker_pool::worker_pool()
+      : running_(false)
+   {
+   }
+
+   worker_pool::~worker_pool()
+   {
+      destroy();
+   }
+
+   bool worker_pool::is_valid() const
+   {
+      return running_;
+   }
+
+   bool worker_pool::create(const int32 thread_count)
+   {
+      assert(!running_);
+
+      // note: default leaves one hardware thread for the main loop
+      int32 count = thread_count;
+      if (count <= 0) {
+         count = hardware_thread_count() - 1;
+      }
+      if (count < 1) {
+         count = 1;
+      }
+
+      running_ = true;
+      threads_.reserve(count);
+      for (int32 index = 0; index < count; index++) {
+         threads_.emplace_back([this]() {
+            for (;;) {
+               std::function<void()> job;
+               {
+                  std::unique_lock<std::mutex> lock(mutex_);
+                  condition_.wait(lock, [this]() { return !running_ || !jobs_.empty(); });
+                  if (!running_ && jobs_.empty()) {
+                     return;
+                  }
+
+                  job = std::move(jobs_.front());
+                  jobs_.pop_front();
+               }
+
+               job();
+            }
+         });
+      }
+
+      return is_valid();
+   }
+
+   void worker_pool::destroy()
+   {
+      {
+         std::lock_guard<std::mutex> lock(mutex_);
+         if (!running_) {
+            return;
+         }
+         running_ = false;
+      }
+
+      // note: queued jobs are drained before the threads exit
+      condition_.notify_all();
+      for (auto &thread : threads_) {
+         thread.join();
+      }
+
+      threads_.clear();
+   }
+
+   void worker_pool::submit(std::function<void()> job)
+   {
+      assert(running_);
+      {
+         std::lock_guard<std::mutex> lock(mutex_);
+         jobs_.push_back(std::move(job));
+      }
+      condition_.notify_one();
+   }
+
+   void worker_pool::parallel_for(const int32 count, const std::function<void(const int32 index)> &job)
+   {
+      if (count <= 0) {
+         return;
+      }
+
+      if (!running_ || count == 1) {
+         for (int32 index = 0; index < count; index++) {
+            job(index);
+         }
+         return;
+      }
+
+      // note: helpers that start after all indices are claimed return immediately,
+      //       so the state has to outlive this call
+      auto state = std::make_shared<parallel_for_state>(count, job);
+      const int32 helpers = thread_count() < count - 1 ? thread_count() : count - 1;
+      for (int32 index = 0; index < helpers; index++) {
+         submit([state]() { state->run(); });
+      }
+
+      state->run();
+      state->wait();
+   }
+
+   int32 worker_pool::thread_count() const
+   {
+      return static_cast<int32>(threads_.size());
+   }
+
+   void parallel_for(worker_pool *pool, const int32 count, const std::function<void(const int32 index)> &job)
+   {
+      if (pool) {
+         pool->parallel_for(count, job);
+         return;
+      }
+
+      for (int32 index = 0; index < count; index++) {
+         job(index);
+      }
+   }
+} // !avocado
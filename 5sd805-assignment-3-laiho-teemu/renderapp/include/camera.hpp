@@ -24,10 +24,23 @@ namespace avocado {
          count,
       };
 
+      static constexpr uint32 ALL_PLANES = (1u << int(side::count)) - 1;
+
       frustum();
 
       void construct(const glm::mat4 &viewprojection);
       bool is_inside(const glm::vec3 &position) const;
+      bool is_inside(const glm::vec3 &center, const float radius) const;
+
+      // note: conservative, a box crossing two planes outside the corner can pass
+      bool is_inside(const glm::vec3 &min_corner, const glm::vec3 &max_corner) const;
+
+      // note: the same box test for hierarchies. only the planes in plane_mask are tested,
+      //       planes the box lies fully inside of are cleared from it for the children,
+      //       an empty mask means the whole subtree is in view. rejected_plane is tested
+      //       first and receives the plane that culls the box, it is likely to cull the
+      //       same box next frame
+      bool is_inside(const glm::vec3 &min_corner, const glm::vec3 &max_corner, uint32 &plane_mask, uint8 &rejected_plane) const;
 
       // Ax + By + Cz + D = 0
       glm::vec4 planes_[int(side::count)];
@@ -0,0 +1,96 @@
+// cdlod.hpp
+
+#ifndef CDLOD_HPP_INCLUDED
+#define CDLOD_HPP_INCLUDED
+
+#include <avocado.hpp>
+#include <avocado_render.hpp>
+
+#include "camera.hpp"
+#include "heightfield.hpp"
+
+namespace avocado {
+	struct worker_pool;
+	struct occlusion_buffer;
+	struct horizon_buffer;
+
+	// note: continuous distance-dependent level of detail. every quadtree node is drawn with
+	//       the same grid mesh stretched over the node, level 0 samples every height and each
+	//       level above samples every other one of the level below. the range of a level is the
+	//       distance where the height error of the next level shrinks below pixel_error_ on
+	//       screen, vertices morph into the next level before the range ends so nothing pops
+	struct cdlod {
+		static constexpr int32 GRID_SIZE = 32;		// quads per node side
+		static constexpr int32 LEVEL_LIMIT = 12;
+
+		struct node {
+			float min_height_;
+			float max_height_;
+			uint8 rejected_plane_;	// frustum plane that culled the node last, tested first
+		};
+
+		struct level {
+			level();
+
+			int32 nodes_x_;
+			int32 nodes_z_;
+			float error_;			// largest height difference to the full resolution surface
+			float range_;			// distance where the next level takes over
+			float morph_start_;		// distance where vertices start morphing into the next level
+			dynamic_array<node> nodes_;
+		};
+
+		// note: a node drawn at its level, quadrants covered by finer nodes are left out
+		struct selection {
+			int32 level_;
+			int32 x_;
+			int32 z_;
+			int32 quadrants_;
+		};
+
+		cdlod();
+
+		bool is_valid() const;
+		bool create(const heightfield &field, worker_pool *pool = nullptr);
+		void destroy();
+
+		// note: new heights of a field the size of the one created from, the node bounds,
+		//       level errors and the height texture follow them
+		bool set_heights(const heightfield &field, worker_pool *pool = nullptr);
+
+		// note: baked ambient occlusion laid out like the field, see terrain_occlusion.
+		//       until it is set nothing is occluded
+		bool set_occlusion(const dynamic_array<float> &occlusion);
+
+		// note: picks the nodes to draw, viewport_height in pixels. nodes hidden in the
+		//       occlusion buffer or below the horizon, when given, are left out with
+		//       everything below them. children are visited nearest first for the horizon
+		void select(const camera &camera,
+					const frustum &frustum,
+					const float viewport_height,
+					const occlusion_buffer *occlusion = nullptr,
+					horizon_buffer *horizon = nullptr);
+
+		// note: program is built from assets/heightmap/cdlod.vs.txt and the heightmap
+		//       fragment shader, the caller sets the camera and lighting uniforms
+		void draw(renderer &rend, shader_program &program);
+
+		float pixel_error_;
+		int32 width_;
+		int32 height_;
+		int32 level_count_;
+		level levels_[LEVEL_LIMIT];
+		dynamic_array<selection> selected_;
+		dynamic_array<int32> roots_;		// top level nodes nearest first
+
+		vertex_buffer buffer_;
+		vertex_layout layout_;
+		index_buffer index_buffer_;
+		texture heights_;
+		texture occlusion_;
+		sampler_state sampler_;
+		int32 quadrant_index_count_;
+	};
+} // !avocado
+
+#endif // !CDLOD_HPP_INCLUDED
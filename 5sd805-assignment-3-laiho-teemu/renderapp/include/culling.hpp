@@ -0,0 +1,84 @@
+// culling.hpp
+
+#ifndef CULLING_HPP_INCLUDED
+#define CULLING_HPP_INCLUDED
+
+#include <avocado.hpp>
+
+#include "camera.hpp"
+
+namespace avocado {
+	// note: axis aligned boxes as centres and half extents, one array per component so
+	//       the culling loads four or eight boxes with one instruction per component
+	struct box_bounds {
+		void clear();
+		void reserve(const int32 count);
+		void push_back(const glm::vec3 &min_corner, const glm::vec3 &max_corner);
+		void set(const int32 index, const glm::vec3 &min_corner, const glm::vec3 &max_corner);
+		int32 size() const;
+
+		dynamic_array<float> center_x_;
+		dynamic_array<float> center_y_;
+		dynamic_array<float> center_z_;
+		dynamic_array<float> extent_x_;
+		dynamic_array<float> extent_y_;
+		dynamic_array<float> extent_z_;
+	};
+
+	struct sphere_bounds {
+		void clear();
+		void reserve(const int32 count);
+		void push_back(const glm::vec3 &center, const float radius);
+		void set(const int32 index, const glm::vec3 &center, const float radius);
+		int32 size() const;
+
+		dynamic_array<float> center_x_;
+		dynamic_array<float> center_y_;
+		dynamic_array<float> center_z_;
+		dynamic_array<float> radius_;
+	};
+
+	// note: indices of the bounds not fully outside one of the frustum planes, ascending,
+	//       written over visible. the same conservative tests as frustum::is_inside, a box
+	//       crossing two planes outside a corner passes. eight bounds per step with avx2,
+	//       four with sse2. returns the visible count
+	int32 cull_boxes(const frustum &view, const box_bounds &bounds, dynamic_array<int32> &visible);
+	int32 cull_spheres(const frustum &view, const sphere_bounds &bounds, dynamic_array<int32> &visible);
+
+	// note: bounding volume hierarchy over box bounds for culling in about the time of
+	//       the visible count. nodes split their boxes in half along the longest side of
+	//       their centres. the walk carries the mask of planes a node may still cross
+	//       down to its children, once a node is inside all of them its boxes are taken
+	//       without a test. every node remembers the plane that culled it last and tests
+	//       that one first. the boxes of a leaf that crosses a plane go through the same
+	//       kernel as cull_boxes, from a copy of the bounds kept in tree order
+	struct bounds_tree {
+		static constexpr int32 LEAF_SIZE = 8;
+
+		// note: depth first, the left child follows its parent
+		struct node {
+			glm::vec3 min_corner_;
+			glm::vec3 max_corner_;
+			int32 first_;		// into items_
+			int32 count_;
+			int32 right_;		// 0 for leaves
+		};
+
+		void build(const box_bounds &bounds);
+
+		// note: bounds moved but kept their count, node boxes are grown or shrunk to
+		//       them again without changing the tree, ordered_ is copied again
+		void refit(const box_bounds &bounds);
+
+		// note: indices of the bounds not culled, in tree order rather than ascending.
+		//       returns the visible count
+		int32 cull(const frustum &view, const box_bounds &bounds, dynamic_array<int32> &visible);
+
+		dynamic_array<node> nodes_;
+		dynamic_array<int32> items_;		// bounds indices, each node owns a range
+		box_bounds ordered_;				// ordered_[i] is box items_[i]
+		dynamic_array<uint8> node_rejected_planes_;
+	};
+} // !avocado
+
+#endif // !CULLING_HPP_INCLUDED
@@ -0,0 +1,64 @@
+// height_pyramid.hpp
+
+#ifndef HEIGHT_PYRAMID_HPP_INCLUDED
+#define HEIGHT_PYRAMID_HPP_INCLUDED
+
+#pragma warning(push)
+#pragma warning(disable: 4127)
+#pragma warning(disable: 4201)
+#include <glm/glm.hpp>
+#pragma warning(pop)
+
+#include "terrain_query.hpp"
+
+namespace avocado {
+	struct worker_pool;
+
+	struct terrain_ray {
+		glm::vec3 origin_;
+		glm::vec3 direction_;
+		float max_distance_;	// in lengths of direction_
+	};
+
+	struct terrain_hit {
+		bool hit_;
+		float distance_;		// origin_ + direction_ * distance_ is the hit position
+		glm::vec3 position_;
+		glm::vec3 normal_;		// of the triangle hit, facing up
+	};
+
+	// note: min/max quadtree over blocks of LEAF_SIZE quads of the terrain mesh. rays skip
+	//       every node whose height range they pass over or under and test the exact mesh
+	//       triangles in the leaves they reach. rays are traced in packets of four that share
+	//       one traversal, so neighbouring rays (a row of pixels, a spread of pellets) should
+	//       be next to each other in the batch. the terrain has to outlive the pyramid
+	struct height_pyramid {
+		static constexpr int32 LEAF_SIZE = 4;
+
+		struct level {
+			int32 width_;
+			int32 height_;
+			dynamic_array<glm::vec2> bounds_;	// lowest and highest height per node
+		};
+
+		height_pyramid();
+
+		bool is_valid() const;
+		bool create(const terrain_query &terrain, worker_pool *pool = nullptr);
+		void destroy();
+
+		// note: refits the nodes over samples [x0, x1) x [z0, z1) after the terrain query
+		//       heights there changed
+		void update(const int32 x0, const int32 z0, const int32 x1, const int32 z1);
+
+		bool raycast(const terrain_ray &ray, terrain_hit &hit) const;
+
+		// note: with a worker pool the packets are traced across the workers
+		void raycast(const int32 count, const terrain_ray *rays, terrain_hit *hits, worker_pool *pool = nullptr) const;
+
+		const terrain_query *terrain_;
+		dynamic_array<level> levels_;		// leaf blocks first, single root last
+	};
+} // !avocado
+
+#endif // !HEIGHT_PYRAMID_HPP_INCLUDED
@@ -0,0 +1,49 @@
+// heightfield.hpp
+
+#ifndef HEIGHTFIELD_HPP_INCLUDED
+#define HEIGHTFIELD_HPP_INCLUDED
+
+#include <avocado.hpp>
+
+namespace avocado {
+	// note: row-major grid of height samples, one sample per world unit in x and z
+	struct heightfield {
+		// note: how height samples are stored in a file. image values are normalized to 0 .. 1,
+		//       raw floats are used as they are, and each sample becomes offset + value * scale
+		enum class encoding {
+			grayscale,		// 8 or 16 bit image, only the first channel is read
+			packed_rgb,		// 8 bit rgb image, 24 bit heights with red as the high byte
+			packed_rgba,	// 8 bit rgba image, 32 bit heights with red as the high byte, rounded to float
+			raw_r16,		// headerless little endian 16 bit samples, row by row
+			raw_r32f,		// headerless 32 bit float samples, row by row
+		};
+
+		heightfield();
+
+		bool is_valid() const;
+		bool create(const int32 width, const int32 height);
+
+		// note: red channel as (255 - red) / 10 in whole units, only 26 distinct heights
+		bool create(const bitmap &image);
+		bool create(const char *filename);
+
+		// note: the raw encodings need the grid size, the images carry their own
+		bool create(const char *filename, const encoding format, const float scale, const float offset);
+		bool create(const char *filename, const encoding format, const int32 width, const int32 height, const float scale, const float offset);
+		void destroy();
+
+		// note: sample coordinates are clamped to the grid edges
+		float at(const int32 x, const int32 z) const;
+		void set(const int32 x, const int32 z, const float value);
+
+		int32 width_;
+		int32 height_;
+		dynamic_array<float> heights_;
+	};
+
+	// note: count samples of format to heights the way create reads a whole file, image
+	//       samples are components channels apart. for callers keeping the source around
+	void convert_heights(const void *source, const heightfield::encoding format, const int32 components, const size_t count, const float scale, const float offset, float *result);
+} // !avocado
+
+#endif // !HEIGHTFIELD_HPP_INCLUDED
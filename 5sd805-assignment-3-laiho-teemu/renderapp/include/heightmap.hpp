@@ -6,17 +6,115 @@
 #include <avocado.hpp>
 #include <avocado_render.hpp>
 
+#include "heightfield.hpp"
+
 namespace avocado {
+	struct worker_pool;
+
 	struct vertex {
 		glm::vec3 position_;
 		glm::vec4 color_;
 		glm::vec3 normal_;
 	};
 
+	// note: compact grid vertex, x and z follow from the vertex index so only the
+	//       quantized height and an octahedral encoded normal are stored
+	struct terrain_vertex {
+		uint16 height_;		// (height - height_offset) / height_scale in 0 .. 65535
+		uint16 occlusion_;	// ambient occlusion in 0 .. 65535, 0 is open sky
+		int16 normal_[2];	// octahedral normal in -32767 .. 32767
+	};
+
+	static_assert(sizeof(terrain_vertex) == 8, "terrain_vertex is expected to be 8 bytes");
+
+	// note: quantize is 65535 / height_scale of the map the vertex belongs to
+	terrain_vertex encode_terrain_vertex(const float height, const glm::vec3 &normal, const float height_offset, const float quantize);
+
+	// note: range of the index buffer drawing one block of the grid, and its bounds
+	struct chunk {
+		int32 start_index_;
+		int32 index_count_;
+		int32 base_vertex_;
+
+		glm::vec3 min_corner_;
+		glm::vec3 max_corner_;
+	};
+
 	struct heightmap {
+		// note: quads per chunk side in the chunk-contiguous index buffer
+		static constexpr int32 CHUNK_SIZE = 7;
+
+		// note: the default image stores depth below the top in its red channel, ten steps
+		//       per unit, read as 16 bit grayscale so heights keep their full precision
+		static constexpr float DEFAULT_HEIGHT_SCALE = -25.5f;
+		static constexpr float DEFAULT_HEIGHT_OFFSET = 25.5f;
+
+		// note: one block of the terrain mesh, indices are local to the block's vertices
+		struct tile {
+			tile();
+
+			int32 x_;		// first quad column covered by the tile
+			int32 z_;		// first quad row covered by the tile
+			int32 width_;	// quads along x
+			int32 height_;	// quads along z
+			dynamic_array<vertex> vertices_;
+			dynamic_array<uint32> indices_;
+		};
+
+		struct tile_listener {
+			virtual ~tile_listener() {}
+
+			// note: tile storage is reused for the next tile, return false to stop
+			virtual bool on_tile(const tile &tile) = 0;
+		};
+
+		// note: 16 bit indices shared by every chunk of the grid. the vertices of a template
+		//       draw are stored chunk by chunk, a block of (chunk_size_ + 1)^2 vertices per
+		//       chunk with the samples on shared edges repeated, and the template indexes one
+		//       block whose first vertex is passed to the draw as base vertex. the 16 bit
+		//       limit depends on the chunk size alone, not on the width of the map. chunks cut
+		//       short by the right edge, the bottom edge or both draw their own ranges after
+		//       the full template, from edge_start_ on, so every range can be reordered for
+		//       the vertex cache on its own
+		struct chunk_template {
+			chunk_template();
+
+			// note: vertices per chunk block
+			int32 block_size() const;
+
+			// note: position of grid sample (x, z) inside the block of chunk (chunk_x, chunk_z)
+			int32 vertex_index(const int32 chunk_x, const int32 chunk_z, const int32 x, const int32 z) const;
+
+			// note: one chunk per distinct template range the chunks draw, full template first
+			void ranges(dynamic_array<chunk> &result) const;
+
+			// note: grid ordered vertices of the map rearranged into chunk blocks, block
+			//       samples past the grid edge repeat the edge and are never drawn
+			void gather(const dynamic_array<vertex> &grid, dynamic_array<vertex> &result) const;
+			void gather(const dynamic_array<terrain_vertex> &grid, dynamic_array<terrain_vertex> &result) const;
+
+			int32 chunk_size_;	// quads per chunk side
+			int32 chunks_x_;
+			int32 chunks_z_;
+			int32 edge_start_;
+			int32 grid_width_;	// samples of the map
+			int32 grid_height_;
+			dynamic_array<uint16> indices_;
+			dynamic_array<chunk> chunks_;	// row by row, chunks_x_ per row
+		};
+
 		heightmap();
 
-		bool create(dynamic_array<vertex> &vertices, dynamic_array<uint32> &indices);
+		// note: with a worker pool the grid is built in parallel bands of chunk rows
+		bool create(dynamic_array<vertex> &vertices, dynamic_array<uint32> &indices, worker_pool *pool = nullptr);
+		bool create(const heightfield &field, dynamic_array<vertex> &vertices, dynamic_array<uint32> &indices, worker_pool *pool = nullptr);
+		bool create(dynamic_array<terrain_vertex> &vertices, dynamic_array<uint32> &indices, worker_pool *pool = nullptr);
+		bool create(const heightfield &field, dynamic_array<terrain_vertex> &vertices, dynamic_array<uint32> &indices, worker_pool *pool = nullptr);
+		bool create_tiles(const heightfield &field, const int32 tile_size, tile_listener &listener);
+
+		// note: for the grid of the last create, not create_tiles. fails when a chunk block
+		//       holds more vertices than 16 bit indices can reach, chunk_size above 255
+		bool create_chunk_template(const int32 chunk_size, chunk_template &result) const;
 
 		glm::vec3 getsurfacenormal(glm::vec3 v0, glm::vec3 v1, glm::vec3 v2);
 
@@ -24,8 +122,13 @@ namespace avocado {
 		int32 image_height;
 		int32 vertex_count;
 		int32 index_count;
+		float height_offset;
+		float height_scale;
+
+		// note: CHUNK_SIZE blocks of the index buffer from create, in index order
+		dynamic_array<chunk> chunks;
 	};
 }
 
 
-#endif // !HEIGHTMAP_HPP_INCLUDED
\ No newline at end of file
+#endif // !HEIGHTMAP_HPP_INCLUDED
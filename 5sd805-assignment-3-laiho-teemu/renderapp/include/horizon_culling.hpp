@@ -0,0 +1,84 @@
+// horizon_culling.hpp
+
+#ifndef HORIZON_CULLING_HPP_INCLUDED
+#define HORIZON_CULLING_HPP_INCLUDED
+
+#pragma warning(push)
+#pragma warning(disable: 4127)
+#pragma warning(disable: 4201)
+#include <glm/glm.hpp>
+#pragma warning(pop)
+
+#include <avocado.hpp>
+
+namespace avocado {
+	struct box_bounds;
+
+	// note: occlusion culling of terrain by terrain. chunks or lod nodes are walked front
+	//       to back and the highest terrain seen so far is kept per screen column, a chunk
+	//       whose top stays below it in all of its columns is hidden. the screen is the one
+	//       of the camera turned level, so every column is a vertical slice of the world
+	//       and anything under the surface of a nearer chunk is solid ground. a chunk adds
+	//       the bottom of its bounds to the horizon once the walk has passed its farthest
+	//       point, the terrain inside is no lower than that
+	struct horizon_buffer {
+		// note: the half_width for a camera, the columns span the widest the view gets on
+		//       the level screen, bottom corners of a camera looking down reach out further
+		//       than the top ones. pitch in radians
+		static float half_width(const glm::mat4 &projection, const float pitch);
+
+		horizon_buffer();
+
+		bool is_valid() const;
+		bool create(const int32 columns);
+		void destroy();
+
+		// note: drops the bounds of visible hidden by the ones in front of them, the rest
+		//       are left nearest first. forward is the view direction, half_width the
+		//       tangent of half the horizontal view angle the columns span, bounds
+		//       reaching past it or behind the eye are kept. returns the visible count
+		int32 cull(const glm::vec3 &eye,
+				   const glm::vec3 &forward,
+				   const float half_width,
+				   const box_bounds &bounds,
+				   dynamic_array<int32> &visible);
+
+		// note: the walk of cull for callers with their own order, a quadtree visits its
+		//       children nearest first. begin clears the horizon and returns false when
+		//       nothing can be hidden, a box tested after one nearer to the eye than an
+		//       occluder already in the horizon is kept, so any order is safe and front to
+		//       back hides the most. add marks a visible box as solid ground below its top
+		bool begin(const glm::vec3 &eye, const glm::vec3 &forward, const float half_width);
+		bool is_hidden(const glm::vec3 &min_corner, const glm::vec3 &max_corner);
+		void add(const glm::vec3 &min_corner, const glm::vec3 &max_corner);
+
+		// note: horizontal distance from the eye to the nearest and farthest point
+		struct entry {
+			float nearest_;
+			float farthest_;
+			int32 index_;
+		};
+
+		// note: the camera turned level, x and y over the distance along the view
+		//       direction, x in columns
+		struct view {
+			glm::vec3 eye_;
+			glm::vec3 forward_;
+			glm::vec3 right_;
+			float half_width_;
+			float scale_;
+		};
+
+		int32 columns_;
+		bool active_;						// between a begin that succeeded and the next one
+		view view_;
+		float flushed_;						// farthest point of the occluders in the horizon
+		dynamic_array<float> horizon_;		// highest y / z per column
+		dynamic_array<float> upper_;		// top of an occluder at each column edge
+		dynamic_array<entry> entries_;
+		dynamic_array<entry> pending_;		// visible, not yet in the horizon, heap by farthest_
+		dynamic_array<glm::vec3> boxes_;	// min and max corner of each pending entry
+	};
+} // !avocado
+
+#endif // !HORIZON_CULLING_HPP_INCLUDED
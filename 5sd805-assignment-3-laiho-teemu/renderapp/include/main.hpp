@@ -11,11 +11,27 @@
 
 #include <avocado.hpp>
 #include <avocado_render.hpp>
+#include <avocado_thread.hpp>
 
 #include <camera.hpp>
 #include "skybox.hpp"
 
 #include "heightmap.hpp"
+#include "cdlod.hpp"
+#include "terrain_query.hpp"
+#include "height_pyramid.hpp"
+#include "terrain_cache.hpp"
+#include "tile_world.hpp"
+#include "rtin.hpp"
+#include "mesh_optimizer.hpp"
+#include "terrain_erosion.hpp"
+#include "terrain_editor.hpp"
+#include "terrain_occlusion.hpp"
+#include "terrain_splat.hpp"
+#include "terrain_normal_map.hpp"
+#include "culling.hpp"
+#include "occlusion_culling.hpp"
+#include "horizon_culling.hpp"
 
 namespace avocado {
     //struct vertex {
@@ -27,15 +43,53 @@ namespace avocado {
       glm::vec3 normal_;
    };
 
-   struct chunk {
-       int start_index_;
-       int index_count_;
+   struct renderapp final : application {
+      static constexpr int32 WINDOW_WIDTH = 1280;
+      static constexpr int32 WINDOW_HEIGHT = 720;
 
-       glm::vec3 min_corner_;
-       glm::vec3 max_corner_;
-   };
+      // note: bounding sphere of the unit crate
+      static constexpr float CRATE_RADIUS = 0.8660254f;
+
+      // note: smallest camera height above the terrain
+      static constexpr float CAMERA_CLEARANCE = 1.5f;
+
+      // note: quads per side of a terrain draw, a block of 33 * 33 chunk vertices fits in
+      //       16 bit indices on a map of any width
+      static constexpr int32 TERRAIN_CHUNK_SIZE = 32;
+
+      // note: quads per block of the adaptive terrain and the height error it may leave
+      static constexpr int32 TERRAIN_BLOCK_SIZE = 32;
+      static constexpr float TERRAIN_MAX_ERROR = 0.25f;
+
+      // note: vertex cache efficiency the overdraw ordering may trade away, 1.05 is 5%
+      static constexpr float TERRAIN_OVERDRAW_THRESHOLD = 1.05f;
+
+      // note: samples per side of the procedural terrain outside the streamed world
+      static constexpr int32 PROCEDURAL_TERRAIN_SIZE = 1024;
+
+      // note: erosion iterations in all, run for EROSION_BUDGET_MS of each frame. what is
+      //       built from the heights follows after every EROSION_BATCH of them
+      static constexpr int32 EROSION_ITERATIONS = 200;
+      static constexpr int32 EROSION_BATCH = 25;
+      static constexpr float EROSION_BUDGET_MS = 4.0f;
+
+      // note: horizon map tiles baked again per frame after terrain edits
+      static constexpr int32 HORIZON_TILES_PER_FRAME = 4;
+
+      // note: radians the sun moves per second while the time of day runs
+      static constexpr float SUN_SPEED = 0.2f;
+
+      // note: farthest the brush reaches along the view direction
+      static constexpr float BRUSH_REACH = 512.0f;
+
+      // note: software occlusion buffer size and the samples between occluder vertices
+      static constexpr int32 OCCLUSION_WIDTH = 256;
+      static constexpr int32 OCCLUSION_HEIGHT = 144;
+      static constexpr int32 OCCLUDER_SPACING = 32;
+
+      // note: screen columns of the terrain horizon for culling chunks
+      static constexpr int32 HORIZON_COLUMNS = 512;
 
-   struct renderapp final : application {
       renderapp();
 
       virtual bool on_init();
@@ -45,8 +99,12 @@ namespace avocado {
 
       void set_phong_reflection_uniforms(int mode, int color);
       void change_light();
+      void cull_chunks(const dynamic_array<chunk> &chunks);
+      void refresh_terrain(const terrain_editor::rect &changed);
+      bool apply_erosion();
 
       renderer renderer_;
+      worker_pool workers_;
       shader_program shader_;
       vertex_buffer buffer_;
       vertex_layout layout_;
@@ -78,8 +136,86 @@ namespace avocado {
       uint32 heightmap_index_count;
       uint32 heightmap_index_size;
 
+      // note: 8 byte quantized vertices instead of the 40 byte vertex
+      bool compact_terrain_;
       dynamic_array<vertex> vertices_;
+      dynamic_array<terrain_vertex> compact_vertices_;
       dynamic_array<uint32> indices_;
+      heightmap::chunk_template chunk_template_;
+
+      // note: bounds of the drawn chunks and a hierarchy over them for culling, built
+      //       when they are missing and refitted when an edit has moved them
+      box_bounds chunk_bounds_;
+      bounds_tree chunk_tree_;
+      bool refit_chunks_;
+      dynamic_array<int32> visible_chunks_;
+
+      // note: error bounded triangles instead of two per quad
+      bool adaptive_terrain_;
+
+      // note: full vertex terrain from 32 bit indices is also ordered against overdraw
+      bool overdraw_terrain_;
+
+      // note: quadtree level of detail instead of the full resolution mesh
+      bool lod_terrain_;
+      cdlod cdlod_;
+
+      // note: endless world streamed in tiles around the camera, the loaded map repeats
+      bool stream_terrain_;
+      heightfield_tile_source tile_source_;
+      tile_world tile_world_;
+
+      // note: heights from seeded noise instead of the heightmap image, streamed tiles are
+      //       generated as they are needed
+      bool procedural_terrain_;
+      noise_tile_source noise_source_;
+
+      // note: hydraulic and thermal erosion of the heights over the frames after load. a
+      //       streamed world or a mesh the editor cannot rewrite is built from heights
+      //       eroded at load instead. eroded_ counts the iterations the terrain follows
+      bool erode_terrain_;
+      terrain_erosion erosion_;
+      int64 eroded_;
+
+      // note: horizon based ambient occlusion baked into the terrain at load, cached meshes
+      //       keep it in their vertices
+      bool occlusion_terrain_;
+
+      // note: terrain shadows for any sun direction from horizon maps
+      bool shadow_terrain_;
+      terrain_horizon horizon_;
+
+      // note: sand, grass, rock and snow blended by height, slope and curvature
+      bool splat_terrain_;
+      terrain_splat splat_;
+
+      // note: per pixel normals of the full resolution heights, shading no longer follows
+      //       the density of the mesh
+      bool normal_map_terrain_;
+      terrain_normal_map normal_map_;
+
+      // note: chunks and level of detail nodes behind a coarse copy of the terrain are
+      //       dropped before they are drawn
+      bool occlusion_culling_;
+      terrain_occluder occluder_;
+      occlusion_buffer occlusion_;
+
+      // note: chunks and lod nodes below the horizon of the ones in front of them are
+      //       dropped, walked front to back on the main thread
+      bool horizon_culling_;
+      horizon_buffer chunk_horizon_;
+
+      // note: brush editing of the compact full resolution terrain, works on its own copy
+      //       of the heights. off by default, the default cdlod path has no editable mesh.
+      //       erosion shares the copy and the editor rewrites the mesh after its batches
+      bool edit_terrain_;
+      heightfield edit_field_;
+      terrain_editor editor_;
+      terrain_brush brush_;
+
+      // note: height and ray lookups for gameplay, independent of how the terrain is drawn
+      terrain_query terrain_;
+      height_pyramid terrain_rays_;
 
       skybox skybox_;
 
@@ -87,6 +223,7 @@ namespace avocado {
       const void* material_shininess_pointer = &material_shininess_float;
 
       glm::vec3 lightdirection_;
+      float sun_angle_;
       float deltatime_;
    };
 } // !avocado
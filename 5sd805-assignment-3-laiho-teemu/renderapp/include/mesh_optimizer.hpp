@@ -0,0 +1,68 @@
+// mesh_optimizer.hpp
+
+#ifndef MESH_OPTIMIZER_HPP_INCLUDED
+#define MESH_OPTIMIZER_HPP_INCLUDED
+
+#pragma warning(push)
+#pragma warning(disable: 4127)
+#pragma warning(disable: 4201)
+#include <glm/glm.hpp>
+#pragma warning(pop)
+
+#include <avocado.hpp>
+
+#include "heightmap.hpp"
+
+namespace avocado {
+	struct worker_pool;
+
+	// note: post-transform cache behaviour of a triangle list, simulated as a fifo of
+	//       cache_size entries. acmr is vertex shader runs per triangle, 0.5 is the best a
+	//       large regular grid can do and 3 the worst. atvr is runs per distinct vertex, 1 is
+	//       the best possible
+	struct vertex_cache_stats {
+		int32 triangles_;
+		int32 vertices_;
+		int32 misses_;
+		float acmr_;
+		float atvr_;
+	};
+
+	static constexpr int32 DEFAULT_VERTEX_CACHE_SIZE = 16;
+
+	vertex_cache_stats analyze_vertex_cache(const uint32 *indices, const int32 index_count, const int32 cache_size = DEFAULT_VERTEX_CACHE_SIZE);
+	vertex_cache_stats analyze_vertex_cache(const uint16 *indices, const int32 index_count, const int32 cache_size = DEFAULT_VERTEX_CACHE_SIZE);
+
+	// note: summed over the index ranges of the chunks, each range starting with a cold cache
+	vertex_cache_stats analyze_vertex_cache(const uint32 *indices, const dynamic_array<chunk> &chunks, const int32 cache_size = DEFAULT_VERTEX_CACHE_SIZE);
+
+	// note: reorders the triangles of a list for the post-transform cache, tom forsyth's
+	//       linear-speed greedy ordering. the triangles and their winding are kept, only
+	//       the order changes. a list the ordering would not improve is left as it is
+	void optimize_vertex_cache(uint32 *indices, const int32 index_count);
+	void optimize_vertex_cache(uint16 *indices, const int32 index_count);
+
+	// note: every chunk range on its own so the ranges still draw the same triangles
+	void optimize_vertex_cache(uint32 *indices, const dynamic_array<chunk> &chunks, worker_pool *pool = nullptr);
+
+	// note: run after optimize_vertex_cache. the list is cut into clusters where the cache
+	//       starts over, and further where a cluster has reached threshold times the acmr of
+	//       the whole list, then clusters facing away from the middle of the mesh are moved to
+	//       the front so they tend to occlude the rest. a threshold of 1 keeps the cache
+	//       efficiency, higher gives smaller clusters and less overdraw. position i is read
+	//       from (const uint8 *)positions + i * stride
+	void optimize_overdraw(uint32 *indices, const int32 index_count, const glm::vec3 *positions, const int32 stride, const float threshold);
+	void optimize_overdraw(uint16 *indices, const int32 index_count, const glm::vec3 *positions, const int32 stride, const float threshold);
+	void optimize_overdraw(uint32 *indices, const dynamic_array<chunk> &chunks, const glm::vec3 *positions, const int32 stride, const float threshold, worker_pool *pool = nullptr);
+
+	// note: renumbers the vertices in the order the indices first use them and rewrites the
+	//       indices, remap[old] is the new index. vertices the indices never use keep their
+	//       relative order after the used ones
+	void optimize_vertex_fetch(uint32 *indices, const int32 index_count, const int32 vertex_count, dynamic_array<uint32> &remap);
+	void optimize_vertex_fetch(uint16 *indices, const int32 index_count, const int32 vertex_count, dynamic_array<uint32> &remap);
+
+	// note: moves vertex i of vertex_size bytes to remap[i]
+	void remap_vertices(void *vertices, const int32 vertex_count, const int32 vertex_size, const dynamic_array<uint32> &remap);
+} // !avocado
+
+#endif // !MESH_OPTIMIZER_HPP_INCLUDED
@@ -0,0 +1,42 @@
+// normals.hpp
+
+#ifndef NORMALS_HPP_INCLUDED
+#define NORMALS_HPP_INCLUDED
+
+#pragma warning(push)
+#pragma warning(disable: 4127)
+#pragma warning(disable: 4201)
+#include <glm/glm.hpp>
+#pragma warning(pop)
+
+#include "heightfield.hpp"
+
+namespace avocado {
+	struct worker_pool;
+
+	// note: smooth unit normals from central differences of the height samples,
+	//       one-sided differences are used on the grid border.
+	//       covers the samples [x0, x1) x [z0, z1), the normal of sample (x, z) is written to
+	//       (uint8 *)dst + (z - z0) * pitch + (x - x0) * stride, so it can fill a normal_
+	//       member in place inside an interleaved vertex array
+	void compute_normals(const heightfield &field,
+						 const int32 x0,
+						 const int32 z0,
+						 const int32 x1,
+						 const int32 z1,
+						 glm::vec3 *dst,
+						 const int32 stride,
+						 const int32 pitch);
+
+	// note: whole grid in row bands, dst laid out like the heightfield
+	void compute_normals(const heightfield &field,
+						 glm::vec3 *dst,
+						 const int32 stride,
+						 worker_pool *pool = nullptr);
+
+	// note: octahedral mapping of a unit vector onto [-1, 1] x [-1, 1]
+	glm::vec2 octahedral_encode(const glm::vec3 &normal);
+	glm::vec3 octahedral_decode(const glm::vec2 &encoded);
+} // !avocado
+
+#endif // !NORMALS_HPP_INCLUDED
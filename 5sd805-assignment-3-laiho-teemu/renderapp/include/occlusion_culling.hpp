@@ -0,0 +1,100 @@
+// occlusion_culling.hpp
+
+#ifndef OCCLUSION_CULLING_HPP_INCLUDED
+#define OCCLUSION_CULLING_HPP_INCLUDED
+
+#pragma warning(push)
+#pragma warning(disable: 4127)
+#pragma warning(disable: 4201)
+#include <glm/glm.hpp>
+#pragma warning(pop)
+
+#include <avocado.hpp>
+
+#include "heightfield.hpp"
+
+namespace avocado {
+	struct worker_pool;
+	struct box_bounds;
+
+	// note: low resolution depth buffer of the occluders on the cpu, boxes are tested
+	//       against it before they are drawn. bands of rows are rasterized in parallel,
+	//       each band going over all occluder triangles four pixels at a time with sse2.
+	//       every tile of TILE_SIZE pixels keeps the farthest depth in it, so most tests
+	//       settle per tile. pixels are covered when their centre is, and take the
+	//       farthest depth the triangle reaches inside them, triangles crossing the near
+	//       plane are left out. depth is normalized device z, smaller is nearer
+	struct occlusion_buffer {
+		static constexpr int32 TILE_SIZE = 8;
+		static constexpr int32 BAND_ROWS = TILE_SIZE * 2;
+
+		occlusion_buffer();
+
+		bool is_valid() const;
+
+		// note: width and height in pixels, multiples of TILE_SIZE
+		bool create(const int32 width, const int32 height);
+		void destroy();
+
+		// note: clears the buffer and draws the triangles of positions picked by indices,
+		//       viewprojection as for the vertex shader
+		void render(const glm::mat4 &viewprojection,
+					const glm::vec3 *positions,
+					const int32 vertex_count,
+					const uint32 *indices,
+					const int32 index_count,
+					worker_pool *pool = nullptr);
+
+		// note: false only when every pixel the box covers on screen holds something nearer
+		//       than the nearest point of the box
+		bool is_visible(const glm::vec3 &min_corner, const glm::vec3 &max_corner) const;
+
+		// note: drops the occluded bounds from visible, keeping the order of the rest.
+		//       returns the visible count
+		int32 cull(const box_bounds &bounds, dynamic_array<int32> &visible, worker_pool *pool = nullptr);
+
+		// note: screen position, depth and the depth the triangle reaches across a pixel
+		struct triangle {
+			float edges_[3][3];		// a * x + b * y + c, positive inside
+			float depth_[3];		// a * x + b * y + c at a pixel centre, farthest in the pixel
+			float farthest_;
+			int32 min_x_;
+			int32 min_y_;
+			int32 max_x_;
+			int32 max_y_;
+		};
+
+		int32 width_;
+		int32 height_;
+		int32 tiles_x_;
+		int32 tiles_y_;
+		glm::mat4 viewprojection_;
+		dynamic_array<float> depth_;
+		dynamic_array<float> tile_depth_;		// farthest depth per tile
+		dynamic_array<glm::vec4> screen_;		// x, y, depth and w per vertex
+		dynamic_array<triangle> triangles_;
+		dynamic_array<uint8> flags_;
+	};
+
+	// note: coarse terrain mesh for occlusion, a vertex every spacing samples. every vertex
+	//       takes the lowest height around it, so the coarse surface lies below the terrain
+	//       and never hides what the terrain would not
+	struct terrain_occluder {
+		terrain_occluder();
+
+		bool is_valid() const;
+		bool create(const heightfield &field, const int32 spacing);
+		void destroy();
+
+		// note: samples [x0, x1) x [z0, z1) of the field have changed
+		void update(const heightfield &field, const int32 x0, const int32 z0, const int32 x1, const int32 z1);
+
+		int32 spacing_;
+		int32 columns_;
+		int32 rows_;
+		dynamic_array<glm::vec3> positions_;
+		dynamic_array<uint32> indices_;
+	};
+} // !avocado
+
+#endif // !OCCLUSION_CULLING_HPP_INCLUDED
@@ -0,0 +1,49 @@
+// rtin.hpp
+
+#ifndef RTIN_HPP_INCLUDED
+#define RTIN_HPP_INCLUDED
+
+#pragma warning(push)
+#pragma warning(disable: 4127)
+#pragma warning(disable: 4201)
+#include <glm/glm.hpp>
+#pragma warning(pop)
+
+#include <avocado.hpp>
+
+#include "heightfield.hpp"
+#include "heightmap.hpp"
+
+namespace avocado {
+	struct worker_pool;
+
+	// note: right-triangulated irregular network. the map is cut into square blocks of
+	//       block_size quads (a power of two) and each block is a binary tree of right
+	//       triangles, a triangle is split at the middle of its long edge while any height
+	//       sample it covers is further than max_error from it. split errors are computed once
+	//       and shared across block edges so neighbouring blocks never crack, any max_error
+	//       can then be triangulated quickly. triangles that would reach past the map are
+	//       split down to single quads and dropped outside
+	struct rtin {
+		rtin();
+
+		bool is_valid() const;
+		bool create(const heightfield &field, const int32 block_size, worker_pool *pool = nullptr);
+		void destroy();
+
+		// note: indices into a vertex buffer laid out like the heightfield, the same vertices
+		//       heightmap::create writes, and one chunk per block in index order
+		void triangulate(const float max_error, dynamic_array<uint32> &indices, dynamic_array<chunk> &chunks, worker_pool *pool = nullptr) const;
+		void triangulate(const int32 block_x, const int32 block_z, const float max_error, dynamic_array<uint32> &indices) const;
+
+		int32 width_;
+		int32 height_;
+		int32 block_size_;
+		int32 blocks_x_;
+		int32 blocks_z_;
+		dynamic_array<float> errors_;		// (block_size_ + 1)^2 per block, blocks row by row
+		dynamic_array<chunk> bounds_;		// per block, index ranges left empty
+	};
+} // !avocado
+
+#endif // !RTIN_HPP_INCLUDED
@@ -0,0 +1,100 @@
+// terrain_cache.hpp
+
+#ifndef TERRAIN_CACHE_HPP_INCLUDED
+#define TERRAIN_CACHE_HPP_INCLUDED
+
+#pragma warning(push)
+#pragma warning(disable: 4127)
+#pragma warning(disable: 4201)
+#include <glm/glm.hpp>
+#pragma warning(pop)
+
+#include <avocado.hpp>
+
+#include "heightfield.hpp"
+#include "heightmap.hpp"
+
+namespace avocado {
+	// note: processed terrain stored next to the source image so startup can skip the image
+	//       decode and the mesh build. the file is one header followed by 64 byte aligned
+	//       sections and is mapped as a whole, vertex and index data go to the buffers straight
+	//       from the mapping. a cache is only used when its version and the hash of the source
+	//       image bytes match and it was built with the same params, the mesh sections are
+	//       empty when only heights were cached
+	struct terrain_cache {
+		static constexpr uint32 MAGIC = 0x4e525254;		// "TRRN"
+		static constexpr uint32 VERSION = 7;
+		static constexpr uint64 SECTION_ALIGNMENT = 64;
+
+		struct section {
+			uint64 offset_;		// in bytes from the start of the file
+			uint64 count_;		// in elements
+		};
+
+		// note: the settings the cached data was built with
+		struct params {
+			float height_scale_;	// of the heightfield decode
+			float height_offset_;
+			int32 chunk_size_;		// asked of the chunk template
+			uint32 occlusion_;		// 1 when the vertices carry baked occlusion
+		};
+
+		struct header {
+			uint32 magic_;
+			uint32 version_;
+			uint64 source_hash_;
+			params params_;
+			int32 width_;
+			int32 height_;
+			float height_offset_;
+			float height_scale_;
+			int32 index_count_;		// of the full 32 bit grid
+			int32 chunk_size_;		// of the chunk template, 0 without one
+			int32 chunks_x_;
+			int32 chunks_z_;
+			int32 edge_start_;
+			section heights_;			// float, width_ * height_
+			section vertices_;			// terrain_vertex, in chunk blocks with a chunk template
+			section template_indices_;	// uint16, chunk template
+			section template_chunks_;	// chunk, chunk template
+			section indices_;			// uint32, only without a chunk template
+			section chunks_;			// chunk, heightmap CHUNK_SIZE blocks
+		};
+
+		// note: 64 bit fnv-1a
+		static uint64 hash(const void *data, const int64 size);
+		static bool hash_file(const char *filename, uint64 &result);
+
+		// note: indices are written only when chunk_template has none
+		static bool write(const char *filename, const uint64 source_hash, const params &build_params, const heightfield &field);
+		static bool write(const char *filename,
+						  const uint64 source_hash,
+						  const params &build_params,
+						  const heightfield &field,
+						  const heightmap &map,
+						  const dynamic_array<terrain_vertex> &vertices,
+						  const dynamic_array<uint32> &indices,
+						  const heightmap::chunk_template &chunk_template);
+
+		terrain_cache();
+
+		bool is_valid() const;
+		bool create(const char *filename, const uint64 source_hash, const params &build_params);
+		void destroy();
+
+		bool has_mesh() const;
+
+		// note: the heights and the chunk template are copied, the vertices and the 32 bit
+		//       indices are read from the mapping
+		bool load(heightfield &field) const;
+		bool load(heightmap &map, heightmap::chunk_template &chunk_template) const;
+
+		const terrain_vertex *vertices() const;
+		const uint32 *indices() const;
+
+		mapped_file file_;
+		const header *header_;
+	};
+} // !avocado
+
+#endif // !TERRAIN_CACHE_HPP_INCLUDED
@@ -0,0 +1,90 @@
+// terrain_editor.hpp
+
+#ifndef TERRAIN_EDITOR_HPP_INCLUDED
+#define TERRAIN_EDITOR_HPP_INCLUDED
+
+#pragma warning(push)
+#pragma warning(disable: 4127)
+#pragma warning(disable: 4201)
+#include <glm/glm.hpp>
+#pragma warning(pop)
+
+#include <avocado.hpp>
+#include <avocado_render.hpp>
+
+#include "heightfield.hpp"
+#include "heightmap.hpp"
+
+namespace avocado {
+	struct terrain_query;
+
+	struct terrain_brush {
+		enum class mode {
+			raise,
+			lower,
+			smooth,		// pulls samples towards the average of their neighbours
+		};
+
+		terrain_brush();
+
+		mode mode_;
+		float radius_;		// in samples
+		float strength_;	// height change per second at the centre, blend rate when smoothing
+	};
+
+	// note: edits the heights of a compact vertex terrain in place. strokes only touch the
+	//       field and remember the rectangles they changed, flush then recomputes the normals
+	//       inside those rectangles, uploads the rewritten vertex rows with sub-range buffer
+	//       updates, and refreshes the height queries and the chunk bounds that overlap them.
+	//       heights stay inside the range the vertices were quantized to
+	struct terrain_editor {
+		// note: samples [x0_, x1_) x [z0_, z1_)
+		struct rect {
+			int32 x0_;
+			int32 z0_;
+			int32 x1_;
+			int32 z1_;
+		};
+
+		terrain_editor();
+
+		bool is_valid() const;
+
+		// note: buffer holds the vertices of map.create(field, terrain_vertex ...), in grid order
+		//       or gathered into the blocks of layout. the editor keeps pointers to field,
+		//       buffer and layout until destroy. the baked occlusion of the vertices, when
+		//       given, is kept for the rewritten ones
+		bool create(heightfield &field,
+					const heightmap &map,
+					vertex_buffer &buffer,
+					const terrain_vertex *vertices = nullptr,
+					const heightmap::chunk_template *layout = nullptr);
+		void destroy();
+
+		// note: one stroke of the brush centred on sample coordinates x and z, scaled by the
+		//       frame time. false when the brush misses the field
+		bool apply(const terrain_brush &brush, const float x, const float z, const float deltatime);
+
+		// note: samples of the field changed by something other than the brush, they go
+		//       out with the next flush
+		void invalidate(const rect &area);
+
+		// note: chunks are row by row, chunk_size quads per side like heightmap::chunks or
+		//       chunk_template::chunks_. changed receives the bounds of everything flushed.
+		//       returns the number of vertices uploaded
+		int32 flush(dynamic_array<chunk> &chunks, const int32 chunk_size, terrain_query *query = nullptr, rect *changed = nullptr);
+
+		heightfield *field_;
+		vertex_buffer *buffer_;
+		const heightmap::chunk_template *layout_;
+		float height_offset_;
+		float height_scale_;
+		dynamic_array<rect> dirty_;
+		dynamic_array<uint16> occlusion_;
+		dynamic_array<float> scratch_;
+		dynamic_array<glm::vec3> normals_;
+		dynamic_array<terrain_vertex> staging_;
+	};
+} // !avocado
+
+#endif // !TERRAIN_EDITOR_HPP_INCLUDED
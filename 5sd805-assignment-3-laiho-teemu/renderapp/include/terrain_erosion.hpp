@@ -0,0 +1,72 @@
+// terrain_erosion.hpp
+
+#ifndef TERRAIN_EROSION_HPP_INCLUDED
+#define TERRAIN_EROSION_HPP_INCLUDED
+
+#pragma warning(push)
+#pragma warning(disable: 4127)
+#pragma warning(disable: 4201)
+#include <glm/glm.hpp>
+#pragma warning(pop)
+
+#include <avocado.hpp>
+
+#include "heightfield.hpp"
+
+namespace avocado {
+	struct worker_pool;
+
+	// note: grid erosion of a heightfield, one sample per cell. hydraulic erosion follows
+	//       the virtual pipe model: rain fills the cells, water flows to the four
+	//       neighbours through pipes driven by the height differences, moving water
+	//       dissolves ground up to its carrying capacity and drops it where it slows down.
+	//       thermal erosion then slides ground down slopes steeper than the talus angle.
+	//       an iteration is a series of passes over cache sized blocks on the worker pool,
+	//       each pass only writes the cell it visits and what neighbours read comes from the
+	//       previous pass or the other half of a double buffer, so blocks never race.
+	//       the first half of a double buffer holds the latest state between iterations,
+	//       so the erosion can stop after any iteration and carry on in a later frame
+	struct terrain_erosion {
+		static constexpr int32 BLOCK_SIZE = 64;
+
+		terrain_erosion();
+
+		bool is_valid() const;
+		bool create(const heightfield &field, worker_pool *pool = nullptr);
+		void destroy();
+
+		void step();
+
+		// note: iterations until budget_ms has passed, at least one, so the erosion can be
+		//       spread over frames. returns the number of iterations run
+		int32 run(const float budget_ms);
+
+		// note: ground heights after the iterations so far
+		bool heights(heightfield &result) const;
+		float height(const int32 x, const int32 z) const;
+
+		float time_step_;
+		float rain_;				// water added per cell and second
+		float evaporation_;			// fraction of the water lost per second
+		float capacity_;			// sediment carried per unit of slope and speed
+		float dissolve_;			// rate ground is picked up below capacity
+		float deposit_;				// rate sediment is dropped above capacity
+		float min_tilt_;			// keeps flat ground eroding a little
+		float talus_;				// height difference between neighbours that stays put
+		float thermal_rate_;		// fraction of the excess moved per second
+
+		worker_pool *pool_;
+		int32 width_;
+		int32 height_;
+		int64 iterations_;
+		dynamic_array<float> ground_[2];
+		dynamic_array<float> sediment_[2];
+		dynamic_array<float> water_;
+		dynamic_array<glm::vec4> flux_;			// outflow to the left, right, up and down neighbour
+		dynamic_array<glm::vec2> velocity_;
+		dynamic_array<glm::vec4> transport_;	// share of the water and sediment leaving each way
+		dynamic_array<glm::vec4> slide_;		// thermal outflow in the same directions
+	};
+} // !avocado
+
+#endif // !TERRAIN_EROSION_HPP_INCLUDED
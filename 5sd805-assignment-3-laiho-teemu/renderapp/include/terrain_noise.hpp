@@ -0,0 +1,53 @@
+// terrain_noise.hpp
+
+#ifndef TERRAIN_NOISE_HPP_INCLUDED
+#define TERRAIN_NOISE_HPP_INCLUDED
+
+#pragma warning(push)
+#pragma warning(disable: 4127)
+#pragma warning(disable: 4201)
+#include <glm/glm.hpp>
+#pragma warning(pop)
+
+#include <avocado.hpp>
+
+#include "heightfield.hpp"
+
+namespace avocado {
+	struct worker_pool;
+
+	// note: endless procedural heights from octaves of 2d gradient noise. a sample depends
+	//       only on the settings and its own world coordinates, and every code path computes
+	//       it with the same float operations, so any part of the field can be generated again
+	//       on demand and comes out bit for bit the same, with or without avx2 and threads
+	struct terrain_noise {
+		enum class variant {
+			fbm,		// sum of octaves, rolling hills
+			ridged,		// folded octaves, sharp crests and valleys
+			warped,		// fbm looked up at coordinates displaced by two more fbm fields
+		};
+
+		terrain_noise();
+
+		// note: samples [x0, x0 + width) x [z0, z0 + height) of the field into result,
+		//       with a worker pool the rows are generated in parallel bands
+		bool generate(heightfield &result, const int32 x0, const int32 z0, const int32 width, const int32 height, worker_pool *pool = nullptr) const;
+		float sample(const int32 x, const int32 z) const;
+
+		// note: every sample lies in [offset_ - scale_, offset_ + scale_]
+		float lowest() const;
+		float highest() const;
+
+		uint32 seed_;
+		variant variant_;
+		int32 octaves_;
+		float frequency_;		// of the first octave, in cycles per sample
+		float lacunarity_;		// frequency ratio between octaves
+		float gain_;			// amplitude ratio between octaves
+		float warp_;			// displacement of the warped variant, in samples
+		float scale_;
+		float offset_;
+	};
+} // !avocado
+
+#endif // !TERRAIN_NOISE_HPP_INCLUDED
@@ -0,0 +1,56 @@
+// terrain_normal_map.hpp
+
+#ifndef TERRAIN_NORMAL_MAP_HPP_INCLUDED
+#define TERRAIN_NORMAL_MAP_HPP_INCLUDED
+
+#pragma warning(push)
+#pragma warning(disable: 4127)
+#pragma warning(disable: 4201)
+#include <glm/glm.hpp>
+#pragma warning(pop)
+
+#include <avocado.hpp>
+#include <avocado_render.hpp>
+
+#include "heightfield.hpp"
+
+namespace avocado {
+	struct worker_pool;
+
+	// note: object space normals of every height sample, octahedral encoded into a two
+	//       channel texture, so lighting keeps the detail of the full resolution field
+	//       however coarse the mesh drawn over it is. terrain normals point up, where the
+	//       octahedral mapping is linear and filtering the encoded texels is safe. the
+	//       normals are computed in tiles spread over the worker pool, an edit only bakes
+	//       its own rectangle again
+	struct terrain_normal_map {
+		static constexpr int32 TILE_SIZE = 64;
+
+		terrain_normal_map();
+
+		bool is_valid() const;
+		bool create(const heightfield &field, worker_pool *pool = nullptr);
+		void destroy();
+
+		// note: bakes the normals of [x0, x1) x [z0, z1) from the changed field and uploads
+		//       them. the normals next to a changed height change too, so pass the changed
+		//       heights grown by one sample, which is what terrain_editor::flush reports
+		void update(const heightfield &field, const int32 x0, const int32 z0, const int32 x1, const int32 z1, worker_pool *pool = nullptr);
+
+		// note: texture on unit, u_normal_map and u_normal_map_size
+		void bind(renderer &rend, shader_program &program, const int32 unit);
+
+		// note: channel bytes per texel
+		int32 texel_size() const;
+
+		texture_format format_;		// TEXTURE_FORMAT_RG16 or TEXTURE_FORMAT_RG8, set before create
+		int32 width_;
+		int32 height_;
+		dynamic_array<uint8> texels_;
+		dynamic_array<uint8> staging_;
+		texture texture_;
+		sampler_state sampler_;
+	};
+} // !avocado
+
+#endif // !TERRAIN_NORMAL_MAP_HPP_INCLUDED
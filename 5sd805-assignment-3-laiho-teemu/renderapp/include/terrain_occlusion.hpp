@@ -0,0 +1,87 @@
+// terrain_occlusion.hpp
+
+#ifndef TERRAIN_OCCLUSION_HPP_INCLUDED
+#define TERRAIN_OCCLUSION_HPP_INCLUDED
+
+#pragma warning(push)
+#pragma warning(disable: 4127)
+#pragma warning(disable: 4201)
+#include <glm/glm.hpp>
+#pragma warning(pop)
+
+#include <avocado.hpp>
+#include <avocado_render.hpp>
+
+#include "heightfield.hpp"
+#include "heightmap.hpp"
+
+namespace avocado {
+	struct worker_pool;
+
+	// note: horizon based ambient occlusion of every height sample. in each of directions_
+	//       evenly spread directions the heights are scanned outwards up to radius_ samples
+	//       for the steepest elevation, and the sky between the tangent plane and that horizon
+	//       counts as blocked, sin(horizon) - sin(tangent) per direction averaged over all of
+	//       them. a row is scanned for all its samples at once with sse2 or avx2, the rows
+	//       are shared out over the worker pool
+	struct terrain_occlusion {
+		static constexpr int32 MAX_DIRECTIONS = 64;
+
+		terrain_occlusion();
+
+		// note: result is laid out like the field, 0 is open sky and 1 fully blocked
+		bool bake(const heightfield &field, dynamic_array<float> &result, worker_pool *pool = nullptr) const;
+
+		int32 directions_;
+		float radius_;		// in samples, the scan steps grow with the distance
+	};
+
+	// note: horizon maps for sun shadows. for each of AZIMUTHS directions a sample keeps the
+	//       sine of the highest elevation the terrain reaches within radius_ samples, and it
+	//       lies in the shadow of the terrain when the sun is lower than the horizon towards it,
+	//       so shadows for any sun are one lookup. four azimuths share the channels of an rgba8
+	//       texture. the maps are baked in tiles spread over the worker pool, an edit only
+	//       invalidates the tiles whose horizons reach it and update bakes and uploads a few of
+	//       those at a time
+	struct terrain_horizon {
+		static constexpr int32 AZIMUTHS = 8;		// has to match heightmap.fs.txt
+		static constexpr int32 LAYERS = AZIMUTHS / 4;
+		static constexpr int32 TILE_SIZE = 64;
+
+		terrain_horizon();
+
+		bool is_valid() const;
+		bool create(const heightfield &field, worker_pool *pool = nullptr);
+		void destroy();
+
+		// note: samples [x0, x1) x [z0, z1) of the field have changed
+		void invalidate(const int32 x0, const int32 z0, const int32 x1, const int32 z1);
+
+		// note: bakes and uploads up to max_tiles invalidated tiles from the changed field,
+		//       returns the number still waiting
+		int32 update(const heightfield &field, const int32 max_tiles, worker_pool *pool = nullptr);
+
+		// note: textures on first_unit and the units after it, u_horizon0 .. and u_horizon_size
+		void bind(renderer &rend, shader_program &program, const int32 first_unit);
+
+		float radius_;		// in samples, set before create
+		int32 width_;
+		int32 height_;
+		int32 tiles_x_;
+		int32 tiles_z_;
+		int32 dirty_count_;
+		dynamic_array<uint8> dirty_;				// per tile, row by row
+		dynamic_array<uint8> layers_[LAYERS];		// rgba per sample, 255 is straight up
+		dynamic_array<uint8> staging_;
+		texture textures_[LAYERS];
+		sampler_state sampler_;
+	};
+
+	// note: vertices from heightmap::create of the baked field, before they are reordered.
+	//       compact vertices keep it in occlusion_, full vertices keep the visibility
+	//       1 - occlusion in the alpha of their colour
+	void store_occlusion(const dynamic_array<float> &occlusion, dynamic_array<terrain_vertex> &vertices);
+	void store_occlusion(const dynamic_array<float> &occlusion, dynamic_array<vertex> &vertices);
+} // !avocado
+
+#endif // !TERRAIN_OCCLUSION_HPP_INCLUDED
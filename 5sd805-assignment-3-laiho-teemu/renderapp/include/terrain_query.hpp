@@ -0,0 +1,44 @@
+// terrain_query.hpp
+
+#ifndef TERRAIN_QUERY_HPP_INCLUDED
+#define TERRAIN_QUERY_HPP_INCLUDED
+
+#pragma warning(push)
+#pragma warning(disable: 4127)
+#pragma warning(disable: 4201)
+#include <glm/glm.hpp>
+#pragma warning(pop)
+
+#include "heightfield.hpp"
+#include "heightmap.hpp"
+
+namespace avocado {
+	struct worker_pool;
+
+	// note: bilinear height and normal lookups on a 16 bit copy of the terrain, positions are
+	//       in heightfield units and clamped to the grid. the batched calls take separate x and z
+	//       arrays and answer four queries per step, eight with avx2
+	struct terrain_query {
+		terrain_query();
+
+		bool is_valid() const;
+		bool create(const heightfield &field);
+		bool create(const heightmap &map, const dynamic_array<terrain_vertex> &vertices);
+		void destroy();
+
+		float height(const float x, const float z) const;
+		glm::vec3 normal(const float x, const float z) const;
+
+		// note: with a worker pool the queries are split into batches across the workers
+		void heights(const int32 count, const float *x, const float *z, float *result, worker_pool *pool = nullptr) const;
+		void normals(const int32 count, const float *x, const float *z, glm::vec3 *result, worker_pool *pool = nullptr) const;
+
+		int32 width_;
+		int32 height_;
+		float height_offset_;
+		float height_scale_;		// height range covered by 0 .. 65535
+		dynamic_array<uint16> heights_;
+	};
+} // !avocado
+
+#endif // !TERRAIN_QUERY_HPP_INCLUDED
@@ -0,0 +1,74 @@
+// terrain_splat.hpp
+
+#ifndef TERRAIN_SPLAT_HPP_INCLUDED
+#define TERRAIN_SPLAT_HPP_INCLUDED
+
+#pragma warning(push)
+#pragma warning(disable: 4127)
+#pragma warning(disable: 4201)
+#include <glm/glm.hpp>
+#pragma warning(pop)
+
+#include <avocado.hpp>
+#include <avocado_render.hpp>
+
+#include "heightfield.hpp"
+
+namespace avocado {
+	struct worker_pool;
+
+	// note: material weights of every height sample from its height, slope and curvature.
+	//       rock covers slopes steeper than rock_slope_, of the rest snow covers the top of the
+	//       height range and sand the bottom, grass what is left. curvature shifts the slope and
+	//       the sand line, ridges turn to rock sooner and hollows gather sand. weights are rgba8
+	//       per sample in sand, grass, rock, snow order, summing to 255 give or take rounding,
+	//       ready for texture::create. rows are computed with sse2 or avx2 in tiles spread over
+	//       the worker pool, an edit only recomputes its own rectangle
+	struct terrain_splat {
+		enum layer {
+			LAYER_SAND,
+			LAYER_GRASS,
+			LAYER_ROCK,
+			LAYER_SNOW,
+			LAYER_COUNT,
+		};
+
+		static constexpr int32 TILE_SIZE = 64;
+
+		terrain_splat();
+
+		bool is_valid() const;
+
+		// note: weights of the whole field and the texture holding them. the height range of
+		//       the field is kept, later updates place the sand and snow lines the same way
+		bool create(const heightfield &field, worker_pool *pool = nullptr);
+		void destroy();
+
+		// note: samples [x0, x1) x [z0, z1) again from the changed field and uploaded. slope and
+		//       curvature read the neighbours, so pass the changed heights grown by one sample,
+		//       which is what terrain_editor::flush reports
+		void update(const heightfield &field, const int32 x0, const int32 z0, const int32 x1, const int32 z1, worker_pool *pool = nullptr);
+
+		// note: texture on unit, u_splat, u_splat_size and u_splat_colors
+		void bind(renderer &rend, shader_program &program, const int32 unit);
+
+		float sand_level_;			// fraction of the height range below which sand takes over
+		float snow_level_;			// fraction of the height range above which snow takes over
+		float transition_;			// fraction of the height range the sand and snow lines blend over
+		float rock_slope_;			// rise per sample where rock takes over
+		float slope_transition_;	// slope range rock blends in over
+		float curvature_;			// slope and height shift per unit of curvature
+		glm::vec3 colors_[LAYER_COUNT];
+
+		int32 width_;
+		int32 height_;
+		float lowest_;
+		float highest_;
+		dynamic_array<uint8> weights_;
+		dynamic_array<uint8> staging_;
+		texture texture_;
+		sampler_state sampler_;
+	};
+} // !avocado
+
+#endif // !TERRAIN_SPLAT_HPP_INCLUDED
@@ -0,0 +1,39 @@
+// terrain_texture.hpp
+
+#ifndef TERRAIN_TEXTURE_HPP_INCLUDED
+#define TERRAIN_TEXTURE_HPP_INCLUDED
+
+#include <avocado.hpp>
+#include <avocado_render.hpp>
+
+#include <functional>
+
+namespace avocado {
+	struct worker_pool;
+
+	// note: shared by the textures baked per height sample. the rectangle [x0, x1) x [z0, z1)
+	//       is cut along a grid of tile_size tiles, so neighbouring edits split the same way,
+	//       and bake gets the part of each tile inside it, spread over the worker pool
+	void bake_tiles(const int32 tile_size,
+					const int32 x0,
+					const int32 z0,
+					const int32 x1,
+					const int32 z1,
+					worker_pool *pool,
+					const std::function<void(const int32 x0, const int32 z0, const int32 x1, const int32 z1)> &bake);
+
+	// note: texels holds width texels of texel_size bytes per row, the rows of the
+	//       rectangle are packed into staging and go to the texture in one update
+	void upload_rect(texture &target,
+					 const texture_format format,
+					 const int32 texel_size,
+					 const uint8 *texels,
+					 const int32 width,
+					 const int32 x0,
+					 const int32 z0,
+					 const int32 x1,
+					 const int32 z1,
+					 dynamic_array<uint8> &staging);
+} // !avocado
+
+#endif // !TERRAIN_TEXTURE_HPP_INCLUDED
@@ -0,0 +1,166 @@
+// tile_world.hpp
+
+#ifndef TILE_WORLD_HPP_INCLUDED
+#define TILE_WORLD_HPP_INCLUDED
+
+#pragma warning(push)
+#pragma warning(disable: 4127)
+#pragma warning(disable: 4201)
+#include <glm/glm.hpp>
+#pragma warning(pop)
+
+#include <avocado.hpp>
+#include <avocado_render.hpp>
+
+#include <mutex>
+#include <condition_variable>
+
+#include "camera.hpp"
+#include "heightfield.hpp"
+#include "heightmap.hpp"
+#include "terrain_noise.hpp"
+
+namespace avocado {
+	struct worker_pool;
+
+	// note: hands out the heights of one tile, called from worker threads so it has to be
+	//       safe to call concurrently. the result holds tile_world::SOURCE_SAMPLES samples per
+	//       side starting one sample before the tile, the extra border gives smooth normals
+	//       across tile edges. false leaves a hole in the world
+	struct tile_source {
+		virtual ~tile_source() {}
+
+		virtual bool load(const int32 x, const int32 z, heightfield &result) = 0;
+	};
+
+	// note: one file per tile, pattern is a printf format taking the tile x and z, like
+	//       "assets/world/%d_%d.r16", raw files have to be SOURCE_SAMPLES wide and high
+	struct file_tile_source : tile_source {
+		file_tile_source(const char *pattern, const heightfield::encoding format, const float scale, const float offset);
+
+		virtual bool load(const int32 x, const int32 z, heightfield &result);
+
+		string pattern_;
+		heightfield::encoding format_;
+		float scale_;
+		float offset_;
+	};
+
+	// note: tiles cut from one map, mirrored at its edges so it repeats without seams in
+	//       every direction. an image stays decoded as it is and only the rows a tile
+	//       needs are converted to heights while it loads, the float grid of the whole map
+	//       is never built. generated or eroded heights are kept as a copy of the field
+	struct heightfield_tile_source : tile_source {
+		heightfield_tile_source();
+
+		bool create(const heightfield &field);
+
+		// note: image encodings only, lowest_ and highest_ are found while loading
+		bool create(const char *filename, const heightfield::encoding format, const float scale, const float offset);
+		void destroy();
+
+		virtual bool load(const int32 x, const int32 z, heightfield &result);
+
+		heightfield field_;
+		bitmap image_;
+		bitmap16 image16_;
+		heightfield::encoding format_;
+		float scale_;
+		float offset_;
+		int32 width_;
+		int32 height_;
+		float lowest_;
+		float highest_;
+	};
+
+	// note: tiles generated from noise_ on the loading worker, nothing is read or stored
+	struct noise_tile_source : tile_source {
+		virtual bool load(const int32 x, const int32 z, heightfield &result);
+
+		terrain_noise noise_;
+	};
+
+	// note: endless grid of terrain tiles around the camera. tiles within load_radius_ are
+	//       loaded and meshed on the worker threads and uploaded a few per update, a tile keeps
+	//       its quantized vertices on the cpu and its vertex buffer on the gpu until the least
+	//       recently used tiles have to go to stay inside the budgets. a tile with a vertex
+	//       buffer always has its vertices, so height works wherever ground is drawn. update
+	//       never waits for a worker, tiles show up when they are ready
+	struct tile_world {
+		static constexpr int32 TILE_SIZE = 128;					// quads per tile side
+		static constexpr int32 TILE_SAMPLES = TILE_SIZE + 1;		// vertices per tile side
+		static constexpr int32 SOURCE_SAMPLES = TILE_SIZE + 3;	// samples per side from a tile_source
+
+		struct tile {
+			tile();
+
+			int32 x_;
+			int32 z_;
+			bool loading_;
+			bool missing_;				// the source had nothing for the tile
+			uint64 last_used_;			// update count when last within the load radius
+			glm::vec3 min_corner_;
+			glm::vec3 max_corner_;
+			dynamic_array<terrain_vertex> vertices_;
+			vertex_buffer buffer_;
+		};
+
+		// note: handed from a worker back to update
+		struct loaded_tile {
+			int32 x_;
+			int32 z_;
+			bool valid_;
+			float min_height_;
+			float max_height_;
+			dynamic_array<terrain_vertex> vertices_;
+		};
+
+		tile_world();
+
+		bool is_valid() const;
+
+		// note: heights are quantized across [lowest, highest] for the whole world so
+		//       neighbouring tiles agree on their shared edges
+		bool create(tile_source &source, worker_pool &pool, const float lowest, const float highest);
+		void destroy();
+
+		void update(const glm::vec3 &position);
+
+		// note: program is built from assets/heightmap/heightmap_compact.vs.txt, the caller
+		//       sets the camera and lighting uniforms
+		void draw(renderer &rend, shader_program &program, const frustum &frustum);
+
+		// note: false when the tile under the position is not loaded
+		bool height(const float x, const float z, float &result) const;
+
+		int64 cpu_bytes() const;
+		int64 gpu_bytes() const;
+
+		float load_radius_;
+		int64 cpu_budget_;
+		int64 gpu_budget_;
+		int32 upload_limit_;		// vertex buffers created per update
+		int32 job_limit_;			// tiles loading at once
+
+		tile_source *source_;
+		worker_pool *pool_;
+		float height_offset_;
+		float height_scale_;
+		uint64 frame_;
+		int32 jobs_;				// submitted and not yet collected
+		int64 cpu_bytes_;
+		int64 gpu_bytes_;
+		hash_map<uint64, tile> tiles_;
+
+		index_buffer index_buffer_;
+		vertex_layout layout_;
+
+		// note: shared with the workers
+		std::mutex mutex_;
+		std::condition_variable finished_;
+		int32 pending_;
+		dynamic_array<loaded_tile> completed_;
+	};
+} // !avocado
+
+#endif // !TILE_WORLD_HPP_INCLUDED
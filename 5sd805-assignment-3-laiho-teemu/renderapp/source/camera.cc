@@ -65,6 +65,64 @@ namespace avocado {
       return true;
    }
 
+   bool frustum::is_inside(const glm::vec3 &center, const float radius) const
+   {
+      for (int index = 0; index < int(side::count); index++) {
+         const glm::vec3 normal(planes_[index]);
+         if (glm::dot(normal, center) + planes_[index].w < -radius) {
+            return false;
+         }
+      }
+
+      return true;
+   }
+
+   bool frustum::is_inside(const glm::vec3 &min_corner, const glm::vec3 &max_corner) const
+   {
+      for (int index = 0; index < int(side::count); index++) {
+         // note: corner furthest along the plane normal
+         const glm::vec3 normal(planes_[index]);
+         const glm::vec3 corner(normal.x >= 0.0f ? max_corner.x : min_corner.x,
+                                normal.y >= 0.0f ? max_corner.y : min_corner.y,
+                                normal.z >= 0.0f ? max_corner.z : min_corner.z);
+         if (glm::dot(normal, corner) + planes_[index].w < 0.0f) {
+            return false;
+         }
+      }
+
+      return true;
+   }
+
+   bool frustum::is_inside(const glm::vec3 &min_corner, const glm::vec3 &max_corner, uint32 &plane_mask, uint8 &rejected_plane) const
+   {
+      const int first = rejected_plane < int(side::count) ? rejected_plane : 0;
+      for (int offset = 0; offset < int(side::count); offset++) {
+         const int index = (first + offset) % int(side::count);
+         if ((plane_mask & (1u << index)) == 0) {
+            continue;
+         }
+
+         // note: corners furthest along and against the plane normal
+         const glm::vec3 normal(planes_[index]);
+         const glm::vec3 outer(normal.x >= 0.0f ? max_corner.x : min_corner.x,
+                               normal.y >= 0.0f ? max_corner.y : min_corner.y,
+                               normal.z >= 0.0f ? max_corner.z : min_corner.z);
+         if (glm::dot(normal, outer) + planes_[index].w < 0.0f) {
+            rejected_plane = uint8(index);
+            return false;
+         }
+
+         const glm::vec3 inner(normal.x >= 0.0f ? min_corner.x : max_corner.x,
+                               normal.y >= 0.0f ? min_corner.y : max_corner.y,
+                               normal.z >= 0.0f ? min_corner.z : max_corner.z);
+         if (glm::dot(normal, inner) + planes_[index].w >= 0.0f) {
+            plane_mask &= ~(1u << index);
+         }
+      }
+
+      return true;
+   }
+
    camera::camera()
       : pitch_(0.0f)
       , yaw_(0.0f)
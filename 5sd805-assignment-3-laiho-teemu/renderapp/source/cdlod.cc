@@ -0,0 +1,555 @@
+// cdlod.cc
+
+#include "cdlod.hpp"
+#include "horizon_culling.hpp"
+#include "mesh_optimizer.hpp"
+#include "occlusion_culling.hpp"
+
+#include <avocado_thread.hpp>
+
+#include <algorithm>
+#include <limits>
+
+namespace avocado {
+	namespace
+	{
+		// note: share of a level's range spent morphing into the next level
+		const float MORPH_START = 0.66f;
+
+		// note: rows of samples per job when measuring level errors
+		const int32 BAND_ROWS = 64;
+
+		// note: largest difference between the heights and the surface spanned by every
+		//       spacing-th sample, which is what a level draws once fully morphed
+		float level_error(const heightfield &field, const int32 spacing, worker_pool *pool)
+		{
+			const int32 last_x = field.width_ - 1;
+			const int32 last_z = field.height_ - 1;
+			const int32 band_count = (field.height_ + BAND_ROWS - 1) / BAND_ROWS;
+
+			dynamic_array<float> band_errors(band_count, 0.0f);
+			parallel_for(pool, band_count, [&](const int32 band)
+			{
+				float error = 0.0f;
+				const int32 end = glm::min((band + 1) * BAND_ROWS, field.height_);
+				for (int32 z = band * BAND_ROWS; z < end; z++)
+				{
+					const int32 z0 = (z / spacing) * spacing;
+					const int32 z1 = glm::min(z0 + spacing, last_z);
+					const float tz = z1 > z0 ? static_cast<float>(z - z0) / static_cast<float>(z1 - z0) : 0.0f;
+
+					for (int32 x = 0; x < field.width_; x++)
+					{
+						const int32 x0 = (x / spacing) * spacing;
+						const int32 x1 = glm::min(x0 + spacing, last_x);
+						const float tx = x1 > x0 ? static_cast<float>(x - x0) / static_cast<float>(x1 - x0) : 0.0f;
+
+						const float top = glm::mix(field.at(x0, z0), field.at(x1, z0), tx);
+						const float bottom = glm::mix(field.at(x0, z1), field.at(x1, z1), tx);
+						error = glm::max(error, glm::abs(field.at(x, z) - glm::mix(top, bottom, tz)));
+					}
+				}
+
+				band_errors[band] = error;
+			});
+
+			float error = 0.0f;
+			for (const float band_error : band_errors)
+			{
+				error = glm::max(error, band_error);
+			}
+
+			return error;
+		}
+
+		// note: node bounds from the samples up and the height error of every level
+		void fit_levels(cdlod &lod, const heightfield &field, worker_pool *pool)
+		{
+			const int32 quads_x = lod.width_ - 1;
+			const int32 quads_z = lod.height_ - 1;
+
+			// note: bounds of the finest nodes come from the samples, the rest from their children
+			{
+				cdlod::level &finest = lod.levels_[0];
+				parallel_for(pool, finest.nodes_z_, [&](const int32 z)
+				{
+					const int32 z0 = z * cdlod::GRID_SIZE;
+					const int32 z1 = glm::min(z0 + cdlod::GRID_SIZE, quads_z);
+					for (int32 x = 0; x < finest.nodes_x_; x++)
+					{
+						const int32 x0 = x * cdlod::GRID_SIZE;
+						const int32 x1 = glm::min(x0 + cdlod::GRID_SIZE, quads_x);
+
+						cdlod::node &current = finest.nodes_[z * finest.nodes_x_ + x];
+						current.min_height_ = field.at(x0, z0);
+						current.max_height_ = current.min_height_;
+						for (int32 sz = z0; sz <= z1; sz++)
+						{
+							for (int32 sx = x0; sx <= x1; sx++)
+							{
+								current.min_height_ = glm::min(current.min_height_, field.at(sx, sz));
+								current.max_height_ = glm::max(current.max_height_, field.at(sx, sz));
+							}
+						}
+					}
+				});
+			}
+
+			for (int32 index = 1; index < lod.level_count_; index++)
+			{
+				cdlod::level &current = lod.levels_[index];
+				const cdlod::level &below = lod.levels_[index - 1];
+				for (int32 z = 0; z < current.nodes_z_; z++)
+				{
+					for (int32 x = 0; x < current.nodes_x_; x++)
+					{
+						cdlod::node &parent = current.nodes_[z * current.nodes_x_ + x];
+						parent = below.nodes_[(z * 2) * below.nodes_x_ + x * 2];
+						for (int32 quadrant = 1; quadrant < 4; quadrant++)
+						{
+							const int32 cx = x * 2 + (quadrant & 1);
+							const int32 cz = z * 2 + (quadrant >> 1);
+							if (cx < below.nodes_x_ && cz < below.nodes_z_)
+							{
+								const cdlod::node &child = below.nodes_[cz * below.nodes_x_ + cx];
+								parent.min_height_ = glm::min(parent.min_height_, child.min_height_);
+								parent.max_height_ = glm::max(parent.max_height_, child.max_height_);
+							}
+						}
+					}
+				}
+
+				current.error_ = level_error(field, 1 << index, pool);
+			}
+		}
+
+		bool sphere_intersects_box(const glm::vec3 &center, const float radius, const glm::vec3 &min, const glm::vec3 &max)
+		{
+			const glm::vec3 closest = glm::clamp(center, min, max);
+			const glm::vec3 delta = closest - center;
+			return glm::dot(delta, delta) <= radius * radius;
+		}
+
+		// note: returns false when the node is beyond the range of its level, the parent then
+		//       draws the area itself. plane_mask holds the frustum planes the parent crosses,
+		//       a node inside all of them is in view without a test. a drawn node joins the
+		//       horizon as a whole, the terrain of its finer quadrants is no lower either
+		bool select_node(cdlod &lod, const glm::vec3 &eye, const frustum &frustum,
+						 const occlusion_buffer *occlusion, horizon_buffer *horizon,
+						 const int32 level, const int32 x, const int32 z, uint32 plane_mask)
+		{
+			cdlod::level &current = lod.levels_[level];
+			cdlod::node &node = current.nodes_[z * current.nodes_x_ + x];
+
+			const int32 size = cdlod::GRID_SIZE << level;
+			const glm::vec3 min(static_cast<float>(x * size),
+								node.min_height_,
+								static_cast<float>(z * size));
+			const glm::vec3 max(static_cast<float>(glm::min((x + 1) * size, lod.width_ - 1)),
+								node.max_height_,
+								static_cast<float>(glm::min((z + 1) * size, lod.height_ - 1)));
+
+			if (!sphere_intersects_box(eye, current.range_, min, max))
+			{
+				return false;
+			}
+
+			// note: out of view is handled, nothing below needs drawing
+			if (plane_mask != 0 && !frustum.is_inside(min, max, plane_mask, node.rejected_plane_))
+			{
+				return true;
+			}
+
+			if (horizon != nullptr && horizon->is_hidden(min, max))
+			{
+				return true;
+			}
+
+			if (occlusion != nullptr && !occlusion->is_visible(min, max))
+			{
+				return true;
+			}
+
+			cdlod::selection selection;
+			selection.level_ = level;
+			selection.x_ = x;
+			selection.z_ = z;
+			selection.quadrants_ = 0xf;
+
+			if (level == 0 || !sphere_intersects_box(eye, lod.levels_[level - 1].range_, min, max))
+			{
+				lod.selected_.push_back(selection);
+				if (horizon != nullptr)
+				{
+					horizon->add(min, max);
+				}
+				return true;
+			}
+
+			// note: children out of their range are drawn as quadrants of this node,
+			//       children past the edge of the map have nothing to draw. the quadrant
+			//       on the side of the eye goes first, the one across from it last
+			const cdlod::level &below = lod.levels_[level - 1];
+			const float half = static_cast<float>(size / 2);
+			const int32 nearest = (eye.x >= min.x + half ? 1 : 0) | (eye.z >= min.z + half ? 2 : 0);
+			selection.quadrants_ = 0;
+			for (int32 order = 0; order < 4; order++)
+			{
+				const int32 quadrant = order ^ nearest;
+				const int32 cx = x * 2 + (quadrant & 1);
+				const int32 cz = z * 2 + (quadrant >> 1);
+				if (cx >= below.nodes_x_ || cz >= below.nodes_z_)
+				{
+					continue;
+				}
+
+				if (!select_node(lod, eye, frustum, occlusion, horizon, level - 1, cx, cz, plane_mask))
+				{
+					selection.quadrants_ |= 1 << quadrant;
+				}
+			}
+
+			if (selection.quadrants_ != 0)
+			{
+				lod.selected_.push_back(selection);
+				if (horizon != nullptr)
+				{
+					horizon->add(min, max);
+				}
+			}
+
+			return true;
+		}
+	}
+
+	cdlod::level::level()
+		: nodes_x_(0)
+		, nodes_z_(0)
+		, error_(0.0f)
+		, range_(0.0f)
+		, morph_start_(0.0f)
+	{
+	}
+
+	cdlod::cdlod()
+		: pixel_error_(2.0f)
+		, width_(0)
+		, height_(0)
+		, level_count_(0)
+		, quadrant_index_count_(0)
+	{
+	}
+
+	bool cdlod::is_valid() const
+	{
+		return level_count_ > 0 && buffer_.is_valid() && index_buffer_.is_valid() && heights_.is_valid();
+	}
+
+	bool cdlod::create(const heightfield &field, worker_pool *pool)
+	{
+		if (field.width_ < 2 || field.height_ < 2)
+		{
+			assert(!"heightmap dimensions not correct!");
+			return false;
+		}
+
+		width_ = field.width_;
+		height_ = field.height_;
+
+		const int32 quads_x = width_ - 1;
+		const int32 quads_z = height_ - 1;
+
+		// note: levels double the node size until a single node covers the map
+		level_count_ = 0;
+		for (int32 index = 0; index < LEVEL_LIMIT; index++)
+		{
+			const int32 size = GRID_SIZE << index;
+
+			level &current = levels_[index];
+			current.nodes_x_ = (quads_x + size - 1) / size;
+			current.nodes_z_ = (quads_z + size - 1) / size;
+			current.nodes_.resize(current.nodes_x_ * current.nodes_z_);
+			level_count_ = index + 1;
+
+			if (current.nodes_x_ == 1 && current.nodes_z_ == 1)
+			{
+				break;
+			}
+		}
+
+		fit_levels(*this, field, pool);
+
+		// note: one grid shared by every node, indices are laid out quadrant by quadrant
+		//       so any run of neighbouring quadrants is a single range
+		{
+			const int32 pitch = GRID_SIZE + 1;
+			const int32 half = GRID_SIZE / 2;
+
+			dynamic_array<glm::vec2> vertices(pitch * pitch);
+			for (int32 z = 0; z < pitch; z++)
+			{
+				for (int32 x = 0; x < pitch; x++)
+				{
+					vertices[z * pitch + x] = glm::vec2(static_cast<float>(x), static_cast<float>(z));
+				}
+			}
+
+			quadrant_index_count_ = half * half * 6;
+
+			dynamic_array<uint16> indices;
+			indices.reserve(quadrant_index_count_ * 4);
+			for (int32 quadrant = 0; quadrant < 4; quadrant++)
+			{
+				const int32 qx = (quadrant & 1) * half;
+				const int32 qz = (quadrant >> 1) * half;
+				for (int32 z = qz; z < qz + half; z++)
+				{
+					for (int32 x = qx; x < qx + half; x++)
+					{
+						const uint16 base = static_cast<uint16>(z * pitch + x);
+
+						indices.push_back(base);
+						indices.push_back(static_cast<uint16>(base + pitch));
+						indices.push_back(static_cast<uint16>(base + pitch + 1));
+
+						indices.push_back(static_cast<uint16>(base + pitch + 1));
+						indices.push_back(static_cast<uint16>(base + 1));
+						indices.push_back(base);
+					}
+				}
+			}
+
+			// note: each quadrant is ordered for the vertex cache on its own so the ranges stay
+			//       whole, then the grid vertices are renumbered in the order they are first used
+			for (int32 quadrant = 0; quadrant < 4; quadrant++)
+			{
+				optimize_vertex_cache(indices.data() + quadrant * quadrant_index_count_, quadrant_index_count_);
+			}
+
+			dynamic_array<uint32> remap;
+			optimize_vertex_fetch(indices.data(), static_cast<int32>(indices.size()), static_cast<int32>(vertices.size()), remap);
+			remap_vertices(vertices.data(), static_cast<int32>(vertices.size()), static_cast<int32>(sizeof(glm::vec2)), remap);
+
+			if (!buffer_.create(BUFFER_ACCESS_MODE_STATIC,
+								static_cast<int32>(vertices.size() * sizeof(glm::vec2)),
+								vertices.data()))
+			{
+				return false;
+			}
+
+			if (!index_buffer_.create(static_cast<int32>(indices.size() * sizeof(uint16)), indices.data()))
+			{
+				return false;
+			}
+
+			layout_.add_attribute(0, vertex_layout::ATTRIBUTE_FORMAT_FLOAT, 2, false);
+		}
+
+		// note: vertices read their heights from a float texture
+		if (!heights_.create(TEXTURE_FORMAT_R32F, width_, height_, field.heights_.data()))
+		{
+			return false;
+		}
+
+		// note: one open sample stands in for the occlusion until it is baked
+		const float open = 0.0f;
+		if (!occlusion_.create(TEXTURE_FORMAT_R32F, 1, 1, &open))
+		{
+			return false;
+		}
+
+		if (!sampler_.create(SAMPLER_FILTER_MODE_LINEAR,
+							 SAMPLER_ADDRESS_MODE_CLAMP,
+							 SAMPLER_ADDRESS_MODE_CLAMP))
+		{
+			return false;
+		}
+
+		return is_valid();
+	}
+
+	bool cdlod::set_heights(const heightfield &field, worker_pool *pool)
+	{
+		if (!is_valid() || field.width_ != width_ || field.height_ != height_)
+		{
+			assert(!"heights do not match the terrain!");
+			return false;
+		}
+
+		fit_levels(*this, field, pool);
+		heights_.update(TEXTURE_FORMAT_R32F, width_, height_, field.heights_.data());
+
+		return true;
+	}
+
+	void cdlod::destroy()
+	{
+		if (buffer_.is_valid())
+		{
+			buffer_.destroy();
+		}
+		if (index_buffer_.is_valid())
+		{
+			index_buffer_.destroy();
+		}
+		if (heights_.is_valid())
+		{
+			heights_.destroy();
+		}
+		if (occlusion_.is_valid())
+		{
+			occlusion_.destroy();
+		}
+		if (sampler_.is_valid())
+		{
+			sampler_.destroy();
+		}
+
+		for (int32 index = 0; index < level_count_; index++)
+		{
+			levels_[index] = level();
+		}
+
+		level_count_ = 0;
+		selected_.clear();
+		roots_.clear();
+	}
+
+	bool cdlod::set_occlusion(const dynamic_array<float> &occlusion)
+	{
+		if (!is_valid() || static_cast<int32>(occlusion.size()) != width_ * height_)
+		{
+			assert(!"occlusion does not match the terrain!");
+			return false;
+		}
+
+		if (occlusion_.is_valid())
+		{
+			occlusion_.destroy();
+		}
+
+		return occlusion_.create(TEXTURE_FORMAT_R32F, width_, height_, occlusion.data());
+	}
+
+	void cdlod::select(const camera &camera,
+					   const frustum &frustum,
+					   const float viewport_height,
+					   const occlusion_buffer *occlusion,
+					   horizon_buffer *horizon)
+	{
+		selected_.clear();
+		if (level_count_ == 0)
+		{
+			return;
+		}
+
+		// note: an error of e world units at distance d covers e * scale / d pixels, so a level
+		//       ends where the error of the next level drops to pixel_error_. ranges at least
+		//       double per level, which keeps neighbouring nodes within one level of each other
+		const float scale = viewport_height * 0.5f * camera.projection_[1][1];
+		float previous = 0.0f;
+		for (int32 index = 0; index < level_count_; index++)
+		{
+			float range = std::numeric_limits<float>::max();
+			if (index + 1 < level_count_)
+			{
+				const float minimum = index == 0 ? GRID_SIZE * 2.0f : previous * 2.0f;
+				range = glm::max(levels_[index + 1].error_ * scale / pixel_error_, minimum);
+			}
+
+			levels_[index].range_ = range;
+			levels_[index].morph_start_ = previous + (range - previous) * MORPH_START;
+			previous = range;
+		}
+
+		if (horizon != nullptr)
+		{
+			const float half_width = horizon_buffer::half_width(camera.projection_, camera.pitch_);
+			if (!horizon->begin(camera.position_, -camera.z_axis_, half_width))
+			{
+				horizon = nullptr;
+			}
+		}
+
+		const int32 top = level_count_ - 1;
+		const level &roots = levels_[top];
+		const float size = static_cast<float>(GRID_SIZE << top);
+		const glm::vec2 eye(camera.position_.x, camera.position_.z);
+		auto distance = [&](const int32 index)
+		{
+			const glm::vec2 min(static_cast<float>(index % roots.nodes_x_) * size, static_cast<float>(index / roots.nodes_x_) * size);
+			const glm::vec2 delta = glm::clamp(eye, min, min + size) - eye;
+			return glm::dot(delta, delta);
+		};
+
+		roots_.resize(roots.nodes_x_ * roots.nodes_z_);
+		for (int32 index = 0; index < static_cast<int32>(roots_.size()); index++)
+		{
+			roots_[index] = index;
+		}
+
+		std::sort(roots_.begin(), roots_.end(), [&](const int32 lhs, const int32 rhs)
+		{
+			return distance(lhs) < distance(rhs);
+		});
+
+		for (const int32 index : roots_)
+		{
+			select_node(*this, camera.position_, frustum, occlusion, horizon,
+						top, index % roots.nodes_x_, index / roots.nodes_x_, frustum::ALL_PLANES);
+		}
+	}
+
+	void cdlod::draw(renderer &rend, shader_program &program)
+	{
+		const int32 unit = 0;
+		const int32 occlusion_unit = 1;
+		const glm::vec2 map_size(static_cast<float>(width_ - 1), static_cast<float>(height_ - 1));
+
+		rend.set_shader_uniform(program, UNIFORM_TYPE_SAMPLER, "u_heights", 1, &unit);
+		rend.set_shader_uniform(program, UNIFORM_TYPE_SAMPLER, "u_occlusion", 1, &occlusion_unit);
+		rend.set_shader_uniform(program, UNIFORM_TYPE_VEC2, "u_map_size", 1, glm::value_ptr(map_size));
+		rend.set_vertex_buffer(buffer_);
+		rend.set_vertex_layout(layout_);
+		rend.set_index_buffer(index_buffer_);
+		rend.set_texture(heights_, unit);
+		rend.set_sampler_state(sampler_, unit);
+		rend.set_texture(occlusion_, occlusion_unit);
+		rend.set_sampler_state(sampler_, occlusion_unit);
+
+		for (const selection &selected : selected_)
+		{
+			const level &current = levels_[selected.level_];
+			const float spacing = static_cast<float>(1 << selected.level_);
+			const float size = GRID_SIZE * spacing;
+			const glm::vec3 placement(static_cast<float>(selected.x_) * size, static_cast<float>(selected.z_) * size, spacing);
+
+			const float length = current.range_ - current.morph_start_;
+			const glm::vec2 morph(current.range_ / length, 1.0f / length);
+
+			rend.set_shader_uniform(program, UNIFORM_TYPE_VEC3, "u_node", 1, glm::value_ptr(placement));
+			rend.set_shader_uniform(program, UNIFORM_TYPE_VEC2, "u_morph", 1, glm::value_ptr(morph));
+
+			// note: runs of neighbouring quadrants go in one draw
+			for (int32 quadrant = 0; quadrant < 4;)
+			{
+				if ((selected.quadrants_ & (1 << quadrant)) == 0)
+				{
+					quadrant++;
+					continue;
+				}
+
+				const int32 first = quadrant;
+				while (quadrant < 4 && (selected.quadrants_ & (1 << quadrant)) != 0)
+				{
+					quadrant++;
+				}
+
+				rend.draw_indexed(PRIMITIVE_TOPOLOGY_TRIANGLE_LIST,
+								  INDEX_TYPE_UNSIGNED_SHORT,
+								  first * quadrant_index_count_,
+								  (quadrant - first) * quadrant_index_count_);
+			}
+		}
+	}
+} // !avocado
@@ -0,0 +1,548 @@
+// culling.cc
+
+#include "culling.hpp"
+
+#include <algorithm>
+
+#include <emmintrin.h>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+namespace avocado {
+	namespace
+	{
+		constexpr int32 PLANE_COUNT = int32(frustum::side::count);
+
+		// note: plane components split out for broadcasting, absolute normals give the
+		//       reach of a box's half extents towards a plane
+		struct frustum_planes {
+			float x_[PLANE_COUNT];
+			float y_[PLANE_COUNT];
+			float z_[PLANE_COUNT];
+			float w_[PLANE_COUNT];
+			float abs_x_[PLANE_COUNT];
+			float abs_y_[PLANE_COUNT];
+			float abs_z_[PLANE_COUNT];
+		};
+
+		frustum_planes split_planes(const frustum &view)
+		{
+			frustum_planes result;
+			for (int32 index = 0; index < PLANE_COUNT; index++)
+			{
+				const glm::vec4 &plane = view.planes_[index];
+				result.x_[index] = plane.x;
+				result.y_[index] = plane.y;
+				result.z_[index] = plane.z;
+				result.w_[index] = plane.w;
+				result.abs_x_[index] = glm::abs(plane.x);
+				result.abs_y_[index] = glm::abs(plane.y);
+				result.abs_z_[index] = glm::abs(plane.z);
+			}
+			return result;
+		}
+
+		// note: the vector loops follow these tests operation for operation, so the scalar
+		//       tail agrees with them on every bound
+		bool box_outside(const frustum_planes &planes, const box_bounds &bounds, const int32 index)
+		{
+			const float cx = bounds.center_x_[index];
+			const float cy = bounds.center_y_[index];
+			const float cz = bounds.center_z_[index];
+			const float ex = bounds.extent_x_[index];
+			const float ey = bounds.extent_y_[index];
+			const float ez = bounds.extent_z_[index];
+			for (int32 plane = 0; plane < PLANE_COUNT; plane++)
+			{
+				const float distance = ((cx * planes.x_[plane] + cy * planes.y_[plane]) + cz * planes.z_[plane]) + planes.w_[plane];
+				const float reach = (ex * planes.abs_x_[plane] + ey * planes.abs_y_[plane]) + ez * planes.abs_z_[plane];
+				if (distance + reach < 0.0f)
+				{
+					return true;
+				}
+			}
+			return false;
+		}
+
+		bool sphere_outside(const frustum_planes &planes, const sphere_bounds &bounds, const int32 index)
+		{
+			const float cx = bounds.center_x_[index];
+			const float cy = bounds.center_y_[index];
+			const float cz = bounds.center_z_[index];
+			const float radius = bounds.radius_[index];
+			for (int32 plane = 0; plane < PLANE_COUNT; plane++)
+			{
+				const float distance = ((cx * planes.x_[plane] + cy * planes.y_[plane]) + cz * planes.z_[plane]) + planes.w_[plane];
+				if (distance + radius < 0.0f)
+				{
+					return true;
+				}
+			}
+			return false;
+		}
+
+		void box_corners(const box_bounds &bounds, const int32 index, glm::vec3 &min_corner, glm::vec3 &max_corner)
+		{
+			const glm::vec3 center(bounds.center_x_[index], bounds.center_y_[index], bounds.center_z_[index]);
+			const glm::vec3 extent(bounds.extent_x_[index], bounds.extent_y_[index], bounds.extent_z_[index]);
+			min_corner = center - extent;
+			max_corner = center + extent;
+		}
+
+		// note: deep enough for a balanced tree over any int32 count of bounds
+		constexpr int32 TREE_STACK_SIZE = 64;
+
+		int32 build_node(bounds_tree &tree, const box_bounds &bounds, const int32 first, const int32 count)
+		{
+			const int32 index = static_cast<int32>(tree.nodes_.size());
+			tree.nodes_.push_back(bounds_tree::node());
+
+			glm::vec3 min_corner(0.0f);
+			glm::vec3 max_corner(0.0f);
+			glm::vec3 min_center(0.0f);
+			glm::vec3 max_center(0.0f);
+			for (int32 offset = 0; offset < count; offset++)
+			{
+				const int32 item = tree.items_[first + offset];
+				const glm::vec3 center(bounds.center_x_[item], bounds.center_y_[item], bounds.center_z_[item]);
+				glm::vec3 lower;
+				glm::vec3 upper;
+				box_corners(bounds, item, lower, upper);
+
+				min_corner = offset == 0 ? lower : glm::min(min_corner, lower);
+				max_corner = offset == 0 ? upper : glm::max(max_corner, upper);
+				min_center = offset == 0 ? center : glm::min(min_center, center);
+				max_center = offset == 0 ? center : glm::max(max_center, center);
+			}
+
+			bounds_tree::node current;
+			current.min_corner_ = min_corner;
+			current.max_corner_ = max_corner;
+			current.first_ = first;
+			current.count_ = count;
+			current.right_ = 0;
+			tree.nodes_[index] = current;
+			if (count <= bounds_tree::LEAF_SIZE)
+			{
+				return index;
+			}
+
+			const glm::vec3 spread = max_center - min_center;
+			const float *centers = bounds.center_x_.data();
+			if (spread.y > spread.x && spread.y >= spread.z)
+			{
+				centers = bounds.center_y_.data();
+			}
+			else if (spread.z > spread.x && spread.z > spread.y)
+			{
+				centers = bounds.center_z_.data();
+			}
+
+			// note: median split, the tree stays balanced however the bounds are spread
+			const int32 half = count / 2;
+			int32 *items = tree.items_.data() + first;
+			std::nth_element(items, items + half, items + count, [centers](const int32 lhs, const int32 rhs)
+			{
+				return centers[lhs] < centers[rhs];
+			});
+
+			build_node(tree, bounds, first, half);
+			const int32 right = build_node(tree, bounds, first + half, count - half);
+			tree.nodes_[index].right_ = right;
+
+			return index;
+		}
+
+		// note: branch free compaction, every lane writes its index and only visible lanes
+		//       move the end forward. writes stay below first + lanes, inside the output
+		int32 append_visible(int32 *dst, int32 count, const int32 first, const int32 lanes, const int32 visible_mask)
+		{
+			for (int32 lane = 0; lane < lanes; lane++)
+			{
+				dst[count] = first + lane;
+				count += (visible_mask >> lane) & 1;
+			}
+			return count;
+		}
+
+		// note: result[i] is box items[i] of bounds
+		void gather_boxes(const box_bounds &bounds, const dynamic_array<int32> &items, box_bounds &result)
+		{
+			const int32 count = static_cast<int32>(items.size());
+			result.center_x_.resize(count);
+			result.center_y_.resize(count);
+			result.center_z_.resize(count);
+			result.extent_x_.resize(count);
+			result.extent_y_.resize(count);
+			result.extent_z_.resize(count);
+			for (int32 index = 0; index < count; index++)
+			{
+				const int32 item = items[index];
+				result.center_x_[index] = bounds.center_x_[item];
+				result.center_y_[index] = bounds.center_y_[item];
+				result.center_z_[index] = bounds.center_z_[item];
+				result.extent_x_[index] = bounds.extent_x_[item];
+				result.extent_y_[index] = bounds.extent_y_[item];
+				result.extent_z_[index] = bounds.extent_z_[item];
+			}
+		}
+
+		// note: the boxes [first, end) against every plane, visible indices are appended at
+		//       dst + result. returns the new count
+		int32 cull_box_range(const frustum_planes &planes, const box_bounds &bounds, const int32 first, const int32 end, int32 *dst, int32 result)
+		{
+			int32 index = first;
+
+#if defined(__AVX2__)
+			for (; index + 8 <= end; index += 8)
+			{
+				const __m256 cx = _mm256_loadu_ps(bounds.center_x_.data() + index);
+				const __m256 cy = _mm256_loadu_ps(bounds.center_y_.data() + index);
+				const __m256 cz = _mm256_loadu_ps(bounds.center_z_.data() + index);
+				const __m256 ex = _mm256_loadu_ps(bounds.extent_x_.data() + index);
+				const __m256 ey = _mm256_loadu_ps(bounds.extent_y_.data() + index);
+				const __m256 ez = _mm256_loadu_ps(bounds.extent_z_.data() + index);
+
+				__m256 outside = _mm256_setzero_ps();
+				for (int32 plane = 0; plane < PLANE_COUNT; plane++)
+				{
+					const __m256 distance = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(cx, _mm256_set1_ps(planes.x_[plane])),
+																					  _mm256_mul_ps(cy, _mm256_set1_ps(planes.y_[plane]))),
+																		_mm256_mul_ps(cz, _mm256_set1_ps(planes.z_[plane]))),
+														  _mm256_set1_ps(planes.w_[plane]));
+					const __m256 reach = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ex, _mm256_set1_ps(planes.abs_x_[plane])),
+																	 _mm256_mul_ps(ey, _mm256_set1_ps(planes.abs_y_[plane]))),
+													   _mm256_mul_ps(ez, _mm256_set1_ps(planes.abs_z_[plane])));
+					outside = _mm256_or_ps(outside, _mm256_cmp_ps(_mm256_add_ps(distance, reach), _mm256_setzero_ps(), _CMP_LT_OQ));
+				}
+
+				result = append_visible(dst, result, index, 8, ~_mm256_movemask_ps(outside) & 0xff);
+			}
+#endif
+
+			for (; index + 4 <= end; index += 4)
+			{
+				const __m128 cx = _mm_loadu_ps(bounds.center_x_.data() + index);
+				const __m128 cy = _mm_loadu_ps(bounds.center_y_.data() + index);
+				const __m128 cz = _mm_loadu_ps(bounds.center_z_.data() + index);
+				const __m128 ex = _mm_loadu_ps(bounds.extent_x_.data() + index);
+				const __m128 ey = _mm_loadu_ps(bounds.extent_y_.data() + index);
+				const __m128 ez = _mm_loadu_ps(bounds.extent_z_.data() + index);
+
+				__m128 outside = _mm_setzero_ps();
+				for (int32 plane = 0; plane < PLANE_COUNT; plane++)
+				{
+					const __m128 distance = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(cx, _mm_set1_ps(planes.x_[plane])),
+																			 _mm_mul_ps(cy, _mm_set1_ps(planes.y_[plane]))),
+																  _mm_mul_ps(cz, _mm_set1_ps(planes.z_[plane]))),
+													   _mm_set1_ps(planes.w_[plane]));
+					const __m128 reach = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ex, _mm_set1_ps(planes.abs_x_[plane])),
+															   _mm_mul_ps(ey, _mm_set1_ps(planes.abs_y_[plane]))),
+													_mm_mul_ps(ez, _mm_set1_ps(planes.abs_z_[plane])));
+					outside = _mm_or_ps(outside, _mm_cmplt_ps(_mm_add_ps(distance, reach), _mm_setzero_ps()));
+				}
+
+				result = append_visible(dst, result, index, 4, ~_mm_movemask_ps(outside) & 0xf);
+			}
+
+			for (; index < end; index++)
+			{
+				dst[result] = index;
+				result += box_outside(planes, bounds, index) ? 0 : 1;
+			}
+
+			return result;
+		}
+	} // !anon
+
+	void box_bounds::clear()
+	{
+		center_x_.clear();
+		center_y_.clear();
+		center_z_.clear();
+		extent_x_.clear();
+		extent_y_.clear();
+		extent_z_.clear();
+	}
+
+	void box_bounds::reserve(const int32 count)
+	{
+		center_x_.reserve(count);
+		center_y_.reserve(count);
+		center_z_.reserve(count);
+		extent_x_.reserve(count);
+		extent_y_.reserve(count);
+		extent_z_.reserve(count);
+	}
+
+	void box_bounds::push_back(const glm::vec3 &min_corner, const glm::vec3 &max_corner)
+	{
+		center_x_.push_back(0.0f);
+		center_y_.push_back(0.0f);
+		center_z_.push_back(0.0f);
+		extent_x_.push_back(0.0f);
+		extent_y_.push_back(0.0f);
+		extent_z_.push_back(0.0f);
+		set(size() - 1, min_corner, max_corner);
+	}
+
+	void box_bounds::set(const int32 index, const glm::vec3 &min_corner, const glm::vec3 &max_corner)
+	{
+		const glm::vec3 center = (min_corner + max_corner) * 0.5f;
+		const glm::vec3 extent = (max_corner - min_corner) * 0.5f;
+		center_x_[index] = center.x;
+		center_y_[index] = center.y;
+		center_z_[index] = center.z;
+		extent_x_[index] = extent.x;
+		extent_y_[index] = extent.y;
+		extent_z_[index] = extent.z;
+	}
+
+	int32 box_bounds::size() const
+	{
+		return static_cast<int32>(center_x_.size());
+	}
+
+	void sphere_bounds::clear()
+	{
+		center_x_.clear();
+		center_y_.clear();
+		center_z_.clear();
+		radius_.clear();
+	}
+
+	void sphere_bounds::reserve(const int32 count)
+	{
+		center_x_.reserve(count);
+		center_y_.reserve(count);
+		center_z_.reserve(count);
+		radius_.reserve(count);
+	}
+
+	void sphere_bounds::push_back(const glm::vec3 &center, const float radius)
+	{
+		center_x_.push_back(center.x);
+		center_y_.push_back(center.y);
+		center_z_.push_back(center.z);
+		radius_.push_back(radius);
+	}
+
+	void sphere_bounds::set(const int32 index, const glm::vec3 &center, const float radius)
+	{
+		center_x_[index] = center.x;
+		center_y_[index] = center.y;
+		center_z_[index] = center.z;
+		radius_[index] = radius;
+	}
+
+	int32 sphere_bounds::size() const
+	{
+		return static_cast<int32>(center_x_.size());
+	}
+
+	int32 cull_boxes(const frustum &view, const box_bounds &bounds, dynamic_array<int32> &visible)
+	{
+		const int32 count = bounds.size();
+		visible.resize(count);
+		if (count == 0)
+		{
+			return 0;
+		}
+
+		const int32 result = cull_box_range(split_planes(view), bounds, 0, count, visible.data(), 0);
+
+		visible.resize(result);
+		return result;
+	}
+
+	int32 cull_spheres(const frustum &view, const sphere_bounds &bounds, dynamic_array<int32> &visible)
+	{
+		const int32 count = bounds.size();
+		visible.resize(count);
+		if (count == 0)
+		{
+			return 0;
+		}
+
+		const frustum_planes planes = split_planes(view);
+		int32 *dst = visible.data();
+		int32 result = 0;
+		int32 index = 0;
+
+#if defined(__AVX2__)
+		for (; index + 8 <= count; index += 8)
+		{
+			const __m256 cx = _mm256_loadu_ps(bounds.center_x_.data() + index);
+			const __m256 cy = _mm256_loadu_ps(bounds.center_y_.data() + index);
+			const __m256 cz = _mm256_loadu_ps(bounds.center_z_.data() + index);
+			const __m256 radius = _mm256_loadu_ps(bounds.radius_.data() + index);
+
+			__m256 outside = _mm256_setzero_ps();
+			for (int32 plane = 0; plane < PLANE_COUNT; plane++)
+			{
+				const __m256 distance = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(cx, _mm256_set1_ps(planes.x_[plane])),
+																				  _mm256_mul_ps(cy, _mm256_set1_ps(planes.y_[plane]))),
+																	_mm256_mul_ps(cz, _mm256_set1_ps(planes.z_[plane]))),
+													  _mm256_set1_ps(planes.w_[plane]));
+				outside = _mm256_or_ps(outside, _mm256_cmp_ps(_mm256_add_ps(distance, radius), _mm256_setzero_ps(), _CMP_LT_OQ));
+			}
+
+			result = append_visible(dst, result, index, 8, ~_mm256_movemask_ps(outside) & 0xff);
+		}
+#endif
+
+		for (; index + 4 <= count; index += 4)
+		{
+			const __m128 cx = _mm_loadu_ps(bounds.center_x_.data() + index);
+			const __m128 cy = _mm_loadu_ps(bounds.center_y_.data() + index);
+			const __m128 cz = _mm_loadu_ps(bounds.center_z_.data() + index);
+			const __m128 radius = _mm_loadu_ps(bounds.radius_.data() + index);
+
+			__m128 outside = _mm_setzero_ps();
+			for (int32 plane = 0; plane < PLANE_COUNT; plane++)
+			{
+				const __m128 distance = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(cx, _mm_set1_ps(planes.x_[plane])),
+																		 _mm_mul_ps(cy, _mm_set1_ps(planes.y_[plane]))),
+															  _mm_mul_ps(cz, _mm_set1_ps(planes.z_[plane]))),
+												   _mm_set1_ps(planes.w_[plane]));
+				outside = _mm_or_ps(outside, _mm_cmplt_ps(_mm_add_ps(distance, radius), _mm_setzero_ps()));
+			}
+
+			result = append_visible(dst, result, index, 4, ~_mm_movemask_ps(outside) & 0xf);
+		}
+
+		for (; index < count; index++)
+		{
+			dst[result] = index;
+			result += sphere_outside(planes, bounds, index) ? 0 : 1;
+		}
+
+		visible.resize(result);
+		return result;
+	}
+
+	void bounds_tree::build(const box_bounds &bounds)
+	{
+		const int32 count = bounds.size();
+		nodes_.clear();
+		items_.resize(count);
+		for (int32 index = 0; index < count; index++)
+		{
+			items_[index] = index;
+		}
+
+		if (count > 0)
+		{
+			nodes_.reserve(static_cast<size_t>(count / LEAF_SIZE) * 2 + 1);
+			build_node(*this, bounds, 0, count);
+		}
+
+		gather_boxes(bounds, items_, ordered_);
+		node_rejected_planes_.assign(nodes_.size(), 0);
+	}
+
+	void bounds_tree::refit(const box_bounds &bounds)
+	{
+		if (bounds.size() != static_cast<int32>(items_.size()))
+		{
+			assert(!"bounds do not match the tree!");
+			return;
+		}
+
+		gather_boxes(bounds, items_, ordered_);
+
+		// note: children come after their parent, walking backwards finishes them first
+		for (int32 index = static_cast<int32>(nodes_.size()) - 1; index >= 0; index--)
+		{
+			node &current = nodes_[index];
+			if (current.right_ != 0)
+			{
+				const node &left = nodes_[index + 1];
+				const node &right = nodes_[current.right_];
+				current.min_corner_ = glm::min(left.min_corner_, right.min_corner_);
+				current.max_corner_ = glm::max(left.max_corner_, right.max_corner_);
+				continue;
+			}
+
+			for (int32 offset = 0; offset < current.count_; offset++)
+			{
+				glm::vec3 lower;
+				glm::vec3 upper;
+				box_corners(ordered_, current.first_ + offset, lower, upper);
+				current.min_corner_ = offset == 0 ? lower : glm::min(current.min_corner_, lower);
+				current.max_corner_ = offset == 0 ? upper : glm::max(current.max_corner_, upper);
+			}
+		}
+	}
+
+	int32 bounds_tree::cull(const frustum &view, const box_bounds &bounds, dynamic_array<int32> &visible)
+	{
+		visible.clear();
+		if (bounds.size() != static_cast<int32>(items_.size()))
+		{
+			assert(!"bounds do not match the tree!");
+			return 0;
+		}
+
+		if (nodes_.empty())
+		{
+			return 0;
+		}
+
+		visible.resize(items_.size());
+
+		const frustum_planes planes = split_planes(view);
+
+		struct entry {
+			int32 node_;
+			uint32 plane_mask_;
+		};
+
+		entry stack[TREE_STACK_SIZE];
+		int32 depth = 0;
+		stack[depth++] = entry{ 0, frustum::ALL_PLANES };
+
+		int32 *dst = visible.data();
+		int32 result = 0;
+		while (depth > 0)
+		{
+			const entry current = stack[--depth];
+			const node &tested = nodes_[current.node_];
+
+			uint32 plane_mask = current.plane_mask_;
+			if (plane_mask != 0 && !view.is_inside(tested.min_corner_, tested.max_corner_, plane_mask, node_rejected_planes_[current.node_]))
+			{
+				continue;
+			}
+
+			// note: inside every plane, the whole range is visible
+			if (plane_mask == 0)
+			{
+				std::copy(items_.begin() + tested.first_, items_.begin() + tested.first_ + tested.count_, dst + result);
+				result += tested.count_;
+				continue;
+			}
+
+			// note: the leaf boxes sit next to each other in ordered_, the kernel gives their
+			//       positions there and items_ turns them back into bounds indices
+			if (tested.right_ == 0)
+			{
+				const int32 first = result;
+				result = cull_box_range(planes, ordered_, tested.first_, tested.first_ + tested.count_, dst, result);
+				for (int32 index = first; index < result; index++)
+				{
+					dst[index] = items_[dst[index]];
+				}
+				continue;
+			}
+
+			assert(depth + 2 <= TREE_STACK_SIZE);
+			stack[depth++] = entry{ tested.right_, plane_mask };
+			stack[depth++] = entry{ current.node_ + 1, plane_mask };
+		}
+
+		visible.resize(result);
+		return result;
+	}
+} // !avocado
@@ -0,0 +1,483 @@
+// height_pyramid.cc
+
+#include "height_pyramid.hpp"
+
+#include <avocado_thread.hpp>
+
+#include <emmintrin.h>
+
+namespace avocado {
+	namespace
+	{
+		// note: packets of four rays per job when a worker pool is given
+		const int32 PACKETS_PER_JOB = 16;
+
+		// note: deep enough for the children of every level on the way down
+		const int32 STACK_LIMIT = 128;
+
+		struct packet {
+			__m128 ox;
+			__m128 oy;
+			__m128 oz;
+			__m128 dx;
+			__m128 dy;
+			__m128 dz;
+			__m128 ix;
+			__m128 iy;
+			__m128 iz;
+			__m128 best;		// nearest hit so far, starts at the max distance
+			__m128i quad;		// quad of the nearest hit, -1 when nothing was hit
+			__m128i triangle;
+			int32 active;		// lanes carrying a ray
+		};
+
+		struct node_ref {
+			int32 level;
+			int32 x;
+			int32 z;
+		};
+
+		inline float inverse(const float d)
+		{
+			// note: keeps the slab math finite for rays parallel to an axis
+			const float limit = 1e-12f;
+			return 1.0f / (glm::abs(d) > limit ? d : (d < 0.0f ? -limit : limit));
+		}
+
+		inline __m128 select(const __m128 mask, const __m128 a, const __m128 b)
+		{
+			return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+		}
+
+		inline __m128i select(const __m128i mask, const __m128i a, const __m128i b)
+		{
+			return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+		}
+
+		inline float sample(const terrain_query &terrain, const int32 x, const int32 z)
+		{
+			const uint16 value = terrain.heights_[static_cast<size_t>(z) * terrain.width_ + x];
+			return terrain.height_offset_ + static_cast<float>(value) * (terrain.height_scale_ / 65535.0f);
+		}
+
+		// note: the two triangles of a quad, wound like the heightmap index buffer
+		void quad_triangle(const terrain_query &terrain, const int32 x, const int32 z, const int32 triangle, glm::vec3 (&v)[3])
+		{
+			const glm::vec3 p00(static_cast<float>(x), sample(terrain, x, z), static_cast<float>(z));
+			const glm::vec3 p10(static_cast<float>(x + 1), sample(terrain, x + 1, z), static_cast<float>(z));
+			const glm::vec3 p01(static_cast<float>(x), sample(terrain, x, z + 1), static_cast<float>(z + 1));
+			const glm::vec3 p11(static_cast<float>(x + 1), sample(terrain, x + 1, z + 1), static_cast<float>(z + 1));
+
+			if (triangle == 0)
+			{
+				v[0] = p00;
+				v[1] = p01;
+				v[2] = p11;
+			}
+			else
+			{
+				v[0] = p11;
+				v[1] = p10;
+				v[2] = p00;
+			}
+		}
+
+		// note: moller-trumbore for the four rays of the packet at once
+		void intersect_triangle(packet &p, const glm::vec3 (&v)[3], const __m128 lanes, const int32 quad, const int32 triangle)
+		{
+			const glm::vec3 e1 = v[1] - v[0];
+			const glm::vec3 e2 = v[2] - v[0];
+			const __m128 e1x = _mm_set1_ps(e1.x);
+			const __m128 e1y = _mm_set1_ps(e1.y);
+			const __m128 e1z = _mm_set1_ps(e1.z);
+			const __m128 e2x = _mm_set1_ps(e2.x);
+			const __m128 e2y = _mm_set1_ps(e2.y);
+			const __m128 e2z = _mm_set1_ps(e2.z);
+
+			const __m128 px = _mm_sub_ps(_mm_mul_ps(p.dy, e2z), _mm_mul_ps(p.dz, e2y));
+			const __m128 py = _mm_sub_ps(_mm_mul_ps(p.dz, e2x), _mm_mul_ps(p.dx, e2z));
+			const __m128 pz = _mm_sub_ps(_mm_mul_ps(p.dx, e2y), _mm_mul_ps(p.dy, e2x));
+			const __m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)), _mm_mul_ps(e1z, pz));
+			const __m128 inv = _mm_div_ps(_mm_set1_ps(1.0f), det);
+
+			const __m128 sx = _mm_sub_ps(p.ox, _mm_set1_ps(v[0].x));
+			const __m128 sy = _mm_sub_ps(p.oy, _mm_set1_ps(v[0].y));
+			const __m128 sz = _mm_sub_ps(p.oz, _mm_set1_ps(v[0].z));
+			const __m128 u = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(sx, px), _mm_mul_ps(sy, py)), _mm_mul_ps(sz, pz)), inv);
+
+			const __m128 qx = _mm_sub_ps(_mm_mul_ps(sy, e1z), _mm_mul_ps(sz, e1y));
+			const __m128 qy = _mm_sub_ps(_mm_mul_ps(sz, e1x), _mm_mul_ps(sx, e1z));
+			const __m128 qz = _mm_sub_ps(_mm_mul_ps(sx, e1y), _mm_mul_ps(sy, e1x));
+			const __m128 w = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(p.dx, qx), _mm_mul_ps(p.dy, qy)), _mm_mul_ps(p.dz, qz)), inv);
+			const __m128 t = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)), inv);
+
+			// note: comparisons against nan fail, which also rejects rays parallel to the triangle
+			const __m128 zero = _mm_setzero_ps();
+			const __m128 one = _mm_set1_ps(1.0f);
+			__m128 hit = _mm_and_ps(lanes, _mm_cmpneq_ps(det, zero));
+			hit = _mm_and_ps(hit, _mm_cmpge_ps(u, zero));
+			hit = _mm_and_ps(hit, _mm_cmpge_ps(w, zero));
+			hit = _mm_and_ps(hit, _mm_cmple_ps(_mm_add_ps(u, w), one));
+			hit = _mm_and_ps(hit, _mm_cmpge_ps(t, zero));
+			hit = _mm_and_ps(hit, _mm_cmplt_ps(t, p.best));
+
+			const __m128i mask = _mm_castps_si128(hit);
+			p.best = select(hit, t, p.best);
+			p.quad = select(mask, _mm_set1_epi32(quad), p.quad);
+			p.triangle = select(mask, _mm_set1_epi32(triangle), p.triangle);
+		}
+
+		void trace(const height_pyramid &pyramid, packet &p)
+		{
+			const terrain_query &terrain = *pyramid.terrain_;
+			const int32 quads_x = terrain.width_ - 1;
+			const int32 quads_z = terrain.height_ - 1;
+			const __m128 zero = _mm_setzero_ps();
+
+			// note: children are visited front to back along the first ray, the others in the
+			//       packet still get correct results since every lane keeps its own nearest hit
+			alignas(16) float direction_x[4];
+			alignas(16) float direction_z[4];
+			_mm_store_ps(direction_x, p.dx);
+			_mm_store_ps(direction_z, p.dz);
+			int32 lead = 0;
+			while ((p.active & (1 << lead)) == 0)
+			{
+				lead++;
+			}
+			const int32 flip_x = direction_x[lead] < 0.0f ? 1 : 0;
+			const int32 flip_z = direction_z[lead] < 0.0f ? 1 : 0;
+
+			node_ref stack[STACK_LIMIT];
+			int32 count = 0;
+			stack[count++] = { static_cast<int32>(pyramid.levels_.size()) - 1, 0, 0 };
+
+			while (count > 0)
+			{
+				const node_ref node = stack[--count];
+				const height_pyramid::level &current = pyramid.levels_[node.level];
+				const glm::vec2 bounds = current.bounds_[node.z * current.width_ + node.x];
+
+				const int32 size = height_pyramid::LEAF_SIZE << node.level;
+				const int32 x0 = node.x * size;
+				const int32 z0 = node.z * size;
+				const int32 x1 = glm::min(x0 + size, quads_x);
+				const int32 z1 = glm::min(z0 + size, quads_z);
+
+				// note: slab test of the node box against every ray
+				const __m128 ax = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(static_cast<float>(x0)), p.ox), p.ix);
+				const __m128 bx = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(static_cast<float>(x1)), p.ox), p.ix);
+				const __m128 ay = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(bounds.x), p.oy), p.iy);
+				const __m128 by = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(bounds.y), p.oy), p.iy);
+				const __m128 az = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(static_cast<float>(z0)), p.oz), p.iz);
+				const __m128 bz = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(static_cast<float>(z1)), p.oz), p.iz);
+
+				const __m128 enter = _mm_max_ps(_mm_max_ps(_mm_min_ps(ax, bx), _mm_min_ps(ay, by)), _mm_max_ps(_mm_min_ps(az, bz), zero));
+				const __m128 leave = _mm_min_ps(_mm_min_ps(_mm_max_ps(ax, bx), _mm_max_ps(ay, by)), _mm_min_ps(_mm_max_ps(az, bz), p.best));
+
+				const int32 lanes = _mm_movemask_ps(_mm_cmple_ps(enter, leave)) & p.active;
+				if (lanes == 0)
+				{
+					continue;
+				}
+
+				if (node.level == 0)
+				{
+					const __m128 mask = _mm_castsi128_ps(_mm_set_epi32((lanes & 8) ? -1 : 0,
+																	   (lanes & 4) ? -1 : 0,
+																	   (lanes & 2) ? -1 : 0,
+																	   (lanes & 1) ? -1 : 0));
+					glm::vec3 v[3];
+					for (int32 z = z0; z < z1; z++)
+					{
+						for (int32 x = x0; x < x1; x++)
+						{
+							const int32 quad = z * quads_x + x;
+							quad_triangle(terrain, x, z, 0, v);
+							intersect_triangle(p, v, mask, quad, 0);
+							quad_triangle(terrain, x, z, 1, v);
+							intersect_triangle(p, v, mask, quad, 1);
+						}
+					}
+					continue;
+				}
+
+				// note: pushed far to near so the nearest child is popped first
+				const height_pyramid::level &below = pyramid.levels_[node.level - 1];
+				for (int32 order = 3; order >= 0; order--)
+				{
+					const int32 cx = node.x * 2 + ((order & 1) ^ flip_x);
+					const int32 cz = node.z * 2 + ((order >> 1) ^ flip_z);
+					if (cx < below.width_ && cz < below.height_)
+					{
+						assert(count < STACK_LIMIT);
+						stack[count++] = { node.level - 1, cx, cz };
+					}
+				}
+			}
+		}
+
+		// note: leaf bounds come from the samples of each block, edges included
+		glm::vec2 leaf_bounds(const terrain_query &terrain, const int32 x, const int32 z)
+		{
+			const int32 x0 = x * height_pyramid::LEAF_SIZE;
+			const int32 z0 = z * height_pyramid::LEAF_SIZE;
+			const int32 x1 = glm::min(x0 + height_pyramid::LEAF_SIZE, terrain.width_ - 1);
+			const int32 z1 = glm::min(z0 + height_pyramid::LEAF_SIZE, terrain.height_ - 1);
+
+			glm::vec2 bounds(sample(terrain, x0, z0));
+			for (int32 sz = z0; sz <= z1; sz++)
+			{
+				for (int32 sx = x0; sx <= x1; sx++)
+				{
+					const float height = sample(terrain, sx, sz);
+					bounds.x = glm::min(bounds.x, height);
+					bounds.y = glm::max(bounds.y, height);
+				}
+			}
+
+			return bounds;
+		}
+
+		glm::vec2 merged_bounds(const height_pyramid::level &below, const int32 x, const int32 z)
+		{
+			glm::vec2 bounds = below.bounds_[(z * 2) * below.width_ + x * 2];
+			for (int32 quadrant = 1; quadrant < 4; quadrant++)
+			{
+				const int32 cx = x * 2 + (quadrant & 1);
+				const int32 cz = z * 2 + (quadrant >> 1);
+				if (cx < below.width_ && cz < below.height_)
+				{
+					const glm::vec2 child = below.bounds_[cz * below.width_ + cx];
+					bounds.x = glm::min(bounds.x, child.x);
+					bounds.y = glm::max(bounds.y, child.y);
+				}
+			}
+
+			return bounds;
+		}
+
+		void load_packet(packet &p, const terrain_ray *rays, const int32 count)
+		{
+			alignas(16) float values[9][4];
+			alignas(16) float best[4];
+			p.active = 0;
+			for (int32 lane = 0; lane < 4; lane++)
+			{
+				// note: missing lanes repeat the first ray and stay inactive
+				const terrain_ray &ray = rays[lane < count ? lane : 0];
+				values[0][lane] = ray.origin_.x;
+				values[1][lane] = ray.origin_.y;
+				values[2][lane] = ray.origin_.z;
+				values[3][lane] = ray.direction_.x;
+				values[4][lane] = ray.direction_.y;
+				values[5][lane] = ray.direction_.z;
+				values[6][lane] = inverse(ray.direction_.x);
+				values[7][lane] = inverse(ray.direction_.y);
+				values[8][lane] = inverse(ray.direction_.z);
+				best[lane] = ray.max_distance_;
+				if (lane < count)
+				{
+					p.active |= 1 << lane;
+				}
+			}
+
+			p.ox = _mm_load_ps(values[0]);
+			p.oy = _mm_load_ps(values[1]);
+			p.oz = _mm_load_ps(values[2]);
+			p.dx = _mm_load_ps(values[3]);
+			p.dy = _mm_load_ps(values[4]);
+			p.dz = _mm_load_ps(values[5]);
+			p.ix = _mm_load_ps(values[6]);
+			p.iy = _mm_load_ps(values[7]);
+			p.iz = _mm_load_ps(values[8]);
+			p.best = _mm_load_ps(best);
+			p.quad = _mm_set1_epi32(-1);
+			p.triangle = _mm_setzero_si128();
+		}
+
+		void store_packet(const height_pyramid &pyramid, const packet &p, const terrain_ray *rays, terrain_hit *hits, const int32 count)
+		{
+			const terrain_query &terrain = *pyramid.terrain_;
+			const int32 quads_x = terrain.width_ - 1;
+
+			alignas(16) float best[4];
+			alignas(16) int32 quad[4];
+			alignas(16) int32 triangle[4];
+			_mm_store_ps(best, p.best);
+			_mm_store_si128(reinterpret_cast<__m128i *>(quad), p.quad);
+			_mm_store_si128(reinterpret_cast<__m128i *>(triangle), p.triangle);
+
+			for (int32 lane = 0; lane < count; lane++)
+			{
+				terrain_hit &hit = hits[lane];
+				hit.hit_ = quad[lane] >= 0;
+				if (!hit.hit_)
+				{
+					hit.distance_ = rays[lane].max_distance_;
+					hit.position_ = rays[lane].origin_ + rays[lane].direction_ * hit.distance_;
+					hit.normal_ = glm::vec3(0.0f, 1.0f, 0.0f);
+					continue;
+				}
+
+				glm::vec3 v[3];
+				quad_triangle(terrain, quad[lane] % quads_x, quad[lane] / quads_x, triangle[lane], v);
+				const glm::vec3 normal = glm::normalize(glm::cross(v[1] - v[0], v[2] - v[0]));
+
+				hit.distance_ = best[lane];
+				hit.position_ = rays[lane].origin_ + rays[lane].direction_ * hit.distance_;
+				hit.normal_ = normal.y < 0.0f ? -normal : normal;
+			}
+		}
+	}
+
+	height_pyramid::height_pyramid()
+		: terrain_(nullptr)
+	{
+	}
+
+	bool height_pyramid::is_valid() const
+	{
+		return terrain_ != nullptr && !levels_.empty();
+	}
+
+	bool height_pyramid::create(const terrain_query &terrain, worker_pool *pool)
+	{
+		if (!terrain.is_valid())
+		{
+			assert(!"terrain query not created!");
+			return false;
+		}
+
+		terrain_ = &terrain;
+		levels_.clear();
+
+		const int32 quads_x = terrain.width_ - 1;
+		const int32 quads_z = terrain.height_ - 1;
+
+		{
+			level leaves;
+			leaves.width_ = (quads_x + LEAF_SIZE - 1) / LEAF_SIZE;
+			leaves.height_ = (quads_z + LEAF_SIZE - 1) / LEAF_SIZE;
+			leaves.bounds_.resize(leaves.width_ * leaves.height_);
+
+			parallel_for(pool, leaves.height_, [&](const int32 z)
+			{
+				for (int32 x = 0; x < leaves.width_; x++)
+				{
+					leaves.bounds_[z * leaves.width_ + x] = leaf_bounds(terrain, x, z);
+				}
+			});
+
+			levels_.push_back(std::move(leaves));
+		}
+
+		// note: each level above merges two by two nodes until one node covers the map
+		while (levels_.back().width_ > 1 || levels_.back().height_ > 1)
+		{
+			const level &below = levels_.back();
+
+			level above;
+			above.width_ = (below.width_ + 1) / 2;
+			above.height_ = (below.height_ + 1) / 2;
+			above.bounds_.resize(above.width_ * above.height_);
+
+			for (int32 z = 0; z < above.height_; z++)
+			{
+				for (int32 x = 0; x < above.width_; x++)
+				{
+					above.bounds_[z * above.width_ + x] = merged_bounds(below, x, z);
+				}
+			}
+
+			levels_.push_back(std::move(above));
+		}
+
+		return is_valid();
+	}
+
+	void height_pyramid::update(const int32 x0, const int32 z0, const int32 x1, const int32 z1)
+	{
+		assert(is_valid());
+
+		if (x0 >= x1 || z0 >= z1)
+		{
+			return;
+		}
+
+		// note: a sample on a block edge belongs to the blocks on both sides of it
+		const level &leaves = levels_.front();
+		int32 left = glm::max((x0 - 1) / LEAF_SIZE, 0);
+		int32 top = glm::max((z0 - 1) / LEAF_SIZE, 0);
+		int32 right = glm::min((x1 - 1) / LEAF_SIZE, leaves.width_ - 1);
+		int32 bottom = glm::min((z1 - 1) / LEAF_SIZE, leaves.height_ - 1);
+		if (left > right || top > bottom)
+		{
+			return;
+		}
+
+		for (int32 z = top; z <= bottom; z++)
+		{
+			for (int32 x = left; x <= right; x++)
+			{
+				levels_[0].bounds_[z * leaves.width_ + x] = leaf_bounds(*terrain_, x, z);
+			}
+		}
+
+		for (size_t index = 1; index < levels_.size(); index++)
+		{
+			left /= 2;
+			top /= 2;
+			right /= 2;
+			bottom /= 2;
+
+			level &above = levels_[index];
+			for (int32 z = top; z <= bottom; z++)
+			{
+				for (int32 x = left; x <= right; x++)
+				{
+					above.bounds_[z * above.width_ + x] = merged_bounds(levels_[index - 1], x, z);
+				}
+			}
+		}
+	}
+
+	void height_pyramid::destroy()
+	{
+		terrain_ = nullptr;
+		dynamic_array<level>().swap(levels_);
+	}
+
+	bool height_pyramid::raycast(const terrain_ray &ray, terrain_hit &hit) const
+	{
+		assert(is_valid());
+
+		packet p;
+		load_packet(p, &ray, 1);
+		trace(*this, p);
+		store_packet(*this, p, &ray, &hit, 1);
+
+		return hit.hit_;
+	}
+
+	void height_pyramid::raycast(const int32 count, const terrain_ray *rays, terrain_hit *hits, worker_pool *pool) const
+	{
+		assert(is_valid());
+
+		const int32 packet_count = (count + 3) / 4;
+		parallel_for(pool, (packet_count + PACKETS_PER_JOB - 1) / PACKETS_PER_JOB, [&](const int32 job)
+		{
+			const int32 end = glm::min((job + 1) * PACKETS_PER_JOB, packet_count);
+			for (int32 index = job * PACKETS_PER_JOB; index < end; index++)
+			{
+				const int32 first = index * 4;
+				const int32 lanes = glm::min(4, count - first);
+
+				packet p;
+				load_packet(p, rays + first, lanes);
+				trace(*this, p);
+				store_packet(*this, p, rays + first, hits + first, lanes);
+			}
+		});
+	}
+} // !avocado
@@ -0,0 +1,330 @@
+// heightfield.cc
+
+#include "heightfield.hpp"
+
+#include <emmintrin.h>
+
+namespace avocado {
+	namespace
+	{
+		inline void store_heights(float *result, const __m128 values, const __m128 factor, const __m128 offset)
+		{
+			_mm_storeu_ps(result, _mm_add_ps(offset, _mm_mul_ps(values, factor)));
+		}
+
+		// note: r << 16 | g << 8 | b of four pixels whose bytes start each lane
+		inline __m128i compose_packed(const __m128i pixels)
+		{
+			const __m128i byte = _mm_set1_epi32(0xff);
+			const __m128i r = _mm_and_si128(pixels, byte);
+			const __m128i g = _mm_and_si128(_mm_srli_epi32(pixels, 8), byte);
+			const __m128i b = _mm_and_si128(_mm_srli_epi32(pixels, 16), byte);
+			return _mm_or_si128(_mm_or_si128(_mm_slli_epi32(r, 16), _mm_slli_epi32(g, 8)), b);
+		}
+
+		// note: first channel of 16 bit samples, four or eight heights per step
+		void convert_channel16(const uint16 *source, const int32 components, const size_t count, const float factor, const float offset, float *result)
+		{
+			const __m128 vfactor = _mm_set1_ps(factor);
+			const __m128 voffset = _mm_set1_ps(offset);
+			const __m128i zero = _mm_setzero_si128();
+			const __m128i low = _mm_set1_epi32(0xffff);
+
+			size_t index = 0;
+			if (components == 1)
+			{
+				for (; index + 8 <= count; index += 8)
+				{
+					const __m128i samples = _mm_loadu_si128(reinterpret_cast<const __m128i *>(source + index));
+					store_heights(result + index, _mm_cvtepi32_ps(_mm_unpacklo_epi16(samples, zero)), vfactor, voffset);
+					store_heights(result + index + 4, _mm_cvtepi32_ps(_mm_unpackhi_epi16(samples, zero)), vfactor, voffset);
+				}
+			}
+			else if (components == 2)
+			{
+				for (; index + 4 <= count; index += 4)
+				{
+					const __m128i samples = _mm_loadu_si128(reinterpret_cast<const __m128i *>(source + index * 2));
+					store_heights(result + index, _mm_cvtepi32_ps(_mm_and_si128(samples, low)), vfactor, voffset);
+				}
+			}
+			else if (components == 4)
+			{
+				for (; index + 4 <= count; index += 4)
+				{
+					const __m128i first = _mm_and_si128(_mm_loadu_si128(reinterpret_cast<const __m128i *>(source + index * 4)), low);
+					const __m128i second = _mm_and_si128(_mm_loadu_si128(reinterpret_cast<const __m128i *>(source + index * 4 + 8)), low);
+					const __m128i samples = _mm_unpacklo_epi64(_mm_shuffle_epi32(first, _MM_SHUFFLE(3, 1, 2, 0)),
+															   _mm_shuffle_epi32(second, _MM_SHUFFLE(3, 1, 2, 0)));
+					store_heights(result + index, _mm_cvtepi32_ps(samples), vfactor, voffset);
+				}
+			}
+
+			for (; index < count; index++)
+			{
+				result[index] = offset + static_cast<float>(source[index * components]) * factor;
+			}
+		}
+
+		// note: the 24 high bits are exact in a float, the alpha byte of rgba is a fraction
+		//       below them. rgba heights are put together and scaled in double and rounded
+		//       to float once, a float sum would drop the alpha byte of every height above
+		//       65536 before the scale is applied
+		void convert_packed(const uint8 *source, const int32 components, const size_t count, const float factor, const float offset, float *result)
+		{
+			const __m128 vfactor = _mm_set1_ps(factor);
+			const __m128 voffset = _mm_set1_ps(offset);
+			const __m128d dfactor = _mm_set1_pd(factor);
+			const __m128d doffset = _mm_set1_pd(offset);
+			const __m128d fraction = _mm_set1_pd(1.0 / 256.0);
+
+			size_t index = 0;
+			if (components == 4)
+			{
+				for (; index + 4 <= count; index += 4)
+				{
+					const __m128i pixels = _mm_loadu_si128(reinterpret_cast<const __m128i *>(source + index * 4));
+					const __m128i high = compose_packed(pixels);
+					const __m128i low = _mm_srli_epi32(pixels, 24);
+
+					// note: two heights per double vector, the upper pair moved down first
+					const __m128d first = _mm_add_pd(_mm_cvtepi32_pd(high), _mm_mul_pd(_mm_cvtepi32_pd(low), fraction));
+					const __m128d second = _mm_add_pd(_mm_cvtepi32_pd(_mm_srli_si128(high, 8)),
+													  _mm_mul_pd(_mm_cvtepi32_pd(_mm_srli_si128(low, 8)), fraction));
+					const __m128 lower = _mm_cvtpd_ps(_mm_add_pd(doffset, _mm_mul_pd(first, dfactor)));
+					const __m128 upper = _mm_cvtpd_ps(_mm_add_pd(doffset, _mm_mul_pd(second, dfactor)));
+					_mm_storeu_ps(result + index, _mm_movelh_ps(lower, upper));
+				}
+			}
+			else
+			{
+				// note: sixteen bytes are read for four pixels, so the last pixels are left to the scalar loop
+				for (; (index + 4) * 3 + 4 <= count * 3; index += 4)
+				{
+					const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(source + index * 3));
+					const __m128i pixels = _mm_unpacklo_epi64(_mm_unpacklo_epi32(bytes, _mm_srli_si128(bytes, 3)),
+															  _mm_unpacklo_epi32(_mm_srli_si128(bytes, 6), _mm_srli_si128(bytes, 9)));
+					store_heights(result + index, _mm_cvtepi32_ps(compose_packed(pixels)), vfactor, voffset);
+				}
+			}
+
+			for (; index < count; index++)
+			{
+				const uint8 *pixel = source + index * components;
+				const int32 high = (pixel[0] << 16) | (pixel[1] << 8) | pixel[2];
+				if (components == 4)
+				{
+					const double value = static_cast<double>(high) + static_cast<double>(pixel[3]) * (1.0 / 256.0);
+					result[index] = static_cast<float>(static_cast<double>(offset) + value * static_cast<double>(factor));
+				}
+				else
+				{
+					result[index] = offset + static_cast<float>(high) * factor;
+				}
+			}
+		}
+
+		void convert_float(const float *source, const size_t count, const float scale, const float offset, float *result)
+		{
+			const __m128 vscale = _mm_set1_ps(scale);
+			const __m128 voffset = _mm_set1_ps(offset);
+
+			size_t index = 0;
+			for (; index + 4 <= count; index += 4)
+			{
+				store_heights(result + index, _mm_loadu_ps(source + index), vscale, voffset);
+			}
+
+			for (; index < count; index++)
+			{
+				result[index] = offset + source[index] * scale;
+			}
+		}
+	}
+
+	void convert_heights(const void *source, const heightfield::encoding format, const int32 components, const size_t count, const float scale, const float offset, float *result)
+	{
+		switch (format)
+		{
+			case heightfield::encoding::grayscale:
+			case heightfield::encoding::raw_r16:
+				convert_channel16(static_cast<const uint16 *>(source), components, count, scale / 65535.0f, offset, result);
+				break;
+			case heightfield::encoding::packed_rgb:
+			case heightfield::encoding::packed_rgba:
+				convert_packed(static_cast<const uint8 *>(source), components, count,
+							   scale / (format == heightfield::encoding::packed_rgba ? 16777216.0f : 16777215.0f), offset, result);
+				break;
+			case heightfield::encoding::raw_r32f:
+				convert_float(static_cast<const float *>(source), count, scale, offset, result);
+				break;
+		}
+	}
+
+	heightfield::heightfield()
+		: width_(0)
+		, height_(0)
+	{
+	}
+
+	bool heightfield::is_valid() const
+	{
+		return width_ > 0 && height_ > 0;
+	}
+
+	bool heightfield::create(const int32 width, const int32 height)
+	{
+		assert(width > 0 && height > 0);
+
+		width_ = width;
+		height_ = height;
+		heights_.assign(static_cast<size_t>(width) * height, 0.0f);
+
+		return is_valid();
+	}
+
+	bool heightfield::create(const bitmap &image)
+	{
+		if (!image.is_valid())
+		{
+			return false;
+		}
+
+		if (!create(image.width(), image.height()))
+		{
+			return false;
+		}
+
+		for (int32 z = 0; z < height_; z++)
+		{
+			for (int32 x = 0; x < width_; x++)
+			{
+				// 0xAABBGGRR, only the red channel carries height
+				const int32 pixel = static_cast<int32>(image.get_pixel(x, z) & 0xff);
+				heights_[static_cast<size_t>(z) * width_ + x] = static_cast<float>((255 - pixel) / 10);
+			}
+		}
+
+		return true;
+	}
+
+	bool heightfield::create(const char *filename)
+	{
+		bitmap image;
+		if (!image.create(filename))
+		{
+			return false;
+		}
+
+		const bool result = create(image);
+
+		// note: release image memory
+		image.destroy();
+
+		return result;
+	}
+
+	bool heightfield::create(const char *filename, const encoding format, const float scale, const float offset)
+	{
+		if (format == encoding::grayscale)
+		{
+			bitmap16 image;
+			if (!image.create(filename))
+			{
+				return false;
+			}
+
+			const bool result = create(image.width(), image.height());
+			if (result)
+			{
+				convert_heights(image.data(), format, image.components(), heights_.size(), scale, offset, heights_.data());
+			}
+
+			// note: release image memory
+			image.destroy();
+
+			return result;
+		}
+
+		if (format == encoding::packed_rgb || format == encoding::packed_rgba)
+		{
+			bitmap image;
+			if (!image.create(filename))
+			{
+				return false;
+			}
+
+			const int32 components = format == encoding::packed_rgba ? 4 : 3;
+			if (image.bytes_per_pixel() != components)
+			{
+				assert(!"image channels do not match the height encoding!");
+				image.destroy();
+				return false;
+			}
+
+			const bool result = create(image.width(), image.height());
+			if (result)
+			{
+				convert_heights(image.data(), format, components, heights_.size(), scale, offset, heights_.data());
+			}
+
+			// note: release image memory
+			image.destroy();
+
+			return result;
+		}
+
+		assert(!"raw height files need the grid size!");
+		return false;
+	}
+
+	bool heightfield::create(const char *filename, const encoding format, const int32 width, const int32 height, const float scale, const float offset)
+	{
+		if (format != encoding::raw_r16 && format != encoding::raw_r32f)
+		{
+			return create(filename, format, scale, offset);
+		}
+
+		dynamic_array<uint8> content;
+		if (!file_system::read_file_content(filename, content))
+		{
+			return false;
+		}
+
+		const size_t sample_size = format == encoding::raw_r16 ? sizeof(uint16) : sizeof(float);
+		if (width <= 0 || height <= 0 || content.size() != static_cast<size_t>(width) * height * sample_size)
+		{
+			assert(!"raw height file does not match the grid size!");
+			return false;
+		}
+
+		if (!create(width, height))
+		{
+			return false;
+		}
+
+		convert_heights(content.data(), format, 1, heights_.size(), scale, offset, heights_.data());
+
+		return true;
+	}
+
+	void heightfield::destroy()
+	{
+		width_ = 0;
+		height_ = 0;
+		dynamic_array<float>().swap(heights_);
+	}
+
+	float heightfield::at(const int32 x, const int32 z) const
+	{
+		const int32 cx = x < 0 ? 0 : (x >= width_ ? width_ - 1 : x);
+		const int32 cz = z < 0 ? 0 : (z >= height_ ? height_ - 1 : z);
+		return heights_[static_cast<size_t>(cz) * width_ + cx];
+	}
+
+	void heightfield::set(const int32 x, const int32 z, const float value)
+	{
+		assert(x >= 0 && x < width_ && z >= 0 && z < height_);
+		heights_[static_cast<size_t>(z) * width_ + x] = value;
+	}
+} // !avocado
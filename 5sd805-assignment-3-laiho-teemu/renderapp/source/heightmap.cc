@@ -6,134 +6,545 @@
 #pragma warning(pop)
 
 #include "heightmap.hpp"
+#include "normals.hpp"
+
+#include <avocado_thread.hpp>
+
+#include <algorithm>
 
 namespace avocado {
-	heightmap::heightmap()
-		: image_width(0)
-		, image_height(0)	
-		, vertex_count(0)
-		, index_count(0)
+	namespace
 	{
-	}
+		// note: chunks needed to cover a run of quads, the last one may be partial
+		int32 chunk_count(const int32 quads, const int32 chunk_size)
+		{
+			return (quads + chunk_size - 1) / chunk_size;
+		}
 
-	bool heightmap::create(dynamic_array<vertex>& vertices, dynamic_array<uint32>& indices)
-	{
-		//dynamic_array<vertex> vertices;
-		//dynamic_array<uint32> indices;
+		glm::vec3 grid_position(const heightfield &field, const int32 x, const int32 z)
+		{
+			return glm::vec3(static_cast<float>(x), field.at(x, z), static_cast<float>(z));
+		}
 
-		// note: load heightmap image and create heightmap
+		void set_vertex(vertex &v, const heightfield &field, const int32 x, const int32 z)
 		{
+			v.position_ = grid_position(field, x, z);
+
+			v.color_.a = 1.0f;
+			v.color_.b = 0.0f;
+			v.color_.g = 0.0f;
+			v.color_.r = 1.0f;
+		}
+
+		bool load_default_heightfield(heightfield &field)
+		{
+			// note: load heightmap image and create heightmap
 			const char* filenames[] =
 			{
 				//"assets/heightmap/heightmap_m.png",
 				"assets/heightmap/TKInverted.png",
 			};
 
-			bitmap image;
-			if (!image.create(filenames[0]))
+			if (!field.create(filenames[0], heightfield::encoding::grayscale, heightmap::DEFAULT_HEIGHT_SCALE, heightmap::DEFAULT_HEIGHT_OFFSET))
 			{
 				assert(!"could not load heightmap image");
+				return false;
 			}
 
-			// note: verify image dimensions
+			return true;
+		}
+
+		// note: two triangles for the quad whose top-left vertex is base, pitch is the vertex row length
+		uint32 *write_quad(uint32 *dst, const uint32 base, const uint32 pitch)
+		{
+			// Triangle 1 values
+			dst[0] = base;
+			dst[1] = base + pitch;
+			dst[2] = base + pitch + 1;
+
+			// Triangle 2 values
+			dst[3] = base + pitch + 1;
+			dst[4] = base + 1;
+			dst[5] = base;
+
+			return dst + 6;
+		}
+
+		// note: indices for one row of chunks, chunks on the right and bottom edge are cut short
+		void write_chunk_row(uint32 *dst, const int32 y, const int32 width, const int32 height)
+		{
+			const int32 quads_x = width - 1;
+			const int32 first_row = y * heightmap::CHUNK_SIZE;
+			const int32 rows = glm::min(heightmap::CHUNK_SIZE, height - 1 - first_row);
+
+			// chunkification algorithm
+			for (int32 x = 0; x < chunk_count(quads_x, heightmap::CHUNK_SIZE); x++)
 			{
-				image_width = image.width();
-				image_height = image.height();
+				const int32 columns = glm::min(heightmap::CHUNK_SIZE, quads_x - x * heightmap::CHUNK_SIZE);
 
-				if (image_width != 256 || image_height != 256)
+				for (int32 base_y = 0; base_y < rows; base_y++)
 				{
-					assert("heightmap dimensions not correct!");
+					for (int32 base_x = 0; base_x < columns; base_x++)
+					{
+						// chunk row * offset + indices row *
+						const int32 base = (first_row + base_y) * width + heightmap::CHUNK_SIZE * x + base_x;
+						dst = write_quad(dst, base, width);
+					}
+				}
+			}
+		}
+
+		// note: records for one row of chunks in the order write_chunk_row emits them
+		void set_chunk_row(chunk *dst, const heightfield &field, const int32 y)
+		{
+			const int32 quads_x = field.width_ - 1;
+			const int32 first_row = y * heightmap::CHUNK_SIZE;
+			const int32 rows = glm::min(heightmap::CHUNK_SIZE, field.height_ - 1 - first_row);
+
+			for (int32 x = 0; x < chunk_count(quads_x, heightmap::CHUNK_SIZE); x++)
+			{
+				const int32 first_column = x * heightmap::CHUNK_SIZE;
+				const int32 columns = glm::min(heightmap::CHUNK_SIZE, quads_x - first_column);
+
+				float lowest = field.at(first_column, first_row);
+				float highest = lowest;
+				for (int32 z = first_row; z <= first_row + rows; z++)
+				{
+					for (int32 sx = first_column; sx <= first_column + columns; sx++)
+					{
+						lowest = glm::min(lowest, field.at(sx, z));
+						highest = glm::max(highest, field.at(sx, z));
+					}
 				}
 
-				// note: pointer to image data
-				const void* data = {};
-				data = image.data();
+				chunk &result = dst[x];
+				result.start_index_ = (first_row * quads_x + first_column * rows) * 6;
+				result.index_count_ = columns * rows * 6;
+				result.base_vertex_ = 0;
+				result.min_corner_ = glm::vec3(static_cast<float>(first_column), lowest, static_cast<float>(first_row));
+				result.max_corner_ = glm::vec3(static_cast<float>(first_column + columns), highest, static_cast<float>(first_row + rows));
+			}
+		}
+
+		template <typename T>
+		void gather_blocks(const heightmap::chunk_template &layout, const dynamic_array<T> &grid, dynamic_array<T> &result)
+		{
+			const int32 width = layout.grid_width_;
+			const int32 height = layout.grid_height_;
+			if (grid.size() != static_cast<size_t>(width) * height)
+			{
+				assert(!"vertices do not match the chunk template!");
+				return;
 			}
 
+			const int32 samples = layout.chunk_size_ + 1;
+			result.resize(static_cast<size_t>(layout.chunks_x_) * layout.chunks_z_ * layout.block_size());
+			T *dst = result.data();
+			for (int32 chunk_z = 0; chunk_z < layout.chunks_z_; chunk_z++)
+			{
+				for (int32 chunk_x = 0; chunk_x < layout.chunks_x_; chunk_x++)
+				{
+					for (int32 z = 0; z < samples; z++)
+					{
+						const int32 row = glm::min(chunk_z * layout.chunk_size_ + z, height - 1);
+						for (int32 x = 0; x < samples; x++)
+						{
+							const int32 column = glm::min(chunk_x * layout.chunk_size_ + x, width - 1);
+							*dst++ = grid[static_cast<size_t>(row) * width + column];
+						}
+					}
+				}
+			}
+		}
+	}
+
+	terrain_vertex encode_terrain_vertex(const float height, const glm::vec3 &normal, const float height_offset, const float quantize)
+	{
+		const float quantized = (height - height_offset) * quantize;
+		const glm::vec2 encoded = octahedral_encode(normal) * 32767.0f;
+
+		terrain_vertex result;
+		result.height_ = static_cast<uint16>(glm::clamp(quantized + 0.5f, 0.0f, 65535.0f));
+		result.occlusion_ = 0;
+		result.normal_[0] = static_cast<int16>(glm::round(encoded.x));
+		result.normal_[1] = static_cast<int16>(glm::round(encoded.y));
+		return result;
+	}
+
+	heightmap::tile::tile()
+		: x_(0)
+		, z_(0)
+		, width_(0)
+		, height_(0)
+	{
+	}
+
+	heightmap::chunk_template::chunk_template()
+		: chunk_size_(0)
+		, chunks_x_(0)
+		, chunks_z_(0)
+		, edge_start_(0)
+		, grid_width_(0)
+		, grid_height_(0)
+	{
+	}
+
+	int32 heightmap::chunk_template::block_size() const
+	{
+		return (chunk_size_ + 1) * (chunk_size_ + 1);
+	}
+
+	int32 heightmap::chunk_template::vertex_index(const int32 chunk_x, const int32 chunk_z, const int32 x, const int32 z) const
+	{
+		const int32 local_x = x - chunk_x * chunk_size_;
+		const int32 local_z = z - chunk_z * chunk_size_;
+		assert(local_x >= 0 && local_x <= chunk_size_ && local_z >= 0 && local_z <= chunk_size_);
+		return (chunk_z * chunks_x_ + chunk_x) * block_size() + local_z * (chunk_size_ + 1) + local_x;
+	}
+
+	void heightmap::chunk_template::ranges(dynamic_array<chunk> &result) const
+	{
+		result.clear();
+		for (const chunk &current : chunks_)
+		{
+			const bool known = std::any_of(result.begin(), result.end(), [&](const chunk &range)
+			{
+				return range.start_index_ == current.start_index_;
+			});
+			if (!known)
+			{
+				result.push_back(current);
+			}
+		}
+	}
+
+	void heightmap::chunk_template::gather(const dynamic_array<vertex> &grid, dynamic_array<vertex> &result) const
+	{
+		gather_blocks(*this, grid, result);
+	}
+
+	void heightmap::chunk_template::gather(const dynamic_array<terrain_vertex> &grid, dynamic_array<terrain_vertex> &result) const
+	{
+		gather_blocks(*this, grid, result);
+	}
+
+	heightmap::heightmap()
+		: image_width(0)
+		, image_height(0)
+		, vertex_count(0)
+		, index_count(0)
+		, height_offset(0.0f)
+		, height_scale(1.0f)
+	{
+	}
+
+	bool heightmap::create(dynamic_array<vertex>& vertices, dynamic_array<uint32>& indices, worker_pool *pool)
+	{
+		heightfield field;
+		if (!load_default_heightfield(field))
+		{
+			return false;
+		}
+
+		return create(field, vertices, indices, pool);
+	}
+
+	bool heightmap::create(dynamic_array<terrain_vertex> &vertices, dynamic_array<uint32> &indices, worker_pool *pool)
+	{
+		heightfield field;
+		if (!load_default_heightfield(field))
+		{
+			return false;
+		}
+
+		return create(field, vertices, indices, pool);
+	}
+
+	bool heightmap::create(const heightfield &field, dynamic_array<vertex> &vertices, dynamic_array<uint32> &indices, worker_pool *pool)
+	{
+		// note: any size works, but a mesh needs at least one quad
+		if (field.width_ < 2 || field.height_ < 2)
+		{
+			assert(!"heightmap dimensions not correct!");
+			return false;
+		}
+
+		image_width = field.width_;
+		image_height = field.height_;
+
+		const int32 quads_x = image_width - 1;
+		const int32 quads_z = image_height - 1;
+
+		vertex_count = image_width * image_height;
+		index_count = quads_x * quads_z * 6;
+
+		// note: output is sized up front, every band writes its own disjoint range
+		vertices.resize(vertex_count);
+		indices.resize(index_count);
+		chunks.resize(chunk_count(quads_x, CHUNK_SIZE) * chunk_count(quads_z, CHUNK_SIZE));
+
+		// note: one band per row of chunks, a band owns the vertex rows its chunks start on
+		//       (the last band also owns the final row) and a contiguous run of indices,
+		//       bands only meet at row boundaries so at most one cache line is shared
+		const int32 band_count = chunk_count(quads_z, CHUNK_SIZE);
+		parallel_for(pool, band_count, [&](const int32 y)
+		{
+			const int32 first_row = y * CHUNK_SIZE;
+			const int32 rows = glm::min(CHUNK_SIZE, quads_z - first_row);
+
 			// note: set vertex buffer
 			{
-				vertex_count = image_width * image_height;
-				vertices.resize(vertex_count);
+				const int32 last_row = (y == band_count - 1) ? image_height : first_row + rows;
 
 				// note:  Tommi Lipponen - 5SD805: Real-time Graphics Programming for Games 1 - 2020
-				for (int32 index = 0; index < vertex_count; index++) {
-					const int32 x = index % image_width;
-					const int32 z = index / image_width;
-					int32 pixel = image.get_pixel(x, z);
-
-					// 0xAABBGGRR
-					// 0xff = R
-					// 0xff00 = G
-					// 0xff0000 = B
-					// 0xff000000 = A
-					pixel = pixel & 0xff; // 0xff = 0x00 00 00 00 
-
-					//pixel = 0;
-
-					//const int32 y = index;
-					vertices[index].position_.x = static_cast<float>(x);
-					vertices[index].position_.y = static_cast<float>((255 - pixel) / 10);
-					vertices[index].position_.z = static_cast<float>(z);
-
-					//vertices[index].texcoord_ = glm::vec2(0.0f, 0.0f);
-					//vertices[index].normal_ = glm::vec3(0.0f, 0.0f, 1.0f);
-
-					vertices[index].color_.a = 1.0f;
-					vertices[index].color_.b = 0.0f;
-					vertices[index].color_.g = 0.0f;
-					vertices[index].color_.r = 1.0f;
+				for (int32 z = first_row; z < last_row; z++) {
+					vertex *row = vertices.data() + z * image_width;
+					for (int32 x = 0; x < image_width; x++) {
+						set_vertex(row[x], field, x, z);
+					}
 				}
+
+				// note: set vertex normals
+				compute_normals(field,
+								0,
+								first_row,
+								image_width,
+								last_row,
+								&vertices[first_row * image_width].normal_,
+								static_cast<int32>(sizeof(vertex)),
+								image_width * static_cast<int32>(sizeof(vertex)));
 			}
 
 			// note: set index buffer
+			write_chunk_row(indices.data() + static_cast<size_t>(first_row) * quads_x * 6, y, image_width, image_height);
+			set_chunk_row(chunks.data() + y * chunk_count(quads_x, CHUNK_SIZE), field, y);
+		});
+
+		return true;
+	}
+
+	bool heightmap::create(const heightfield &field, dynamic_array<terrain_vertex> &vertices, dynamic_array<uint32> &indices, worker_pool *pool)
+	{
+		if (field.width_ < 2 || field.height_ < 2)
+		{
+			assert(!"heightmap dimensions not correct!");
+			return false;
+		}
+
+		image_width = field.width_;
+		image_height = field.height_;
+
+		const int32 quads_x = image_width - 1;
+		const int32 quads_z = image_height - 1;
+
+		vertex_count = image_width * image_height;
+		index_count = quads_x * quads_z * 6;
+
+		// note: heights are quantized to 16 bits across the range of the whole map
+		{
+			float lowest = field.heights_[0];
+			float highest = field.heights_[0];
+			for (const float height : field.heights_)
+			{
+				lowest = glm::min(lowest, height);
+				highest = glm::max(highest, height);
+			}
+
+			height_offset = lowest;
+			height_scale = highest > lowest ? highest - lowest : 1.0f;
+		}
+
+		vertices.resize(vertex_count);
+		indices.resize(index_count);
+		chunks.resize(chunk_count(quads_x, CHUNK_SIZE) * chunk_count(quads_z, CHUNK_SIZE));
+
+		// note: same banding as the full vertex build
+		const int32 band_count = chunk_count(quads_z, CHUNK_SIZE);
+		parallel_for(pool, band_count, [&](const int32 y)
+		{
+			const int32 first_row = y * CHUNK_SIZE;
+			const int32 rows = glm::min(CHUNK_SIZE, quads_z - first_row);
+			const int32 last_row = (y == band_count - 1) ? image_height : first_row + rows;
+
+			// note: normals go through a row of scratch before being encoded
+			dynamic_array<glm::vec3> normals(image_width);
+			const float quantize = 65535.0f / height_scale;
+
+			for (int32 z = first_row; z < last_row; z++)
+			{
+				compute_normals(field, 0, z, image_width, z + 1, normals.data(), static_cast<int32>(sizeof(glm::vec3)), 0);
+
+				terrain_vertex *row = vertices.data() + z * image_width;
+				for (int32 x = 0; x < image_width; x++)
+				{
+					row[x] = encode_terrain_vertex(field.at(x, z), normals[x], height_offset, quantize);
+				}
+			}
+
+			write_chunk_row(indices.data() + static_cast<size_t>(first_row) * quads_x * 6, y, image_width, image_height);
+			set_chunk_row(chunks.data() + y * chunk_count(quads_x, CHUNK_SIZE), field, y);
+		});
+
+		return true;
+	}
+
+	bool heightmap::create_tiles(const heightfield &field, const int32 tile_size, tile_listener &listener)
+	{
+		if (field.width_ < 2 || field.height_ < 2 || tile_size < 1)
+		{
+			assert(!"heightmap dimensions not correct!");
+			return false;
+		}
+
+		image_width = field.width_;
+		image_height = field.height_;
+		vertex_count = 0;
+		index_count = 0;
+		chunks.clear();
+
+		const int32 quads_x = image_width - 1;
+		const int32 quads_z = image_height - 1;
+
+		// note: a single tile worth of storage is alive at any time
+		tile block;
+		block.vertices_.reserve((tile_size + 1) * (tile_size + 1));
+		block.indices_.reserve(tile_size * tile_size * 6);
+
+		for (int32 tz = 0; tz < chunk_count(quads_z, tile_size); tz++)
+		{
+			for (int32 tx = 0; tx < chunk_count(quads_x, tile_size); tx++)
 			{
-				index_count = (image_width - 1) * (image_height - 1) * 6;
-				//indices.resize(index_count);
-				indices.reserve(index_count);
+				block.x_ = tx * tile_size;
+				block.z_ = tz * tile_size;
+				block.width_ = glm::min(tile_size, quads_x - block.x_);
+				block.height_ = glm::min(tile_size, quads_z - block.z_);
 
-				// chunkification algorithm.
-				for (int y = 0; y < image_height / 7; y++)
+				// note: edge vertices are shared with the neighbouring tiles and duplicated in each
+				const int32 pitch = block.width_ + 1;
+				block.vertices_.resize(pitch * (block.height_ + 1));
+				for (int32 z = 0; z <= block.height_; z++)
 				{
-					for (int x = 0; x < image_width / 7; x++)
+					for (int32 x = 0; x <= block.width_; x++)
 					{
-						for (int base_y = 0; base_y < 7; base_y++)
-						{
-							for (int32 base_x = 0; base_x < 7; base_x++)
-							{
-								// chunk row * offset + indices row * 
-								int base = (y * 7 + base_y) * image_width + 7 * x + base_x;	
-
-								// Triangle 1 values
-								indices.push_back(base);
-								indices.push_back(base + image_width);
-								indices.push_back(base + image_width + 1);
-
-								// Triangle 2 values
-								indices.push_back(base + image_width + 1);
-								indices.push_back(base + 1);
-								indices.push_back(base);
-							}
-						}
+						set_vertex(block.vertices_[z * pitch + x], field, block.x_ + x, block.z_ + z);
+					}
+				}
+
+				// note: normals see the samples beyond the tile, so shared edges match
+				compute_normals(field,
+								block.x_,
+								block.z_,
+								block.x_ + block.width_ + 1,
+								block.z_ + block.height_ + 1,
+								&block.vertices_[0].normal_,
+								static_cast<int32>(sizeof(vertex)),
+								pitch * static_cast<int32>(sizeof(vertex)));
+
+				block.indices_.resize(block.width_ * block.height_ * 6);
+				uint32 *dst = block.indices_.data();
+				for (int32 z = 0; z < block.height_; z++)
+				{
+					for (int32 x = 0; x < block.width_; x++)
+					{
+						dst = write_quad(dst, z * pitch + x, pitch);
 					}
-				}		
+				}
 
+				vertex_count += static_cast<int32>(block.vertices_.size());
+				index_count += static_cast<int32>(block.indices_.size());
+
+				if (!listener.on_tile(block))
+				{
+					return false;
+				}
 			}
+		}
+
+		return true;
+	}
+
+	bool heightmap::create_chunk_template(const int32 chunk_size, chunk_template &result) const
+	{
+		if (image_width < 2 || image_height < 2 || chunk_size < 1 || chunks.empty())
+		{
+			assert(!"heightmap dimensions not correct!");
+			return false;
+		}
+
+		// note: the bottom-right vertex of a chunk block has the largest index
+		if ((chunk_size + 1) * (chunk_size + 1) > 0x10000)
+		{
+			return false;
+		}
+
+		const int32 quads_x = image_width - 1;
+		const int32 quads_z = image_height - 1;
+		const int32 edge_columns = quads_x % chunk_size;
+		const int32 edge_rows = quads_z % chunk_size;
 
-			// note: set vertex normals
+		result.chunk_size_ = chunk_size;
+		result.chunks_x_ = chunk_count(quads_x, chunk_size);
+		result.chunks_z_ = chunk_count(quads_z, chunk_size);
+		result.edge_start_ = chunk_size * chunk_size * 6;
+		result.grid_width_ = image_width;
+		result.grid_height_ = image_height;
+		result.indices_.clear();
+
+		// note: the full template, then the right edge, bottom edge and corner ones the grid
+		//       needs. variant_start[rows is short][columns are short]
+		int32 variant_start[2][2] = {};
+		uint32 quad[6];
+		for (int32 variant = 0; variant < 4; variant++)
+		{
+			const int32 columns = (variant & 1) ? edge_columns : chunk_size;
+			const int32 rows = (variant & 2) ? edge_rows : chunk_size;
+			variant_start[variant >> 1][variant & 1] = static_cast<int32>(result.indices_.size());
+			for (int32 z = 0; z < rows; z++)
 			{
-				for (int32 index = 0; index < indices.size() - 3; index += 3)
+				for (int32 x = 0; x < columns; x++)
 				{
-					// note: get triangle normals
-					glm::vec3 normal = getsurfacenormal(vertices[indices[index]].position_, 
-														 vertices[indices[index+1]].position_, 
-														 vertices[indices[index+2]].position_);
-					vertices[indices[index]].normal_ = normal;
+					write_quad(quad, z * (chunk_size + 1) + x, chunk_size + 1);
+					for (const uint32 index : quad)
+					{
+						result.indices_.push_back(static_cast<uint16>(index));
+					}
 				}
 			}
+		}
+
+		// note: bounds are merged from the CHUNK_SIZE blocks overlapping each chunk
+		const int32 blocks_x = chunk_count(quads_x, CHUNK_SIZE);
+		result.chunks_.resize(result.chunks_x_ * result.chunks_z_);
+		for (int32 z = 0; z < result.chunks_z_; z++)
+		{
+			for (int32 x = 0; x < result.chunks_x_; x++)
+			{
+				const int32 first_column = x * chunk_size;
+				const int32 first_row = z * chunk_size;
+				const int32 columns = glm::min(chunk_size, quads_x - first_column);
+				const int32 rows = glm::min(chunk_size, quads_z - first_row);
+
+				chunk &current = result.chunks_[z * result.chunks_x_ + x];
+				current.start_index_ = variant_start[rows == chunk_size ? 0 : 1][columns == chunk_size ? 0 : 1];
+				current.index_count_ = columns * rows * 6;
+				current.base_vertex_ = (z * result.chunks_x_ + x) * result.block_size();
+				current.min_corner_ = glm::vec3(static_cast<float>(first_column), 0.0f, static_cast<float>(first_row));
+				current.max_corner_ = glm::vec3(static_cast<float>(first_column + columns), 0.0f, static_cast<float>(first_row + rows));
 
-			// note: release image memory
-			image.destroy();
+				bool first = true;
+				for (int32 by = first_row / CHUNK_SIZE; by <= (first_row + rows - 1) / CHUNK_SIZE; by++)
+				{
+					for (int32 bx = first_column / CHUNK_SIZE; bx <= (first_column + columns - 1) / CHUNK_SIZE; bx++)
+					{
+						const chunk &block = chunks[by * blocks_x + bx];
+						current.min_corner_.y = first ? block.min_corner_.y : glm::min(current.min_corner_.y, block.min_corner_.y);
+						current.max_corner_.y = first ? block.max_corner_.y : glm::max(current.max_corner_.y, block.max_corner_.y);
+						first = false;
+					}
+				}
+			}
 		}
+
 		return true;
 	}
 
@@ -144,6 +555,6 @@ namespace avocado {
 		glm::vec3 c = glm::cross(v10, v20);
 		glm::vec3 n = glm::normalize(c);
 
-		return c;
+		return n;
 	}
 }
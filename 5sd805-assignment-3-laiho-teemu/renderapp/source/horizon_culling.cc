@@ -0,0 +1,314 @@
+// horizon_culling.cc
+
+#include "horizon_culling.hpp"
+#include "culling.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace avocado {
+	namespace
+	{
+		// note: points this close to the eye plane or behind it are not projected
+		constexpr float NEAREST = 1e-3f;
+
+		constexpr float LOWEST = -std::numeric_limits<float>::max();
+
+		bool project(const horizon_buffer::view &view, const glm::vec3 &position, glm::vec2 &result)
+		{
+			const glm::vec3 offset = position - view.eye_;
+			const float depth = glm::dot(offset, view.forward_);
+			if (depth <= NEAREST)
+			{
+				return false;
+			}
+
+			result.x = (glm::dot(offset, view.right_) / depth + view.half_width_) * view.scale_;
+			result.y = offset.y / depth;
+			return true;
+		}
+
+		// note: horizontal distance from the eye to the nearest and farthest point of the box
+		horizon_buffer::entry measure(const glm::vec3 &eye, const glm::vec3 &min_corner, const glm::vec3 &max_corner)
+		{
+			const glm::vec2 center((min_corner.x + max_corner.x) * 0.5f - eye.x, (min_corner.z + max_corner.z) * 0.5f - eye.z);
+			const glm::vec2 extent((max_corner.x - min_corner.x) * 0.5f, (max_corner.z - min_corner.z) * 0.5f);
+			const glm::vec2 nearest = glm::max(glm::abs(center) - extent, glm::vec2(0.0f));
+			const glm::vec2 farthest = glm::abs(center) + extent;
+
+			horizon_buffer::entry result;
+			result.nearest_ = glm::length(nearest);
+			result.farthest_ = glm::length(farthest);
+			result.index_ = 0;
+			return result;
+		}
+
+		// note: every terrain point of the box in every column it covers lies below what
+		//       nearer chunks have put there
+		bool is_below_horizon(const horizon_buffer::view &view, const float *horizon, const int32 columns,
+							  const glm::vec3 &min_corner, const glm::vec3 &max_corner)
+		{
+			float left = std::numeric_limits<float>::max();
+			float right = LOWEST;
+			float top = LOWEST;
+			for (int32 corner = 0; corner < 8; corner++)
+			{
+				const glm::vec3 position((corner & 1) ? max_corner.x : min_corner.x,
+										 (corner & 2) ? max_corner.y : min_corner.y,
+										 (corner & 4) ? max_corner.z : min_corner.z);
+				glm::vec2 projected;
+				if (!project(view, position, projected))
+				{
+					return false;
+				}
+
+				left = glm::min(left, projected.x);
+				right = glm::max(right, projected.x);
+				top = glm::max(top, projected.y);
+			}
+
+			if (left < 0.0f || right >= static_cast<float>(columns))
+			{
+				return false;
+			}
+
+			const int32 last = static_cast<int32>(right);
+			for (int32 column = static_cast<int32>(left); column <= last; column++)
+			{
+				if (horizon[column] <= top)
+				{
+					return false;
+				}
+			}
+
+			return true;
+		}
+
+		// note: the terrain over the box is no lower than its bottom, a ray passing under
+		//       that rectangle is in the ground. the top of the projected rectangle is
+		//       taken at the column edges, a column gets the lower of its two edges, the
+		//       outline is convex and never dips lower in between. columns the rectangle
+		//       covers only in part are left alone
+		void add_occluder(const horizon_buffer::view &view, float *horizon, float *upper, const int32 columns,
+						  const glm::vec3 &min_corner, const glm::vec3 &max_corner)
+		{
+			const glm::vec3 corners[4] =
+			{
+				glm::vec3(min_corner.x, min_corner.y, min_corner.z),
+				glm::vec3(max_corner.x, min_corner.y, min_corner.z),
+				glm::vec3(max_corner.x, min_corner.y, max_corner.z),
+				glm::vec3(min_corner.x, min_corner.y, max_corner.z),
+			};
+
+			glm::vec2 projected[4];
+			float left = std::numeric_limits<float>::max();
+			float right = LOWEST;
+			for (int32 corner = 0; corner < 4; corner++)
+			{
+				if (!project(view, corners[corner], projected[corner]))
+				{
+					return;
+				}
+
+				left = glm::min(left, projected[corner].x);
+				right = glm::max(right, projected[corner].x);
+			}
+
+			// note: clamped before the conversion, corners near the eye plane land far out
+			const int32 first = static_cast<int32>(glm::max(std::ceil(left), 0.0f));
+			const int32 last = static_cast<int32>(glm::min(std::floor(right), static_cast<float>(columns)));
+			if (first >= last)
+			{
+				return;
+			}
+
+			std::fill(upper + first, upper + last + 1, LOWEST);
+			for (int32 corner = 0; corner < 4; corner++)
+			{
+				const glm::vec2 &a = projected[corner];
+				const glm::vec2 &b = projected[(corner + 1) & 3];
+				if (a.x == b.x)
+				{
+					continue;
+				}
+
+				const int32 from = static_cast<int32>(glm::max(std::ceil(glm::min(a.x, b.x)), static_cast<float>(first)));
+				const int32 to = static_cast<int32>(glm::min(std::floor(glm::max(a.x, b.x)), static_cast<float>(last)));
+				const float slope = (b.y - a.y) / (b.x - a.x);
+				for (int32 edge = from; edge <= to; edge++)
+				{
+					upper[edge] = glm::max(upper[edge], a.y + (static_cast<float>(edge) - a.x) * slope);
+				}
+			}
+
+			for (int32 column = first; column < last; column++)
+			{
+				horizon[column] = glm::max(horizon[column], glm::min(upper[column], upper[column + 1]));
+			}
+		}
+
+		bool farther(const horizon_buffer::entry &lhs, const horizon_buffer::entry &rhs)
+		{
+			return lhs.farthest_ > rhs.farthest_;
+		}
+	} // !anon
+
+	// static
+	float horizon_buffer::half_width(const glm::mat4 &projection, const float pitch)
+	{
+		return 1.0f / projection[0][0] / glm::max(std::cos(pitch), 0.5f);
+	}
+
+	horizon_buffer::horizon_buffer()
+		: columns_(0)
+		, active_(false)
+		, flushed_(0.0f)
+	{
+	}
+
+	bool horizon_buffer::is_valid() const
+	{
+		return columns_ > 0;
+	}
+
+	bool horizon_buffer::create(const int32 columns)
+	{
+		if (columns < 1)
+		{
+			assert(!"horizon buffer needs columns!");
+			return false;
+		}
+
+		columns_ = columns;
+		horizon_.resize(columns);
+		upper_.resize(columns + 1);
+
+		return is_valid();
+	}
+
+	void horizon_buffer::destroy()
+	{
+		dynamic_array<float>().swap(horizon_);
+		dynamic_array<float>().swap(upper_);
+		dynamic_array<entry>().swap(entries_);
+		dynamic_array<entry>().swap(pending_);
+		dynamic_array<glm::vec3>().swap(boxes_);
+		columns_ = 0;
+		active_ = false;
+	}
+
+	int32 horizon_buffer::cull(const glm::vec3 &eye,
+							   const glm::vec3 &forward,
+							   const float half_width,
+							   const box_bounds &bounds,
+							   dynamic_array<int32> &visible)
+	{
+		const int32 count = static_cast<int32>(visible.size());
+		if (count == 0 || !begin(eye, forward, half_width))
+		{
+			return count;
+		}
+
+		entries_.resize(count);
+		for (int32 index = 0; index < count; index++)
+		{
+			const int32 item = visible[index];
+			const glm::vec3 center(bounds.center_x_[item], bounds.center_y_[item], bounds.center_z_[item]);
+			const glm::vec3 extent(bounds.extent_x_[item], bounds.extent_y_[item], bounds.extent_z_[item]);
+
+			entries_[index] = measure(eye, center - extent, center + extent);
+			entries_[index].index_ = item;
+		}
+
+		std::sort(entries_.begin(), entries_.end(), [](const entry &lhs, const entry &rhs)
+		{
+			return lhs.nearest_ < rhs.nearest_;
+		});
+
+		int32 result = 0;
+		for (const entry &current : entries_)
+		{
+			const int32 item = current.index_;
+			const glm::vec3 center(bounds.center_x_[item], bounds.center_y_[item], bounds.center_z_[item]);
+			const glm::vec3 extent(bounds.extent_x_[item], bounds.extent_y_[item], bounds.extent_z_[item]);
+			if (is_hidden(center - extent, center + extent))
+			{
+				continue;
+			}
+
+			visible[result++] = item;
+			add(center - extent, center + extent);
+		}
+
+		visible.resize(result);
+		return result;
+	}
+
+	bool horizon_buffer::begin(const glm::vec3 &eye, const glm::vec3 &forward, const float half_width)
+	{
+		const glm::vec2 level(forward.x, forward.z);
+		active_ = is_valid() && half_width > 0.0f && glm::length(level) >= NEAREST;
+		if (!active_)
+		{
+			return false;
+		}
+
+		view_.eye_ = eye;
+		view_.forward_ = glm::vec3(glm::normalize(level).x, 0.0f, glm::normalize(level).y);
+		view_.right_ = glm::vec3(-view_.forward_.z, 0.0f, view_.forward_.x);
+		view_.half_width_ = half_width;
+		view_.scale_ = static_cast<float>(columns_) / (half_width * 2.0f);
+
+		std::fill(horizon_.begin(), horizon_.end(), LOWEST);
+		flushed_ = 0.0f;
+		pending_.clear();
+		boxes_.clear();
+
+		return true;
+	}
+
+	bool horizon_buffer::is_hidden(const glm::vec3 &min_corner, const glm::vec3 &max_corner)
+	{
+		if (!active_)
+		{
+			return false;
+		}
+
+		// note: a box the walk is still inside of could hide parts of itself, it joins
+		//       the horizon only once the box tested lies behind it
+		const entry current = measure(view_.eye_, min_corner, max_corner);
+		while (!pending_.empty() && pending_.front().farthest_ <= current.nearest_)
+		{
+			std::pop_heap(pending_.begin(), pending_.end(), farther);
+
+			const entry &occluder = pending_.back();
+			add_occluder(view_, horizon_.data(), upper_.data(), columns_, boxes_[occluder.index_], boxes_[occluder.index_ + 1]);
+			flushed_ = glm::max(flushed_, occluder.farthest_);
+			pending_.pop_back();
+		}
+
+		if (current.nearest_ < flushed_)
+		{
+			return false;
+		}
+
+		return is_below_horizon(view_, horizon_.data(), columns_, min_corner, max_corner);
+	}
+
+	void horizon_buffer::add(const glm::vec3 &min_corner, const glm::vec3 &max_corner)
+	{
+		if (!active_)
+		{
+			return;
+		}
+
+		entry occluder = measure(view_.eye_, min_corner, max_corner);
+		occluder.index_ = static_cast<int32>(boxes_.size());
+		boxes_.push_back(min_corner);
+		boxes_.push_back(max_corner);
+
+		pending_.push_back(occluder);
+		std::push_heap(pending_.begin(), pending_.end(), farther);
+	}
+} // !avocado
@@ -2,12 +2,17 @@
 
 // Controls:
 // Wireframe mode: hold "t".
+// Terrain brush (edit_terrain_): hold "r" to raise, "f" to lower, "g" to smooth.
+//   Off by default, needs compact_terrain_ with lod_terrain_ and adaptive_terrain_ off.
+// Time of day: hold "5" to move the sun.
 
 #include "main.hpp"
 
 #include "avocado_render.hpp"
 #include "avocado_opengl.h"
 
+#include <algorithm>
+
 namespace avocado {
    // note: camera
   
@@ -16,8 +21,8 @@ namespace avocado {
    application *application::create(settings &settings)
    {
       settings.title_      = "renderapp";
-      settings.width_      = 1280;
-      settings.height_     = 720;
+      settings.width_      = renderapp::WINDOW_WIDTH;
+      settings.height_     = renderapp::WINDOW_HEIGHT;
       settings.center_     = true;
       //settings.borderless_ = true;
 
@@ -27,6 +32,23 @@ namespace avocado {
    // note: renderapp class
    renderapp::renderapp()
       : controller_(camera_)
+      , compact_terrain_(true)
+      , refit_chunks_(false)
+      , adaptive_terrain_(false)
+      , overdraw_terrain_(false)
+      , lod_terrain_(true)
+      , stream_terrain_(false)
+      , procedural_terrain_(false)
+      , erode_terrain_(false)
+      , eroded_(0)
+      , occlusion_terrain_(true)
+      , shadow_terrain_(true)
+      , splat_terrain_(true)
+      , normal_map_terrain_(true)
+      , occlusion_culling_(true)
+      , horizon_culling_(true)
+      , edit_terrain_(false)
+      , sun_angle_(0.5f)
    {
    }
 
@@ -36,6 +58,11 @@ namespace avocado {
          return false;
       }
 
+      // note: worker threads for terrain building
+      if (!workers_.create()) {
+         return on_error("could not create worker threads!");
+      }
+
       // note: set default light direction
       lightdirection_ = glm::vec3{ 0.0f, 10.0f,0.0f };
 
@@ -46,28 +73,332 @@ namespace avocado {
           }
       }
 
-      // note: create heightmap
+      // note: load terrain heights, shared by the renderers and the height queries. the processed
+      //       terrain is cached next to the image and reused while the image is unchanged.
+      //       procedural and eroded heights are generated again on every start instead
+      const char *heightmap_filename = "assets/heightmap/TKInverted.png";
+      const char *cache_filename = "assets/heightmap/TKInverted.terrain";
+
+      // note: a streamed image is read by the tile source a tile at a time, the float
+      //       grid of the whole map is not built
+      const bool stream_image = stream_terrain_ && !procedural_terrain_ && !erode_terrain_;
+      const bool use_cache = !procedural_terrain_ && !erode_terrain_ && !stream_image;
+      uint64 source_hash = 0;
+      if (use_cache && !terrain_cache::hash_file(heightmap_filename, source_hash)) {
+          return on_error("could not load heightmap image");
+      }
+
+      const bool build_mesh = !lod_terrain_ && !stream_terrain_;
+      const bool cache_mesh = compact_terrain_ && !adaptive_terrain_ && use_cache;
+      terrain_cache::params cache_params = {};
+      cache_params.height_scale_ = heightmap::DEFAULT_HEIGHT_SCALE;
+      cache_params.height_offset_ = heightmap::DEFAULT_HEIGHT_OFFSET;
+      cache_params.chunk_size_ = TERRAIN_CHUNK_SIZE;
+      cache_params.occlusion_ = occlusion_terrain_ ? 1 : 0;
+
+      terrain_cache cache;
+      const bool cached = use_cache && cache.create(cache_filename, source_hash, cache_params) &&
+                          (!build_mesh || !cache_mesh || cache.has_mesh());
+
+      heightfield field;
+      if (procedural_terrain_) {
+          if (!noise_source_.noise_.generate(field, 0, 0, PROCEDURAL_TERRAIN_SIZE, PROCEDURAL_TERRAIN_SIZE, &workers_)) {
+              return on_error("could not generate terrain heights");
+          }
+      }
+      else if (stream_image) {
+          if (!tile_source_.create(heightmap_filename,
+                                   heightfield::encoding::grayscale,
+                                   heightmap::DEFAULT_HEIGHT_SCALE,
+                                   heightmap::DEFAULT_HEIGHT_OFFSET))
+          {
+              return on_error("could not load heightmap image");
+          }
+      }
+      else if (cached ? !cache.load(field) : !field.create(heightmap_filename,
+                                                      heightfield::encoding::grayscale,
+                                                      heightmap::DEFAULT_HEIGHT_SCALE,
+                                                      heightmap::DEFAULT_HEIGHT_OFFSET))
       {
-          heightmap_.create(vertices_, indices_);
+          return on_error("could not load heightmap image");
+      }
+
+      // note: weathered by water and slides over the frames after load. streamed tiles and
+      //       meshes the editor cannot rewrite are built from heights eroded up front
+      if (erode_terrain_) {
+          if (!erosion_.create(field, &workers_)) {
+              return on_error("could not create terrain erosion");
+          }
+
+          if (stream_terrain_ || (build_mesh && (!compact_terrain_ || adaptive_terrain_))) {
+              while (erosion_.iterations_ < EROSION_ITERATIONS) {
+                  erosion_.step();
+              }
 
-          heightmap_vertex_size = static_cast<uint32>(vertices_.size() * sizeof(vertex));
-          heightmap_vertex_count = static_cast<uint32>(vertices_.size());
+              if (!erosion_.heights(field)) {
+                  return on_error("could not erode terrain");
+              }
 
-          heightmap_index_size = static_cast<uint32>(indices_.size() * sizeof(uint32));
-          heightmap_index_count = static_cast<uint32>(indices_.size());
+              erosion_.destroy();
+          }
+      }
+
+      if (!stream_image && !terrain_.create(field)) {
+          return on_error("could not create terrain queries");
+      }
+
+      if (!stream_image && !terrain_rays_.create(terrain_, &workers_)) {
+          return on_error("could not create terrain ray queries");
+      }
+
+      // note: streamed tiles are not baked, a cached mesh already has it
+      dynamic_array<float> occlusion;
+      if (occlusion_terrain_ && !stream_terrain_ && !(build_mesh && cache_mesh && cached)) {
+          terrain_occlusion baker;
+          if (!baker.bake(field, occlusion, &workers_)) {
+              return on_error("could not bake terrain occlusion");
+          }
+      }
+
+      // note: horizon maps of the whole map, streamed tiles have no shadows
+      if (shadow_terrain_ && !stream_terrain_) {
+          if (!horizon_.create(field, &workers_)) {
+              return on_error("could not create terrain horizon maps");
+          }
+      }
+
+      // note: splat weights of the whole map, streamed tiles keep the plain material
+      if (splat_terrain_ && !stream_terrain_) {
+          if (!splat_.create(field, &workers_)) {
+              return on_error("could not create terrain splat weights");
+          }
+      }
+
+      // note: normal map of the whole map, streamed tiles light with their vertex normals
+      if (normal_map_terrain_ && !stream_terrain_) {
+          if (!normal_map_.create(field, &workers_)) {
+              return on_error("could not bake terrain normal map");
+          }
+      }
+
+      // note: occluders of the whole map, streamed tiles are only frustum culled
+      if (occlusion_culling_ && !stream_terrain_) {
+          if (!occluder_.create(field, OCCLUDER_SPACING) || !occlusion_.create(OCCLUSION_WIDTH, OCCLUSION_HEIGHT)) {
+              return on_error("could not create terrain occlusion culling");
+          }
+      }
+
+      if (horizon_culling_ && !stream_terrain_) {
+          if (!chunk_horizon_.create(HORIZON_COLUMNS)) {
+              return on_error("could not create terrain horizon culling");
+          }
+      }
+
+      // note: create streamed terrain
+      if (stream_terrain_) {
+          if (procedural_terrain_) {
+              if (!tile_world_.create(noise_source_, workers_, noise_source_.noise_.lowest(), noise_source_.noise_.highest())) {
+                  return on_error("could not create terrain tile world");
+              }
+          }
+          else if ((!stream_image && !tile_source_.create(field)) ||
+                   !tile_world_.create(tile_source_, workers_, tile_source_.lowest_, tile_source_.highest_))
+          {
+              return on_error("could not create terrain tile world");
+          }
+      }
+      // note: create level of detail terrain
+      else if (lod_terrain_) {
+          if (!cdlod_.create(field, &workers_)) {
+              return on_error("could not create level of detail terrain");
+          }
+
+          if (!occlusion.empty() && !cdlod_.set_occlusion(occlusion)) {
+              return on_error("could not upload terrain occlusion");
+          }
+      }
+
+      // note: create heightmap
+      if (build_mesh) {
+          const void *vertex_data = nullptr;
+          const void *index_data = nullptr;
+
+          if (cache_mesh && cached) {
+              if (!cache.load(heightmap_, chunk_template_)) {
+                  return on_error("could not load terrain cache");
+              }
+
+              heightmap_vertex_size = static_cast<uint32>(heightmap_.vertex_count * sizeof(terrain_vertex));
+              heightmap_vertex_count = static_cast<uint32>(heightmap_.vertex_count);
+              vertex_data = cache.vertices();
+
+              if (chunk_template_.indices_.empty()) {
+                  heightmap_index_size = static_cast<uint32>(heightmap_.index_count * sizeof(uint32));
+                  heightmap_index_count = static_cast<uint32>(heightmap_.index_count);
+                  index_data = cache.indices();
+              }
+          }
+          else {
+              if (compact_terrain_) {
+                  if (!heightmap_.create(field, compact_vertices_, indices_, &workers_)) {
+                      return on_error("could not create heightmap");
+                  }
+
+                  if (!occlusion.empty()) {
+                      store_occlusion(occlusion, compact_vertices_);
+                  }
+
+                  heightmap_vertex_size = static_cast<uint32>(compact_vertices_.size() * sizeof(terrain_vertex));
+                  heightmap_vertex_count = static_cast<uint32>(compact_vertices_.size());
+                  vertex_data = compact_vertices_.data();
+              }
+              else {
+                  if (!heightmap_.create(field, vertices_, indices_, &workers_)) {
+                      return on_error("could not create heightmap");
+                  }
+
+                  if (!occlusion.empty()) {
+                      store_occlusion(occlusion, vertices_);
+                  }
+
+                  heightmap_vertex_size = static_cast<uint32>(vertices_.size() * sizeof(vertex));
+                  heightmap_vertex_count = static_cast<uint32>(vertices_.size());
+                  vertex_data = vertices_.data();
+              }
+
+              // note: adaptive triangles within TERRAIN_MAX_ERROR of the heights replace the
+              //       full grid indices, one chunk per block
+              if (adaptive_terrain_) {
+                  rtin mesher;
+                  if (!mesher.create(field, TERRAIN_BLOCK_SIZE, &workers_)) {
+                      return on_error("could not create adaptive terrain");
+                  }
+
+                  mesher.triangulate(TERRAIN_MAX_ERROR, indices_, heightmap_.chunks, &workers_);
+                  heightmap_.index_count = static_cast<int32>(indices_.size());
+
+                  heightmap_index_size = static_cast<uint32>(indices_.size() * sizeof(uint32));
+                  heightmap_index_count = static_cast<uint32>(indices_.size());
+                  index_data = indices_.data();
+              }
+              // note: chunks share one 16 bit index template when the grid is narrow enough,
+              //       otherwise the whole grid is drawn from 32 bit indices
+              else if (!heightmap_.create_chunk_template(TERRAIN_CHUNK_SIZE, chunk_template_)) {
+                  heightmap_index_size = static_cast<uint32>(indices_.size() * sizeof(uint32));
+                  heightmap_index_count = static_cast<uint32>(indices_.size());
+                  index_data = indices_.data();
+              }
+              // note: every template chunk gets its own block of vertices
+              else if (compact_terrain_) {
+                  dynamic_array<terrain_vertex> blocks;
+                  chunk_template_.gather(compact_vertices_, blocks);
+                  compact_vertices_.swap(blocks);
+
+                  heightmap_.vertex_count = static_cast<int32>(compact_vertices_.size());
+                  heightmap_vertex_size = static_cast<uint32>(compact_vertices_.size() * sizeof(terrain_vertex));
+                  heightmap_vertex_count = static_cast<uint32>(compact_vertices_.size());
+                  vertex_data = compact_vertices_.data();
+              }
+              else {
+                  dynamic_array<vertex> blocks;
+                  chunk_template_.gather(vertices_, blocks);
+                  vertices_.swap(blocks);
+
+                  heightmap_.vertex_count = static_cast<int32>(vertices_.size());
+                  heightmap_vertex_size = static_cast<uint32>(vertices_.size() * sizeof(vertex));
+                  heightmap_vertex_count = static_cast<uint32>(vertices_.size());
+                  vertex_data = vertices_.data();
+              }
+
+              // note: 32 bit indices are reordered chunk by chunk for the post-transform vertex
+              //       cache, the shared template range by range. template vertices sit at fixed
+              //       places in their chunk block so they are not moved
+              if (!chunk_template_.indices_.empty()) {
+                  uint16 *template_indices = chunk_template_.indices_.data();
+                  const vertex_cache_stats before = analyze_vertex_cache(template_indices, chunk_template_.edge_start_);
+
+                  dynamic_array<chunk> ranges;
+                  chunk_template_.ranges(ranges);
+                  for (const chunk &range : ranges) {
+                      optimize_vertex_cache(template_indices + range.start_index_, range.index_count_);
+                  }
+
+                  const vertex_cache_stats after = analyze_vertex_cache(template_indices, chunk_template_.edge_start_);
+                  debug::output("terrain template vertex cache: acmr %.3f -> %.3f, atvr %.3f -> %.3f\n",
+                                before.acmr_, after.acmr_, before.atvr_, after.atvr_);
+              }
+              else {
+                  const vertex_cache_stats before = analyze_vertex_cache(indices_.data(), heightmap_.chunks);
+                  optimize_vertex_cache(indices_.data(), heightmap_.chunks, &workers_);
+
+                  // note: compact vertices are placed by their index so only full vertices can move
+                  if (!compact_terrain_) {
+                      if (overdraw_terrain_) {
+                          optimize_overdraw(indices_.data(), heightmap_.chunks, &vertices_[0].position_, static_cast<int32>(sizeof(vertex)), TERRAIN_OVERDRAW_THRESHOLD, &workers_);
+                      }
+
+                      dynamic_array<uint32> remap;
+                      optimize_vertex_fetch(indices_.data(), static_cast<int32>(indices_.size()), static_cast<int32>(vertices_.size()), remap);
+                      remap_vertices(vertices_.data(), static_cast<int32>(vertices_.size()), static_cast<int32>(sizeof(vertex)), remap);
+                  }
+
+                  const vertex_cache_stats after = analyze_vertex_cache(indices_.data(), heightmap_.chunks);
+                  debug::output("terrain vertex cache: acmr %.3f -> %.3f, atvr %.3f -> %.3f\n",
+                                before.acmr_, after.acmr_, before.atvr_, after.atvr_);
+              }
+
+              if (cache_mesh) {
+                  terrain_cache::write(cache_filename, source_hash, cache_params, field, heightmap_, compact_vertices_, indices_, chunk_template_);
+              }
+          }
+
+          if (!chunk_template_.indices_.empty()) {
+              heightmap_index_size = static_cast<uint32>(chunk_template_.indices_.size() * sizeof(uint16));
+              heightmap_index_count = static_cast<uint32>(chunk_template_.indices_.size());
+              index_data = chunk_template_.indices_.data();
+          }
 
           // note:  Tommi Lipponen - 5SD805: Real-time Graphics Programming for Games 1 - 2020
-          if (!index_buffer_.create(heightmap_index_size, indices_.data())) {
+          if (!index_buffer_.create(heightmap_index_size, index_data)) {
               return on_error("could not create index buffer");
           }
 
           // note:  Tommi Lipponen - 5SD805: Real-time Graphics Programming for Games 1 - 2020
           if (!vertex_buffer_.create(BUFFER_ACCESS_MODE_STATIC,
               heightmap_vertex_size,
-              vertices_.data()))
+              vertex_data))
           {
               return on_error("could not create terrain vertex buffer");
           }
+
+          // note: compact vertices sit at their grid index or in their chunk block, so an
+          //       edited or eroded area maps to rows of the buffer. adaptive triangles would
+          //       need triangulating again
+          if ((edit_terrain_ || erosion_.is_valid()) && compact_terrain_ && !adaptive_terrain_) {
+              edit_field_ = field;
+              if (!editor_.create(edit_field_,
+                                  heightmap_,
+                                  vertex_buffer_,
+                                  static_cast<const terrain_vertex *>(vertex_data),
+                                  chunk_template_.indices_.empty() ? nullptr : &chunk_template_))
+              {
+                  return on_error("could not create terrain editor");
+              }
+          }
+
+          // note: the buffers hold their own copy now
+          indices_.clear();
+          indices_.shrink_to_fit();
+      }
+      else if (!cached && use_cache) {
+          terrain_cache::write(cache_filename, source_hash, cache_params, field);
+      }
+
+      cache.destroy();
+
+      // note: without a mesh to edit erosion still needs the heights the maps were baked from
+      if (erosion_.is_valid() && !edit_field_.is_valid()) {
+          edit_field_ = field;
       }
 
       // note: load shader source from disk
@@ -91,8 +422,17 @@ namespace avocado {
 
       // note: load heightmap shader source from disk
       {
+          const char *vertex_filename = compact_terrain_ ? "assets/heightmap/heightmap_compact.vs.txt"
+                                                         : "assets/heightmap/heightmap.vs.txt";
+          if (stream_terrain_) {
+              vertex_filename = "assets/heightmap/heightmap_compact.vs.txt";
+          }
+          else if (lod_terrain_) {
+              vertex_filename = "assets/heightmap/cdlod.vs.txt";
+          }
+
           string vertex_source;
-          if (!file_system::read_file_content("assets/heightmap/heightmap.vs.txt", vertex_source)) {
+          if (!file_system::read_file_content(vertex_filename, vertex_source)) {
               return on_error("Could not load vertex source");
           }
 
@@ -186,7 +526,11 @@ namespace avocado {
       }
 
       // note: describe heightmap vertex_layout_
-      {
+      if (compact_terrain_) {
+          vertex_layout_.add_attribute(0, vertex_layout::ATTRIBUTE_FORMAT_UNSIGNED_SHORT, 2, true);
+          vertex_layout_.add_attribute(2, vertex_layout::ATTRIBUTE_FORMAT_SHORT, 2, false);
+      }
+      else {
           vertex_layout_.add_attribute(0, vertex_layout::ATTRIBUTE_FORMAT_FLOAT, 3, false);
           vertex_layout_.add_attribute(1, vertex_layout::ATTRIBUTE_FORMAT_FLOAT, 4, false);
           vertex_layout_.add_attribute(2, vertex_layout::ATTRIBUTE_FORMAT_FLOAT, 3, false);
@@ -263,6 +607,20 @@ namespace avocado {
    void renderapp::on_exit()
    {
        skybox_.destroy();
+       erosion_.destroy();
+       editor_.destroy();
+       edit_field_.destroy();
+       terrain_rays_.destroy();
+       horizon_.destroy();
+       splat_.destroy();
+       normal_map_.destroy();
+       occlusion_.destroy();
+       occluder_.destroy();
+       chunk_horizon_.destroy();
+       cdlod_.destroy();
+       tile_world_.destroy();
+       tile_source_.destroy();
+       workers_.destroy();
    }
 
    bool renderapp::on_tick(const time &deltatime)
@@ -291,12 +649,108 @@ namespace avocado {
           {
               lightdirection_ = glm::vec3{ -10.0f, 5.0f,0.0f };
           }
+
+          // note: the sun rises along +x, passes a little to the +z side and sets along -x
+          if (keyboard_.key_down(keyboard::key::five))
+          {
+              sun_angle_ = glm::mod(sun_angle_ + SUN_SPEED * deltatime.as_seconds(), glm::two_pi<float>());
+              lightdirection_ = -10.0f * glm::normalize(glm::vec3{ std::cos(sun_angle_), std::sin(sun_angle_), 0.35f });
+          }
       }
 
       // camera_.update();
       controller_.update(keyboard_, mouse_, deltatime);
+
+      // note: keep the camera above the ground while over the terrain
+      if (stream_terrain_) {
+          const glm::vec3 &position = camera_.position_;
+          float ground = 0.0f;
+          if (tile_world_.height(position.x, position.z, ground) && position.y < ground + CAMERA_CLEARANCE) {
+              camera_.set_position(glm::vec3(position.x, ground + CAMERA_CLEARANCE, position.z));
+              camera_.update();
+          }
+      }
+      else {
+          const glm::vec3 &position = camera_.position_;
+          if (position.x >= 0.0f && position.x <= static_cast<float>(terrain_.width_ - 1) &&
+              position.z >= 0.0f && position.z <= static_cast<float>(terrain_.height_ - 1))
+          {
+              const float ground = terrain_.height(position.x, position.z) + CAMERA_CLEARANCE;
+              if (position.y < ground) {
+                  camera_.set_position(glm::vec3(position.x, ground, position.z));
+                  camera_.update();
+              }
+          }
+      }
+
+      // note: erosion runs a few milliseconds per frame, the terrain follows a batch at a time
+      if (erosion_.is_valid()) {
+          erosion_.run(EROSION_BUDGET_MS);
+          if (erosion_.iterations_ - eroded_ >= EROSION_BATCH || erosion_.iterations_ >= EROSION_ITERATIONS) {
+              if (!apply_erosion()) {
+                  return on_error("could not erode terrain");
+              }
+          }
+      }
+
+      // note: hold r to raise, f to lower and g to smooth the terrain in the middle of the view
+      if (editor_.is_valid()) {
+          bool stroke = edit_terrain_;
+          if (keyboard_.key_down(keyboard::key::r)) {
+              brush_.mode_ = terrain_brush::mode::raise;
+          }
+          else if (keyboard_.key_down(keyboard::key::f)) {
+              brush_.mode_ = terrain_brush::mode::lower;
+          }
+          else if (keyboard_.key_down(keyboard::key::g)) {
+              brush_.mode_ = terrain_brush::mode::smooth;
+          }
+          else {
+              stroke = false;
+          }
+
+          // note: the brush lands where the view direction first meets the terrain mesh
+          terrain_hit hit = {};
+          const terrain_ray ray = { camera_.position_, -camera_.z_axis_, BRUSH_REACH };
+          if (stroke && terrain_rays_.raycast(ray, hit)) {
+              editor_.apply(brush_, hit.position_.x, hit.position_.z, deltatime.as_seconds());
+          }
+
+          terrain_editor::rect changed = {};
+          const int32 uploaded = chunk_template_.chunks_.empty()
+              ? editor_.flush(heightmap_.chunks, heightmap::CHUNK_SIZE, &terrain_, &changed)
+              : editor_.flush(chunk_template_.chunks_, chunk_template_.chunk_size_, &terrain_, &changed);
+          if (uploaded > 0) {
+              refresh_terrain(changed);
+          }
+      }
+
+      // note: shadows catch up with edits and erosion a few tiles per frame
+      if (horizon_.is_valid() && edit_field_.is_valid()) {
+          horizon_.update(edit_field_, HORIZON_TILES_PER_FRAME, &workers_);
+      }
+
       frustum_.construct(glm::transpose(camera_.projection_ * camera_.view_));
 
+      if (occlusion_.is_valid()) {
+          occlusion_.render(camera_.projection_ * camera_.view_,
+                            occluder_.positions_.data(),
+                            static_cast<int32>(occluder_.positions_.size()),
+                            occluder_.indices_.data(),
+                            static_cast<int32>(occluder_.indices_.size()),
+                            &workers_);
+      }
+
+      // note: streaming only queues work for the workers and uploads a few finished tiles
+      if (stream_terrain_) {
+          tile_world_.update(camera_.position_);
+      }
+      else if (lod_terrain_) {
+          cdlod_.select(camera_, frustum_, static_cast<float>(WINDOW_HEIGHT),
+                        occlusion_.is_valid() ? &occlusion_ : nullptr,
+                        chunk_horizon_.is_valid() ? &chunk_horizon_ : nullptr);
+      }
+
       const glm::mat4 t = glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, 1.0f, -3.0f));
       const glm::mat4 r = glm::rotate(glm::mat4(1.0f), time::now().as_seconds(), glm::vec3(0.0f, 1.0f, 0.0f));
       world_ = t * r;
@@ -319,7 +773,7 @@ namespace avocado {
       renderer_.set_depth_state(true, true);
       renderer_.set_rasterizer_state(CULL_MODE_BACK);
 
-      if (frustum_.is_inside(glm::vec3(world_[3]))) {
+      if (frustum_.is_inside(glm::vec3(world_[3]), CRATE_RADIUS)) {
          renderer_.set_texture(texture_);
          renderer_.set_shader_uniform(shader_, UNIFORM_TYPE_MATRIX, "u_world", 1, glm::value_ptr(world_));
          renderer_.draw(PRIMITIVE_TOPOLOGY_TRIANGLE_LIST, 0, vertex_count_);
@@ -331,7 +785,7 @@ namespace avocado {
       //   renderer_.draw(PRIMITIVE_TOPOLOGY_TRIANGLE_LIST, 0, vertex_count_);
       //}
 
-      if (frustum_.is_inside(glm::vec3(world3_[3]))) {
+      if (frustum_.is_inside(glm::vec3(world3_[3]), CRATE_RADIUS)) {
           renderer_.set_texture(texture2_);
           renderer_.set_shader_uniform(shader_, UNIFORM_TYPE_MATRIX, "u_world", 1, glm::value_ptr(world3_));
           renderer_.draw(PRIMITIVE_TOPOLOGY_TRIANGLE_LIST, 0, vertex_count_);
@@ -346,10 +800,23 @@ namespace avocado {
 
       renderer_.set_shader_uniform(heightmap_shader_, UNIFORM_TYPE_MATRIX, "u_projection", 1, glm::value_ptr(camera_.projection_));
       renderer_.set_shader_uniform(heightmap_shader_, UNIFORM_TYPE_MATRIX, "u_view", 1, glm::value_ptr(camera_.view_));
+      // note: template chunks draw from blocks of their own vertices
+      const int32 grid_width = chunk_template_.indices_.empty() ? heightmap_.image_width : chunk_template_.chunk_size_ + 1;
+      const int32 grid_chunks_x = chunk_template_.indices_.empty() ? 0 : chunk_template_.chunks_x_;
+      renderer_.set_shader_uniform(heightmap_shader_, UNIFORM_TYPE_INT, "u_grid_width", 1, &grid_width);
+      renderer_.set_shader_uniform(heightmap_shader_, UNIFORM_TYPE_INT, "u_grid_chunks_x", 1, &grid_chunks_x);
+      renderer_.set_shader_uniform(heightmap_shader_, UNIFORM_TYPE_FLOAT, "u_height_offset", 1, &heightmap_.height_offset);
+      renderer_.set_shader_uniform(heightmap_shader_, UNIFORM_TYPE_FLOAT, "u_height_scale", 1, &heightmap_.height_scale);
+      if (horizon_.is_valid()) {
+          horizon_.bind(renderer_, heightmap_shader_, 2);
+      }
+      if (splat_.is_valid()) {
+          splat_.bind(renderer_, heightmap_shader_, 4);
+      }
+      if (normal_map_.is_valid()) {
+          normal_map_.bind(renderer_, heightmap_shader_, 5);
+      }
       renderer_.set_rasterizer_state(CULL_MODE_BACK);   
-      renderer_.set_vertex_buffer(vertex_buffer_);
-      renderer_.set_vertex_layout(vertex_layout_);
-      renderer_.set_index_buffer(index_buffer_);
 
       // check for wireframe mode.
       {
@@ -359,13 +826,59 @@ namespace avocado {
           }
       }
 
+      // note: render the resident tiles of the streamed world
+      if (stream_terrain_) {
+          tile_world_.draw(renderer_, heightmap_shader_, frustum_);
+      }
+      // note: render the selected level of detail nodes
+      else if (lod_terrain_) {
+          cdlod_.draw(renderer_, heightmap_shader_);
+      }
       // note: render using the index buffer
-      renderer_.draw_indexed(PRIMITIVE_TOPOLOGY_TRIANGLE_LIST,  
-          INDEX_TYPE_UNSIGNED_INT,
-          //INDEX_TYPE_UNSIGNED_BYTE,
-          0,
-          heightmap_index_count
-      );
+      else if (!chunk_template_.indices_.empty()) {
+          renderer_.set_vertex_buffer(vertex_buffer_);
+          renderer_.set_vertex_layout(vertex_layout_);
+          renderer_.set_index_buffer(index_buffer_);
+
+          cull_chunks(chunk_template_.chunks_);
+          for (const int32 index : visible_chunks_) {
+              const chunk &visible = chunk_template_.chunks_[index];
+              renderer_.draw_indexed(PRIMITIVE_TOPOLOGY_TRIANGLE_LIST,
+                  INDEX_TYPE_UNSIGNED_SHORT,
+                  visible.start_index_,
+                  visible.index_count_,
+                  visible.base_vertex_);
+          }
+      }
+      else {
+          renderer_.set_vertex_buffer(vertex_buffer_);
+          renderer_.set_vertex_layout(vertex_layout_);
+          renderer_.set_index_buffer(index_buffer_);
+
+          // note: chunks follow each other in the index buffer, so visible neighbours
+          //       are merged into one draw
+          int32 start_index = 0;
+          int32 index_count = 0;
+          cull_chunks(heightmap_.chunks);
+          for (const int32 index : visible_chunks_) {
+              const chunk &visible = heightmap_.chunks[index];
+              if (index_count > 0 && start_index + index_count == visible.start_index_) {
+                  index_count += visible.index_count_;
+                  continue;
+              }
+
+              if (index_count > 0) {
+                  renderer_.draw_indexed(PRIMITIVE_TOPOLOGY_TRIANGLE_LIST, INDEX_TYPE_UNSIGNED_INT, start_index, index_count);
+              }
+
+              start_index = visible.start_index_;
+              index_count = visible.index_count_;
+          }
+
+          if (index_count > 0) {
+              renderer_.draw_indexed(PRIMITIVE_TOPOLOGY_TRIANGLE_LIST, INDEX_TYPE_UNSIGNED_INT, start_index, index_count);
+          }
+      }
 
       skybox_.draw(renderer_, camera_);
    }
@@ -442,4 +955,104 @@ namespace avocado {
        renderer_.set_shader_uniform(heightmap_shader_, UNIFORM_TYPE_VEC3, "light_diffuse", 1, glm::value_ptr(diffuseColor));
        renderer_.set_shader_uniform(heightmap_shader_, UNIFORM_TYPE_VEC3, "light_specular", 1, glm::value_ptr(ambientColor));
    }
+
+   void renderapp::cull_chunks(const dynamic_array<chunk> &chunks)
+   {
+       if (chunk_bounds_.size() != static_cast<int32>(chunks.size())) {
+           chunk_bounds_.clear();
+           chunk_bounds_.reserve(static_cast<int32>(chunks.size()));
+           for (const chunk &bounds : chunks) {
+               chunk_bounds_.push_back(bounds.min_corner_, bounds.max_corner_);
+           }
+           chunk_tree_.build(chunk_bounds_);
+           refit_chunks_ = false;
+       }
+       else if (refit_chunks_) {
+           for (int32 index = 0; index < chunk_bounds_.size(); index++) {
+               chunk_bounds_.set(index, chunks[index].min_corner_, chunks[index].max_corner_);
+           }
+           chunk_tree_.refit(chunk_bounds_);
+           refit_chunks_ = false;
+       }
+
+       // note: the tree hands out indices in its own order, sorted neighbours in the
+       //       index buffer stay neighbours and still merge into one draw
+       chunk_tree_.cull(frustum_, chunk_bounds_, visible_chunks_);
+       if (chunk_horizon_.is_valid()) {
+           const float half_width = horizon_buffer::half_width(camera_.projection_, camera_.pitch_);
+           chunk_horizon_.cull(camera_.position_, -camera_.z_axis_, half_width, chunk_bounds_, visible_chunks_);
+       }
+       if (occlusion_.is_valid()) {
+           occlusion_.cull(chunk_bounds_, visible_chunks_, &workers_);
+       }
+       std::sort(visible_chunks_.begin(), visible_chunks_.end());
+   }
+
+   // note: brings what is built from edit_field_ up to date inside changed, the horizon
+   //       maps bake their invalidated tiles a few per frame
+   void renderapp::refresh_terrain(const terrain_editor::rect &changed)
+   {
+       terrain_rays_.update(changed.x0_, changed.z0_, changed.x1_, changed.z1_);
+       refit_chunks_ = true;
+
+       if (horizon_.is_valid()) {
+           horizon_.invalidate(changed.x0_, changed.z0_, changed.x1_, changed.z1_);
+       }
+
+       if (splat_.is_valid()) {
+           splat_.update(edit_field_, changed.x0_, changed.z0_, changed.x1_, changed.z1_, &workers_);
+       }
+
+       if (normal_map_.is_valid()) {
+           normal_map_.update(edit_field_, changed.x0_, changed.z0_, changed.x1_, changed.z1_, &workers_);
+       }
+
+       if (occluder_.is_valid()) {
+           occluder_.update(edit_field_, changed.x0_, changed.z0_, changed.x1_, changed.z1_);
+       }
+   }
+
+   // note: the heights after the latest erosion iterations replace edit_field_, brush
+   //       strokes since the last batch included. the editor rewrites the mesh and the
+   //       queries on its next flush, the level of detail terrain takes the whole field
+   //       and bakes its occlusion again. erosion is dropped after its last batch
+   bool renderapp::apply_erosion()
+   {
+       eroded_ = erosion_.iterations_;
+       if (!erosion_.heights(edit_field_)) {
+           return false;
+       }
+
+       const terrain_editor::rect all = { 0, 0, edit_field_.width_, edit_field_.height_ };
+       if (editor_.is_valid()) {
+           editor_.invalidate(all);
+       }
+       else {
+           if (!terrain_.create(edit_field_)) {
+               return false;
+           }
+
+           refresh_terrain(all);
+       }
+
+       if (cdlod_.is_valid()) {
+           if (!cdlod_.set_heights(edit_field_, &workers_)) {
+               return false;
+           }
+
+           if (occlusion_terrain_) {
+               dynamic_array<float> occlusion;
+               terrain_occlusion baker;
+               if (!baker.bake(edit_field_, occlusion, &workers_) || !cdlod_.set_occlusion(occlusion)) {
+                   return false;
+               }
+           }
+       }
+
+       if (erosion_.iterations_ >= EROSION_ITERATIONS) {
+           erosion_.destroy();
+       }
+
+       return true;
+   }
 } // !avocado
@@ -0,0 +1,547 @@
+// mesh_optimizer.cc
+
+#include "mesh_optimizer.hpp"
+
+#include <avocado_thread.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <numeric>
+
+namespace avocado {
+	namespace
+	{
+		// note: forsyth's scoring, the cache model is an lru of CACHE_SIZE entries
+		constexpr int32 CACHE_SIZE = 32;
+		constexpr int32 MAX_VALENCE = 32;
+		constexpr float LAST_TRIANGLE_SCORE = 0.75f;
+		constexpr float CACHE_DECAY_POWER = 1.5f;
+		constexpr float VALENCE_BOOST_SCALE = 2.0f;
+		constexpr float VALENCE_BOOST_POWER = 0.5f;
+
+		struct score_table
+		{
+			score_table()
+			{
+				for (int32 position = 0; position < CACHE_SIZE; position++)
+				{
+					if (position < 3)
+					{
+						cache_[position] = LAST_TRIANGLE_SCORE;
+					}
+					else
+					{
+						const float scaler = 1.0f / static_cast<float>(CACHE_SIZE - 3);
+						cache_[position] = std::pow(1.0f - static_cast<float>(position - 3) * scaler, CACHE_DECAY_POWER);
+					}
+				}
+
+				valence_[0] = 0.0f;
+				for (int32 valence = 1; valence <= MAX_VALENCE; valence++)
+				{
+					valence_[valence] = VALENCE_BOOST_SCALE * std::pow(static_cast<float>(valence), -VALENCE_BOOST_POWER);
+				}
+			}
+
+			// note: vertices without triangles left never attract a triangle
+			float score(const int32 position, const int32 valence) const
+			{
+				if (valence == 0)
+				{
+					return -1.0f;
+				}
+
+				const float cached = position >= 0 ? cache_[position] : 0.0f;
+				return cached + valence_[glm::min(valence, MAX_VALENCE)];
+			}
+
+			float cache_[CACHE_SIZE];
+			float valence_[MAX_VALENCE + 1];
+		};
+
+		const score_table &scores()
+		{
+			static const score_table table;
+			return table;
+		}
+
+		// note: numbers the distinct vertices of a list from zero so the work arrays only
+		//       have to cover the vertices the list uses, not the whole vertex buffer
+		template <typename T>
+		int32 compact_indices(const T *indices, const int32 index_count, dynamic_array<uint32> &local)
+		{
+			dynamic_array<uint32> distinct(indices, indices + index_count);
+			std::sort(distinct.begin(), distinct.end());
+			distinct.erase(std::unique(distinct.begin(), distinct.end()), distinct.end());
+
+			local.resize(index_count);
+			for (int32 index = 0; index < index_count; index++)
+			{
+				const auto found = std::lower_bound(distinct.begin(), distinct.end(), static_cast<uint32>(indices[index]));
+				local[index] = static_cast<uint32>(found - distinct.begin());
+			}
+
+			return static_cast<int32>(distinct.size());
+		}
+
+		// note: fifo where a vertex is cached while fewer than cache_size vertices have been
+		//       added after it, so nothing has to move
+		struct fifo_cache
+		{
+			fifo_cache(const int32 vertex_count, const int32 cache_size)
+				: cache_size_(cache_size)
+				, time_(cache_size + 1)
+				, added_(vertex_count, 0)
+			{
+			}
+
+			bool access(const uint32 vertex)
+			{
+				if (time_ - added_[vertex] < cache_size_)
+				{
+					return true;
+				}
+
+				added_[vertex] = ++time_;
+				return false;
+			}
+
+			void flush()
+			{
+				time_ += cache_size_;
+			}
+
+			int32 cache_size_;
+			int32 time_;
+			dynamic_array<int32> added_;
+		};
+
+		int32 count_misses(const dynamic_array<uint32> &local, const int32 vertex_count, const int32 cache_size)
+		{
+			fifo_cache cache(vertex_count, cache_size);
+
+			int32 result = 0;
+			for (const uint32 vertex : local)
+			{
+				result += cache.access(vertex) ? 0 : 1;
+			}
+
+			return result;
+		}
+
+		template <typename T>
+		vertex_cache_stats analyze(const T *indices, const int32 index_count, const int32 cache_size)
+		{
+			vertex_cache_stats result = {};
+			result.triangles_ = index_count / 3;
+			if (result.triangles_ == 0)
+			{
+				return result;
+			}
+
+			dynamic_array<uint32> local;
+			result.vertices_ = compact_indices(indices, result.triangles_ * 3, local);
+			result.misses_ = count_misses(local, result.vertices_, cache_size);
+
+			result.acmr_ = static_cast<float>(result.misses_) / static_cast<float>(result.triangles_);
+			result.atvr_ = static_cast<float>(result.misses_) / static_cast<float>(result.vertices_);
+			return result;
+		}
+
+		template <typename T>
+		void optimize_cache(T *indices, const int32 index_count)
+		{
+			const int32 triangle_count = index_count / 3;
+			if (triangle_count < 2)
+			{
+				return;
+			}
+
+			dynamic_array<uint32> local;
+			const int32 vertex_count = compact_indices(indices, triangle_count * 3, local);
+
+			// note: triangles of every vertex, the first valence[v] entries are the ones not emitted yet
+			dynamic_array<int32> valence(vertex_count, 0);
+			for (const uint32 vertex : local)
+			{
+				valence[vertex]++;
+			}
+
+			dynamic_array<int32> offsets(vertex_count + 1, 0);
+			for (int32 vertex = 0; vertex < vertex_count; vertex++)
+			{
+				offsets[vertex + 1] = offsets[vertex] + valence[vertex];
+			}
+
+			dynamic_array<int32> adjacency(triangle_count * 3);
+			{
+				dynamic_array<int32> fill(offsets.begin(), offsets.end() - 1);
+				for (int32 index = 0; index < triangle_count * 3; index++)
+				{
+					adjacency[fill[local[index]]++] = index / 3;
+				}
+			}
+
+			const score_table &table = scores();
+			dynamic_array<int32> cache_position(vertex_count, -1);
+			dynamic_array<float> vertex_scores(vertex_count);
+			for (int32 vertex = 0; vertex < vertex_count; vertex++)
+			{
+				vertex_scores[vertex] = table.score(-1, valence[vertex]);
+			}
+
+			int32 best = 0;
+			float best_score = -1.0f;
+			for (int32 triangle = 0; triangle < triangle_count; triangle++)
+			{
+				const uint32 *corners = &local[triangle * 3];
+				const float score = vertex_scores[corners[0]] + vertex_scores[corners[1]] + vertex_scores[corners[2]];
+				if (score > best_score)
+				{
+					best = triangle;
+					best_score = score;
+				}
+			}
+
+			dynamic_array<uint8> emitted(triangle_count, 0);
+			dynamic_array<T> result(triangle_count * 3);
+			dynamic_array<uint32> result_local(triangle_count * 3);
+			int32 cache[CACHE_SIZE + 3];
+			int32 cache_count = 0;
+			int32 cursor = 0;
+
+			for (int32 written = 0; written < triangle_count; written++)
+			{
+				// note: nothing in the cache has triangles left, carry on in the input order
+				if (best < 0)
+				{
+					while (emitted[cursor])
+					{
+						cursor++;
+					}
+					best = cursor;
+				}
+
+				const uint32 *corners = &local[best * 3];
+				for (int32 corner = 0; corner < 3; corner++)
+				{
+					result[written * 3 + corner] = indices[best * 3 + corner];
+					result_local[written * 3 + corner] = corners[corner];
+
+					const int32 vertex = corners[corner];
+					int32 *list = &adjacency[offsets[vertex]];
+					const int32 count = valence[vertex];
+					for (int32 index = 0; index < count; index++)
+					{
+						if (list[index] == best)
+						{
+							list[index] = list[count - 1];
+							list[count - 1] = best;
+							valence[vertex]--;
+							break;
+						}
+					}
+				}
+				emitted[best] = 1;
+
+				// note: the corners move to the front of the cache, the rest shift back
+				int32 next[CACHE_SIZE + 3];
+				int32 next_count = 0;
+				for (int32 corner = 0; corner < 3; corner++)
+				{
+					const int32 vertex = corners[corner];
+					if (std::find(next, next + next_count, vertex) == next + next_count)
+					{
+						next[next_count++] = vertex;
+					}
+				}
+
+				const int32 corner_count = next_count;
+				for (int32 index = 0; index < cache_count; index++)
+				{
+					const int32 vertex = cache[index];
+					if (std::find(next, next + corner_count, vertex) == next + corner_count)
+					{
+						next[next_count++] = vertex;
+					}
+				}
+
+				for (int32 index = 0; index < next_count; index++)
+				{
+					const int32 vertex = next[index];
+					cache_position[vertex] = index < CACHE_SIZE ? index : -1;
+					vertex_scores[vertex] = table.score(cache_position[vertex], valence[vertex]);
+				}
+
+				// note: only triangles touching the cache changed score, the best of them goes next
+				best = -1;
+				best_score = -1.0f;
+				for (int32 index = 0; index < next_count; index++)
+				{
+					const int32 vertex = next[index];
+					const int32 *list = &adjacency[offsets[vertex]];
+					for (int32 entry = 0; entry < valence[vertex]; entry++)
+					{
+						const int32 triangle = list[entry];
+						const uint32 *other = &local[triangle * 3];
+						const float score = vertex_scores[other[0]] + vertex_scores[other[1]] + vertex_scores[other[2]];
+						if (score > best_score)
+						{
+							best = triangle;
+							best_score = score;
+						}
+					}
+				}
+
+				cache_count = glm::min(next_count, CACHE_SIZE);
+				std::copy(next, next + cache_count, cache);
+			}
+
+			// note: small lists that already load every vertex once, like the rows of a narrow
+			//       grid chunk, can come out worse than they went in
+			if (count_misses(result_local, vertex_count, DEFAULT_VERTEX_CACHE_SIZE) >= count_misses(local, vertex_count, DEFAULT_VERTEX_CACHE_SIZE))
+			{
+				return;
+			}
+
+			std::copy(result.begin(), result.end(), indices);
+		}
+
+		template <typename T>
+		void optimize_clusters(T *indices, const int32 index_count, const glm::vec3 *positions, const int32 stride, const float threshold)
+		{
+			const int32 triangle_count = index_count / 3;
+			if (triangle_count < 2)
+			{
+				return;
+			}
+
+			auto position = [&](const T index) -> const glm::vec3 &
+			{
+				return *reinterpret_cast<const glm::vec3 *>(reinterpret_cast<const uint8 *>(positions) + static_cast<size_t>(index) * stride);
+			};
+
+			dynamic_array<uint32> local;
+			const int32 vertex_count = compact_indices(indices, triangle_count * 3, local);
+
+			// note: misses per triangle in the current order
+			dynamic_array<int32> misses(triangle_count, 0);
+			{
+				fifo_cache cache(vertex_count, DEFAULT_VERTEX_CACHE_SIZE);
+				for (int32 index = 0; index < triangle_count * 3; index++)
+				{
+					misses[index / 3] += cache.access(local[index]) ? 0 : 1;
+				}
+			}
+			const int32 total_misses = std::accumulate(misses.begin(), misses.end(), 0);
+
+			// note: hard boundaries where a triangle misses all its vertices, the order before
+			//       it does not help the cache. soft ones inside them once the running acmr of a
+			//       cluster, starting cold, is down to threshold times the acmr of the whole list
+			const float target = threshold * static_cast<float>(total_misses) / static_cast<float>(triangle_count);
+
+			dynamic_array<int32> clusters;
+			{
+				fifo_cache cache(vertex_count, DEFAULT_VERTEX_CACHE_SIZE);
+				int32 cluster_misses = 0;
+				int32 cluster_triangles = 0;
+				for (int32 triangle = 0; triangle < triangle_count; triangle++)
+				{
+					if (cluster_triangles == 0 || misses[triangle] == 3)
+					{
+						clusters.push_back(triangle);
+						cache.flush();
+						cluster_misses = 0;
+						cluster_triangles = 0;
+					}
+
+					for (int32 corner = 0; corner < 3; corner++)
+					{
+						cluster_misses += cache.access(local[triangle * 3 + corner]) ? 0 : 1;
+					}
+					cluster_triangles++;
+
+					if (static_cast<float>(cluster_misses) <= target * static_cast<float>(cluster_triangles))
+					{
+						cluster_triangles = 0;
+					}
+				}
+			}
+
+			const int32 cluster_count = static_cast<int32>(clusters.size());
+			if (cluster_count < 2)
+			{
+				return;
+			}
+			clusters.push_back(triangle_count);
+
+			// note: area weighted centroid and normal of every cluster
+			dynamic_array<glm::vec3> centroids(cluster_count, glm::vec3(0.0f));
+			dynamic_array<glm::vec3> normals(cluster_count, glm::vec3(0.0f));
+			glm::vec3 mesh_centroid(0.0f);
+			float mesh_area = 0.0f;
+			for (int32 cluster = 0; cluster < cluster_count; cluster++)
+			{
+				float area = 0.0f;
+				for (int32 triangle = clusters[cluster]; triangle < clusters[cluster + 1]; triangle++)
+				{
+					const glm::vec3 &p0 = position(indices[triangle * 3 + 0]);
+					const glm::vec3 &p1 = position(indices[triangle * 3 + 1]);
+					const glm::vec3 &p2 = position(indices[triangle * 3 + 2]);
+
+					const glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+					const float weight = glm::length(normal);
+
+					centroids[cluster] += (p0 + p1 + p2) * (weight / 3.0f);
+					normals[cluster] += normal;
+					area += weight;
+				}
+
+				mesh_centroid += centroids[cluster];
+				mesh_area += area;
+				centroids[cluster] = area > 0.0f ? centroids[cluster] / area : position(indices[clusters[cluster] * 3]);
+			}
+			mesh_centroid = mesh_area > 0.0f ? mesh_centroid / mesh_area : centroids[0];
+
+			// note: clusters facing out from the middle first
+			dynamic_array<float> keys(cluster_count);
+			dynamic_array<int32> order(cluster_count);
+			for (int32 cluster = 0; cluster < cluster_count; cluster++)
+			{
+				const float length = glm::length(normals[cluster]);
+				const glm::vec3 normal = length > 0.0f ? normals[cluster] / length : glm::vec3(0.0f);
+				keys[cluster] = glm::dot(centroids[cluster] - mesh_centroid, normal);
+				order[cluster] = cluster;
+			}
+
+			std::stable_sort(order.begin(), order.end(), [&](const int32 lhs, const int32 rhs)
+			{
+				return keys[lhs] > keys[rhs];
+			});
+
+			dynamic_array<T> result;
+			result.reserve(triangle_count * 3);
+			for (const int32 cluster : order)
+			{
+				result.insert(result.end(), indices + clusters[cluster] * 3, indices + clusters[cluster + 1] * 3);
+			}
+
+			std::copy(result.begin(), result.end(), indices);
+		}
+
+		template <typename T>
+		void optimize_fetch(T *indices, const int32 index_count, const int32 vertex_count, dynamic_array<uint32> &remap)
+		{
+			const uint32 unused = 0xffffffffu;
+			remap.assign(vertex_count, unused);
+
+			uint32 next = 0;
+			for (int32 index = 0; index < index_count; index++)
+			{
+				uint32 &target = remap[indices[index]];
+				if (target == unused)
+				{
+					target = next++;
+				}
+				indices[index] = static_cast<T>(target);
+			}
+
+			for (uint32 &target : remap)
+			{
+				if (target == unused)
+				{
+					target = next++;
+				}
+			}
+		}
+	} // !anon
+
+	vertex_cache_stats analyze_vertex_cache(const uint32 *indices, const int32 index_count, const int32 cache_size)
+	{
+		return analyze(indices, index_count, cache_size);
+	}
+
+	vertex_cache_stats analyze_vertex_cache(const uint16 *indices, const int32 index_count, const int32 cache_size)
+	{
+		return analyze(indices, index_count, cache_size);
+	}
+
+	vertex_cache_stats analyze_vertex_cache(const uint32 *indices, const dynamic_array<chunk> &chunks, const int32 cache_size)
+	{
+		vertex_cache_stats result = {};
+		for (const chunk &current : chunks)
+		{
+			const vertex_cache_stats stats = analyze(indices + current.start_index_, current.index_count_, cache_size);
+			result.triangles_ += stats.triangles_;
+			result.vertices_ += stats.vertices_;
+			result.misses_ += stats.misses_;
+		}
+
+		if (result.triangles_ > 0)
+		{
+			result.acmr_ = static_cast<float>(result.misses_) / static_cast<float>(result.triangles_);
+			result.atvr_ = static_cast<float>(result.misses_) / static_cast<float>(result.vertices_);
+		}
+
+		return result;
+	}
+
+	void optimize_vertex_cache(uint32 *indices, const int32 index_count)
+	{
+		optimize_cache(indices, index_count);
+	}
+
+	void optimize_vertex_cache(uint16 *indices, const int32 index_count)
+	{
+		optimize_cache(indices, index_count);
+	}
+
+	void optimize_vertex_cache(uint32 *indices, const dynamic_array<chunk> &chunks, worker_pool *pool)
+	{
+		parallel_for(pool, static_cast<int32>(chunks.size()), [&](const int32 index)
+		{
+			optimize_cache(indices + chunks[index].start_index_, chunks[index].index_count_);
+		});
+	}
+
+	void optimize_overdraw(uint32 *indices, const int32 index_count, const glm::vec3 *positions, const int32 stride, const float threshold)
+	{
+		optimize_clusters(indices, index_count, positions, stride, threshold);
+	}
+
+	void optimize_overdraw(uint16 *indices, const int32 index_count, const glm::vec3 *positions, const int32 stride, const float threshold)
+	{
+		optimize_clusters(indices, index_count, positions, stride, threshold);
+	}
+
+	void optimize_overdraw(uint32 *indices, const dynamic_array<chunk> &chunks, const glm::vec3 *positions, const int32 stride, const float threshold, worker_pool *pool)
+	{
+		parallel_for(pool, static_cast<int32>(chunks.size()), [&](const int32 index)
+		{
+			optimize_clusters(indices + chunks[index].start_index_, chunks[index].index_count_, positions, stride, threshold);
+		});
+	}
+
+	void optimize_vertex_fetch(uint32 *indices, const int32 index_count, const int32 vertex_count, dynamic_array<uint32> &remap)
+	{
+		optimize_fetch(indices, index_count, vertex_count, remap);
+	}
+
+	void optimize_vertex_fetch(uint16 *indices, const int32 index_count, const int32 vertex_count, dynamic_array<uint32> &remap)
+	{
+		optimize_fetch(indices, index_count, vertex_count, remap);
+	}
+
+	void remap_vertices(void *vertices, const int32 vertex_count, const int32 vertex_size, const dynamic_array<uint32> &remap)
+	{
+		const size_t size = static_cast<size_t>(vertex_size);
+		uint8 *dst = static_cast<uint8 *>(vertices);
+		const dynamic_array<uint8> src(dst, dst + static_cast<size_t>(vertex_count) * size);
+
+		for (int32 index = 0; index < vertex_count; index++)
+		{
+			std::memcpy(dst + remap[index] * size, src.data() + static_cast<size_t>(index) * size, size);
+		}
+	}
+} // !avocado
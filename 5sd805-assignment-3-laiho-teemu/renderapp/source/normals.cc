@@ -0,0 +1,181 @@
+// normals.cc
+
+#include "normals.hpp"
+
+#include <avocado_thread.hpp>
+
+#include <emmintrin.h>
+#if defined(__AVX__)
+#include <immintrin.h>
+#endif
+
+namespace avocado {
+	namespace
+	{
+		inline void store_normal(uint8 *dst, const float x, const float y, const float z)
+		{
+			glm::vec3 *normal = reinterpret_cast<glm::vec3 *>(dst);
+			normal->x = x;
+			normal->y = y;
+			normal->z = z;
+		}
+
+		// note: border samples and row tails
+		void normal_scalar(const heightfield &field, const int32 x, const int32 z, uint8 *dst)
+		{
+			const int32 xl = x > 0 ? x - 1 : x;
+			const int32 xr = x < field.width_ - 1 ? x + 1 : x;
+			const int32 zu = z > 0 ? z - 1 : z;
+			const int32 zd = z < field.height_ - 1 ? z + 1 : z;
+
+			const float sx = xr > xl ? 1.0f / static_cast<float>(xr - xl) : 0.0f;
+			const float sz = zd > zu ? 1.0f / static_cast<float>(zd - zu) : 0.0f;
+
+			const glm::vec3 normal = glm::normalize(glm::vec3((field.at(xl, z) - field.at(xr, z)) * sx,
+															  1.0f,
+															  (field.at(x, zu) - field.at(x, zd)) * sz));
+			store_normal(dst, normal.x, normal.y, normal.z);
+		}
+
+		void compute_row(const heightfield &field,
+						 const int32 x0,
+						 const int32 x1,
+						 const int32 z,
+						 uint8 *dst,
+						 const int32 stride)
+		{
+			const int32 width = field.width_;
+			const int32 zu = z > 0 ? z - 1 : z;
+			const int32 zd = z < field.height_ - 1 ? z + 1 : z;
+			const float sz = zd > zu ? 1.0f / static_cast<float>(zd - zu) : 0.0f;
+
+			const float *row = field.heights_.data() + static_cast<size_t>(z) * width;
+			const float *up = field.heights_.data() + static_cast<size_t>(zu) * width;
+			const float *down = field.heights_.data() + static_cast<size_t>(zd) * width;
+
+			int32 x = x0;
+			for (; x < x1 && x < 1; x++)
+			{
+				normal_scalar(field, x, z, dst + (x - x0) * stride);
+			}
+
+			// note: interior samples have both x neighbours, four or eight at a time
+			const int32 end = glm::min(x1, width - 1);
+			alignas(32) float nx[8];
+			alignas(32) float ny[8];
+			alignas(32) float nz[8];
+
+#if defined(__AVX__)
+			{
+				const __m256 half = _mm256_set1_ps(0.5f);
+				const __m256 one = _mm256_set1_ps(1.0f);
+				const __m256 scale_z = _mm256_set1_ps(sz);
+				for (; x + 8 <= end; x += 8)
+				{
+					const __m256 dx = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(row + x - 1), _mm256_loadu_ps(row + x + 1)), half);
+					const __m256 dz = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(up + x), _mm256_loadu_ps(down + x)), scale_z);
+					const __m256 length = _mm256_sqrt_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dz, dz)), one));
+					const __m256 inverse = _mm256_div_ps(one, length);
+
+					_mm256_store_ps(nx, _mm256_mul_ps(dx, inverse));
+					_mm256_store_ps(ny, inverse);
+					_mm256_store_ps(nz, _mm256_mul_ps(dz, inverse));
+					for (int32 lane = 0; lane < 8; lane++)
+					{
+						store_normal(dst + (x - x0 + lane) * stride, nx[lane], ny[lane], nz[lane]);
+					}
+				}
+			}
+#endif
+
+			{
+				const __m128 half = _mm_set1_ps(0.5f);
+				const __m128 one = _mm_set1_ps(1.0f);
+				const __m128 scale_z = _mm_set1_ps(sz);
+				for (; x + 4 <= end; x += 4)
+				{
+					const __m128 dx = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(row + x - 1), _mm_loadu_ps(row + x + 1)), half);
+					const __m128 dz = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(up + x), _mm_loadu_ps(down + x)), scale_z);
+					const __m128 length = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dz, dz)), one));
+					const __m128 inverse = _mm_div_ps(one, length);
+
+					_mm_store_ps(nx, _mm_mul_ps(dx, inverse));
+					_mm_store_ps(ny, inverse);
+					_mm_store_ps(nz, _mm_mul_ps(dz, inverse));
+					for (int32 lane = 0; lane < 4; lane++)
+					{
+						store_normal(dst + (x - x0 + lane) * stride, nx[lane], ny[lane], nz[lane]);
+					}
+				}
+			}
+
+			for (; x < x1; x++)
+			{
+				normal_scalar(field, x, z, dst + (x - x0) * stride);
+			}
+		}
+	}
+
+	void compute_normals(const heightfield &field,
+						 const int32 x0,
+						 const int32 z0,
+						 const int32 x1,
+						 const int32 z1,
+						 glm::vec3 *dst,
+						 const int32 stride,
+						 const int32 pitch)
+	{
+		assert(x0 >= 0 && z0 >= 0 && x1 <= field.width_ && z1 <= field.height_);
+
+		uint8 *base = reinterpret_cast<uint8 *>(dst);
+		for (int32 z = z0; z < z1; z++)
+		{
+			compute_row(field, x0, x1, z, base + static_cast<size_t>(z - z0) * pitch, stride);
+		}
+	}
+
+	void compute_normals(const heightfield &field,
+						 glm::vec3 *dst,
+						 const int32 stride,
+						 worker_pool *pool)
+	{
+		// note: bands of 64 rows keep each job's output contiguous
+		const int32 band_rows = 64;
+		const int32 band_count = (field.height_ + band_rows - 1) / band_rows;
+		const int32 pitch = field.width_ * stride;
+
+		parallel_for(pool, band_count, [&](const int32 band)
+		{
+			const int32 z0 = band * band_rows;
+			const int32 z1 = glm::min(z0 + band_rows, field.height_);
+			uint8 *first = reinterpret_cast<uint8 *>(dst) + static_cast<size_t>(z0) * pitch;
+			compute_normals(field, 0, z0, field.width_, z1, reinterpret_cast<glm::vec3 *>(first), stride, pitch);
+		});
+	}
+
+	glm::vec2 octahedral_encode(const glm::vec3 &normal)
+	{
+		const glm::vec3 n = normal / (glm::abs(normal.x) + glm::abs(normal.y) + glm::abs(normal.z));
+		if (n.y >= 0.0f)
+		{
+			return glm::vec2(n.x, n.z);
+		}
+
+		// note: lower hemisphere folds over the diagonals
+		return glm::vec2((1.0f - glm::abs(n.z)) * (n.x >= 0.0f ? 1.0f : -1.0f),
+						 (1.0f - glm::abs(n.x)) * (n.z >= 0.0f ? 1.0f : -1.0f));
+	}
+
+	glm::vec3 octahedral_decode(const glm::vec2 &encoded)
+	{
+		glm::vec3 n(encoded.x, 1.0f - glm::abs(encoded.x) - glm::abs(encoded.y), encoded.y);
+		if (n.y < 0.0f)
+		{
+			const float x = n.x;
+			n.x = (1.0f - glm::abs(n.z)) * (x >= 0.0f ? 1.0f : -1.0f);
+			n.z = (1.0f - glm::abs(x)) * (n.z >= 0.0f ? 1.0f : -1.0f);
+		}
+
+		return glm::normalize(n);
+	}
+} // !avocado
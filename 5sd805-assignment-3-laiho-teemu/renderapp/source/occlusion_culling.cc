@@ -0,0 +1,455 @@
+// occlusion_culling.cc
+
+#include "occlusion_culling.hpp"
+#include "culling.hpp"
+
+#include <avocado_thread.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include <emmintrin.h>
+
+namespace avocado {
+	namespace
+	{
+		// note: vertices, triangles or bounds per job
+		constexpr int32 BATCH_SIZE = 1024;
+
+		// note: w of vertices in front of the near plane, their triangles are left out
+		constexpr float CLIPPED = -1.0f;
+
+		bool setup_triangle(const glm::vec4 &v0, const glm::vec4 &v1, const glm::vec4 &v2,
+							const int32 width, const int32 height, occlusion_buffer::triangle &result)
+		{
+			if (v0.w <= 0.0f || v1.w <= 0.0f || v2.w <= 0.0f)
+			{
+				return false;
+			}
+
+			const float det = (v1.x - v0.x) * (v2.y - v0.y) - (v2.x - v0.x) * (v1.y - v0.y);
+			if (std::abs(det) < 1e-6f)
+			{
+				return false;
+			}
+
+			result.min_x_ = glm::max(static_cast<int32>(std::floor(glm::min(v0.x, glm::min(v1.x, v2.x)))), 0);
+			result.min_y_ = glm::max(static_cast<int32>(std::floor(glm::min(v0.y, glm::min(v1.y, v2.y)))), 0);
+			result.max_x_ = glm::min(static_cast<int32>(std::ceil(glm::max(v0.x, glm::max(v1.x, v2.x)))), width - 1);
+			result.max_y_ = glm::min(static_cast<int32>(std::ceil(glm::max(v0.y, glm::max(v1.y, v2.y)))), height - 1);
+			if (result.min_x_ > result.max_x_ || result.min_y_ > result.max_y_)
+			{
+				return false;
+			}
+
+			// note: edge from a to b, the third corner is on the positive side
+			const float sign = det > 0.0f ? 1.0f : -1.0f;
+			const glm::vec4 *corners[3] = { &v0, &v1, &v2 };
+			for (int32 edge = 0; edge < 3; edge++)
+			{
+				const glm::vec4 &a = *corners[edge];
+				const glm::vec4 &b = *corners[(edge + 1) % 3];
+				result.edges_[edge][0] = (a.y - b.y) * sign;
+				result.edges_[edge][1] = (b.x - a.x) * sign;
+				result.edges_[edge][2] = (a.x * b.y - a.y * b.x) * sign;
+			}
+
+			// note: the plane through the corner depths, moved back by the most it changes
+			//       between a pixel centre and the pixel corners
+			const float dx = ((v1.z - v0.z) * (v2.y - v0.y) - (v2.z - v0.z) * (v1.y - v0.y)) / det;
+			const float dy = ((v2.z - v0.z) * (v1.x - v0.x) - (v1.z - v0.z) * (v2.x - v0.x)) / det;
+			result.depth_[0] = dx;
+			result.depth_[1] = dy;
+			result.depth_[2] = v0.z - dx * v0.x - dy * v0.y + 0.5f * (std::abs(dx) + std::abs(dy));
+			result.farthest_ = glm::max(v0.z, glm::max(v1.z, v2.z));
+
+			return true;
+		}
+
+		void rasterize(const occlusion_buffer::triangle &current, const int32 y0, const int32 y1, const int32 width, float *depth)
+		{
+			const __m128 offsets = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+			const __m128 zero = _mm_setzero_ps();
+			const __m128 a0 = _mm_set1_ps(current.edges_[0][0]);
+			const __m128 a1 = _mm_set1_ps(current.edges_[1][0]);
+			const __m128 a2 = _mm_set1_ps(current.edges_[2][0]);
+			const __m128 da = _mm_set1_ps(current.depth_[0]);
+			const __m128 farthest = _mm_set1_ps(current.farthest_);
+
+			// note: rows are multiples of four pixels, blocks never run past them
+			const int32 first_x = current.min_x_ & ~3;
+			for (int32 y = glm::max(current.min_y_, y0); y <= glm::min(current.max_y_, y1 - 1); y++)
+			{
+				const float centre_y = static_cast<float>(y) + 0.5f;
+				const __m128 row0 = _mm_set1_ps(current.edges_[0][1] * centre_y + current.edges_[0][2]);
+				const __m128 row1 = _mm_set1_ps(current.edges_[1][1] * centre_y + current.edges_[1][2]);
+				const __m128 row2 = _mm_set1_ps(current.edges_[2][1] * centre_y + current.edges_[2][2]);
+				const __m128 row_depth = _mm_set1_ps(current.depth_[1] * centre_y + current.depth_[2]);
+
+				float *row = depth + static_cast<size_t>(y) * width;
+				for (int32 x = first_x; x <= current.max_x_; x += 4)
+				{
+					const __m128 centre_x = _mm_add_ps(_mm_set1_ps(static_cast<float>(x)), offsets);
+					const __m128 inside = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(a0, centre_x), row0), zero),
+																_mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(a1, centre_x), row1), zero)),
+													 _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(a2, centre_x), row2), zero));
+					if (_mm_movemask_ps(inside) == 0)
+					{
+						continue;
+					}
+
+					const __m128 z = _mm_min_ps(_mm_add_ps(_mm_mul_ps(da, centre_x), row_depth), farthest);
+					const __m128 previous = _mm_loadu_ps(row + x);
+					const __m128 nearest = _mm_min_ps(previous, z);
+					_mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, nearest), _mm_andnot_ps(inside, previous)));
+				}
+			}
+		}
+	} // !anon
+
+	occlusion_buffer::occlusion_buffer()
+		: width_(0)
+		, height_(0)
+		, tiles_x_(0)
+		, tiles_y_(0)
+		, viewprojection_(1.0f)
+	{
+	}
+
+	bool occlusion_buffer::is_valid() const
+	{
+		return !depth_.empty();
+	}
+
+	bool occlusion_buffer::create(const int32 width, const int32 height)
+	{
+		if (width < TILE_SIZE || height < TILE_SIZE || width % TILE_SIZE != 0 || height % TILE_SIZE != 0)
+		{
+			assert(!"occlusion buffer size has to be a multiple of the tile size!");
+			return false;
+		}
+
+		width_ = width;
+		height_ = height;
+		tiles_x_ = width / TILE_SIZE;
+		tiles_y_ = height / TILE_SIZE;
+
+		// note: nothing occludes until the first render
+		depth_.assign(static_cast<size_t>(width_) * height_, 1.0f);
+		tile_depth_.assign(static_cast<size_t>(tiles_x_) * tiles_y_, 1.0f);
+
+		return is_valid();
+	}
+
+	void occlusion_buffer::destroy()
+	{
+		dynamic_array<float>().swap(depth_);
+		dynamic_array<float>().swap(tile_depth_);
+		dynamic_array<glm::vec4>().swap(screen_);
+		dynamic_array<triangle>().swap(triangles_);
+		dynamic_array<uint8>().swap(flags_);
+		width_ = 0;
+		height_ = 0;
+		tiles_x_ = 0;
+		tiles_y_ = 0;
+	}
+
+	void occlusion_buffer::render(const glm::mat4 &viewprojection,
+								  const glm::vec3 *positions,
+								  const int32 vertex_count,
+								  const uint32 *indices,
+								  const int32 index_count,
+								  worker_pool *pool)
+	{
+		if (!is_valid())
+		{
+			return;
+		}
+
+		viewprojection_ = viewprojection;
+
+		const float half_width = static_cast<float>(width_) * 0.5f;
+		const float half_height = static_cast<float>(height_) * 0.5f;
+		screen_.resize(vertex_count);
+		parallel_for(pool, (vertex_count + BATCH_SIZE - 1) / BATCH_SIZE, [&](const int32 batch)
+		{
+			const int32 last = glm::min((batch + 1) * BATCH_SIZE, vertex_count);
+			for (int32 index = batch * BATCH_SIZE; index < last; index++)
+			{
+				const glm::vec4 clip = viewprojection * glm::vec4(positions[index], 1.0f);
+				if (clip.w <= 0.0f || clip.z < -clip.w)
+				{
+					screen_[index] = glm::vec4(0.0f, 0.0f, 0.0f, CLIPPED);
+					continue;
+				}
+
+				const float inverse_w = 1.0f / clip.w;
+				screen_[index] = glm::vec4((clip.x * inverse_w + 1.0f) * half_width,
+										   (clip.y * inverse_w + 1.0f) * half_height,
+										   clip.z * inverse_w,
+										   clip.w);
+			}
+		});
+
+		const int32 triangle_count = index_count / 3;
+		triangles_.resize(triangle_count);
+		flags_.resize(triangle_count);
+		parallel_for(pool, (triangle_count + BATCH_SIZE - 1) / BATCH_SIZE, [&](const int32 batch)
+		{
+			const int32 last = glm::min((batch + 1) * BATCH_SIZE, triangle_count);
+			for (int32 index = batch * BATCH_SIZE; index < last; index++)
+			{
+				const uint32 *corners = indices + index * 3;
+				flags_[index] = setup_triangle(screen_[corners[0]], screen_[corners[1]], screen_[corners[2]],
+											   width_, height_, triangles_[index]) ? 1 : 0;
+			}
+		});
+
+		int32 kept = 0;
+		for (int32 index = 0; index < triangle_count; index++)
+		{
+			if (flags_[index])
+			{
+				triangles_[kept++] = triangles_[index];
+			}
+		}
+		triangles_.resize(kept);
+
+		// note: every band owns its rows and the tiles in them, no two jobs write the same pixel
+		const int32 band_count = (height_ + BAND_ROWS - 1) / BAND_ROWS;
+		parallel_for(pool, band_count, [&](const int32 band)
+		{
+			const int32 y0 = band * BAND_ROWS;
+			const int32 y1 = glm::min(y0 + BAND_ROWS, height_);
+			float *depth = depth_.data();
+			std::fill(depth + static_cast<size_t>(y0) * width_, depth + static_cast<size_t>(y1) * width_, 1.0f);
+
+			for (const triangle &current : triangles_)
+			{
+				if (current.max_y_ >= y0 && current.min_y_ < y1)
+				{
+					rasterize(current, y0, y1, width_, depth);
+				}
+			}
+
+			for (int32 ty = y0 / TILE_SIZE; ty < y1 / TILE_SIZE; ty++)
+			{
+				for (int32 tx = 0; tx < tiles_x_; tx++)
+				{
+					float farthest = -1.0f;
+					for (int32 y = ty * TILE_SIZE; y < (ty + 1) * TILE_SIZE; y++)
+					{
+						const float *row = depth + static_cast<size_t>(y) * width_ + tx * TILE_SIZE;
+						for (int32 x = 0; x < TILE_SIZE; x++)
+						{
+							farthest = glm::max(farthest, row[x]);
+						}
+					}
+					tile_depth_[ty * tiles_x_ + tx] = farthest;
+				}
+			}
+		});
+	}
+
+	bool occlusion_buffer::is_visible(const glm::vec3 &min_corner, const glm::vec3 &max_corner) const
+	{
+		if (!is_valid())
+		{
+			return true;
+		}
+
+		// note: boxes reaching in front of the near plane are taken as visible
+		glm::vec3 lower(std::numeric_limits<float>::max());
+		glm::vec3 upper(-std::numeric_limits<float>::max());
+		for (int32 corner = 0; corner < 8; corner++)
+		{
+			const glm::vec3 position((corner & 1) ? max_corner.x : min_corner.x,
+									 (corner & 2) ? max_corner.y : min_corner.y,
+									 (corner & 4) ? max_corner.z : min_corner.z);
+			const glm::vec4 clip = viewprojection_ * glm::vec4(position, 1.0f);
+			if (clip.w <= 0.0f || clip.z < -clip.w)
+			{
+				return true;
+			}
+
+			const glm::vec3 projected = glm::vec3(clip) / clip.w;
+			lower = glm::min(lower, projected);
+			upper = glm::max(upper, projected);
+		}
+
+		const float half_width = static_cast<float>(width_) * 0.5f;
+		const float half_height = static_cast<float>(height_) * 0.5f;
+		const int32 x0 = glm::max(static_cast<int32>(std::floor((lower.x + 1.0f) * half_width)), 0);
+		const int32 y0 = glm::max(static_cast<int32>(std::floor((lower.y + 1.0f) * half_height)), 0);
+		const int32 x1 = glm::min(static_cast<int32>(std::floor((upper.x + 1.0f) * half_width)), width_ - 1);
+		const int32 y1 = glm::min(static_cast<int32>(std::floor((upper.y + 1.0f) * half_height)), height_ - 1);
+		if (x0 > x1 || y0 > y1)
+		{
+			return false;
+		}
+
+		const float nearest = lower.z;
+		for (int32 ty = y0 / TILE_SIZE; ty <= y1 / TILE_SIZE; ty++)
+		{
+			for (int32 tx = x0 / TILE_SIZE; tx <= x1 / TILE_SIZE; tx++)
+			{
+				// note: everything in the tile is nearer than the box
+				if (tile_depth_[ty * tiles_x_ + tx] < nearest)
+				{
+					continue;
+				}
+
+				const int32 last_y = glm::min(y1, ty * TILE_SIZE + TILE_SIZE - 1);
+				const int32 last_x = glm::min(x1, tx * TILE_SIZE + TILE_SIZE - 1);
+				for (int32 y = glm::max(y0, ty * TILE_SIZE); y <= last_y; y++)
+				{
+					const float *row = depth_.data() + static_cast<size_t>(y) * width_;
+					for (int32 x = glm::max(x0, tx * TILE_SIZE); x <= last_x; x++)
+					{
+						if (row[x] >= nearest)
+						{
+							return true;
+						}
+					}
+				}
+			}
+		}
+
+		return false;
+	}
+
+	int32 occlusion_buffer::cull(const box_bounds &bounds, dynamic_array<int32> &visible, worker_pool *pool)
+	{
+		const int32 count = static_cast<int32>(visible.size());
+		if (!is_valid() || count == 0)
+		{
+			return count;
+		}
+
+		flags_.resize(count);
+		parallel_for(pool, (count + BATCH_SIZE - 1) / BATCH_SIZE, [&](const int32 batch)
+		{
+			const int32 last = glm::min((batch + 1) * BATCH_SIZE, count);
+			for (int32 index = batch * BATCH_SIZE; index < last; index++)
+			{
+				const int32 item = visible[index];
+				const glm::vec3 center(bounds.center_x_[item], bounds.center_y_[item], bounds.center_z_[item]);
+				const glm::vec3 extent(bounds.extent_x_[item], bounds.extent_y_[item], bounds.extent_z_[item]);
+				flags_[index] = is_visible(center - extent, center + extent) ? 1 : 0;
+			}
+		});
+
+		int32 result = 0;
+		for (int32 index = 0; index < count; index++)
+		{
+			visible[result] = visible[index];
+			result += flags_[index];
+		}
+
+		visible.resize(result);
+		return result;
+	}
+
+	terrain_occluder::terrain_occluder()
+		: spacing_(0)
+		, columns_(0)
+		, rows_(0)
+	{
+	}
+
+	bool terrain_occluder::is_valid() const
+	{
+		return !indices_.empty();
+	}
+
+	bool terrain_occluder::create(const heightfield &field, const int32 spacing)
+	{
+		if (!field.is_valid() || field.width_ < 2 || field.height_ < 2 || spacing < 1)
+		{
+			assert(!"heightfield not created!");
+			return false;
+		}
+
+		spacing_ = spacing;
+		columns_ = (field.width_ - 2) / spacing + 2;
+		rows_ = (field.height_ - 2) / spacing + 2;
+
+		positions_.resize(static_cast<size_t>(columns_) * rows_);
+		for (int32 row = 0; row < rows_; row++)
+		{
+			for (int32 column = 0; column < columns_; column++)
+			{
+				positions_[row * columns_ + column] = glm::vec3(static_cast<float>(glm::min(column * spacing, field.width_ - 1)),
+																0.0f,
+																static_cast<float>(glm::min(row * spacing, field.height_ - 1)));
+			}
+		}
+		update(field, 0, 0, field.width_, field.height_);
+
+		indices_.clear();
+		indices_.reserve(static_cast<size_t>(columns_ - 1) * (rows_ - 1) * 6);
+		for (int32 row = 0; row + 1 < rows_; row++)
+		{
+			for (int32 column = 0; column + 1 < columns_; column++)
+			{
+				const uint32 corner = static_cast<uint32>(row * columns_ + column);
+				const uint32 below = corner + static_cast<uint32>(columns_);
+				indices_.push_back(corner);
+				indices_.push_back(below);
+				indices_.push_back(corner + 1);
+				indices_.push_back(corner + 1);
+				indices_.push_back(below);
+				indices_.push_back(below + 1);
+			}
+		}
+
+		return is_valid();
+	}
+
+	void terrain_occluder::destroy()
+	{
+		dynamic_array<glm::vec3>().swap(positions_);
+		dynamic_array<uint32>().swap(indices_);
+		spacing_ = 0;
+		columns_ = 0;
+		rows_ = 0;
+	}
+
+	void terrain_occluder::update(const heightfield &field, const int32 x0, const int32 z0, const int32 x1, const int32 z1)
+	{
+		if (positions_.empty())
+		{
+			return;
+		}
+
+		// note: a vertex covers the samples out to its neighbours, the quads on either
+		//       side of it stay below the lowest of them
+		const int32 first_column = glm::max(x0 / spacing_ - 1, 0);
+		const int32 first_row = glm::max(z0 / spacing_ - 1, 0);
+		const int32 last_column = glm::min((x1 - 1) / spacing_ + 1, columns_ - 1);
+		const int32 last_row = glm::min((z1 - 1) / spacing_ + 1, rows_ - 1);
+		for (int32 row = first_row; row <= last_row; row++)
+		{
+			const int32 sz0 = glm::min((row - 1) * spacing_, field.height_ - 1);
+			const int32 sz1 = glm::min((row + 1) * spacing_, field.height_ - 1);
+			for (int32 column = first_column; column <= last_column; column++)
+			{
+				const int32 sx0 = glm::min((column - 1) * spacing_, field.width_ - 1);
+				const int32 sx1 = glm::min((column + 1) * spacing_, field.width_ - 1);
+
+				float lowest = std::numeric_limits<float>::max();
+				for (int32 sz = glm::max(sz0, 0); sz <= sz1; sz++)
+				{
+					const float *heights = field.heights_.data() + static_cast<size_t>(sz) * field.width_;
+					for (int32 sx = glm::max(sx0, 0); sx <= sx1; sx++)
+					{
+						lowest = glm::min(lowest, heights[sx]);
+					}
+				}
+
+				positions_[row * columns_ + column].y = lowest;
+			}
+		}
+	}
+} // !avocado
@@ -0,0 +1,386 @@
+// rtin.cc
+
+#include "rtin.hpp"
+
+#include <avocado_thread.hpp>
+
+#include <cfloat>
+
+namespace avocado {
+	namespace
+	{
+		// note: long edge (a, b) of every triangle in the tree of a block, children after
+		//       their parents. the halves of single quads are leaves and not listed
+		void triangle_coordinates(const int32 block_size, dynamic_array<int32> &result)
+		{
+			const int32 count = block_size * block_size * 2 - 2;
+			result.resize(static_cast<size_t>(count) * 4);
+
+			for (int32 index = 0; index < count; index++)
+			{
+				int32 id = index + 2;
+				int32 ax = 0, ay = 0, bx = 0, by = 0, cx = 0, cy = 0;
+				if (id & 1)
+				{
+					bx = by = cx = block_size;
+				}
+				else
+				{
+					ax = ay = cy = block_size;
+				}
+
+				while ((id >>= 1) > 1)
+				{
+					const int32 mx = (ax + bx) >> 1;
+					const int32 my = (ay + by) >> 1;
+					if (id & 1)
+					{
+						bx = ax;
+						by = ay;
+						ax = cx;
+						ay = cy;
+					}
+					else
+					{
+						ax = bx;
+						ay = by;
+						bx = cx;
+						by = cy;
+					}
+					cx = mx;
+					cy = my;
+				}
+
+				int32 *coordinates = result.data() + index * 4;
+				coordinates[0] = ax;
+				coordinates[1] = ay;
+				coordinates[2] = bx;
+				coordinates[3] = by;
+			}
+		}
+
+		int32 edge_function(const int32 ax, const int32 ay, const int32 bx, const int32 by, const int32 px, const int32 py)
+		{
+			return (bx - ax) * (py - ay) - (by - ay) * (px - ax);
+		}
+
+		// note: largest vertical distance from the plane of the triangle to the samples inside it
+		float triangle_error(const heightfield &field,
+							 const int32 origin_x,
+							 const int32 origin_z,
+							 const int32 ax, const int32 ay,
+							 const int32 bx, const int32 by,
+							 const int32 cx, const int32 cy)
+		{
+			const int32 area = edge_function(ax, ay, bx, by, cx, cy);
+			const float ha = field.at(origin_x + ax, origin_z + ay);
+			const float hb = field.at(origin_x + bx, origin_z + by);
+			const float hc = field.at(origin_x + cx, origin_z + cy);
+			const float inverse_area = 1.0f / static_cast<float>(area);
+
+			const int32 x0 = glm::min(ax, glm::min(bx, cx));
+			const int32 x1 = glm::max(ax, glm::max(bx, cx));
+			const int32 y0 = glm::min(ay, glm::min(by, cy));
+			const int32 y1 = glm::max(ay, glm::max(by, cy));
+
+			float result = 0.0f;
+			for (int32 y = y0; y <= y1; y++)
+			{
+				for (int32 x = x0; x <= x1; x++)
+				{
+					const int32 wa = edge_function(bx, by, cx, cy, x, y);
+					const int32 wb = edge_function(cx, cy, ax, ay, x, y);
+					const int32 wc = edge_function(ax, ay, bx, by, x, y);
+					const bool covered = area > 0 ? (wa >= 0 && wb >= 0 && wc >= 0) : (wa <= 0 && wb <= 0 && wc <= 0);
+					if (!covered)
+					{
+						continue;
+					}
+
+					const float plane = (static_cast<float>(wa) * ha + static_cast<float>(wb) * hb + static_cast<float>(wc) * hc) * inverse_area;
+					result = glm::max(result, glm::abs(plane - field.at(origin_x + x, origin_z + y)));
+				}
+			}
+
+			return result;
+		}
+
+		// note: a split is at least as bad as the splits below it, so a triangle is only
+		//       kept whole when all of its descendants would be
+		void propagate_errors(const dynamic_array<int32> &coordinates, const int32 block_size, float *errors)
+		{
+			const int32 samples = block_size + 1;
+			const int32 parent_count = block_size * block_size - 2;
+
+			for (int32 index = parent_count - 1; index >= 0; index--)
+			{
+				const int32 *triangle = coordinates.data() + index * 4;
+				const int32 ax = triangle[0], ay = triangle[1], bx = triangle[2], by = triangle[3];
+				const int32 mx = (ax + bx) >> 1;
+				const int32 my = (ay + by) >> 1;
+				const int32 cx = mx + my - ay;
+				const int32 cy = my + ax - mx;
+
+				float &middle = errors[my * samples + mx];
+				middle = glm::max(middle, errors[((ay + cy) >> 1) * samples + ((ax + cx) >> 1)]);
+				middle = glm::max(middle, errors[((by + cy) >> 1) * samples + ((bx + cx) >> 1)]);
+			}
+		}
+
+		// note: one shared edge sample of two neighbouring blocks, true when either changed
+		bool merge_error(float &lhs, float &rhs)
+		{
+			if (lhs == rhs)
+			{
+				return false;
+			}
+
+			lhs = rhs = glm::max(lhs, rhs);
+			return true;
+		}
+	}
+
+	rtin::rtin()
+		: width_(0)
+		, height_(0)
+		, block_size_(0)
+		, blocks_x_(0)
+		, blocks_z_(0)
+	{
+	}
+
+	bool rtin::is_valid() const
+	{
+		return blocks_x_ > 0 && blocks_z_ > 0;
+	}
+
+	bool rtin::create(const heightfield &field, const int32 block_size, worker_pool *pool)
+	{
+		if (field.width_ < 2 || field.height_ < 2)
+		{
+			assert(!"heightfield dimensions not correct!");
+			return false;
+		}
+
+		if (block_size < 2 || (block_size & (block_size - 1)) != 0)
+		{
+			assert(!"block size has to be a power of two!");
+			return false;
+		}
+
+		width_ = field.width_;
+		height_ = field.height_;
+		block_size_ = block_size;
+		blocks_x_ = (width_ - 1 + block_size - 1) / block_size;
+		blocks_z_ = (height_ - 1 + block_size - 1) / block_size;
+
+		const int32 samples = block_size + 1;
+		const size_t block_stride = static_cast<size_t>(samples) * samples;
+		const int32 block_count = blocks_x_ * blocks_z_;
+		errors_.assign(block_stride * block_count, 0.0f);
+		bounds_.resize(block_count);
+
+		dynamic_array<int32> coordinates;
+		triangle_coordinates(block_size, coordinates);
+		const int32 triangle_count = block_size * block_size * 2 - 2;
+
+		parallel_for(pool, block_count, [&](const int32 block)
+		{
+			const int32 origin_x = (block % blocks_x_) * block_size;
+			const int32 origin_z = (block / blocks_x_) * block_size;
+			float *errors = errors_.data() + block_stride * block;
+
+			auto inside = [&](const int32 x, const int32 z)
+			{
+				return origin_x + x < width_ && origin_z + z < height_;
+			};
+
+			// note: largest height difference between each triangle and the samples it covers,
+			//       kept at the middle of its long edge where the split would add a vertex
+			for (int32 index = triangle_count - 1; index >= 0; index--)
+			{
+				const int32 *triangle = coordinates.data() + index * 4;
+				const int32 ax = triangle[0], ay = triangle[1], bx = triangle[2], by = triangle[3];
+				const int32 mx = (ax + bx) >> 1;
+				const int32 my = (ay + by) >> 1;
+				const int32 cx = mx + my - ay;
+				const int32 cy = my + ax - mx;
+
+				float error = FLT_MAX;
+				if (inside(ax, ay) && inside(bx, by) && inside(cx, cy))
+				{
+					error = triangle_error(field, origin_x, origin_z, ax, ay, bx, by, cx, cy);
+				}
+
+				float &middle = errors[my * samples + mx];
+				middle = glm::max(middle, error);
+			}
+
+			propagate_errors(coordinates, block_size, errors);
+
+			chunk &bounds = bounds_[block];
+			const int32 last_x = glm::min(origin_x + block_size, width_ - 1);
+			const int32 last_z = glm::min(origin_z + block_size, height_ - 1);
+			float lowest = field.at(origin_x, origin_z);
+			float highest = lowest;
+			for (int32 z = origin_z; z <= last_z; z++)
+			{
+				for (int32 x = origin_x; x <= last_x; x++)
+				{
+					lowest = glm::min(lowest, field.at(x, z));
+					highest = glm::max(highest, field.at(x, z));
+				}
+			}
+
+			bounds.start_index_ = 0;
+			bounds.index_count_ = 0;
+			bounds.base_vertex_ = 0;
+			bounds.min_corner_ = glm::vec3(static_cast<float>(origin_x), lowest, static_cast<float>(origin_z));
+			bounds.max_corner_ = glm::vec3(static_cast<float>(last_x), highest, static_cast<float>(last_z));
+		});
+
+		// note: samples on a block edge belong to triangles on both sides, both have to agree
+		//       on the split or the edge cracks. raising a sample can raise its parents, so
+		//       merging and propagating repeat until nothing changes
+		dynamic_array<uint8> dirty(block_count, 0);
+		for (;;)
+		{
+			bool changed = false;
+			for (int32 bz = 0; bz < blocks_z_; bz++)
+			{
+				for (int32 bx = 0; bx < blocks_x_; bx++)
+				{
+					const int32 block = bz * blocks_x_ + bx;
+					float *errors = errors_.data() + block_stride * block;
+
+					if (bx + 1 < blocks_x_)
+					{
+						float *right = errors + block_stride;
+						for (int32 z = 0; z < samples; z++)
+						{
+							if (merge_error(errors[z * samples + block_size], right[z * samples]))
+							{
+								dirty[block] = dirty[block + 1] = 1;
+								changed = true;
+							}
+						}
+					}
+
+					if (bz + 1 < blocks_z_)
+					{
+						float *below = errors + block_stride * blocks_x_;
+						for (int32 x = 0; x < samples; x++)
+						{
+							if (merge_error(errors[block_size * samples + x], below[x]))
+							{
+								dirty[block] = dirty[block + blocks_x_] = 1;
+								changed = true;
+							}
+						}
+					}
+				}
+			}
+
+			if (!changed)
+			{
+				break;
+			}
+
+			parallel_for(pool, block_count, [&](const int32 block)
+			{
+				if (dirty[block])
+				{
+					propagate_errors(coordinates, block_size, errors_.data() + block_stride * block);
+					dirty[block] = 0;
+				}
+			});
+		}
+
+		return is_valid();
+	}
+
+	void rtin::destroy()
+	{
+		width_ = 0;
+		height_ = 0;
+		block_size_ = 0;
+		blocks_x_ = 0;
+		blocks_z_ = 0;
+		dynamic_array<float>().swap(errors_);
+		dynamic_array<chunk>().swap(bounds_);
+	}
+
+	void rtin::triangulate(const float max_error, dynamic_array<uint32> &indices, dynamic_array<chunk> &chunks, worker_pool *pool) const
+	{
+		assert(is_valid());
+
+		const int32 block_count = blocks_x_ * blocks_z_;
+		dynamic_array<dynamic_array<uint32>> blocks(block_count);
+		parallel_for(pool, block_count, [&](const int32 block)
+		{
+			triangulate(block % blocks_x_, block / blocks_x_, max_error, blocks[block]);
+		});
+
+		indices.clear();
+		chunks.resize(block_count);
+		for (int32 block = 0; block < block_count; block++)
+		{
+			chunk &result = chunks[block];
+			result = bounds_[block];
+			result.start_index_ = static_cast<int32>(indices.size());
+			result.index_count_ = static_cast<int32>(blocks[block].size());
+			indices.insert(indices.end(), blocks[block].begin(), blocks[block].end());
+		}
+	}
+
+	void rtin::triangulate(const int32 block_x, const int32 block_z, const float max_error, dynamic_array<uint32> &indices) const
+	{
+		assert(is_valid());
+		assert(block_x >= 0 && block_x < blocks_x_ && block_z >= 0 && block_z < blocks_z_);
+
+		const int32 samples = block_size_ + 1;
+		const int32 origin_x = block_x * block_size_;
+		const int32 origin_z = block_z * block_size_;
+		const float *errors = errors_.data() + static_cast<size_t>(samples) * samples * (block_z * blocks_x_ + block_x);
+
+		struct triangle {
+			int32 ax, ay, bx, by, cx, cy;
+		};
+
+		dynamic_array<triangle> stack;
+		stack.push_back({ block_size_, block_size_, 0, 0, 0, block_size_ });
+		stack.push_back({ 0, 0, block_size_, block_size_, block_size_, 0 });
+
+		while (!stack.empty())
+		{
+			const triangle current = stack.back();
+			stack.pop_back();
+
+			const int32 mx = (current.ax + current.bx) >> 1;
+			const int32 my = (current.ay + current.by) >> 1;
+			const bool splittable = glm::abs(current.ax - current.cx) + glm::abs(current.ay - current.cy) > 1;
+			if (splittable && errors[my * samples + mx] > max_error)
+			{
+				stack.push_back({ current.bx, current.by, current.cx, current.cy, mx, my });
+				stack.push_back({ current.cx, current.cy, current.ax, current.ay, mx, my });
+				continue;
+			}
+
+			const int32 x[3] = { origin_x + current.ax, origin_x + current.bx, origin_x + current.cx };
+			const int32 z[3] = { origin_z + current.ay, origin_z + current.by, origin_z + current.cy };
+			if (glm::max(x[0], glm::max(x[1], x[2])) >= width_ || glm::max(z[0], glm::max(z[1], z[2])) >= height_)
+			{
+				continue;
+			}
+
+			// note: same winding as the heightmap index buffer
+			const int32 orientation = (x[1] - x[0]) * (z[2] - z[0]) - (z[1] - z[0]) * (x[2] - x[0]);
+			const int32 second = orientation < 0 ? 1 : 2;
+			const int32 third = orientation < 0 ? 2 : 1;
+
+			indices.push_back(static_cast<uint32>(z[0] * width_ + x[0]));
+			indices.push_back(static_cast<uint32>(z[second] * width_ + x[second]));
+			indices.push_back(static_cast<uint32>(z[third] * width_ + x[third]));
+		}
+	}
+} // !avocado
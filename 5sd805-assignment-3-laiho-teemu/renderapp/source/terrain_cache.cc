@@ -0,0 +1,363 @@
+// terrain_cache.cc
+
+#include "terrain_cache.hpp"
+
+#include <cstring>
+
+namespace avocado {
+	namespace
+	{
+		// note: heights, vertices, template indices, template chunks, indices and chunks
+		const int32 SECTION_COUNT = 6;
+
+		uint64 align_offset(const uint64 offset)
+		{
+			const uint64 mask = terrain_cache::SECTION_ALIGNMENT - 1;
+			return (offset + mask) & ~mask;
+		}
+
+		// note: reserves room for the section at the end of the file, end is moved past it
+		terrain_cache::section place_section(uint64 &end, const size_t count, const size_t element_size)
+		{
+			terrain_cache::section result = {};
+			if (count == 0)
+			{
+				return result;
+			}
+
+			result.offset_ = align_offset(end);
+			result.count_ = count;
+			end = result.offset_ + count * element_size;
+
+			return result;
+		}
+
+		bool write_section(file_writer &writer, const terrain_cache::section &section, const void *data, const size_t element_size)
+		{
+			if (section.count_ == 0)
+			{
+				return true;
+			}
+
+			return writer.pad(static_cast<int64>(section.offset_) - writer.offset()) &&
+				writer.write(data, static_cast<int64>(section.count_ * element_size));
+		}
+
+		bool is_same(const terrain_cache::params &lhs, const terrain_cache::params &rhs)
+		{
+			return lhs.height_scale_ == rhs.height_scale_ &&
+				lhs.height_offset_ == rhs.height_offset_ &&
+				lhs.chunk_size_ == rhs.chunk_size_ &&
+				lhs.occlusion_ == rhs.occlusion_;
+		}
+
+		bool is_section_inside(const terrain_cache::section &section, const size_t element_size, const int64 file_size)
+		{
+			if (section.count_ == 0)
+			{
+				return true;
+			}
+
+			const uint64 size = static_cast<uint64>(file_size);
+			if (section.offset_ % terrain_cache::SECTION_ALIGNMENT != 0 || section.offset_ > size)
+			{
+				return false;
+			}
+
+			return section.count_ <= (size - section.offset_) / element_size;
+		}
+
+		// note: the sections are written straight from their arrays in file order, a file
+		//       cut short by a failed write does not pass the size checks of create
+		bool write_content(const char *filename,
+						   const terrain_cache::header &header,
+						   const void *const (&sections)[SECTION_COUNT],
+						   const size_t (&element_sizes)[SECTION_COUNT])
+		{
+			file_writer writer;
+			if (!writer.create(filename, true))
+			{
+				return false;
+			}
+
+			const terrain_cache::section *placed[SECTION_COUNT] =
+			{
+				&header.heights_,
+				&header.vertices_,
+				&header.template_indices_,
+				&header.template_chunks_,
+				&header.indices_,
+				&header.chunks_,
+			};
+
+			bool result = writer.write(&header, sizeof(header));
+			for (int32 index = 0; result && index < SECTION_COUNT; index++)
+			{
+				result = write_section(writer, *placed[index], sections[index], element_sizes[index]);
+			}
+
+			writer.destroy();
+
+			return result;
+		}
+	}
+
+	// static
+	uint64 terrain_cache::hash(const void *data, const int64 size)
+	{
+		const uint8 *bytes = static_cast<const uint8 *>(data);
+
+		uint64 result = 0xcbf29ce484222325ull;
+		for (int64 index = 0; index < size; index++)
+		{
+			result ^= bytes[index];
+			result *= 0x100000001b3ull;
+		}
+
+		return result;
+	}
+
+	// static
+	bool terrain_cache::hash_file(const char *filename, uint64 &result)
+	{
+		mapped_file source;
+		if (!source.create(filename))
+		{
+			return false;
+		}
+
+		result = hash(source.data(), source.size());
+
+		source.destroy();
+
+		return true;
+	}
+
+	// static
+	bool terrain_cache::write(const char *filename, const uint64 source_hash, const params &build_params, const heightfield &field)
+	{
+		if (!field.is_valid())
+		{
+			assert(!"heightfield not created!");
+			return false;
+		}
+
+		header header = {};
+		header.magic_ = MAGIC;
+		header.version_ = VERSION;
+		header.source_hash_ = source_hash;
+		header.width_ = field.width_;
+		header.height_ = field.height_;
+		header.params_ = build_params;
+		header.height_scale_ = 1.0f;
+
+		uint64 end = sizeof(header);
+		header.heights_ = place_section(end, field.heights_.size(), sizeof(float));
+
+		const void *const sections[SECTION_COUNT] = { field.heights_.data() };
+		const size_t element_sizes[SECTION_COUNT] = { sizeof(float) };
+
+		return write_content(filename, header, sections, element_sizes);
+	}
+
+	// static
+	bool terrain_cache::write(const char *filename,
+							  const uint64 source_hash,
+							  const params &build_params,
+							  const heightfield &field,
+							  const heightmap &map,
+							  const dynamic_array<terrain_vertex> &vertices,
+							  const dynamic_array<uint32> &indices,
+							  const heightmap::chunk_template &chunk_template)
+	{
+		if (!field.is_valid())
+		{
+			assert(!"heightfield not created!");
+			return false;
+		}
+
+		const size_t vertex_count = chunk_template.indices_.empty()
+			? static_cast<size_t>(field.width_) * field.height_
+			: static_cast<size_t>(chunk_template.chunks_x_) * chunk_template.chunks_z_ * chunk_template.block_size();
+		if (vertices.size() != vertex_count)
+		{
+			assert(!"vertices do not match the heightfield!");
+			return false;
+		}
+
+		header header = {};
+		header.magic_ = MAGIC;
+		header.version_ = VERSION;
+		header.source_hash_ = source_hash;
+		header.params_ = build_params;
+		header.width_ = field.width_;
+		header.height_ = field.height_;
+		header.height_offset_ = map.height_offset;
+		header.height_scale_ = map.height_scale;
+		header.index_count_ = map.index_count;
+		header.chunk_size_ = chunk_template.chunk_size_;
+		header.chunks_x_ = chunk_template.chunks_x_;
+		header.chunks_z_ = chunk_template.chunks_z_;
+		header.edge_start_ = chunk_template.edge_start_;
+
+		uint64 end = sizeof(header);
+		header.heights_ = place_section(end, field.heights_.size(), sizeof(float));
+		header.vertices_ = place_section(end, vertices.size(), sizeof(terrain_vertex));
+		header.template_indices_ = place_section(end, chunk_template.indices_.size(), sizeof(uint16));
+		header.template_chunks_ = place_section(end, chunk_template.chunks_.size(), sizeof(chunk));
+		if (chunk_template.indices_.empty())
+		{
+			header.indices_ = place_section(end, indices.size(), sizeof(uint32));
+		}
+		header.chunks_ = place_section(end, map.chunks.size(), sizeof(chunk));
+
+		const void *const sections[SECTION_COUNT] =
+		{
+			field.heights_.data(),
+			vertices.data(),
+			chunk_template.indices_.data(),
+			chunk_template.chunks_.data(),
+			indices.data(),
+			map.chunks.data(),
+		};
+		const size_t element_sizes[SECTION_COUNT] =
+		{
+			sizeof(float),
+			sizeof(terrain_vertex),
+			sizeof(uint16),
+			sizeof(chunk),
+			sizeof(uint32),
+			sizeof(chunk),
+		};
+
+		return write_content(filename, header, sections, element_sizes);
+	}
+
+	terrain_cache::terrain_cache()
+		: header_(nullptr)
+	{
+	}
+
+	bool terrain_cache::is_valid() const
+	{
+		return header_ != nullptr;
+	}
+
+	bool terrain_cache::create(const char *filename, const uint64 source_hash, const params &build_params)
+	{
+		if (!file_system::exists(filename))
+		{
+			return false;
+		}
+
+		if (!file_.create(filename))
+		{
+			return false;
+		}
+
+		// note: a stale or damaged cache is not an error, the caller rebuilds it
+		const header *candidate = reinterpret_cast<const header *>(file_.data());
+		const bool valid = file_.size() >= static_cast<int64>(sizeof(header)) &&
+			candidate->magic_ == MAGIC &&
+			candidate->version_ == VERSION &&
+			candidate->source_hash_ == source_hash &&
+			is_same(candidate->params_, build_params) &&
+			candidate->width_ > 0 &&
+			candidate->height_ > 0 &&
+			candidate->heights_.count_ == static_cast<uint64>(candidate->width_) * static_cast<uint64>(candidate->height_) &&
+			(candidate->vertices_.count_ == 0 ||
+			 candidate->vertices_.count_ == (candidate->chunk_size_ > 0
+				? static_cast<uint64>(candidate->chunks_x_) * static_cast<uint64>(candidate->chunks_z_) *
+				  static_cast<uint64>((candidate->chunk_size_ + 1) * (candidate->chunk_size_ + 1))
+				: candidate->heights_.count_)) &&
+			is_section_inside(candidate->heights_, sizeof(float), file_.size()) &&
+			is_section_inside(candidate->vertices_, sizeof(terrain_vertex), file_.size()) &&
+			is_section_inside(candidate->template_indices_, sizeof(uint16), file_.size()) &&
+			is_section_inside(candidate->template_chunks_, sizeof(chunk), file_.size()) &&
+			is_section_inside(candidate->indices_, sizeof(uint32), file_.size()) &&
+			is_section_inside(candidate->chunks_, sizeof(chunk), file_.size());
+		if (!valid)
+		{
+			file_.destroy();
+			return false;
+		}
+
+		header_ = candidate;
+
+		return is_valid();
+	}
+
+	void terrain_cache::destroy()
+	{
+		header_ = nullptr;
+		file_.destroy();
+	}
+
+	bool terrain_cache::has_mesh() const
+	{
+		assert(is_valid());
+		return header_->vertices_.count_ > 0 &&
+			(header_->template_indices_.count_ > 0 || header_->indices_.count_ > 0);
+	}
+
+	bool terrain_cache::load(heightfield &field) const
+	{
+		assert(is_valid());
+
+		if (!field.create(header_->width_, header_->height_))
+		{
+			return false;
+		}
+
+		memcpy(field.heights_.data(), file_.data() + header_->heights_.offset_, field.heights_.size() * sizeof(float));
+
+		return true;
+	}
+
+	bool terrain_cache::load(heightmap &map, heightmap::chunk_template &chunk_template) const
+	{
+		assert(is_valid());
+
+		if (!has_mesh())
+		{
+			return false;
+		}
+
+		map.image_width = header_->width_;
+		map.image_height = header_->height_;
+		map.vertex_count = static_cast<int32>(header_->vertices_.count_);
+		map.index_count = header_->index_count_;
+		map.height_offset = header_->height_offset_;
+		map.height_scale = header_->height_scale_;
+
+		const chunk *chunks = reinterpret_cast<const chunk *>(file_.data() + header_->chunks_.offset_);
+		map.chunks.assign(chunks, chunks + header_->chunks_.count_);
+
+		chunk_template.chunk_size_ = header_->chunk_size_;
+		chunk_template.chunks_x_ = header_->chunks_x_;
+		chunk_template.chunks_z_ = header_->chunks_z_;
+		chunk_template.edge_start_ = header_->edge_start_;
+		chunk_template.grid_width_ = header_->width_;
+		chunk_template.grid_height_ = header_->height_;
+
+		const uint16 *template_indices = reinterpret_cast<const uint16 *>(file_.data() + header_->template_indices_.offset_);
+		chunk_template.indices_.assign(template_indices, template_indices + header_->template_indices_.count_);
+
+		const chunk *template_chunks = reinterpret_cast<const chunk *>(file_.data() + header_->template_chunks_.offset_);
+		chunk_template.chunks_.assign(template_chunks, template_chunks + header_->template_chunks_.count_);
+
+		return true;
+	}
+
+	const terrain_vertex *terrain_cache::vertices() const
+	{
+		assert(is_valid());
+		return reinterpret_cast<const terrain_vertex *>(file_.data() + header_->vertices_.offset_);
+	}
+
+	const uint32 *terrain_cache::indices() const
+	{
+		assert(is_valid());
+		return reinterpret_cast<const uint32 *>(file_.data() + header_->indices_.offset_);
+	}
+} // !avocado
@@ -0,0 +1,434 @@
+// terrain_editor.cc
+
+#include "terrain_editor.hpp"
+#include "terrain_query.hpp"
+#include "normals.hpp"
+
+#include <cmath>
+
+namespace avocado {
+	namespace
+	{
+		bool overlaps_or_touches(const terrain_editor::rect &a, const terrain_editor::rect &b)
+		{
+			return a.x0_ <= b.x1_ && b.x0_ <= a.x1_ && a.z0_ <= b.z1_ && b.z0_ <= a.z1_;
+		}
+
+		// note: strokes mostly land on or next to the previous one, so rectangles that meet
+		//       are joined and a sample is never uploaded twice in one flush
+		void add_dirty(dynamic_array<terrain_editor::rect> &dirty, terrain_editor::rect area)
+		{
+			size_t index = 0;
+			while (index < dirty.size())
+			{
+				const terrain_editor::rect &other = dirty[index];
+				if (!overlaps_or_touches(area, other))
+				{
+					index++;
+					continue;
+				}
+
+				area.x0_ = glm::min(area.x0_, other.x0_);
+				area.z0_ = glm::min(area.z0_, other.z0_);
+				area.x1_ = glm::max(area.x1_, other.x1_);
+				area.z1_ = glm::max(area.z1_, other.z1_);
+
+				// note: the grown rectangle may now meet one that was already checked
+				dirty[index] = dirty.back();
+				dirty.pop_back();
+				index = 0;
+			}
+
+			dirty.push_back(area);
+		}
+
+		// note: chunk (cx, cz) covers the samples cx * chunk_size .. cx * chunk_size + chunk_size
+		//       inclusive, so a sample on a chunk edge belongs to both neighbours
+		void update_bounds(dynamic_array<chunk> &chunks, const int32 chunk_size, const heightfield &field, const terrain_editor::rect &area)
+		{
+			const int32 quads_x = field.width_ - 1;
+			const int32 quads_z = field.height_ - 1;
+			const int32 chunks_x = (quads_x + chunk_size - 1) / chunk_size;
+			const int32 chunks_z = (quads_z + chunk_size - 1) / chunk_size;
+			if (static_cast<int32>(chunks.size()) != chunks_x * chunks_z)
+			{
+				assert(!"chunks do not match the chunk size!");
+				return;
+			}
+
+			const int32 first_x = glm::max(area.x0_ - 1, 0) / chunk_size;
+			const int32 first_z = glm::max(area.z0_ - 1, 0) / chunk_size;
+			const int32 last_x = glm::min((area.x1_ - 1) / chunk_size, chunks_x - 1);
+			const int32 last_z = glm::min((area.z1_ - 1) / chunk_size, chunks_z - 1);
+
+			for (int32 cz = first_z; cz <= last_z; cz++)
+			{
+				const int32 z0 = cz * chunk_size;
+				const int32 z1 = glm::min(z0 + chunk_size, quads_z);
+				for (int32 cx = first_x; cx <= last_x; cx++)
+				{
+					const int32 x0 = cx * chunk_size;
+					const int32 x1 = glm::min(x0 + chunk_size, quads_x);
+
+					float lowest = field.heights_[static_cast<size_t>(z0) * field.width_ + x0];
+					float highest = lowest;
+					for (int32 z = z0; z <= z1; z++)
+					{
+						const float *row = field.heights_.data() + static_cast<size_t>(z) * field.width_;
+						for (int32 x = x0; x <= x1; x++)
+						{
+							lowest = glm::min(lowest, row[x]);
+							highest = glm::max(highest, row[x]);
+						}
+					}
+
+					chunk &current = chunks[cz * chunks_x + cx];
+					current.min_corner_.y = lowest;
+					current.max_corner_.y = highest;
+				}
+			}
+		}
+
+		// note: samples on a chunk edge are in the blocks of both neighbours, rows that
+		//       span a whole block follow each other and go up in one range
+		void upload_blocks(vertex_buffer &buffer, const heightmap::chunk_template &layout, const terrain_editor::rect &area, const terrain_vertex *staging)
+		{
+			const int32 size = layout.chunk_size_;
+			const int32 columns = area.x1_ - area.x0_;
+			const int32 vertex_size = static_cast<int32>(sizeof(terrain_vertex));
+
+			const int32 first_x = glm::max(area.x0_ - 1, 0) / size;
+			const int32 first_z = glm::max(area.z0_ - 1, 0) / size;
+			const int32 last_x = glm::min((area.x1_ - 1) / size, layout.chunks_x_ - 1);
+			const int32 last_z = glm::min((area.z1_ - 1) / size, layout.chunks_z_ - 1);
+
+			for (int32 cz = first_z; cz <= last_z; cz++)
+			{
+				const int32 z0 = glm::max(area.z0_, cz * size);
+				const int32 z1 = glm::min(area.z1_, cz * size + size + 1);
+				for (int32 cx = first_x; cx <= last_x; cx++)
+				{
+					const int32 x0 = glm::max(area.x0_, cx * size);
+					const int32 x1 = glm::min(area.x1_, cx * size + size + 1);
+					if (x0 >= x1 || z0 >= z1)
+					{
+						continue;
+					}
+
+					if (x1 - x0 == size + 1 && columns == size + 1)
+					{
+						buffer.update(layout.vertex_index(cx, cz, x0, z0) * vertex_size,
+									  (z1 - z0) * (size + 1) * vertex_size,
+									  staging + (z0 - area.z0_) * columns);
+						continue;
+					}
+
+					for (int32 z = z0; z < z1; z++)
+					{
+						buffer.update(layout.vertex_index(cx, cz, x0, z) * vertex_size,
+									  (x1 - x0) * vertex_size,
+									  staging + (z - area.z0_) * columns + (x0 - area.x0_));
+					}
+				}
+			}
+		}
+	} // !anon
+
+	terrain_brush::terrain_brush()
+		: mode_(mode::raise)
+		, radius_(32.0f)
+		, strength_(8.0f)
+	{
+	}
+
+	terrain_editor::terrain_editor()
+		: field_(nullptr)
+		, buffer_(nullptr)
+		, layout_(nullptr)
+		, height_offset_(0.0f)
+		, height_scale_(1.0f)
+	{
+	}
+
+	bool terrain_editor::is_valid() const
+	{
+		return field_ != nullptr && buffer_ != nullptr;
+	}
+
+	bool terrain_editor::create(heightfield &field,
+								const heightmap &map,
+								vertex_buffer &buffer,
+								const terrain_vertex *vertices,
+								const heightmap::chunk_template *layout)
+	{
+		if (!field.is_valid() || !buffer.is_valid() ||
+			field.width_ != map.image_width || field.height_ != map.image_height)
+		{
+			assert(!"heightmap not created from the heightfield!");
+			return false;
+		}
+
+		if (layout != nullptr && (layout->grid_width_ != field.width_ || layout->grid_height_ != field.height_))
+		{
+			assert(!"chunk template not created for the heightfield!");
+			return false;
+		}
+
+		field_ = &field;
+		buffer_ = &buffer;
+		layout_ = layout;
+		height_offset_ = map.height_offset;
+		height_scale_ = map.height_scale;
+		dirty_.clear();
+
+		occlusion_.clear();
+		if (vertices != nullptr)
+		{
+			occlusion_.resize(field.heights_.size());
+			for (int32 z = 0; z < field.height_; z++)
+			{
+				for (int32 x = 0; x < field.width_; x++)
+				{
+					const size_t index = static_cast<size_t>(z) * field.width_ + x;
+					const size_t source = layout == nullptr
+						? index
+						: static_cast<size_t>(layout->vertex_index(glm::min(x / layout->chunk_size_, layout->chunks_x_ - 1),
+																   glm::min(z / layout->chunk_size_, layout->chunks_z_ - 1),
+																   x,
+																   z));
+					occlusion_[index] = vertices[source].occlusion_;
+				}
+			}
+		}
+
+		return true;
+	}
+
+	void terrain_editor::destroy()
+	{
+		dynamic_array<rect>().swap(dirty_);
+		dynamic_array<uint16>().swap(occlusion_);
+		dynamic_array<float>().swap(scratch_);
+		dynamic_array<glm::vec3>().swap(normals_);
+		dynamic_array<terrain_vertex>().swap(staging_);
+
+		field_ = nullptr;
+		buffer_ = nullptr;
+		layout_ = nullptr;
+	}
+
+	bool terrain_editor::apply(const terrain_brush &brush, const float x, const float z, const float deltatime)
+	{
+		if (!is_valid())
+		{
+			return false;
+		}
+
+		const int32 width = field_->width_;
+		const int32 height = field_->height_;
+		const float radius = glm::max(brush.radius_, 1.0f);
+
+		const rect area = {
+			glm::max(static_cast<int32>(std::floor(x - radius)), 0),
+			glm::max(static_cast<int32>(std::floor(z - radius)), 0),
+			glm::min(static_cast<int32>(std::ceil(x + radius)) + 1, width),
+			glm::min(static_cast<int32>(std::ceil(z + radius)) + 1, height),
+		};
+		if (area.x0_ >= area.x1_ || area.z0_ >= area.z1_)
+		{
+			return false;
+		}
+
+		// note: smoothing reads the neighbours before this stroke changed them, from a copy
+		//       of the area with a one sample border
+		const int32 pitch = area.x1_ - area.x0_ + 2;
+		if (brush.mode_ == terrain_brush::mode::smooth)
+		{
+			scratch_.resize(static_cast<size_t>(pitch) * (area.z1_ - area.z0_ + 2));
+			float *dst = scratch_.data();
+			for (int32 sz = area.z0_ - 1; sz <= area.z1_; sz++)
+			{
+				for (int32 sx = area.x0_ - 1; sx <= area.x1_; sx++)
+				{
+					*dst++ = field_->at(sx, sz);
+				}
+			}
+		}
+
+		const float lowest = height_offset_;
+		const float highest = height_offset_ + height_scale_;
+		const float rate = brush.strength_ * deltatime;
+		const float inverse_radius_squared = 1.0f / (radius * radius);
+
+		for (int32 sz = area.z0_; sz < area.z1_; sz++)
+		{
+			float *row = field_->heights_.data() + static_cast<size_t>(sz) * width;
+			const float dz = static_cast<float>(sz) - z;
+			for (int32 sx = area.x0_; sx < area.x1_; sx++)
+			{
+				const float dx = static_cast<float>(sx) - x;
+				const float t = (dx * dx + dz * dz) * inverse_radius_squared;
+				if (t >= 1.0f)
+				{
+					continue;
+				}
+
+				// note: smooth falloff with zero slope at the rim, no crease around the stroke
+				const float falloff = (1.0f - t) * (1.0f - t);
+				float value = row[sx];
+				switch (brush.mode_)
+				{
+					case terrain_brush::mode::raise:
+						value += rate * falloff;
+						break;
+					case terrain_brush::mode::lower:
+						value -= rate * falloff;
+						break;
+					case terrain_brush::mode::smooth:
+					{
+						const float *centre = scratch_.data() + (sz - area.z0_ + 1) * pitch + (sx - area.x0_ + 1);
+						const float average = (centre[-pitch - 1] + centre[-pitch] + centre[-pitch + 1] +
+											   centre[-1] + centre[0] + centre[1] +
+											   centre[pitch - 1] + centre[pitch] + centre[pitch + 1]) * (1.0f / 9.0f);
+						value += (average - value) * glm::min(rate * falloff, 1.0f);
+						break;
+					}
+				}
+
+				row[sx] = glm::clamp(value, lowest, highest);
+			}
+		}
+
+		// note: normals use central differences, so they change one sample further out
+		add_dirty(dirty_, rect{ glm::max(area.x0_ - 1, 0),
+								glm::max(area.z0_ - 1, 0),
+								glm::min(area.x1_ + 1, width),
+								glm::min(area.z1_ + 1, height) });
+
+		return true;
+	}
+
+	void terrain_editor::invalidate(const rect &area)
+	{
+		if (!is_valid())
+		{
+			return;
+		}
+
+		// note: normals use central differences, so they change one sample further out
+		const rect grown = { glm::max(area.x0_ - 1, 0),
+							 glm::max(area.z0_ - 1, 0),
+							 glm::min(area.x1_ + 1, field_->width_),
+							 glm::min(area.z1_ + 1, field_->height_) };
+		if (grown.x0_ < grown.x1_ && grown.z0_ < grown.z1_)
+		{
+			add_dirty(dirty_, grown);
+		}
+	}
+
+	int32 terrain_editor::flush(dynamic_array<chunk> &chunks, const int32 chunk_size, terrain_query *query, rect *changed)
+	{
+		if (!is_valid() || dirty_.empty())
+		{
+			return 0;
+		}
+
+		const int32 width = field_->width_;
+		const float quantize = 65535.0f / height_scale_;
+		const int32 vertex_size = static_cast<int32>(sizeof(terrain_vertex));
+
+		int32 result = 0;
+		for (const rect &area : dirty_)
+		{
+			const int32 columns = area.x1_ - area.x0_;
+			const int32 rows = area.z1_ - area.z0_;
+			const size_t count = static_cast<size_t>(columns) * rows;
+
+			if (normals_.size() < count)
+			{
+				normals_.resize(count);
+				staging_.resize(count);
+			}
+
+			compute_normals(*field_, area.x0_, area.z0_, area.x1_, area.z1_, normals_.data(),
+							static_cast<int32>(sizeof(glm::vec3)), columns * static_cast<int32>(sizeof(glm::vec3)));
+
+			for (int32 z = 0; z < rows; z++)
+			{
+				const float *heights = field_->heights_.data() + static_cast<size_t>(area.z0_ + z) * width + area.x0_;
+				const glm::vec3 *normals = normals_.data() + z * columns;
+				terrain_vertex *dst = staging_.data() + z * columns;
+				for (int32 x = 0; x < columns; x++)
+				{
+					dst[x] = encode_terrain_vertex(heights[x], normals[x], height_offset_, quantize);
+				}
+
+				// note: the edit leaves the baked occlusion as it was
+				if (!occlusion_.empty())
+				{
+					const uint16 *occlusion = occlusion_.data() + static_cast<size_t>(area.z0_ + z) * width + area.x0_;
+					for (int32 x = 0; x < columns; x++)
+					{
+						dst[x].occlusion_ = occlusion[x];
+					}
+				}
+			}
+
+			if (layout_ != nullptr)
+			{
+				upload_blocks(*buffer_, *layout_, area, staging_.data());
+			}
+			// note: full width rows follow each other in the buffer and go up in one range
+			else if (columns == width)
+			{
+				buffer_->update(area.z0_ * width * vertex_size, static_cast<int32>(count) * vertex_size, staging_.data());
+			}
+			else
+			{
+				for (int32 z = 0; z < rows; z++)
+				{
+					buffer_->update(((area.z0_ + z) * width + area.x0_) * vertex_size,
+									columns * vertex_size,
+									staging_.data() + z * columns);
+				}
+			}
+
+			if (query != nullptr && query->width_ == width && query->height_ == field_->height_)
+			{
+				const float query_quantize = 65535.0f / query->height_scale_;
+				for (int32 z = area.z0_; z < area.z1_; z++)
+				{
+					const size_t first = static_cast<size_t>(z) * width;
+					for (int32 x = area.x0_; x < area.x1_; x++)
+					{
+						const float height = (field_->heights_[first + x] - query->height_offset_) * query_quantize;
+						query->heights_[first + x] = static_cast<uint16>(glm::clamp(height + 0.5f, 0.0f, 65535.0f));
+					}
+				}
+			}
+
+			if (!chunks.empty() && chunk_size > 0)
+			{
+				update_bounds(chunks, chunk_size, *field_, area);
+			}
+
+			result += static_cast<int32>(count);
+		}
+
+		if (changed != nullptr)
+		{
+			*changed = dirty_[0];
+			for (const rect &area : dirty_)
+			{
+				changed->x0_ = glm::min(changed->x0_, area.x0_);
+				changed->z0_ = glm::min(changed->z0_, area.z0_);
+				changed->x1_ = glm::max(changed->x1_, area.x1_);
+				changed->z1_ = glm::max(changed->z1_, area.z1_);
+			}
+		}
+
+		dirty_.clear();
+
+		return result;
+	}
+} // !avocado
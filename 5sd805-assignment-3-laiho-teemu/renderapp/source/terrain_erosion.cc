@@ -0,0 +1,336 @@
+// terrain_erosion.cc
+
+#include "terrain_erosion.hpp"
+
+#include <avocado_thread.hpp>
+
+#include <algorithm>
+#include <cmath>
+
+namespace avocado {
+	namespace
+	{
+		constexpr float GRAVITY = 9.81f;
+		constexpr float MIN_DEPTH = 1e-2f;
+
+		// note: job per block of cells, fn(x0, z0, x1, z1) covers [x0, x1) x [z0, z1)
+		template <typename F>
+		void for_each_block(worker_pool *pool, const int32 width, const int32 height, const F &fn)
+		{
+			const int32 size = terrain_erosion::BLOCK_SIZE;
+			const int32 blocks_x = (width + size - 1) / size;
+			const int32 blocks_z = (height + size - 1) / size;
+
+			parallel_for(pool, blocks_x * blocks_z, [&](const int32 block)
+			{
+				const int32 x0 = (block % blocks_x) * size;
+				const int32 z0 = (block / blocks_x) * size;
+				fn(x0, z0, glm::min(x0 + size, width), glm::min(z0 + size, height));
+			});
+		}
+	} // !anon
+
+	terrain_erosion::terrain_erosion()
+		: time_step_(0.05f)
+		, rain_(0.02f)
+		, evaporation_(0.5f)
+		, capacity_(1.0f)
+		, dissolve_(5.0f)
+		, deposit_(5.0f)
+		, min_tilt_(0.05f)
+		, talus_(1.2f)
+		, thermal_rate_(2.0f)
+		, pool_(nullptr)
+		, width_(0)
+		, height_(0)
+		, iterations_(0)
+	{
+	}
+
+	bool terrain_erosion::is_valid() const
+	{
+		return !ground_[0].empty();
+	}
+
+	bool terrain_erosion::create(const heightfield &field, worker_pool *pool)
+	{
+		if (!field.is_valid() || field.width_ < 2 || field.height_ < 2)
+		{
+			assert(!"heightfield not created!");
+			return false;
+		}
+
+		const size_t count = field.heights_.size();
+
+		pool_ = pool;
+		width_ = field.width_;
+		height_ = field.height_;
+		iterations_ = 0;
+		ground_[0] = field.heights_;
+		ground_[1].assign(count, 0.0f);
+		sediment_[0].assign(count, 0.0f);
+		sediment_[1].assign(count, 0.0f);
+		water_.assign(count, 0.0f);
+		flux_.assign(count, glm::vec4(0.0f));
+		velocity_.assign(count, glm::vec2(0.0f));
+		slide_.assign(count, glm::vec4(0.0f));
+		transport_.assign(count, glm::vec4(0.0f));
+
+		return true;
+	}
+
+	void terrain_erosion::destroy()
+	{
+		for (int32 index = 0; index < 2; index++)
+		{
+			dynamic_array<float>().swap(ground_[index]);
+			dynamic_array<float>().swap(sediment_[index]);
+		}
+		dynamic_array<float>().swap(water_);
+		dynamic_array<glm::vec4>().swap(flux_);
+		dynamic_array<glm::vec2>().swap(velocity_);
+		dynamic_array<glm::vec4>().swap(slide_);
+		dynamic_array<glm::vec4>().swap(transport_);
+
+		pool_ = nullptr;
+		width_ = 0;
+		height_ = 0;
+		iterations_ = 0;
+	}
+
+	void terrain_erosion::step()
+	{
+		if (!is_valid())
+		{
+			return;
+		}
+
+		const int32 w = width_;
+		const int32 h = height_;
+		const float dt = time_step_;
+		float *water = water_.data();
+		glm::vec4 *flux = flux_.data();
+		glm::vec2 *velocity = velocity_.data();
+		glm::vec4 *slide = slide_.data();
+		glm::vec4 *transport = transport_.data();
+
+		// note: pipe outflow from the water levels. rain falls on every cell alike so it
+		//       leaves the level differences alone, a cell never sends more than it holds
+		{
+			const float *ground = ground_[0].data();
+			for_each_block(pool_, w, h, [&](const int32 x0, const int32 z0, const int32 x1, const int32 z1)
+			{
+				for (int32 z = z0; z < z1; z++)
+				{
+					for (int32 x = x0; x < x1; x++)
+					{
+						const int32 i = z * w + x;
+						const float level = ground[i] + water[i];
+
+						glm::vec4 f = flux[i];
+						f.x = x > 0 ? glm::max(0.0f, f.x + dt * GRAVITY * (level - ground[i - 1] - water[i - 1])) : 0.0f;
+						f.y = x < w - 1 ? glm::max(0.0f, f.y + dt * GRAVITY * (level - ground[i + 1] - water[i + 1])) : 0.0f;
+						f.z = z > 0 ? glm::max(0.0f, f.z + dt * GRAVITY * (level - ground[i - w] - water[i - w])) : 0.0f;
+						f.w = z < h - 1 ? glm::max(0.0f, f.w + dt * GRAVITY * (level - ground[i + w] - water[i + w])) : 0.0f;
+
+						const float outflow = (f.x + f.y + f.z + f.w) * dt;
+						const float available = water[i] + rain_ * dt;
+						if (outflow > available)
+						{
+							f *= available / outflow;
+						}
+
+						// note: suspended sediment leaves with the same share of the water
+						flux[i] = f;
+						transport[i] = available > 0.0f ? f * (dt / available) : glm::vec4(0.0f);
+					}
+				}
+			});
+		}
+
+		// note: water level and velocity from the flow through each cell
+		const float max_speed = 1.0f / dt;
+		for_each_block(pool_, w, h, [&](const int32 x0, const int32 z0, const int32 x1, const int32 z1)
+		{
+			for (int32 z = z0; z < z1; z++)
+			{
+				for (int32 x = x0; x < x1; x++)
+				{
+					const int32 i = z * w + x;
+					const glm::vec4 &f = flux[i];
+					const float from_left = x > 0 ? flux[i - 1].y : 0.0f;
+					const float from_right = x < w - 1 ? flux[i + 1].x : 0.0f;
+					const float from_up = z > 0 ? flux[i - w].w : 0.0f;
+					const float from_down = z < h - 1 ? flux[i + w].z : 0.0f;
+
+					const float before = water[i] + rain_ * dt;
+					const float inflow = from_left + from_right + from_up + from_down;
+					const float after = glm::max(0.0f, before + dt * (inflow - (f.x + f.y + f.z + f.w)));
+					water[i] = after;
+
+					// note: thin films would get absurd speeds
+					const float depth = (before + after) * 0.5f;
+					const glm::vec2 flow((from_left - f.x + f.y - from_right) * 0.5f,
+										 (from_up - f.z + f.w - from_down) * 0.5f);
+					const glm::vec2 speed = depth > MIN_DEPTH ? flow / depth : glm::vec2(0.0f);
+					velocity[i] = glm::clamp(speed, -max_speed, max_speed);
+				}
+			}
+		});
+
+		// note: dissolve below the carrying capacity and deposit above it, the slope reads
+		//       neighbours so the new ground goes to the back buffer
+		{
+			const float *ground = ground_[0].data();
+			const float *sediment = sediment_[0].data();
+			float *next_ground = ground_[1].data();
+			float *next_sediment = sediment_[1].data();
+			for_each_block(pool_, w, h, [&](const int32 x0, const int32 z0, const int32 x1, const int32 z1)
+			{
+				for (int32 z = z0; z < z1; z++)
+				{
+					const int32 zu = z > 0 ? z - 1 : z;
+					const int32 zd = z < h - 1 ? z + 1 : z;
+					for (int32 x = x0; x < x1; x++)
+					{
+						const int32 i = z * w + x;
+						const int32 xl = x > 0 ? x - 1 : x;
+						const int32 xr = x < w - 1 ? x + 1 : x;
+
+						const float gx = (ground[z * w + xr] - ground[z * w + xl]) / static_cast<float>(xr - xl);
+						const float gz = (ground[zd * w + x] - ground[zu * w + x]) / static_cast<float>(zd - zu);
+						const float slope = gx * gx + gz * gz;
+						const float tilt = glm::max(std::sqrt(slope / (1.0f + slope)), min_tilt_);
+
+						// note: shallow water carries less, up to a depth of one unit
+						const float capacity = capacity_ * tilt * glm::length(velocity[i]) * glm::min(water[i], 1.0f);
+						const float carried = sediment[i];
+
+						float amount = 0.0f;
+						if (capacity > carried)
+						{
+							// note: no deeper than the water above, keeps thin films from digging pits
+							amount = glm::min(dissolve_ * dt * (capacity - carried), water[i]);
+						}
+						else
+						{
+							amount = -deposit_ * dt * (carried - capacity);
+						}
+
+						next_ground[i] = ground[i] - amount;
+						next_sediment[i] = carried + amount;
+					}
+				}
+			});
+
+			ground_[0].swap(ground_[1]);
+		}
+
+		// note: sediment moved along with the water, evaporation, and the thermal outflow
+		//       from the new ground
+		{
+			const float *ground = ground_[0].data();
+			const float *carried = sediment_[1].data();
+			float *sediment = sediment_[0].data();
+			const float keep = glm::max(0.0f, 1.0f - evaporation_ * dt);
+			for_each_block(pool_, w, h, [&](const int32 x0, const int32 z0, const int32 x1, const int32 z1)
+			{
+				for (int32 z = z0; z < z1; z++)
+				{
+					for (int32 x = x0; x < x1; x++)
+					{
+						const int32 i = z * w + x;
+						const glm::vec4 &share = transport[i];
+						sediment[i] = carried[i] * (1.0f - (share.x + share.y + share.z + share.w)) +
+									  (x > 0 ? carried[i - 1] * transport[i - 1].y : 0.0f) +
+									  (x < w - 1 ? carried[i + 1] * transport[i + 1].x : 0.0f) +
+									  (z > 0 ? carried[i - w] * transport[i - w].w : 0.0f) +
+									  (z < h - 1 ? carried[i + w] * transport[i + w].z : 0.0f);
+						water[i] *= keep;
+
+						const float b = ground[i];
+						const glm::vec4 excess(x > 0 ? glm::max(0.0f, b - ground[i - 1] - talus_) : 0.0f,
+											   x < w - 1 ? glm::max(0.0f, b - ground[i + 1] - talus_) : 0.0f,
+											   z > 0 ? glm::max(0.0f, b - ground[i - w] - talus_) : 0.0f,
+											   z < h - 1 ? glm::max(0.0f, b - ground[i + w] - talus_) : 0.0f);
+
+						// note: half the largest excess at most, so the cell does not end up lower
+						//       than the neighbour it slides to
+						const float total = excess.x + excess.y + excess.z + excess.w;
+						if (total > 0.0f)
+						{
+							const float largest = glm::max(glm::max(excess.x, excess.y), glm::max(excess.z, excess.w));
+							const float amount = glm::min(thermal_rate_ * dt, 1.0f) * largest * 0.5f;
+							slide[i] = excess * (amount / total);
+						}
+						else
+						{
+							slide[i] = glm::vec4(0.0f);
+						}
+					}
+				}
+			});
+		}
+
+		{
+			const float *ground = ground_[0].data();
+			float *next_ground = ground_[1].data();
+			for_each_block(pool_, w, h, [&](const int32 x0, const int32 z0, const int32 x1, const int32 z1)
+			{
+				for (int32 z = z0; z < z1; z++)
+				{
+					for (int32 x = x0; x < x1; x++)
+					{
+						const int32 i = z * w + x;
+						const glm::vec4 &out = slide[i];
+						const float inflow = (x > 0 ? slide[i - 1].y : 0.0f) +
+											 (x < w - 1 ? slide[i + 1].x : 0.0f) +
+											 (z > 0 ? slide[i - w].w : 0.0f) +
+											 (z < h - 1 ? slide[i + w].z : 0.0f);
+
+						next_ground[i] = ground[i] - (out.x + out.y + out.z + out.w) + inflow;
+					}
+				}
+			});
+
+			ground_[0].swap(ground_[1]);
+		}
+
+		iterations_++;
+	}
+
+	int32 terrain_erosion::run(const float budget_ms)
+	{
+		const time start = time::now();
+
+		int32 result = 0;
+		do
+		{
+			step();
+			result++;
+		} while ((time::now() - start).as_milliseconds() < budget_ms);
+
+		return result;
+	}
+
+	bool terrain_erosion::heights(heightfield &result) const
+	{
+		if (!is_valid() || !result.create(width_, height_))
+		{
+			return false;
+		}
+
+		result.heights_ = ground_[0];
+
+		return true;
+	}
+
+	float terrain_erosion::height(const int32 x, const int32 z) const
+	{
+		assert(is_valid());
+
+		const int32 cx = glm::clamp(x, 0, width_ - 1);
+		const int32 cz = glm::clamp(z, 0, height_ - 1);
+		return ground_[0][static_cast<size_t>(cz) * width_ + cx];
+	}
+} // !avocado
@@ -0,0 +1,404 @@
+// terrain_noise.cc
+
+#include "terrain_noise.hpp"
+
+#include <avocado_thread.hpp>
+
+#include <algorithm>
+#include <cmath>
+
+#include <emmintrin.h>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+namespace avocado {
+	namespace
+	{
+		constexpr uint32 PRIME_X = 0x27d4eb2du;
+		constexpr uint32 PRIME_Z = 0x165667b1u;
+		constexpr uint32 MIX_A = 0x2c1b3c6du;
+		constexpr uint32 MIX_B = 0x297a2d39u;
+		constexpr uint32 OCTAVE_SEED = 0x9e3779b9u;
+		constexpr uint32 WARP_SEED_X = 0x68e31da4u;
+		constexpr uint32 WARP_SEED_Z = 0xb5297a4du;
+		constexpr float RIDGE_SHARPNESS = 2.0f;
+		constexpr int32 BAND_ROWS = 16;
+
+		// note: the scalar, sse2 and avx2 versions below have to stay operation for operation
+		//       the same, including the order of the multiplies and adds, or tiles generated
+		//       with different lane alignments stop matching at their edges
+		inline uint32 mix(uint32 hash)
+		{
+			hash ^= hash >> 15;
+			hash *= MIX_A;
+			hash ^= hash >> 12;
+			hash *= MIX_B;
+			hash ^= hash >> 15;
+			return hash;
+		}
+
+		// note: one of the four diagonal gradients, picked by the two low bits of the hash
+		inline float gradient(const uint32 hash, const float dx, const float dz)
+		{
+			return ((hash & 1) ? -dx : dx) + ((hash & 2) ? -dz : dz);
+		}
+
+		inline float fade(const float t)
+		{
+			const float cubed = t * t * t;
+			return cubed * ((t * 6.0f - 15.0f) * t + 10.0f);
+		}
+
+		inline float lerp(const float a, const float b, const float t)
+		{
+			return a + (b - a) * t;
+		}
+
+		float noise_scalar(const uint32 seed, const float x, const float z)
+		{
+			int32 ix = static_cast<int32>(x);
+			int32 iz = static_cast<int32>(z);
+			ix -= static_cast<float>(ix) > x ? 1 : 0;
+			iz -= static_cast<float>(iz) > z ? 1 : 0;
+
+			const float fx = x - static_cast<float>(ix);
+			const float fz = z - static_cast<float>(iz);
+
+			const uint32 hx0 = static_cast<uint32>(ix) * PRIME_X;
+			const uint32 hz0 = static_cast<uint32>(iz) * PRIME_Z;
+			const uint32 hx1 = hx0 + PRIME_X;
+			const uint32 hz1 = hz0 + PRIME_Z;
+
+			const float g00 = gradient(mix(seed ^ hx0 ^ hz0), fx, fz);
+			const float g10 = gradient(mix(seed ^ hx1 ^ hz0), fx - 1.0f, fz);
+			const float g01 = gradient(mix(seed ^ hx0 ^ hz1), fx, fz - 1.0f);
+			const float g11 = gradient(mix(seed ^ hx1 ^ hz1), fx - 1.0f, fz - 1.0f);
+
+			const float u = fade(fx);
+			const float v = fade(fz);
+			return lerp(lerp(g00, g10, u), lerp(g01, g11, u), v);
+		}
+
+		// note: sse2 has no 32 bit low multiply, it is put together from the even and odd lanes
+		inline __m128i mullo4(const __m128i a, const __m128i b)
+		{
+			const __m128i even = _mm_mul_epu32(a, b);
+			const __m128i odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+			return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)),
+									  _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+		}
+
+		inline __m128i mix4(__m128i hash)
+		{
+			hash = _mm_xor_si128(hash, _mm_srli_epi32(hash, 15));
+			hash = mullo4(hash, _mm_set1_epi32(static_cast<int32>(MIX_A)));
+			hash = _mm_xor_si128(hash, _mm_srli_epi32(hash, 12));
+			hash = mullo4(hash, _mm_set1_epi32(static_cast<int32>(MIX_B)));
+			hash = _mm_xor_si128(hash, _mm_srli_epi32(hash, 15));
+			return hash;
+		}
+
+		// note: the hash bits become sign bits, negating a float only flips its sign
+		inline __m128 gradient4(const __m128i hash, const __m128 dx, const __m128 dz)
+		{
+			const __m128 sign_x = _mm_castsi128_ps(_mm_slli_epi32(hash, 31));
+			const __m128 sign_z = _mm_castsi128_ps(_mm_slli_epi32(_mm_srli_epi32(hash, 1), 31));
+			return _mm_add_ps(_mm_xor_ps(dx, sign_x), _mm_xor_ps(dz, sign_z));
+		}
+
+		inline __m128 fade4(const __m128 t)
+		{
+			const __m128 cubed = _mm_mul_ps(_mm_mul_ps(t, t), t);
+			const __m128 inner = _mm_sub_ps(_mm_mul_ps(t, _mm_set1_ps(6.0f)), _mm_set1_ps(15.0f));
+			return _mm_mul_ps(cubed, _mm_add_ps(_mm_mul_ps(inner, t), _mm_set1_ps(10.0f)));
+		}
+
+		inline __m128 lerp4(const __m128 a, const __m128 b, const __m128 t)
+		{
+			return _mm_add_ps(a, _mm_mul_ps(_mm_sub_ps(b, a), t));
+		}
+
+		__m128 noise4(const uint32 seed, const __m128 x, const __m128 z)
+		{
+			// note: truncation rounds negative coordinates up, step those back down
+			__m128i ix = _mm_cvttps_epi32(x);
+			__m128i iz = _mm_cvttps_epi32(z);
+			ix = _mm_add_epi32(ix, _mm_castps_si128(_mm_cmpgt_ps(_mm_cvtepi32_ps(ix), x)));
+			iz = _mm_add_epi32(iz, _mm_castps_si128(_mm_cmpgt_ps(_mm_cvtepi32_ps(iz), z)));
+
+			const __m128 one = _mm_set1_ps(1.0f);
+			const __m128 fx = _mm_sub_ps(x, _mm_cvtepi32_ps(ix));
+			const __m128 fz = _mm_sub_ps(z, _mm_cvtepi32_ps(iz));
+			const __m128 fx1 = _mm_sub_ps(fx, one);
+			const __m128 fz1 = _mm_sub_ps(fz, one);
+
+			const __m128i prime_x = _mm_set1_epi32(static_cast<int32>(PRIME_X));
+			const __m128i prime_z = _mm_set1_epi32(static_cast<int32>(PRIME_Z));
+			const __m128i seeds = _mm_set1_epi32(static_cast<int32>(seed));
+			const __m128i hx = mullo4(ix, prime_x);
+			const __m128i hx0 = _mm_xor_si128(hx, seeds);
+			const __m128i hz0 = mullo4(iz, prime_z);
+			const __m128i hx1 = _mm_xor_si128(_mm_add_epi32(hx, prime_x), seeds);
+			const __m128i hz1 = _mm_add_epi32(hz0, prime_z);
+
+			const __m128 g00 = gradient4(mix4(_mm_xor_si128(hx0, hz0)), fx, fz);
+			const __m128 g10 = gradient4(mix4(_mm_xor_si128(hx1, hz0)), fx1, fz);
+			const __m128 g01 = gradient4(mix4(_mm_xor_si128(hx0, hz1)), fx, fz1);
+			const __m128 g11 = gradient4(mix4(_mm_xor_si128(hx1, hz1)), fx1, fz1);
+
+			const __m128 u = fade4(fx);
+			const __m128 v = fade4(fz);
+			return lerp4(lerp4(g00, g10, u), lerp4(g01, g11, u), v);
+		}
+
+#if defined(__AVX2__)
+		inline __m256i mix8(__m256i hash)
+		{
+			hash = _mm256_xor_si256(hash, _mm256_srli_epi32(hash, 15));
+			hash = _mm256_mullo_epi32(hash, _mm256_set1_epi32(static_cast<int32>(MIX_A)));
+			hash = _mm256_xor_si256(hash, _mm256_srli_epi32(hash, 12));
+			hash = _mm256_mullo_epi32(hash, _mm256_set1_epi32(static_cast<int32>(MIX_B)));
+			hash = _mm256_xor_si256(hash, _mm256_srli_epi32(hash, 15));
+			return hash;
+		}
+
+		inline __m256 gradient8(const __m256i hash, const __m256 dx, const __m256 dz)
+		{
+			const __m256 sign_x = _mm256_castsi256_ps(_mm256_slli_epi32(hash, 31));
+			const __m256 sign_z = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_srli_epi32(hash, 1), 31));
+			return _mm256_add_ps(_mm256_xor_ps(dx, sign_x), _mm256_xor_ps(dz, sign_z));
+		}
+
+		inline __m256 fade8(const __m256 t)
+		{
+			const __m256 cubed = _mm256_mul_ps(_mm256_mul_ps(t, t), t);
+			const __m256 inner = _mm256_sub_ps(_mm256_mul_ps(t, _mm256_set1_ps(6.0f)), _mm256_set1_ps(15.0f));
+			return _mm256_mul_ps(cubed, _mm256_add_ps(_mm256_mul_ps(inner, t), _mm256_set1_ps(10.0f)));
+		}
+
+		inline __m256 lerp8(const __m256 a, const __m256 b, const __m256 t)
+		{
+			return _mm256_add_ps(a, _mm256_mul_ps(_mm256_sub_ps(b, a), t));
+		}
+
+		__m256 noise8(const uint32 seed, const __m256 x, const __m256 z)
+		{
+			__m256i ix = _mm256_cvttps_epi32(x);
+			__m256i iz = _mm256_cvttps_epi32(z);
+			ix = _mm256_add_epi32(ix, _mm256_castps_si256(_mm256_cmp_ps(_mm256_cvtepi32_ps(ix), x, _CMP_GT_OQ)));
+			iz = _mm256_add_epi32(iz, _mm256_castps_si256(_mm256_cmp_ps(_mm256_cvtepi32_ps(iz), z, _CMP_GT_OQ)));
+
+			const __m256 one = _mm256_set1_ps(1.0f);
+			const __m256 fx = _mm256_sub_ps(x, _mm256_cvtepi32_ps(ix));
+			const __m256 fz = _mm256_sub_ps(z, _mm256_cvtepi32_ps(iz));
+			const __m256 fx1 = _mm256_sub_ps(fx, one);
+			const __m256 fz1 = _mm256_sub_ps(fz, one);
+
+			const __m256i prime_x = _mm256_set1_epi32(static_cast<int32>(PRIME_X));
+			const __m256i prime_z = _mm256_set1_epi32(static_cast<int32>(PRIME_Z));
+			const __m256i seeds = _mm256_set1_epi32(static_cast<int32>(seed));
+			const __m256i hx = _mm256_mullo_epi32(ix, prime_x);
+			const __m256i hx0 = _mm256_xor_si256(hx, seeds);
+			const __m256i hz0 = _mm256_mullo_epi32(iz, prime_z);
+			const __m256i hx1 = _mm256_xor_si256(_mm256_add_epi32(hx, prime_x), seeds);
+			const __m256i hz1 = _mm256_add_epi32(hz0, prime_z);
+
+			const __m256 g00 = gradient8(mix8(_mm256_xor_si256(hx0, hz0)), fx, fz);
+			const __m256 g10 = gradient8(mix8(_mm256_xor_si256(hx1, hz0)), fx1, fz);
+			const __m256 g01 = gradient8(mix8(_mm256_xor_si256(hx0, hz1)), fx, fz1);
+			const __m256 g11 = gradient8(mix8(_mm256_xor_si256(hx1, hz1)), fx1, fz1);
+
+			const __m256 u = fade8(fx);
+			const __m256 v = fade8(fz);
+			return lerp8(lerp8(g00, g10, u), lerp8(g01, g11, u), v);
+		}
+#endif
+
+		// note: one octave at count points given in noise cells
+		void noise_row(const uint32 seed, const int32 count, const float *x, const float *z, float *result)
+		{
+			int32 index = 0;
+#if defined(__AVX2__)
+			for (; index + 8 <= count; index += 8)
+			{
+				_mm256_storeu_ps(result + index, noise8(seed, _mm256_loadu_ps(x + index), _mm256_loadu_ps(z + index)));
+			}
+#endif
+
+			for (; index + 4 <= count; index += 4)
+			{
+				_mm_storeu_ps(result + index, noise4(seed, _mm_loadu_ps(x + index), _mm_loadu_ps(z + index)));
+			}
+
+			for (; index < count; index++)
+			{
+				result[index] = noise_scalar(seed, x[index], z[index]);
+			}
+		}
+
+		// note: work rows of one band, reused for every row of it
+		struct noise_scratch
+		{
+			explicit noise_scratch(const int32 count)
+				: x_(count)
+				, z_(count)
+				, cell_x_(count)
+				, cell_z_(count)
+				, octave_(count)
+				, weight_(count)
+				, warp_x_(count)
+				, warp_z_(count)
+			{
+			}
+
+			dynamic_array<float> x_;
+			dynamic_array<float> z_;
+			dynamic_array<float> cell_x_;
+			dynamic_array<float> cell_z_;
+			dynamic_array<float> octave_;
+			dynamic_array<float> weight_;
+			dynamic_array<float> warp_x_;
+			dynamic_array<float> warp_z_;
+		};
+
+		// note: octaves summed at the points in scratch.x_ and scratch.z_, in about -1 .. 1
+		void octaves_row(const terrain_noise &noise, const uint32 seed, const bool ridged, const int32 count, noise_scratch &scratch, float *result)
+		{
+			std::fill(result, result + count, 0.0f);
+			std::fill(scratch.weight_.begin(), scratch.weight_.begin() + count, 1.0f);
+
+			float frequency = noise.frequency_;
+			float amplitude = 1.0f;
+			float total = 0.0f;
+			for (int32 octave = 0; octave < noise.octaves_; octave++)
+			{
+				for (int32 index = 0; index < count; index++)
+				{
+					scratch.cell_x_[index] = scratch.x_[index] * frequency;
+					scratch.cell_z_[index] = scratch.z_[index] * frequency;
+				}
+
+				const uint32 octave_seed = seed + static_cast<uint32>(octave) * OCTAVE_SEED;
+				noise_row(octave_seed, count, scratch.cell_x_.data(), scratch.cell_z_.data(), scratch.octave_.data());
+
+				if (ridged)
+				{
+					// note: folded at zero into crests, each octave shows mostly where the
+					//       ones before it were already high
+					for (int32 index = 0; index < count; index++)
+					{
+						const float ridge = 1.0f - std::abs(scratch.octave_[index]);
+						const float signal = ridge * ridge * scratch.weight_[index];
+						result[index] += signal * amplitude;
+						scratch.weight_[index] = glm::clamp(signal * RIDGE_SHARPNESS, 0.0f, 1.0f);
+					}
+				}
+				else
+				{
+					for (int32 index = 0; index < count; index++)
+					{
+						result[index] += scratch.octave_[index] * amplitude;
+					}
+				}
+
+				total += amplitude;
+				amplitude *= noise.gain_;
+				frequency *= noise.lacunarity_;
+			}
+
+			const float inverse = 1.0f / total;
+			for (int32 index = 0; index < count; index++)
+			{
+				result[index] = ridged ? result[index] * inverse * 2.0f - 1.0f : result[index] * inverse;
+			}
+		}
+
+		void generate_row(const terrain_noise &noise, const int32 x0, const int32 z, const int32 count, noise_scratch &scratch, float *result)
+		{
+			for (int32 index = 0; index < count; index++)
+			{
+				scratch.x_[index] = static_cast<float>(x0 + index);
+				scratch.z_[index] = static_cast<float>(z);
+			}
+
+			if (noise.variant_ == terrain_noise::variant::warped)
+			{
+				octaves_row(noise, noise.seed_ ^ WARP_SEED_X, false, count, scratch, scratch.warp_x_.data());
+				octaves_row(noise, noise.seed_ ^ WARP_SEED_Z, false, count, scratch, scratch.warp_z_.data());
+				for (int32 index = 0; index < count; index++)
+				{
+					scratch.x_[index] += scratch.warp_x_[index] * noise.warp_;
+					scratch.z_[index] += scratch.warp_z_[index] * noise.warp_;
+				}
+			}
+
+			octaves_row(noise, noise.seed_, noise.variant_ == terrain_noise::variant::ridged, count, scratch, result);
+
+			for (int32 index = 0; index < count; index++)
+			{
+				result[index] = noise.offset_ + glm::clamp(result[index], -1.0f, 1.0f) * noise.scale_;
+			}
+		}
+	} // !anon
+
+	terrain_noise::terrain_noise()
+		: seed_(1)
+		, variant_(variant::fbm)
+		, octaves_(6)
+		, frequency_(1.0f / 256.0f)
+		, lacunarity_(2.0f)
+		, gain_(0.5f)
+		, warp_(64.0f)
+		, scale_(25.5f)
+		, offset_(0.0f)
+	{
+	}
+
+	bool terrain_noise::generate(heightfield &result, const int32 x0, const int32 z0, const int32 width, const int32 height, worker_pool *pool) const
+	{
+		if (width < 1 || height < 1 || octaves_ < 1)
+		{
+			assert(!"noise settings not valid!");
+			return false;
+		}
+
+		if (!result.create(width, height))
+		{
+			return false;
+		}
+
+		const int32 band_count = (height + BAND_ROWS - 1) / BAND_ROWS;
+		parallel_for(pool, band_count, [&](const int32 band)
+		{
+			noise_scratch scratch(width);
+
+			const int32 end = glm::min(height, (band + 1) * BAND_ROWS);
+			for (int32 row = band * BAND_ROWS; row < end; row++)
+			{
+				generate_row(*this, x0, z0 + row, width, scratch, result.heights_.data() + static_cast<size_t>(row) * width);
+			}
+		});
+
+		return true;
+	}
+
+	float terrain_noise::sample(const int32 x, const int32 z) const
+	{
+		noise_scratch scratch(1);
+
+		float result = 0.0f;
+		generate_row(*this, x, z, 1, scratch, &result);
+		return result;
+	}
+
+	float terrain_noise::lowest() const
+	{
+		return offset_ - std::abs(scale_);
+	}
+
+	float terrain_noise::highest() const
+	{
+		return offset_ + std::abs(scale_);
+	}
+} // !avocado
@@ -0,0 +1,163 @@
+// terrain_normal_map.cc
+
+#include "terrain_normal_map.hpp"
+#include "terrain_texture.hpp"
+#include "normals.hpp"
+
+#pragma warning(push)
+#pragma warning(disable: 4127)
+#pragma warning(disable: 4201)
+#include <glm/gtc/type_ptr.hpp>
+#pragma warning(pop)
+
+namespace avocado {
+	namespace
+	{
+		// note: [-1, 1] to the full range of an unsigned normalized channel
+		template <typename T>
+		void encode_texels(const glm::vec3 *normals, const int32 count, const float maximum, uint8 *dst)
+		{
+			T *texels = reinterpret_cast<T *>(dst);
+			for (int32 index = 0; index < count; index++)
+			{
+				const glm::vec2 encoded = octahedral_encode(normals[index]) * 0.5f + 0.5f;
+				texels[index * 2 + 0] = static_cast<T>(glm::clamp(encoded.x, 0.0f, 1.0f) * maximum + 0.5f);
+				texels[index * 2 + 1] = static_cast<T>(glm::clamp(encoded.y, 0.0f, 1.0f) * maximum + 0.5f);
+			}
+		}
+	} // !anon
+
+	terrain_normal_map::terrain_normal_map()
+		: format_(TEXTURE_FORMAT_RG16)
+		, width_(0)
+		, height_(0)
+	{
+	}
+
+	bool terrain_normal_map::is_valid() const
+	{
+		return texture_.is_valid() && sampler_.is_valid();
+	}
+
+	bool terrain_normal_map::create(const heightfield &field, worker_pool *pool)
+	{
+		if (!field.is_valid() || field.width_ < 2 || field.height_ < 2)
+		{
+			assert(!"heightfield not created!");
+			return false;
+		}
+
+		if (format_ != TEXTURE_FORMAT_RG8 && format_ != TEXTURE_FORMAT_RG16)
+		{
+			assert(!"normal map format has to be rg8 or rg16!");
+			return false;
+		}
+
+		width_ = field.width_;
+		height_ = field.height_;
+		texels_.resize(static_cast<size_t>(width_) * height_ * texel_size());
+
+		// note: the first update bakes everything, the texture is created from the result
+		update(field, 0, 0, width_, height_, pool);
+
+		if (!texture_.create(format_, width_, height_, texels_.data()))
+		{
+			return false;
+		}
+
+		if (!sampler_.create(SAMPLER_FILTER_MODE_LINEAR,
+							 SAMPLER_ADDRESS_MODE_CLAMP,
+							 SAMPLER_ADDRESS_MODE_CLAMP))
+		{
+			return false;
+		}
+
+		return is_valid();
+	}
+
+	void terrain_normal_map::destroy()
+	{
+		if (texture_.is_valid())
+		{
+			texture_.destroy();
+		}
+		if (sampler_.is_valid())
+		{
+			sampler_.destroy();
+		}
+
+		dynamic_array<uint8>().swap(texels_);
+		dynamic_array<uint8>().swap(staging_);
+		width_ = 0;
+		height_ = 0;
+	}
+
+	void terrain_normal_map::update(const heightfield &field, const int32 x0, const int32 z0, const int32 x1, const int32 z1, worker_pool *pool)
+	{
+		if (texels_.empty())
+		{
+			return;
+		}
+
+		if (field.width_ != width_ || field.height_ != height_)
+		{
+			assert(!"heightfield does not match the normal map!");
+			return;
+		}
+
+		const int32 left = glm::max(x0, 0);
+		const int32 top = glm::max(z0, 0);
+		const int32 right = glm::min(x1, width_);
+		const int32 bottom = glm::min(z1, height_);
+		if (left >= right || top >= bottom)
+		{
+			return;
+		}
+
+		const int32 size = texel_size();
+		const int32 width = width_;
+		bake_tiles(TILE_SIZE, left, top, right, bottom, pool, [&](const int32 tile_x0, const int32 tile_z0, const int32 tile_x1, const int32 tile_z1)
+		{
+			const int32 columns = tile_x1 - tile_x0;
+
+			dynamic_array<glm::vec3> normals(static_cast<size_t>(columns) * (tile_z1 - tile_z0));
+			compute_normals(field, tile_x0, tile_z0, tile_x1, tile_z1, normals.data(),
+							static_cast<int32>(sizeof(glm::vec3)), columns * static_cast<int32>(sizeof(glm::vec3)));
+
+			for (int32 z = tile_z0; z < tile_z1; z++)
+			{
+				const glm::vec3 *src = normals.data() + static_cast<size_t>(z - tile_z0) * columns;
+				uint8 *dst = texels_.data() + (static_cast<size_t>(z) * width + tile_x0) * size;
+				if (format_ == TEXTURE_FORMAT_RG16)
+				{
+					encode_texels<uint16>(src, columns, 65535.0f, dst);
+				}
+				else
+				{
+					encode_texels<uint8>(src, columns, 255.0f, dst);
+				}
+			}
+		});
+
+		// note: before create made the texture the whole map is uploaded by it
+		if (texture_.is_valid())
+		{
+			upload_rect(texture_, format_, size, texels_.data(), width_, left, top, right, bottom, staging_);
+		}
+	}
+
+	void terrain_normal_map::bind(renderer &rend, shader_program &program, const int32 unit)
+	{
+		const glm::vec2 size(static_cast<float>(width_), static_cast<float>(height_));
+
+		rend.set_shader_uniform(program, UNIFORM_TYPE_VEC2, "u_normal_map_size", 1, glm::value_ptr(size));
+		rend.set_shader_uniform(program, UNIFORM_TYPE_SAMPLER, "u_normal_map", 1, &unit);
+		rend.set_texture(texture_, unit);
+		rend.set_sampler_state(sampler_, unit);
+	}
+
+	int32 terrain_normal_map::texel_size() const
+	{
+		return format_ == TEXTURE_FORMAT_RG16 ? 4 : 2;
+	}
+} // !avocado
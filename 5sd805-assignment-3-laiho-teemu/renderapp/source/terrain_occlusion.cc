@@ -0,0 +1,485 @@
+// terrain_occlusion.cc
+
+#include "terrain_occlusion.hpp"
+#include "terrain_texture.hpp"
+
+#pragma warning(push)
+#pragma warning(disable: 4127)
+#pragma warning(disable: 4201)
+#include <glm/gtc/type_ptr.hpp>
+#pragma warning(pop)
+
+#include <avocado_thread.hpp>
+
+#include <algorithm>
+#include <cmath>
+
+#include <emmintrin.h>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+namespace avocado {
+	namespace
+	{
+		constexpr int32 BAND_ROWS = 16;
+		constexpr float TWO_PI = 6.28318531f;
+
+		// note: offset from the scanned sample to the height it compares against
+		struct scan_step {
+			int32 x_;
+			int32 z_;
+			float inverse_distance_;
+		};
+
+		struct scan_direction {
+			glm::vec2 direction_;
+			int32 first_step_;
+			int32 step_count_;
+		};
+
+		// note: horizon[x] = max(horizon[x], (row[x + offset] - centre[x]) * inverse_distance)
+		//       for x in [first, last), row[x + offset] has to be inside the row
+		void raise_horizon(float *horizon, const float *centre, const float *row, const int32 offset, const float inverse_distance, int32 first, const int32 last)
+		{
+#if defined(__AVX2__)
+			const __m256 scale8 = _mm256_set1_ps(inverse_distance);
+			for (; first + 8 <= last; first += 8)
+			{
+				const __m256 rise = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(row + first + offset), _mm256_loadu_ps(centre + first)), scale8);
+				_mm256_storeu_ps(horizon + first, _mm256_max_ps(_mm256_loadu_ps(horizon + first), rise));
+			}
+#endif
+			const __m128 scale4 = _mm_set1_ps(inverse_distance);
+			for (; first + 4 <= last; first += 4)
+			{
+				const __m128 rise = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(row + first + offset), _mm_loadu_ps(centre + first)), scale4);
+				_mm_storeu_ps(horizon + first, _mm_max_ps(_mm_loadu_ps(horizon + first), rise));
+			}
+			for (; first < last; first++)
+			{
+				horizon[first] = glm::max(horizon[first], (row[first + offset] - centre[first]) * inverse_distance);
+			}
+		}
+
+		// note: the part of the row the offset takes past the edge reads the edge sample
+		void raise_horizon_clamped(float *horizon, const float *centre, const float height, const float inverse_distance, int32 first, const int32 last)
+		{
+			for (; first < last; first++)
+			{
+				horizon[first] = glm::max(horizon[first], (height - centre[first]) * inverse_distance);
+			}
+		}
+
+		// note: one step for the samples [x0, x1) of a row, row is the row step.z_ away
+		void raise_horizon(float *horizon, const float *centre, const float *row, const int32 width, const scan_step &step, const int32 x0, const int32 x1)
+		{
+			const int32 first = glm::clamp(-step.x_, x0, x1);
+			const int32 last = glm::clamp(width - step.x_, first, x1);
+
+			raise_horizon_clamped(horizon, centre, row[0], step.inverse_distance_, x0, first);
+			raise_horizon(horizon, centre, row, step.x_, step.inverse_distance_, first, last);
+			raise_horizon_clamped(horizon, centre, row[width - 1], step.inverse_distance_, last, x1);
+		}
+
+		// note: evenly spread directions starting along +x. steps are one sample apart close
+		//       by and a quarter of the distance further out, where the horizon changes slowly.
+		//       a rounded offset equal to the last is skipped
+		void build_scan(const int32 count, const float radius, dynamic_array<scan_direction> &directions, dynamic_array<scan_step> &steps)
+		{
+			directions.resize(count);
+			steps.clear();
+			for (int32 index = 0; index < count; index++)
+			{
+				const float angle = TWO_PI * static_cast<float>(index) / static_cast<float>(count);
+
+				scan_direction &current = directions[index];
+				current.direction_ = glm::vec2(std::cos(angle), std::sin(angle));
+				current.first_step_ = static_cast<int32>(steps.size());
+
+				int32 last_x = 0;
+				int32 last_z = 0;
+				for (float distance = 1.0f; distance <= radius; distance += glm::max(1.0f, std::floor(distance * 0.25f)))
+				{
+					const int32 x = static_cast<int32>(std::floor(current.direction_.x * distance + 0.5f));
+					const int32 z = static_cast<int32>(std::floor(current.direction_.y * distance + 0.5f));
+					if ((x == last_x && z == last_z) || (x == 0 && z == 0))
+					{
+						continue;
+					}
+
+					const scan_step step = { x, z, 1.0f / std::sqrt(static_cast<float>(x * x + z * z)) };
+					steps.push_back(step);
+					last_x = x;
+					last_z = z;
+				}
+
+				current.step_count_ = static_cast<int32>(steps.size()) - current.first_step_;
+			}
+		}
+
+		// note: occlusion[x] += sin(atan(horizon[x])) - sin(atan(tangent[x])), with the sine
+		//       of the elevation taken straight from its slope as t / sqrt(1 + t * t)
+		void accumulate(float *occlusion, const float *horizon, const float *tangent, const int32 count)
+		{
+			int32 x = 0;
+#if defined(__AVX2__)
+			const __m256 one8 = _mm256_set1_ps(1.0f);
+			for (; x + 8 <= count; x += 8)
+			{
+				const __m256 h = _mm256_loadu_ps(horizon + x);
+				const __m256 t = _mm256_loadu_ps(tangent + x);
+				const __m256 sin_h = _mm256_div_ps(h, _mm256_sqrt_ps(_mm256_add_ps(one8, _mm256_mul_ps(h, h))));
+				const __m256 sin_t = _mm256_div_ps(t, _mm256_sqrt_ps(_mm256_add_ps(one8, _mm256_mul_ps(t, t))));
+				_mm256_storeu_ps(occlusion + x, _mm256_add_ps(_mm256_loadu_ps(occlusion + x), _mm256_sub_ps(sin_h, sin_t)));
+			}
+#endif
+			const __m128 one4 = _mm_set1_ps(1.0f);
+			for (; x + 4 <= count; x += 4)
+			{
+				const __m128 h = _mm_loadu_ps(horizon + x);
+				const __m128 t = _mm_loadu_ps(tangent + x);
+				const __m128 sin_h = _mm_div_ps(h, _mm_sqrt_ps(_mm_add_ps(one4, _mm_mul_ps(h, h))));
+				const __m128 sin_t = _mm_div_ps(t, _mm_sqrt_ps(_mm_add_ps(one4, _mm_mul_ps(t, t))));
+				_mm_storeu_ps(occlusion + x, _mm_add_ps(_mm_loadu_ps(occlusion + x), _mm_sub_ps(sin_h, sin_t)));
+			}
+			for (; x < count; x++)
+			{
+				const float h = horizon[x];
+				const float t = tangent[x];
+				occlusion[x] += h / std::sqrt(1.0f + h * h) - t / std::sqrt(1.0f + t * t);
+			}
+		}
+	} // !anon
+
+	terrain_occlusion::terrain_occlusion()
+		: directions_(16)
+		, radius_(64.0f)
+	{
+	}
+
+	bool terrain_occlusion::bake(const heightfield &field, dynamic_array<float> &result, worker_pool *pool) const
+	{
+		if (!field.is_valid() || field.width_ < 2 || field.height_ < 2)
+		{
+			assert(!"heightfield not created!");
+			return false;
+		}
+
+		if (directions_ < 1 || directions_ > MAX_DIRECTIONS || radius_ < 1.0f)
+		{
+			assert(!"invalid occlusion settings!");
+			return false;
+		}
+
+		const int32 width = field.width_;
+		const int32 height = field.height_;
+
+		dynamic_array<scan_direction> directions;
+		dynamic_array<scan_step> steps;
+		build_scan(directions_, radius_, directions, steps);
+
+		result.resize(static_cast<size_t>(width) * height);
+
+		const float *heights = field.heights_.data();
+		const float average = 1.0f / static_cast<float>(directions_);
+		const int32 band_count = (height + BAND_ROWS - 1) / BAND_ROWS;
+		parallel_for(pool, band_count, [&](const int32 band)
+		{
+			dynamic_array<float> slope_x(width);
+			dynamic_array<float> slope_z(width);
+			dynamic_array<float> tangent(width);
+			dynamic_array<float> horizon(width);
+			dynamic_array<float> occlusion(width);
+
+			const int32 end = glm::min(height, (band + 1) * BAND_ROWS);
+			for (int32 z = band * BAND_ROWS; z < end; z++)
+			{
+				const float *centre = heights + static_cast<size_t>(z) * width;
+
+				// note: central differences like the normals, one sided on the border
+				const int32 up = glm::max(z - 1, 0);
+				const int32 down = glm::min(z + 1, height - 1);
+				const float *row_up = heights + static_cast<size_t>(up) * width;
+				const float *row_down = heights + static_cast<size_t>(down) * width;
+				for (int32 x = 0; x < width; x++)
+				{
+					const int32 left = glm::max(x - 1, 0);
+					const int32 right = glm::min(x + 1, width - 1);
+					slope_x[x] = (centre[right] - centre[left]) / static_cast<float>(right - left);
+					slope_z[x] = (row_down[x] - row_up[x]) / static_cast<float>(down - up);
+				}
+
+				std::fill(occlusion.begin(), occlusion.end(), 0.0f);
+				for (const scan_direction &current : directions)
+				{
+					// note: the horizon starts at the tangent plane, lower ground blocks nothing
+					for (int32 x = 0; x < width; x++)
+					{
+						tangent[x] = slope_x[x] * current.direction_.x + slope_z[x] * current.direction_.y;
+						horizon[x] = tangent[x];
+					}
+
+					for (int32 index = 0; index < current.step_count_; index++)
+					{
+						const scan_step &step = steps[current.first_step_ + index];
+						const float *row = heights + static_cast<size_t>(glm::clamp(z + step.z_, 0, height - 1)) * width;
+						raise_horizon(horizon.data(), centre, row, width, step, 0, width);
+					}
+
+					accumulate(occlusion.data(), horizon.data(), tangent.data(), width);
+				}
+
+				float *dst = result.data() + static_cast<size_t>(z) * width;
+				for (int32 x = 0; x < width; x++)
+				{
+					dst[x] = glm::clamp(occlusion[x] * average, 0.0f, 1.0f);
+				}
+			}
+		});
+
+		return true;
+	}
+
+	terrain_horizon::terrain_horizon()
+		: radius_(128.0f)
+		, width_(0)
+		, height_(0)
+		, tiles_x_(0)
+		, tiles_z_(0)
+		, dirty_count_(0)
+	{
+	}
+
+	bool terrain_horizon::is_valid() const
+	{
+		return textures_[0].is_valid() && sampler_.is_valid();
+	}
+
+	bool terrain_horizon::create(const heightfield &field, worker_pool *pool)
+	{
+		if (!field.is_valid() || field.width_ < 2 || field.height_ < 2)
+		{
+			assert(!"heightfield not created!");
+			return false;
+		}
+
+		if (radius_ < 1.0f)
+		{
+			assert(!"invalid horizon radius!");
+			return false;
+		}
+
+		width_ = field.width_;
+		height_ = field.height_;
+		tiles_x_ = (width_ + TILE_SIZE - 1) / TILE_SIZE;
+		tiles_z_ = (height_ + TILE_SIZE - 1) / TILE_SIZE;
+		for (int32 layer = 0; layer < LAYERS; layer++)
+		{
+			layers_[layer].resize(static_cast<size_t>(width_) * height_ * 4);
+		}
+
+		// note: the first update bakes everything, the textures are created from the result
+		dirty_.assign(static_cast<size_t>(tiles_x_) * tiles_z_, 1);
+		dirty_count_ = tiles_x_ * tiles_z_;
+		update(field, dirty_count_, pool);
+
+		for (int32 layer = 0; layer < LAYERS; layer++)
+		{
+			if (!textures_[layer].create(TEXTURE_FORMAT_RGBA8, width_, height_, layers_[layer].data()))
+			{
+				return false;
+			}
+		}
+
+		if (!sampler_.create(SAMPLER_FILTER_MODE_LINEAR,
+							 SAMPLER_ADDRESS_MODE_CLAMP,
+							 SAMPLER_ADDRESS_MODE_CLAMP))
+		{
+			return false;
+		}
+
+		return is_valid();
+	}
+
+	void terrain_horizon::destroy()
+	{
+		for (int32 layer = 0; layer < LAYERS; layer++)
+		{
+			if (textures_[layer].is_valid())
+			{
+				textures_[layer].destroy();
+			}
+			dynamic_array<uint8>().swap(layers_[layer]);
+		}
+		if (sampler_.is_valid())
+		{
+			sampler_.destroy();
+		}
+
+		dynamic_array<uint8>().swap(dirty_);
+		dynamic_array<uint8>().swap(staging_);
+		width_ = 0;
+		height_ = 0;
+		tiles_x_ = 0;
+		tiles_z_ = 0;
+		dirty_count_ = 0;
+	}
+
+	void terrain_horizon::invalidate(const int32 x0, const int32 z0, const int32 x1, const int32 z1)
+	{
+		if (dirty_.empty())
+		{
+			return;
+		}
+
+		// note: samples up to radius_ away look across the change
+		const int32 reach = static_cast<int32>(std::ceil(radius_));
+		const int32 first_x = glm::max(x0 - reach, 0) / TILE_SIZE;
+		const int32 first_z = glm::max(z0 - reach, 0) / TILE_SIZE;
+		const int32 last_x = glm::min(x1 + reach, width_) - 1;
+		const int32 last_z = glm::min(z1 + reach, height_) - 1;
+		if (last_x < 0 || last_z < 0)
+		{
+			return;
+		}
+
+		for (int32 tz = first_z; tz <= last_z / TILE_SIZE; tz++)
+		{
+			for (int32 tx = first_x; tx <= last_x / TILE_SIZE; tx++)
+			{
+				uint8 &dirty = dirty_[tz * tiles_x_ + tx];
+				dirty_count_ += dirty ? 0 : 1;
+				dirty = 1;
+			}
+		}
+	}
+
+	int32 terrain_horizon::update(const heightfield &field, const int32 max_tiles, worker_pool *pool)
+	{
+		if (dirty_count_ == 0 || max_tiles < 1)
+		{
+			return dirty_count_;
+		}
+
+		if (field.width_ != width_ || field.height_ != height_)
+		{
+			assert(!"heightfield does not match the horizon maps!");
+			return dirty_count_;
+		}
+
+		dynamic_array<int32> tiles;
+		for (int32 index = 0; index < static_cast<int32>(dirty_.size()) && static_cast<int32>(tiles.size()) < max_tiles; index++)
+		{
+			if (dirty_[index])
+			{
+				tiles.push_back(index);
+				dirty_[index] = 0;
+			}
+		}
+		dirty_count_ -= static_cast<int32>(tiles.size());
+
+		dynamic_array<scan_direction> directions;
+		dynamic_array<scan_step> steps;
+		build_scan(AZIMUTHS, radius_, directions, steps);
+
+		// note: the horizon starts level, the sun is down below it anyway
+		const float *heights = field.heights_.data();
+		const int32 width = width_;
+		const int32 height = height_;
+		parallel_for(pool, static_cast<int32>(tiles.size()), [&](const int32 job)
+		{
+			const int32 x0 = (tiles[job] % tiles_x_) * TILE_SIZE;
+			const int32 z0 = (tiles[job] / tiles_x_) * TILE_SIZE;
+			const int32 x1 = glm::min(x0 + TILE_SIZE, width);
+			const int32 z1 = glm::min(z0 + TILE_SIZE, height);
+
+			dynamic_array<float> horizon(width);
+			for (int32 z = z0; z < z1; z++)
+			{
+				const float *centre = heights + static_cast<size_t>(z) * width;
+				for (int32 azimuth = 0; azimuth < AZIMUTHS; azimuth++)
+				{
+					const scan_direction &current = directions[azimuth];
+					std::fill(horizon.begin() + x0, horizon.begin() + x1, 0.0f);
+					for (int32 index = 0; index < current.step_count_; index++)
+					{
+						const scan_step &step = steps[current.first_step_ + index];
+						const float *row = heights + static_cast<size_t>(glm::clamp(z + step.z_, 0, height - 1)) * width;
+						raise_horizon(horizon.data(), centre, row, width, step, x0, x1);
+					}
+
+					uint8 *dst = layers_[azimuth / 4].data() + (static_cast<size_t>(z) * width + x0) * 4 + azimuth % 4;
+					for (int32 x = x0; x < x1; x++, dst += 4)
+					{
+						const float h = horizon[x];
+						*dst = static_cast<uint8>(h / std::sqrt(1.0f + h * h) * 255.0f + 0.5f);
+					}
+				}
+			}
+		});
+
+		// note: tiles go up one rectangle at a time, before create made the textures the
+		//       whole maps are uploaded by it
+		if (textures_[0].is_valid())
+		{
+			for (const int32 tile : tiles)
+			{
+				const int32 x0 = (tile % tiles_x_) * TILE_SIZE;
+				const int32 z0 = (tile / tiles_x_) * TILE_SIZE;
+				const int32 x1 = glm::min(x0 + TILE_SIZE, width_);
+				const int32 z1 = glm::min(z0 + TILE_SIZE, height_);
+				for (int32 layer = 0; layer < LAYERS; layer++)
+				{
+					upload_rect(textures_[layer], TEXTURE_FORMAT_RGBA8, 4, layers_[layer].data(), width_, x0, z0, x1, z1, staging_);
+				}
+			}
+		}
+
+		return dirty_count_;
+	}
+
+	void terrain_horizon::bind(renderer &rend, shader_program &program, const int32 first_unit)
+	{
+		static_assert(LAYERS == 2, "horizon uniform names expect two layers");
+		const char *names[LAYERS] = { "u_horizon0", "u_horizon1" };
+		const glm::vec2 size(static_cast<float>(width_), static_cast<float>(height_));
+
+		rend.set_shader_uniform(program, UNIFORM_TYPE_VEC2, "u_horizon_size", 1, glm::value_ptr(size));
+		for (int32 layer = 0; layer < LAYERS; layer++)
+		{
+			const int32 unit = first_unit + layer;
+			rend.set_shader_uniform(program, UNIFORM_TYPE_SAMPLER, names[layer], 1, &unit);
+			rend.set_texture(textures_[layer], unit);
+			rend.set_sampler_state(sampler_, unit);
+		}
+	}
+
+	void store_occlusion(const dynamic_array<float> &occlusion, dynamic_array<terrain_vertex> &vertices)
+	{
+		if (occlusion.size() != vertices.size())
+		{
+			assert(!"occlusion does not match the vertices!");
+			return;
+		}
+
+		for (size_t index = 0; index < vertices.size(); index++)
+		{
+			vertices[index].occlusion_ = static_cast<uint16>(glm::clamp(occlusion[index], 0.0f, 1.0f) * 65535.0f + 0.5f);
+		}
+	}
+
+	void store_occlusion(const dynamic_array<float> &occlusion, dynamic_array<vertex> &vertices)
+	{
+		if (occlusion.size() != vertices.size())
+		{
+			assert(!"occlusion does not match the vertices!");
+			return;
+		}
+
+		for (size_t index = 0; index < vertices.size(); index++)
+		{
+			vertices[index].color_.a = 1.0f - glm::clamp(occlusion[index], 0.0f, 1.0f);
+		}
+	}
+} // !avocado
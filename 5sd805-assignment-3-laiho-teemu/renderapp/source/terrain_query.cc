@@ -0,0 +1,362 @@
+// terrain_query.cc
+
+#include "terrain_query.hpp"
+
+#include <avocado_thread.hpp>
+
+#include <cstring>
+#include <emmintrin.h>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+namespace avocado {
+	namespace
+	{
+		// note: queries per job when a worker pool is given
+		const int32 BATCH_SIZE = 4096;
+
+		// note: the four samples around a position and the position inside the cell,
+		//       heights are still quantized
+		struct cell {
+			float h00;
+			float h10;
+			float h01;
+			float h11;
+			float tx;
+			float tz;
+		};
+
+		// note: x0 and x0 + 1 sit next to each other, so one 32 bit load reads both
+		inline uint32 load_pair(const uint16 *src)
+		{
+			uint32 result;
+			std::memcpy(&result, src, sizeof(result));
+			return result;
+		}
+
+		cell locate(const terrain_query &query, const float x, const float z)
+		{
+			const float fx = glm::clamp(x, 0.0f, static_cast<float>(query.width_ - 1));
+			const float fz = glm::clamp(z, 0.0f, static_cast<float>(query.height_ - 1));
+			const int32 cx = static_cast<int32>(glm::min(fx, static_cast<float>(query.width_ - 2)));
+			const int32 cz = static_cast<int32>(glm::min(fz, static_cast<float>(query.height_ - 2)));
+
+			const uint16 *top = query.heights_.data() + static_cast<size_t>(cz) * query.width_ + cx;
+			const uint16 *bottom = top + query.width_;
+
+			cell result;
+			result.h00 = static_cast<float>(top[0]);
+			result.h10 = static_cast<float>(top[1]);
+			result.h01 = static_cast<float>(bottom[0]);
+			result.h11 = static_cast<float>(bottom[1]);
+			result.tx = fx - static_cast<float>(cx);
+			result.tz = fz - static_cast<float>(cz);
+			return result;
+		}
+
+		struct cell4 {
+			__m128 h00;
+			__m128 h10;
+			__m128 h01;
+			__m128 h11;
+			__m128 tx;
+			__m128 tz;
+		};
+
+		cell4 locate4(const terrain_query &query, const float *x, const float *z)
+		{
+			const __m128 zero = _mm_setzero_ps();
+			const __m128 fx = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(x), zero), _mm_set1_ps(static_cast<float>(query.width_ - 1)));
+			const __m128 fz = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(z), zero), _mm_set1_ps(static_cast<float>(query.height_ - 1)));
+
+			// note: positions are not negative here so truncation floors
+			const __m128i cx = _mm_cvttps_epi32(_mm_min_ps(fx, _mm_set1_ps(static_cast<float>(query.width_ - 2))));
+			const __m128i cz = _mm_cvttps_epi32(_mm_min_ps(fz, _mm_set1_ps(static_cast<float>(query.height_ - 2))));
+
+			// note: sse2 has no gather, the index math overflows floats on large maps
+			alignas(16) int32 column[4];
+			alignas(16) int32 row[4];
+			alignas(16) uint32 top[4];
+			alignas(16) uint32 bottom[4];
+			_mm_store_si128(reinterpret_cast<__m128i *>(column), cx);
+			_mm_store_si128(reinterpret_cast<__m128i *>(row), cz);
+			for (int32 lane = 0; lane < 4; lane++)
+			{
+				const uint16 *src = query.heights_.data() + static_cast<size_t>(row[lane]) * query.width_ + column[lane];
+				top[lane] = load_pair(src);
+				bottom[lane] = load_pair(src + query.width_);
+			}
+
+			const __m128i low = _mm_set1_epi32(0xffff);
+			const __m128i pair_top = _mm_load_si128(reinterpret_cast<const __m128i *>(top));
+			const __m128i pair_bottom = _mm_load_si128(reinterpret_cast<const __m128i *>(bottom));
+
+			cell4 result;
+			result.h00 = _mm_cvtepi32_ps(_mm_and_si128(pair_top, low));
+			result.h10 = _mm_cvtepi32_ps(_mm_srli_epi32(pair_top, 16));
+			result.h01 = _mm_cvtepi32_ps(_mm_and_si128(pair_bottom, low));
+			result.h11 = _mm_cvtepi32_ps(_mm_srli_epi32(pair_bottom, 16));
+			result.tx = _mm_sub_ps(fx, _mm_cvtepi32_ps(cx));
+			result.tz = _mm_sub_ps(fz, _mm_cvtepi32_ps(cz));
+			return result;
+		}
+
+		inline __m128 lerp4(const __m128 a, const __m128 b, const __m128 t)
+		{
+			return _mm_add_ps(a, _mm_mul_ps(_mm_sub_ps(b, a), t));
+		}
+
+#if defined(__AVX2__)
+		struct cell8 {
+			__m256 h00;
+			__m256 h10;
+			__m256 h01;
+			__m256 h11;
+			__m256 tx;
+			__m256 tz;
+		};
+
+		cell8 locate8(const terrain_query &query, const float *x, const float *z)
+		{
+			const __m256 zero = _mm256_setzero_ps();
+			const __m256 fx = _mm256_min_ps(_mm256_max_ps(_mm256_loadu_ps(x), zero), _mm256_set1_ps(static_cast<float>(query.width_ - 1)));
+			const __m256 fz = _mm256_min_ps(_mm256_max_ps(_mm256_loadu_ps(z), zero), _mm256_set1_ps(static_cast<float>(query.height_ - 1)));
+			const __m256i cx = _mm256_cvttps_epi32(_mm256_min_ps(fx, _mm256_set1_ps(static_cast<float>(query.width_ - 2))));
+			const __m256i cz = _mm256_cvttps_epi32(_mm256_min_ps(fz, _mm256_set1_ps(static_cast<float>(query.height_ - 2))));
+
+			// note: gathers index in 16 bit steps, so each lane reads a pair of samples
+			const __m256i index = _mm256_add_epi32(_mm256_mullo_epi32(cz, _mm256_set1_epi32(query.width_)), cx);
+			const int *base = reinterpret_cast<const int *>(query.heights_.data());
+			const __m256i pair_top = _mm256_i32gather_epi32(base, index, 2);
+			const __m256i pair_bottom = _mm256_i32gather_epi32(base, _mm256_add_epi32(index, _mm256_set1_epi32(query.width_)), 2);
+			const __m256i low = _mm256_set1_epi32(0xffff);
+
+			cell8 result;
+			result.h00 = _mm256_cvtepi32_ps(_mm256_and_si256(pair_top, low));
+			result.h10 = _mm256_cvtepi32_ps(_mm256_srli_epi32(pair_top, 16));
+			result.h01 = _mm256_cvtepi32_ps(_mm256_and_si256(pair_bottom, low));
+			result.h11 = _mm256_cvtepi32_ps(_mm256_srli_epi32(pair_bottom, 16));
+			result.tx = _mm256_sub_ps(fx, _mm256_cvtepi32_ps(cx));
+			result.tz = _mm256_sub_ps(fz, _mm256_cvtepi32_ps(cz));
+			return result;
+		}
+
+		inline __m256 lerp8(const __m256 a, const __m256 b, const __m256 t)
+		{
+			return _mm256_add_ps(a, _mm256_mul_ps(_mm256_sub_ps(b, a), t));
+		}
+#endif
+
+		void heights_batch(const terrain_query &query, const int32 count, const float *x, const float *z, float *result)
+		{
+			const float step = query.height_scale_ / 65535.0f;
+
+			int32 index = 0;
+#if defined(__AVX2__)
+			{
+				const __m256 offset = _mm256_set1_ps(query.height_offset_);
+				const __m256 scale = _mm256_set1_ps(step);
+				for (; index + 8 <= count; index += 8)
+				{
+					const cell8 c = locate8(query, x + index, z + index);
+					const __m256 h = lerp8(lerp8(c.h00, c.h10, c.tx), lerp8(c.h01, c.h11, c.tx), c.tz);
+					_mm256_storeu_ps(result + index, _mm256_add_ps(offset, _mm256_mul_ps(h, scale)));
+				}
+			}
+#endif
+
+			{
+				const __m128 offset = _mm_set1_ps(query.height_offset_);
+				const __m128 scale = _mm_set1_ps(step);
+				for (; index + 4 <= count; index += 4)
+				{
+					const cell4 c = locate4(query, x + index, z + index);
+					const __m128 h = lerp4(lerp4(c.h00, c.h10, c.tx), lerp4(c.h01, c.h11, c.tx), c.tz);
+					_mm_storeu_ps(result + index, _mm_add_ps(offset, _mm_mul_ps(h, scale)));
+				}
+			}
+
+			for (; index < count; index++)
+			{
+				result[index] = query.height(x[index], z[index]);
+			}
+		}
+
+		void normals_batch(const terrain_query &query, const int32 count, const float *x, const float *z, glm::vec3 *result)
+		{
+			const float step = query.height_scale_ / 65535.0f;
+
+			alignas(32) float nx[8];
+			alignas(32) float ny[8];
+			alignas(32) float nz[8];
+
+			int32 index = 0;
+#if defined(__AVX2__)
+			{
+				const __m256 one = _mm256_set1_ps(1.0f);
+				const __m256 scale = _mm256_set1_ps(-step);
+				for (; index + 8 <= count; index += 8)
+				{
+					const cell8 c = locate8(query, x + index, z + index);
+					const __m256 dx = _mm256_mul_ps(lerp8(_mm256_sub_ps(c.h10, c.h00), _mm256_sub_ps(c.h11, c.h01), c.tz), scale);
+					const __m256 dz = _mm256_mul_ps(lerp8(_mm256_sub_ps(c.h01, c.h00), _mm256_sub_ps(c.h11, c.h10), c.tx), scale);
+					const __m256 inverse = _mm256_div_ps(one, _mm256_sqrt_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dz, dz)), one)));
+
+					_mm256_store_ps(nx, _mm256_mul_ps(dx, inverse));
+					_mm256_store_ps(ny, inverse);
+					_mm256_store_ps(nz, _mm256_mul_ps(dz, inverse));
+					for (int32 lane = 0; lane < 8; lane++)
+					{
+						result[index + lane] = glm::vec3(nx[lane], ny[lane], nz[lane]);
+					}
+				}
+			}
+#endif
+
+			{
+				const __m128 one = _mm_set1_ps(1.0f);
+				const __m128 scale = _mm_set1_ps(-step);
+				for (; index + 4 <= count; index += 4)
+				{
+					const cell4 c = locate4(query, x + index, z + index);
+					const __m128 dx = _mm_mul_ps(lerp4(_mm_sub_ps(c.h10, c.h00), _mm_sub_ps(c.h11, c.h01), c.tz), scale);
+					const __m128 dz = _mm_mul_ps(lerp4(_mm_sub_ps(c.h01, c.h00), _mm_sub_ps(c.h11, c.h10), c.tx), scale);
+					const __m128 inverse = _mm_div_ps(one, _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dz, dz)), one)));
+
+					_mm_store_ps(nx, _mm_mul_ps(dx, inverse));
+					_mm_store_ps(ny, inverse);
+					_mm_store_ps(nz, _mm_mul_ps(dz, inverse));
+					for (int32 lane = 0; lane < 4; lane++)
+					{
+						result[index + lane] = glm::vec3(nx[lane], ny[lane], nz[lane]);
+					}
+				}
+			}
+
+			for (; index < count; index++)
+			{
+				result[index] = query.normal(x[index], z[index]);
+			}
+		}
+	}
+
+	terrain_query::terrain_query()
+		: width_(0)
+		, height_(0)
+		, height_offset_(0.0f)
+		, height_scale_(1.0f)
+	{
+	}
+
+	bool terrain_query::is_valid() const
+	{
+		return width_ >= 2 && height_ >= 2;
+	}
+
+	bool terrain_query::create(const heightfield &field)
+	{
+		if (field.width_ < 2 || field.height_ < 2)
+		{
+			assert(!"heightmap dimensions not correct!");
+			return false;
+		}
+
+		width_ = field.width_;
+		height_ = field.height_;
+
+		// note: quantized the same way as the compact terrain vertices
+		float lowest = field.heights_[0];
+		float highest = field.heights_[0];
+		for (const float height : field.heights_)
+		{
+			lowest = glm::min(lowest, height);
+			highest = glm::max(highest, height);
+		}
+
+		height_offset_ = lowest;
+		height_scale_ = highest > lowest ? highest - lowest : 1.0f;
+
+		const float quantize = 65535.0f / height_scale_;
+		heights_.resize(field.heights_.size());
+		for (size_t index = 0; index < heights_.size(); index++)
+		{
+			const float height = (field.heights_[index] - height_offset_) * quantize;
+			heights_[index] = static_cast<uint16>(glm::clamp(height + 0.5f, 0.0f, 65535.0f));
+		}
+
+		return is_valid();
+	}
+
+	bool terrain_query::create(const heightmap &map, const dynamic_array<terrain_vertex> &vertices)
+	{
+		if (map.image_width < 2 || map.image_height < 2 || static_cast<int32>(vertices.size()) != map.image_width * map.image_height)
+		{
+			assert(!"heightmap dimensions not correct!");
+			return false;
+		}
+
+		width_ = map.image_width;
+		height_ = map.image_height;
+		height_offset_ = map.height_offset;
+		height_scale_ = map.height_scale;
+
+		heights_.resize(vertices.size());
+		for (size_t index = 0; index < vertices.size(); index++)
+		{
+			heights_[index] = vertices[index].height_;
+		}
+
+		return is_valid();
+	}
+
+	void terrain_query::destroy()
+	{
+		width_ = 0;
+		height_ = 0;
+		dynamic_array<uint16>().swap(heights_);
+	}
+
+	float terrain_query::height(const float x, const float z) const
+	{
+		assert(is_valid());
+
+		const cell c = locate(*this, x, z);
+		const float h = glm::mix(glm::mix(c.h00, c.h10, c.tx), glm::mix(c.h01, c.h11, c.tx), c.tz);
+		return height_offset_ + h * (height_scale_ / 65535.0f);
+	}
+
+	glm::vec3 terrain_query::normal(const float x, const float z) const
+	{
+		assert(is_valid());
+
+		// note: slopes of the bilinear patch, the normal is (-dh/dx, 1, -dh/dz)
+		const cell c = locate(*this, x, z);
+		const float step = height_scale_ / 65535.0f;
+		const float dx = glm::mix(c.h10 - c.h00, c.h11 - c.h01, c.tz) * step;
+		const float dz = glm::mix(c.h01 - c.h00, c.h11 - c.h10, c.tx) * step;
+		return glm::normalize(glm::vec3(-dx, 1.0f, -dz));
+	}
+
+	void terrain_query::heights(const int32 count, const float *x, const float *z, float *result, worker_pool *pool) const
+	{
+		assert(is_valid());
+
+		parallel_for(pool, (count + BATCH_SIZE - 1) / BATCH_SIZE, [&](const int32 batch)
+		{
+			const int32 first = batch * BATCH_SIZE;
+			heights_batch(*this, glm::min(BATCH_SIZE, count - first), x + first, z + first, result + first);
+		});
+	}
+
+	void terrain_query::normals(const int32 count, const float *x, const float *z, glm::vec3 *result, worker_pool *pool) const
+	{
+		assert(is_valid());
+
+		parallel_for(pool, (count + BATCH_SIZE - 1) / BATCH_SIZE, [&](const int32 batch)
+		{
+			const int32 first = batch * BATCH_SIZE;
+			normals_batch(*this, glm::min(BATCH_SIZE, count - first), x + first, z + first, result + first);
+		});
+	}
+} // !avocado
@@ -0,0 +1,392 @@
+// terrain_splat.cc
+
+#include "terrain_splat.hpp"
+#include "terrain_texture.hpp"
+
+#pragma warning(push)
+#pragma warning(disable: 4127)
+#pragma warning(disable: 4201)
+#include <glm/gtc/type_ptr.hpp>
+#pragma warning(pop)
+
+#include <algorithm>
+#include <cmath>
+
+#include <emmintrin.h>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+namespace avocado {
+	namespace
+	{
+		// note: the tuning folded into starts and scales, x = (value - start) * scale
+		struct splat_rules {
+			float lowest_;
+			float inverse_range_;
+			float curvature_;
+			float sand_start_;
+			float snow_start_;
+			float height_scale_;
+			float rock_start_;
+			float rock_scale_;
+		};
+
+		splat_rules make_rules(const terrain_splat &splat)
+		{
+			const float range = splat.highest_ - splat.lowest_;
+			const float transition = glm::max(splat.transition_, 1e-3f);
+			const float slope_transition = glm::max(splat.slope_transition_, 1e-3f);
+
+			splat_rules result;
+			result.lowest_ = splat.lowest_;
+			result.inverse_range_ = range > 0.0f ? 1.0f / range : 0.0f;
+			result.curvature_ = splat.curvature_;
+			result.sand_start_ = splat.sand_level_ - transition * 0.5f;
+			result.snow_start_ = splat.snow_level_ - transition * 0.5f;
+			result.height_scale_ = 1.0f / transition;
+			result.rock_start_ = splat.rock_slope_ - slope_transition * 0.5f;
+			result.rock_scale_ = 1.0f / slope_transition;
+			return result;
+		}
+
+		float smooth(float x)
+		{
+			x = glm::clamp(x, 0.0f, 1.0f);
+			return x * x * (3.0f - 2.0f * x);
+		}
+
+		uint8 quantize(const float weight)
+		{
+			return static_cast<uint8>(static_cast<int32>(weight * 255.0f + 0.5f));
+		}
+
+		// note: the vector paths below follow this operation for operation, so all three give
+		//       the same bytes. hollows have positive curvature and count as flatter and lower
+		void splat_sample(const splat_rules &rules,
+						  const float left, const float centre, const float right, const float up, const float down,
+						  const float inverse_dx, const float inverse_dz, uint8 *dst)
+		{
+			const float gx = (right - left) * inverse_dx;
+			const float gz = (down - up) * inverse_dz;
+			const float slope = std::sqrt(gx * gx + gz * gz);
+			const float curvature = ((left + right) + (up + down)) - 4.0f * centre;
+			const float shift = curvature * rules.curvature_;
+			const float level = ((centre - shift) - rules.lowest_) * rules.inverse_range_;
+
+			const float rock = smooth(((slope - shift) - rules.rock_start_) * rules.rock_scale_);
+			const float snow = smooth((level - rules.snow_start_) * rules.height_scale_);
+			const float sand = 1.0f - smooth((level - rules.sand_start_) * rules.height_scale_);
+
+			const float rest = 1.0f - rock;
+			const float snow_weight = rest * snow;
+			const float below = rest - snow_weight;
+			const float sand_weight = below * sand;
+
+			dst[terrain_splat::LAYER_SAND] = quantize(sand_weight);
+			dst[terrain_splat::LAYER_GRASS] = quantize(below - sand_weight);
+			dst[terrain_splat::LAYER_ROCK] = quantize(rock);
+			dst[terrain_splat::LAYER_SNOW] = quantize(snow_weight);
+		}
+
+		// note: four samples of each layer interleaved to rgba and narrowed to bytes
+		__m128i pack_weights(const __m128i sand, const __m128i grass, const __m128i rock, const __m128i snow)
+		{
+			const __m128i sand_rock_lo = _mm_unpacklo_epi32(sand, rock);
+			const __m128i sand_rock_hi = _mm_unpackhi_epi32(sand, rock);
+			const __m128i grass_snow_lo = _mm_unpacklo_epi32(grass, snow);
+			const __m128i grass_snow_hi = _mm_unpackhi_epi32(grass, snow);
+			const __m128i first = _mm_packs_epi32(_mm_unpacklo_epi32(sand_rock_lo, grass_snow_lo),
+												  _mm_unpackhi_epi32(sand_rock_lo, grass_snow_lo));
+			const __m128i second = _mm_packs_epi32(_mm_unpacklo_epi32(sand_rock_hi, grass_snow_hi),
+												   _mm_unpackhi_epi32(sand_rock_hi, grass_snow_hi));
+			return _mm_packus_epi16(first, second);
+		}
+
+		__m128 smooth(__m128 x)
+		{
+			x = _mm_min_ps(_mm_max_ps(x, _mm_setzero_ps()), _mm_set1_ps(1.0f));
+			return _mm_mul_ps(_mm_mul_ps(x, x), _mm_sub_ps(_mm_set1_ps(3.0f), _mm_mul_ps(_mm_set1_ps(2.0f), x)));
+		}
+
+		__m128i quantize(const __m128 weight)
+		{
+			return _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(weight, _mm_set1_ps(255.0f)), _mm_set1_ps(0.5f)));
+		}
+
+#if defined(__AVX2__)
+		__m256 smooth(__m256 x)
+		{
+			x = _mm256_min_ps(_mm256_max_ps(x, _mm256_setzero_ps()), _mm256_set1_ps(1.0f));
+			return _mm256_mul_ps(_mm256_mul_ps(x, x), _mm256_sub_ps(_mm256_set1_ps(3.0f), _mm256_mul_ps(_mm256_set1_ps(2.0f), x)));
+		}
+
+		__m256i quantize(const __m256 weight)
+		{
+			return _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(weight, _mm256_set1_ps(255.0f)), _mm256_set1_ps(0.5f)));
+		}
+#endif
+
+		// note: samples [x0, x1) of one row, up and down are the rows next to it clamped to
+		//       the field. the first and last column use one sided differences, everything
+		//       between them goes through the vector loops
+		void splat_row(const splat_rules &rules, const float *up, const float *centre, const float *down,
+					   const float inverse_dz, const int32 width, const int32 x0, const int32 x1, uint8 *dst)
+		{
+			int32 x = x0;
+			if (x == 0)
+			{
+				splat_sample(rules, centre[0], centre[0], centre[1], up[0], down[0], 1.0f, inverse_dz, dst);
+				x++;
+			}
+
+			const int32 inner_end = glm::min(x1, width - 1);
+
+#if defined(__AVX2__)
+			{
+				const __m256 half = _mm256_set1_ps(0.5f);
+				const __m256 four = _mm256_set1_ps(4.0f);
+				const __m256 one = _mm256_set1_ps(1.0f);
+				const __m256 dz = _mm256_set1_ps(inverse_dz);
+				const __m256 curvature_scale = _mm256_set1_ps(rules.curvature_);
+				const __m256 lowest = _mm256_set1_ps(rules.lowest_);
+				const __m256 inverse_range = _mm256_set1_ps(rules.inverse_range_);
+				const __m256 sand_start = _mm256_set1_ps(rules.sand_start_);
+				const __m256 snow_start = _mm256_set1_ps(rules.snow_start_);
+				const __m256 height_scale = _mm256_set1_ps(rules.height_scale_);
+				const __m256 rock_start = _mm256_set1_ps(rules.rock_start_);
+				const __m256 rock_scale = _mm256_set1_ps(rules.rock_scale_);
+
+				for (; x + 8 <= inner_end; x += 8)
+				{
+					const __m256 left = _mm256_loadu_ps(centre + x - 1);
+					const __m256 right = _mm256_loadu_ps(centre + x + 1);
+					const __m256 middle = _mm256_loadu_ps(centre + x);
+					const __m256 above = _mm256_loadu_ps(up + x);
+					const __m256 below_row = _mm256_loadu_ps(down + x);
+
+					const __m256 gx = _mm256_mul_ps(_mm256_sub_ps(right, left), half);
+					const __m256 gz = _mm256_mul_ps(_mm256_sub_ps(below_row, above), dz);
+					const __m256 slope = _mm256_sqrt_ps(_mm256_add_ps(_mm256_mul_ps(gx, gx), _mm256_mul_ps(gz, gz)));
+					const __m256 curvature = _mm256_sub_ps(_mm256_add_ps(_mm256_add_ps(left, right), _mm256_add_ps(above, below_row)),
+														   _mm256_mul_ps(four, middle));
+					const __m256 shift = _mm256_mul_ps(curvature, curvature_scale);
+					const __m256 level = _mm256_mul_ps(_mm256_sub_ps(_mm256_sub_ps(middle, shift), lowest), inverse_range);
+
+					const __m256 rock = smooth(_mm256_mul_ps(_mm256_sub_ps(_mm256_sub_ps(slope, shift), rock_start), rock_scale));
+					const __m256 snow = smooth(_mm256_mul_ps(_mm256_sub_ps(level, snow_start), height_scale));
+					const __m256 sand = _mm256_sub_ps(one, smooth(_mm256_mul_ps(_mm256_sub_ps(level, sand_start), height_scale)));
+
+					const __m256 rest = _mm256_sub_ps(one, rock);
+					const __m256 snow_weight = _mm256_mul_ps(rest, snow);
+					const __m256 below = _mm256_sub_ps(rest, snow_weight);
+					const __m256 sand_weight = _mm256_mul_ps(below, sand);
+
+					const __m256i q_sand = quantize(sand_weight);
+					const __m256i q_grass = quantize(_mm256_sub_ps(below, sand_weight));
+					const __m256i q_rock = quantize(rock);
+					const __m256i q_snow = quantize(snow_weight);
+
+					uint8 *out = dst + static_cast<size_t>(x - x0) * 4;
+					_mm_storeu_si128(reinterpret_cast<__m128i *>(out),
+									 pack_weights(_mm256_castsi256_si128(q_sand), _mm256_castsi256_si128(q_grass),
+												  _mm256_castsi256_si128(q_rock), _mm256_castsi256_si128(q_snow)));
+					_mm_storeu_si128(reinterpret_cast<__m128i *>(out + 16),
+									 pack_weights(_mm256_extracti128_si256(q_sand, 1), _mm256_extracti128_si256(q_grass, 1),
+												  _mm256_extracti128_si256(q_rock, 1), _mm256_extracti128_si256(q_snow, 1)));
+				}
+			}
+#endif
+
+			{
+				const __m128 half = _mm_set1_ps(0.5f);
+				const __m128 four = _mm_set1_ps(4.0f);
+				const __m128 one = _mm_set1_ps(1.0f);
+				const __m128 dz = _mm_set1_ps(inverse_dz);
+				const __m128 curvature_scale = _mm_set1_ps(rules.curvature_);
+				const __m128 lowest = _mm_set1_ps(rules.lowest_);
+				const __m128 inverse_range = _mm_set1_ps(rules.inverse_range_);
+				const __m128 sand_start = _mm_set1_ps(rules.sand_start_);
+				const __m128 snow_start = _mm_set1_ps(rules.snow_start_);
+				const __m128 height_scale = _mm_set1_ps(rules.height_scale_);
+				const __m128 rock_start = _mm_set1_ps(rules.rock_start_);
+				const __m128 rock_scale = _mm_set1_ps(rules.rock_scale_);
+
+				for (; x + 4 <= inner_end; x += 4)
+				{
+					const __m128 left = _mm_loadu_ps(centre + x - 1);
+					const __m128 right = _mm_loadu_ps(centre + x + 1);
+					const __m128 middle = _mm_loadu_ps(centre + x);
+					const __m128 above = _mm_loadu_ps(up + x);
+					const __m128 below_row = _mm_loadu_ps(down + x);
+
+					const __m128 gx = _mm_mul_ps(_mm_sub_ps(right, left), half);
+					const __m128 gz = _mm_mul_ps(_mm_sub_ps(below_row, above), dz);
+					const __m128 slope = _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(gx, gx), _mm_mul_ps(gz, gz)));
+					const __m128 curvature = _mm_sub_ps(_mm_add_ps(_mm_add_ps(left, right), _mm_add_ps(above, below_row)),
+														_mm_mul_ps(four, middle));
+					const __m128 shift = _mm_mul_ps(curvature, curvature_scale);
+					const __m128 level = _mm_mul_ps(_mm_sub_ps(_mm_sub_ps(middle, shift), lowest), inverse_range);
+
+					const __m128 rock = smooth(_mm_mul_ps(_mm_sub_ps(_mm_sub_ps(slope, shift), rock_start), rock_scale));
+					const __m128 snow = smooth(_mm_mul_ps(_mm_sub_ps(level, snow_start), height_scale));
+					const __m128 sand = _mm_sub_ps(one, smooth(_mm_mul_ps(_mm_sub_ps(level, sand_start), height_scale)));
+
+					const __m128 rest = _mm_sub_ps(one, rock);
+					const __m128 snow_weight = _mm_mul_ps(rest, snow);
+					const __m128 below = _mm_sub_ps(rest, snow_weight);
+					const __m128 sand_weight = _mm_mul_ps(below, sand);
+
+					_mm_storeu_si128(reinterpret_cast<__m128i *>(dst + static_cast<size_t>(x - x0) * 4),
+									 pack_weights(quantize(sand_weight), quantize(_mm_sub_ps(below, sand_weight)),
+												  quantize(rock), quantize(snow_weight)));
+				}
+			}
+
+			for (; x < inner_end; x++)
+			{
+				splat_sample(rules, centre[x - 1], centre[x], centre[x + 1], up[x], down[x],
+							 0.5f, inverse_dz, dst + static_cast<size_t>(x - x0) * 4);
+			}
+
+			if (x1 == width && x < x1)
+			{
+				const int32 last = width - 1;
+				splat_sample(rules, centre[last - 1], centre[last], centre[last], up[last], down[last],
+							 1.0f, inverse_dz, dst + static_cast<size_t>(last - x0) * 4);
+			}
+		}
+	} // !anon
+
+	terrain_splat::terrain_splat()
+		: sand_level_(0.12f)
+		, snow_level_(0.75f)
+		, transition_(0.08f)
+		, rock_slope_(0.8f)
+		, slope_transition_(0.4f)
+		, curvature_(0.25f)
+		, width_(0)
+		, height_(0)
+		, lowest_(0.0f)
+		, highest_(0.0f)
+	{
+		colors_[LAYER_SAND] = glm::vec3(0.76f, 0.70f, 0.50f);
+		colors_[LAYER_GRASS] = glm::vec3(0.30f, 0.50f, 0.20f);
+		colors_[LAYER_ROCK] = glm::vec3(0.45f, 0.42f, 0.40f);
+		colors_[LAYER_SNOW] = glm::vec3(0.95f, 0.95f, 0.97f);
+	}
+
+	bool terrain_splat::is_valid() const
+	{
+		return texture_.is_valid() && sampler_.is_valid();
+	}
+
+	bool terrain_splat::create(const heightfield &field, worker_pool *pool)
+	{
+		if (!field.is_valid() || field.width_ < 2 || field.height_ < 2)
+		{
+			assert(!"heightfield not created!");
+			return false;
+		}
+
+		width_ = field.width_;
+		height_ = field.height_;
+		const auto range = std::minmax_element(field.heights_.begin(), field.heights_.end());
+		lowest_ = *range.first;
+		highest_ = *range.second;
+		weights_.resize(static_cast<size_t>(width_) * height_ * 4);
+
+		// note: the first update fills everything, the texture is created from the result
+		update(field, 0, 0, width_, height_, pool);
+
+		if (!texture_.create(TEXTURE_FORMAT_RGBA8, width_, height_, weights_.data()))
+		{
+			return false;
+		}
+
+		if (!sampler_.create(SAMPLER_FILTER_MODE_LINEAR,
+							 SAMPLER_ADDRESS_MODE_CLAMP,
+							 SAMPLER_ADDRESS_MODE_CLAMP))
+		{
+			return false;
+		}
+
+		return is_valid();
+	}
+
+	void terrain_splat::destroy()
+	{
+		if (texture_.is_valid())
+		{
+			texture_.destroy();
+		}
+		if (sampler_.is_valid())
+		{
+			sampler_.destroy();
+		}
+
+		dynamic_array<uint8>().swap(weights_);
+		dynamic_array<uint8>().swap(staging_);
+		width_ = 0;
+		height_ = 0;
+	}
+
+	void terrain_splat::update(const heightfield &field, const int32 x0, const int32 z0, const int32 x1, const int32 z1, worker_pool *pool)
+	{
+		if (weights_.empty())
+		{
+			return;
+		}
+
+		if (field.width_ != width_ || field.height_ != height_)
+		{
+			assert(!"heightfield does not match the splat weights!");
+			return;
+		}
+
+		const int32 left = glm::max(x0, 0);
+		const int32 top = glm::max(z0, 0);
+		const int32 right = glm::min(x1, width_);
+		const int32 bottom = glm::min(z1, height_);
+		if (left >= right || top >= bottom)
+		{
+			return;
+		}
+
+		const splat_rules rules = make_rules(*this);
+		const float *heights = field.heights_.data();
+		const int32 width = width_;
+		const int32 height = height_;
+		bake_tiles(TILE_SIZE, left, top, right, bottom, pool, [&](const int32 tile_x0, const int32 tile_z0, const int32 tile_x1, const int32 tile_z1)
+		{
+			for (int32 z = tile_z0; z < tile_z1; z++)
+			{
+				const int32 above = glm::max(z - 1, 0);
+				const int32 below = glm::min(z + 1, height - 1);
+				splat_row(rules,
+						  heights + static_cast<size_t>(above) * width,
+						  heights + static_cast<size_t>(z) * width,
+						  heights + static_cast<size_t>(below) * width,
+						  1.0f / static_cast<float>(below - above), width, tile_x0, tile_x1,
+						  weights_.data() + (static_cast<size_t>(z) * width + tile_x0) * 4);
+			}
+		});
+
+		// note: before create made the texture the whole field is uploaded by it
+		if (texture_.is_valid())
+		{
+			upload_rect(texture_, TEXTURE_FORMAT_RGBA8, 4, weights_.data(), width_, left, top, right, bottom, staging_);
+		}
+	}
+
+	void terrain_splat::bind(renderer &rend, shader_program &program, const int32 unit)
+	{
+		const glm::vec2 size(static_cast<float>(width_), static_cast<float>(height_));
+
+		rend.set_shader_uniform(program, UNIFORM_TYPE_VEC2, "u_splat_size", 1, glm::value_ptr(size));
+		rend.set_shader_uniform(program, UNIFORM_TYPE_VEC3, "u_splat_colors", LAYER_COUNT, glm::value_ptr(colors_[0]));
+		rend.set_shader_uniform(program, UNIFORM_TYPE_SAMPLER, "u_splat", 1, &unit);
+		rend.set_texture(texture_, unit);
+		rend.set_sampler_state(sampler_, unit);
+	}
+} // !avocado
@@ -0,0 +1,72 @@
+// terrain_texture.cc
+
+#include "terrain_texture.hpp"
+
+#pragma warning(push)
+#pragma warning(disable: 4127)
+#pragma warning(disable: 4201)
+#include <glm/glm.hpp>
+#pragma warning(pop)
+
+#include <avocado_thread.hpp>
+
+#include <cstring>
+
+namespace avocado {
+	void bake_tiles(const int32 tile_size,
+					const int32 x0,
+					const int32 z0,
+					const int32 x1,
+					const int32 z1,
+					worker_pool *pool,
+					const std::function<void(const int32 x0, const int32 z0, const int32 x1, const int32 z1)> &bake)
+	{
+		if (x0 >= x1 || z0 >= z1)
+		{
+			return;
+		}
+
+		const int32 first_x = x0 / tile_size;
+		const int32 first_z = z0 / tile_size;
+		const int32 tiles_x = (x1 - 1) / tile_size - first_x + 1;
+		const int32 tiles_z = (z1 - 1) / tile_size - first_z + 1;
+		parallel_for(pool, tiles_x * tiles_z, [&](const int32 job)
+		{
+			const int32 tx = first_x + job % tiles_x;
+			const int32 tz = first_z + job / tiles_x;
+			bake(glm::max(tx * tile_size, x0),
+				 glm::max(tz * tile_size, z0),
+				 glm::min(tx * tile_size + tile_size, x1),
+				 glm::min(tz * tile_size + tile_size, z1));
+		});
+	}
+
+	void upload_rect(texture &target,
+					 const texture_format format,
+					 const int32 texel_size,
+					 const uint8 *texels,
+					 const int32 width,
+					 const int32 x0,
+					 const int32 z0,
+					 const int32 x1,
+					 const int32 z1,
+					 dynamic_array<uint8> &staging)
+	{
+		const int32 columns = x1 - x0;
+		const int32 rows = z1 - z0;
+		if (columns <= 0 || rows <= 0)
+		{
+			return;
+		}
+
+		const size_t pitch = static_cast<size_t>(columns) * texel_size;
+		staging.resize(pitch * rows);
+		for (int32 z = 0; z < rows; z++)
+		{
+			const uint8 *src = texels + (static_cast<size_t>(z0 + z) * width + x0) * texel_size;
+			std::memcpy(staging.data() + z * pitch, src, pitch);
+		}
+
+		target.update(format, x0, z0, columns, rows, staging.data());
+	}
+} // !avocado
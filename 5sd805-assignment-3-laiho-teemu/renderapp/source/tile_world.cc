@@ -0,0 +1,636 @@
+// tile_world.cc
+
+#include "tile_world.hpp"
+#include "normals.hpp"
+
+#include <avocado_thread.hpp>
+
+#include <algorithm>
+#include <cstdio>
+#include <limits>
+
+namespace avocado {
+	namespace
+	{
+		uint64 tile_key(const int32 x, const int32 z)
+		{
+			return (static_cast<uint64>(static_cast<uint32>(x)) << 32) | static_cast<uint32>(z);
+		}
+
+		// note: distance in x and z from the position to the nearest point of the tile
+		float tile_distance(const glm::vec3 &position, const int32 x, const int32 z)
+		{
+			const float size = static_cast<float>(tile_world::TILE_SIZE);
+			const glm::vec2 lower(static_cast<float>(x) * size, static_cast<float>(z) * size);
+			const glm::vec2 point(position.x, position.z);
+			const glm::vec2 nearest = glm::clamp(point, lower, lower + size);
+			return glm::length(point - nearest);
+		}
+
+		// note: reflects a coordinate back into [0, size), the edge samples are not repeated
+		int32 mirror(const int32 value, const int32 size)
+		{
+			if (size < 2)
+			{
+				return 0;
+			}
+
+			const int32 period = (size - 1) * 2;
+			const int32 wrapped = ((value % period) + period) % period;
+			return wrapped < size ? wrapped : period - wrapped;
+		}
+
+		int64 tile_bytes()
+		{
+			return static_cast<int64>(tile_world::TILE_SAMPLES) * tile_world::TILE_SAMPLES * sizeof(terrain_vertex);
+		}
+
+		// note: runs on a worker thread
+		void build_tile(tile_source &source, const float height_offset, const float height_scale, tile_world::loaded_tile &result)
+		{
+			heightfield field;
+			result.valid_ = source.load(result.x_, result.z_, field) &&
+				field.width_ == tile_world::SOURCE_SAMPLES &&
+				field.height_ == tile_world::SOURCE_SAMPLES;
+			if (!result.valid_)
+			{
+				return;
+			}
+
+			const int32 samples = tile_world::TILE_SAMPLES;
+
+			// note: the border samples only feed the normals
+			dynamic_array<glm::vec3> normals(static_cast<size_t>(samples) * samples);
+			compute_normals(field,
+							1,
+							1,
+							samples + 1,
+							samples + 1,
+							normals.data(),
+							static_cast<int32>(sizeof(glm::vec3)),
+							static_cast<int32>(samples * sizeof(glm::vec3)));
+
+			const float quantize = 65535.0f / height_scale;
+			result.min_height_ = field.at(1, 1);
+			result.max_height_ = result.min_height_;
+			result.vertices_.resize(static_cast<size_t>(samples) * samples);
+			for (int32 z = 0; z < samples; z++)
+			{
+				for (int32 x = 0; x < samples; x++)
+				{
+					const int32 index = z * samples + x;
+					const float value = field.at(x + 1, z + 1);
+					result.vertices_[index] = encode_terrain_vertex(value, normals[index], height_offset, quantize);
+
+					result.min_height_ = glm::min(result.min_height_, value);
+					result.max_height_ = glm::max(result.max_height_, value);
+				}
+			}
+		}
+	}
+
+	file_tile_source::file_tile_source(const char *pattern, const heightfield::encoding format, const float scale, const float offset)
+		: pattern_(pattern)
+		, format_(format)
+		, scale_(scale)
+		, offset_(offset)
+	{
+	}
+
+	bool file_tile_source::load(const int32 x, const int32 z, heightfield &result)
+	{
+		char filename[512] = {};
+		snprintf(filename, sizeof(filename), pattern_.c_str(), x, z);
+
+		if (!file_system::exists(filename))
+		{
+			return false;
+		}
+
+		return result.create(filename,
+							 format_,
+							 tile_world::SOURCE_SAMPLES,
+							 tile_world::SOURCE_SAMPLES,
+							 scale_,
+							 offset_);
+	}
+
+	heightfield_tile_source::heightfield_tile_source()
+		: format_(heightfield::encoding::grayscale)
+		, scale_(1.0f)
+		, offset_(0.0f)
+		, width_(0)
+		, height_(0)
+		, lowest_(0.0f)
+		, highest_(0.0f)
+	{
+	}
+
+	bool heightfield_tile_source::create(const heightfield &field)
+	{
+		if (!field.is_valid())
+		{
+			assert(!"heightfield not created!");
+			return false;
+		}
+
+		field_ = field;
+		width_ = field.width_;
+		height_ = field.height_;
+		lowest_ = *std::min_element(field.heights_.begin(), field.heights_.end());
+		highest_ = *std::max_element(field.heights_.begin(), field.heights_.end());
+
+		return true;
+	}
+
+	bool heightfield_tile_source::create(const char *filename, const heightfield::encoding format, const float scale, const float offset)
+	{
+		int32 components = 0;
+		if (format == heightfield::encoding::grayscale)
+		{
+			if (!image16_.create(filename))
+			{
+				return false;
+			}
+
+			width_ = image16_.width();
+			height_ = image16_.height();
+			components = image16_.components();
+		}
+		else if (format == heightfield::encoding::packed_rgb || format == heightfield::encoding::packed_rgba)
+		{
+			if (!image_.create(filename))
+			{
+				return false;
+			}
+
+			components = format == heightfield::encoding::packed_rgba ? 4 : 3;
+			if (image_.bytes_per_pixel() != components)
+			{
+				assert(!"image channels do not match the height encoding!");
+				image_.destroy();
+				return false;
+			}
+
+			width_ = image_.width();
+			height_ = image_.height();
+		}
+		else
+		{
+			assert(!"tiles are only read from images!");
+			return false;
+		}
+
+		format_ = format;
+		scale_ = scale;
+		offset_ = offset;
+
+		// note: one row of heights at a time for the range of the whole map
+		dynamic_array<float> row(width_);
+		lowest_ = std::numeric_limits<float>::max();
+		highest_ = -std::numeric_limits<float>::max();
+		for (int32 z = 0; z < height_; z++)
+		{
+			const void *source = format_ == heightfield::encoding::grayscale
+				? static_cast<const void *>(image16_.data() + static_cast<size_t>(z) * width_ * components)
+				: static_cast<const void *>(image_.data() + static_cast<size_t>(z) * width_ * components);
+			convert_heights(source, format_, components, row.size(), scale_, offset_, row.data());
+			lowest_ = glm::min(lowest_, *std::min_element(row.begin(), row.end()));
+			highest_ = glm::max(highest_, *std::max_element(row.begin(), row.end()));
+		}
+
+		return true;
+	}
+
+	void heightfield_tile_source::destroy()
+	{
+		field_.destroy();
+		if (image_.is_valid())
+		{
+			image_.destroy();
+		}
+		if (image16_.is_valid())
+		{
+			image16_.destroy();
+		}
+		width_ = 0;
+		height_ = 0;
+	}
+
+	bool heightfield_tile_source::load(const int32 x, const int32 z, heightfield &result)
+	{
+		if (width_ == 0 || !result.create(tile_world::SOURCE_SAMPLES, tile_world::SOURCE_SAMPLES))
+		{
+			return false;
+		}
+
+		const int32 first_x = x * tile_world::TILE_SIZE - 1;
+		const int32 first_z = z * tile_world::TILE_SIZE - 1;
+
+		// note: the mirrored columns of a tile fall in one span of the map, converted once
+		//       per row and picked from
+		int32 left = width_;
+		int32 right = -1;
+		int32 columns[tile_world::SOURCE_SAMPLES];
+		for (int32 column = 0; column < tile_world::SOURCE_SAMPLES; column++)
+		{
+			columns[column] = mirror(first_x + column, width_);
+			left = glm::min(left, columns[column]);
+			right = glm::max(right, columns[column]);
+		}
+
+		const int32 components = format_ == heightfield::encoding::grayscale ? image16_.components() : image_.bytes_per_pixel();
+		dynamic_array<float> span(right - left + 1);
+		for (int32 row = 0; row < tile_world::SOURCE_SAMPLES; row++)
+		{
+			const int32 source_z = mirror(first_z + row, height_);
+			const float *heights = nullptr;
+			if (field_.is_valid())
+			{
+				heights = field_.heights_.data() + static_cast<size_t>(source_z) * width_ + left;
+			}
+			else
+			{
+				const size_t first = (static_cast<size_t>(source_z) * width_ + left) * components;
+				const void *source = format_ == heightfield::encoding::grayscale
+					? static_cast<const void *>(image16_.data() + first)
+					: static_cast<const void *>(image_.data() + first);
+				convert_heights(source, format_, components, span.size(), scale_, offset_, span.data());
+				heights = span.data();
+			}
+
+			for (int32 column = 0; column < tile_world::SOURCE_SAMPLES; column++)
+			{
+				result.set(column, row, heights[columns[column] - left]);
+			}
+		}
+
+		return true;
+	}
+
+	bool noise_tile_source::load(const int32 x, const int32 z, heightfield &result)
+	{
+		return noise_.generate(result,
+							   x * tile_world::TILE_SIZE - 1,
+							   z * tile_world::TILE_SIZE - 1,
+							   tile_world::SOURCE_SAMPLES,
+							   tile_world::SOURCE_SAMPLES);
+	}
+
+	tile_world::tile::tile()
+		: x_(0)
+		, z_(0)
+		, loading_(false)
+		, missing_(false)
+		, last_used_(0)
+		, min_corner_(0.0f)
+		, max_corner_(0.0f)
+	{
+	}
+
+	tile_world::tile_world()
+		: load_radius_(1024.0f)
+		, cpu_budget_(64ll * 1024 * 1024)
+		, gpu_budget_(32ll * 1024 * 1024)
+		, upload_limit_(2)
+		, job_limit_(8)
+		, source_(nullptr)
+		, pool_(nullptr)
+		, height_offset_(0.0f)
+		, height_scale_(1.0f)
+		, frame_(0)
+		, jobs_(0)
+		, cpu_bytes_(0)
+		, gpu_bytes_(0)
+		, pending_(0)
+	{
+	}
+
+	bool tile_world::is_valid() const
+	{
+		return source_ != nullptr && index_buffer_.is_valid();
+	}
+
+	bool tile_world::create(tile_source &source, worker_pool &pool, const float lowest, const float highest)
+	{
+		if (!pool.is_valid())
+		{
+			assert(!"worker pool not created!");
+			return false;
+		}
+
+		// note: every tile draws with the same 16 bit indices, wound like the heightmap
+		{
+			dynamic_array<uint16> indices;
+			indices.reserve(static_cast<size_t>(TILE_SIZE) * TILE_SIZE * 6);
+			for (int32 z = 0; z < TILE_SIZE; z++)
+			{
+				for (int32 x = 0; x < TILE_SIZE; x++)
+				{
+					const uint16 base = static_cast<uint16>(z * TILE_SAMPLES + x);
+
+					indices.push_back(base);
+					indices.push_back(static_cast<uint16>(base + TILE_SAMPLES));
+					indices.push_back(static_cast<uint16>(base + TILE_SAMPLES + 1));
+
+					indices.push_back(static_cast<uint16>(base + TILE_SAMPLES + 1));
+					indices.push_back(static_cast<uint16>(base + 1));
+					indices.push_back(base);
+				}
+			}
+
+			if (!index_buffer_.create(static_cast<int32>(indices.size() * sizeof(uint16)), indices.data()))
+			{
+				return false;
+			}
+		}
+
+		layout_ = vertex_layout();
+		layout_.add_attribute(0, vertex_layout::ATTRIBUTE_FORMAT_UNSIGNED_SHORT, 2, true);
+		layout_.add_attribute(2, vertex_layout::ATTRIBUTE_FORMAT_SHORT, 2, false);
+
+		source_ = &source;
+		pool_ = &pool;
+		height_offset_ = lowest;
+		height_scale_ = highest > lowest ? highest - lowest : 1.0f;
+		frame_ = 0;
+
+		return is_valid();
+	}
+
+	void tile_world::destroy()
+	{
+		// note: workers still building tiles write into completed_
+		{
+			std::unique_lock<std::mutex> lock(mutex_);
+			finished_.wait(lock, [this]() { return pending_ == 0; });
+			completed_.clear();
+		}
+
+		for (auto &entry : tiles_)
+		{
+			if (entry.second.buffer_.is_valid())
+			{
+				entry.second.buffer_.destroy();
+			}
+		}
+
+		tiles_.clear();
+		if (index_buffer_.is_valid())
+		{
+			index_buffer_.destroy();
+		}
+
+		source_ = nullptr;
+		pool_ = nullptr;
+		jobs_ = 0;
+		cpu_bytes_ = 0;
+		gpu_bytes_ = 0;
+	}
+
+	void tile_world::update(const glm::vec3 &position)
+	{
+		assert(is_valid());
+
+		frame_++;
+
+		// note: take over the tiles the workers have finished
+		dynamic_array<loaded_tile> completed;
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			completed.swap(completed_);
+		}
+
+		for (loaded_tile &loaded : completed)
+		{
+			jobs_--;
+
+			tile &current = tiles_[tile_key(loaded.x_, loaded.z_)];
+			current.loading_ = false;
+			current.missing_ = !loaded.valid_;
+			if (current.missing_)
+			{
+				continue;
+			}
+
+			const float size = static_cast<float>(TILE_SIZE);
+			current.min_corner_ = glm::vec3(static_cast<float>(loaded.x_) * size, loaded.min_height_, static_cast<float>(loaded.z_) * size);
+			current.max_corner_ = glm::vec3(current.min_corner_.x + size, loaded.max_height_, current.min_corner_.z + size);
+			current.vertices_.swap(loaded.vertices_);
+			cpu_bytes_ += tile_bytes();
+		}
+
+		// note: tiles within the radius, nearest first
+		struct wanted {
+			float distance_;
+			tile *tile_;
+		};
+
+		dynamic_array<wanted> nearby;
+		{
+			const float size = static_cast<float>(TILE_SIZE);
+			const int32 x0 = static_cast<int32>(glm::floor((position.x - load_radius_) / size));
+			const int32 x1 = static_cast<int32>(glm::floor((position.x + load_radius_) / size));
+			const int32 z0 = static_cast<int32>(glm::floor((position.z - load_radius_) / size));
+			const int32 z1 = static_cast<int32>(glm::floor((position.z + load_radius_) / size));
+			for (int32 z = z0; z <= z1; z++)
+			{
+				for (int32 x = x0; x <= x1; x++)
+				{
+					const float distance = tile_distance(position, x, z);
+					if (distance > load_radius_)
+					{
+						continue;
+					}
+
+					tile &current = tiles_[tile_key(x, z)];
+					current.x_ = x;
+					current.z_ = z;
+					current.last_used_ = frame_;
+					nearby.push_back({ distance, &current });
+				}
+			}
+
+			std::sort(nearby.begin(), nearby.end(), [](const wanted &lhs, const wanted &rhs)
+			{
+				return lhs.distance_ < rhs.distance_;
+			});
+		}
+
+		int32 uploads = 0;
+		for (const wanted &candidate : nearby)
+		{
+			tile &current = *candidate.tile_;
+			if (current.loading_ || current.missing_ || current.buffer_.is_valid())
+			{
+				continue;
+			}
+
+			if (current.vertices_.empty())
+			{
+				if (jobs_ >= job_limit_)
+				{
+					continue;
+				}
+
+				current.loading_ = true;
+				jobs_++;
+				{
+					std::lock_guard<std::mutex> lock(mutex_);
+					pending_++;
+				}
+
+				const int32 x = current.x_;
+				const int32 z = current.z_;
+				pool_->submit([this, x, z]()
+				{
+					loaded_tile loaded;
+					loaded.x_ = x;
+					loaded.z_ = z;
+					build_tile(*source_, height_offset_, height_scale_, loaded);
+
+					{
+						std::lock_guard<std::mutex> lock(mutex_);
+						completed_.push_back(std::move(loaded));
+						pending_--;
+					}
+					finished_.notify_all();
+				});
+				continue;
+			}
+
+			if (uploads >= upload_limit_)
+			{
+				continue;
+			}
+
+			if (current.buffer_.create(BUFFER_ACCESS_MODE_STATIC,
+									   static_cast<int32>(current.vertices_.size() * sizeof(terrain_vertex)),
+									   current.vertices_.data()))
+			{
+				gpu_bytes_ += tile_bytes();
+				uploads++;
+			}
+		}
+
+		// note: least recently used go first, tiles in use this update are kept even when
+		//       the budget is too small for them
+		dynamic_array<tile *> resident;
+		resident.reserve(tiles_.size());
+		for (auto &entry : tiles_)
+		{
+			resident.push_back(&entry.second);
+		}
+
+		std::sort(resident.begin(), resident.end(), [](const tile *lhs, const tile *rhs)
+		{
+			return lhs->last_used_ < rhs->last_used_;
+		});
+
+		for (tile *current : resident)
+		{
+			if (current->last_used_ == frame_ || (gpu_bytes_ <= gpu_budget_ && cpu_bytes_ <= cpu_budget_))
+			{
+				break;
+			}
+
+			// note: height answers from the cpu vertices, so a tile on the gpu keeps them and
+			//       going over the cpu budget takes the vertex buffer along with them
+			const bool over_cpu = cpu_bytes_ > cpu_budget_;
+			if ((over_cpu || gpu_bytes_ > gpu_budget_) && current->buffer_.is_valid())
+			{
+				current->buffer_.destroy();
+				gpu_bytes_ -= tile_bytes();
+			}
+
+			if (over_cpu && !current->vertices_.empty())
+			{
+				dynamic_array<terrain_vertex>().swap(current->vertices_);
+				cpu_bytes_ -= tile_bytes();
+			}
+		}
+
+		// note: forget tiles that are out of range and hold nothing
+		for (auto it = tiles_.begin(); it != tiles_.end();)
+		{
+			const tile &current = it->second;
+			if (current.last_used_ != frame_ && !current.loading_ && current.vertices_.empty() && !current.buffer_.is_valid())
+			{
+				it = tiles_.erase(it);
+			}
+			else
+			{
+				++it;
+			}
+		}
+	}
+
+	void tile_world::draw(renderer &rend, shader_program &program, const frustum &frustum)
+	{
+		const int32 grid_width = TILE_SAMPLES;
+		const int32 grid_chunks_x = 0;
+		rend.set_shader_uniform(program, UNIFORM_TYPE_INT, "u_grid_width", 1, &grid_width);
+		rend.set_shader_uniform(program, UNIFORM_TYPE_INT, "u_grid_chunks_x", 1, &grid_chunks_x);
+		rend.set_shader_uniform(program, UNIFORM_TYPE_FLOAT, "u_height_offset", 1, &height_offset_);
+		rend.set_shader_uniform(program, UNIFORM_TYPE_FLOAT, "u_height_scale", 1, &height_scale_);
+		rend.set_vertex_layout(layout_);
+		rend.set_index_buffer(index_buffer_);
+
+		for (auto &entry : tiles_)
+		{
+			tile &current = entry.second;
+			if (!current.buffer_.is_valid() || !frustum.is_inside(current.min_corner_, current.max_corner_))
+			{
+				continue;
+			}
+
+			const glm::vec2 origin(current.min_corner_.x, current.min_corner_.z);
+			rend.set_shader_uniform(program, UNIFORM_TYPE_VEC2, "u_grid_origin", 1, glm::value_ptr(origin));
+			rend.set_vertex_buffer(current.buffer_);
+			rend.draw_indexed(PRIMITIVE_TOPOLOGY_TRIANGLE_LIST,
+							  INDEX_TYPE_UNSIGNED_SHORT,
+							  0,
+							  TILE_SIZE * TILE_SIZE * 6);
+		}
+	}
+
+	bool tile_world::height(const float x, const float z, float &result) const
+	{
+		const float size = static_cast<float>(TILE_SIZE);
+		const int32 tile_x = static_cast<int32>(glm::floor(x / size));
+		const int32 tile_z = static_cast<int32>(glm::floor(z / size));
+
+		auto it = tiles_.find(tile_key(tile_x, tile_z));
+		if (it == tiles_.end() || it->second.vertices_.empty())
+		{
+			return false;
+		}
+
+		const dynamic_array<terrain_vertex> &vertices = it->second.vertices_;
+		const float local_x = glm::clamp(x - static_cast<float>(tile_x) * size, 0.0f, size);
+		const float local_z = glm::clamp(z - static_cast<float>(tile_z) * size, 0.0f, size);
+		const int32 x0 = glm::min(static_cast<int32>(local_x), TILE_SIZE - 1);
+		const int32 z0 = glm::min(static_cast<int32>(local_z), TILE_SIZE - 1);
+		const float tx = local_x - static_cast<float>(x0);
+		const float tz = local_z - static_cast<float>(z0);
+
+		const terrain_vertex *row0 = vertices.data() + z0 * TILE_SAMPLES + x0;
+		const terrain_vertex *row1 = row0 + TILE_SAMPLES;
+		const float top = glm::mix(static_cast<float>(row0[0].height_), static_cast<float>(row0[1].height_), tx);
+		const float bottom = glm::mix(static_cast<float>(row1[0].height_), static_cast<float>(row1[1].height_), tx);
+
+		result = height_offset_ + glm::mix(top, bottom, tz) * (height_scale_ / 65535.0f);
+
+		return true;
+	}
+
+	int64 tile_world::cpu_bytes() const
+	{
+		return cpu_bytes_;
+	}
+
+	int64 tile_world::gpu_bytes() const
+	{
+		return gpu_bytes_;
+	}
+} // !avocado